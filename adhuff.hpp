@@ -0,0 +1,269 @@
+#ifndef ALGO_ADHUFF_HPP
+#define ALGO_ADHUFF_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <initializer_list>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+extern "C" {
+#include "adhuff_buffer.h"
+#include "adhuff_common.h"
+}
+
+/*
+ * C++17 layer over the C API, header only: link with adhuff_lib.
+ * Failures throw adh::error, the C functions log the details.
+ */
+namespace adh {
+
+class error : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+/*
+ * view of contiguous bytes, the C++17 stand-in of std::span<const byte_t> and std::span<byte_t>:
+ * built from a pointer and a size, or from any contiguous container of 1 byte elements
+ * (std::vector, std::string, std::array, std::span with C++20), without copying
+ */
+template<typename B>
+class basic_bytes {
+    using void_type = std::conditional_t<std::is_const_v<B>, const void, void>;
+
+    template<typename C>
+    using enable_container = std::enable_if_t<
+            sizeof(*std::data(std::declval<C &>())) == 1
+            && std::is_convertible_v<decltype(std::data(std::declval<C &>())), void_type *>>;
+
+public:
+    constexpr basic_bytes() noexcept = default;
+    constexpr basic_bytes(B *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+    template<typename C, typename = enable_container<C>>
+    basic_bytes(C &&container) noexcept
+            : data_(static_cast<B *>(static_cast<void_type *>(std::data(container)))), size_(std::size(container)) {}
+
+    constexpr B *data() const noexcept { return data_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr B *begin() const noexcept { return data_; }
+    constexpr B *end() const noexcept { return data_ + size_; }
+
+private:
+    B *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+using bytes = basic_bytes<const byte_t>;
+using mutable_bytes = basic_bytes<byte_t>;
+
+/*
+ * the C coders keep their state in module variables: the calls of all the contexts are serialized on this mutex
+ */
+inline std::mutex &coder_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+/*
+ * output buffer of a context, allocated and grown by the C coders (adh_*_realloc)
+ */
+class coder_buffer {
+public:
+    // code with call(&data, &capacity, &size), return the bytes written, valid until the next call
+    template<typename Call>
+    bytes code(const char *failure, Call &&call) {
+        byte_t *data = data_.release();
+        std::size_t size = 0;
+        std::unique_lock<std::mutex> lock(coder_mutex());
+        int rc = call(&data, &capacity_, &size);
+        lock.unlock();
+        data_.reset(data);
+        if(rc != RC_OK)
+            throw error(failure);
+        return bytes(data_.get(), size);
+    }
+
+private:
+    struct free_deleter {
+        void operator()(byte_t *data) const noexcept { std::free(data); }
+    };
+
+    std::unique_ptr<byte_t, free_deleter> data_;
+    std::size_t capacity_ = 0;                      // ignored by the coders while data_ is null
+};
+
+/*
+ * compression context: the options and an output buffer kept from a call to the next.
+ * Move only, so that contexts can be pooled and handed over without copying their buffer
+ */
+class Encoder {
+public:
+    explicit Encoder(const adh_options_t &options = adh_options_t()) : options_(options) {}
+
+    // options of the command line, e.g. {"--order1", "--interleave=8"}
+    Encoder(std::initializer_list<const char *> args) : options_() {
+        for(const char *arg : args) {
+            if(adh_parse_option(arg, &options_) != RC_OK)
+                throw error(std::string("invalid option ") + arg);
+        }
+    }
+
+    Encoder(Encoder &&) noexcept = default;
+    Encoder &operator=(Encoder &&) noexcept = default;
+    Encoder(const Encoder &) = delete;
+    Encoder &operator=(const Encoder &) = delete;
+
+    const adh_options_t &options() const noexcept { return options_; }
+
+    // compress straight into out, return the size written. Throws if out is too small
+    std::size_t compress(bytes in, mutable_bytes out) {
+        std::lock_guard<std::mutex> lock(coder_mutex());
+        std::size_t size = 0;
+        if(adh_compress_buffer(in.data(), in.size(), out.data(), out.size(), &size, &options_) != RC_OK)
+            throw error("cannot compress");
+        return size;
+    }
+
+    // compress into the buffer of the context, valid until the next call. The buffer grows while coding if needed
+    bytes compress(bytes in) {
+        return buffer_.code("cannot compress", [&](byte_t **data, std::size_t *capacity, std::size_t *size) {
+            return adh_compress_realloc(in.data(), in.size(), data, capacity, size, &options_);
+        });
+    }
+
+private:
+    adh_options_t options_;
+    coder_buffer buffer_;
+};
+
+/*
+ * decompression context: an output buffer kept from a call to the next, the format is read from the input
+ */
+class Decoder {
+public:
+    Decoder() = default;
+    Decoder(Decoder &&) noexcept = default;
+    Decoder &operator=(Decoder &&) noexcept = default;
+    Decoder(const Decoder &) = delete;
+    Decoder &operator=(const Decoder &) = delete;
+
+    // decompress straight into out, return the size written. Throws if out is too small
+    std::size_t decompress(bytes in, mutable_bytes out) {
+        std::lock_guard<std::mutex> lock(coder_mutex());
+        std::size_t size = 0;
+        if(adh_decompress_buffer(in.data(), in.size(), out.data(), out.size(), &size) != RC_OK)
+            throw error("cannot decompress");
+        return size;
+    }
+
+    // decompress into the buffer of the context, valid until the next call. The buffer grows while decoding if needed
+    bytes decompress(bytes in) {
+        return buffer_.code("cannot decompress", [&](byte_t **data, std::size_t *capacity, std::size_t *size) {
+            return adh_decompress_realloc(in.data(), in.size(), data, capacity, size);
+        });
+    }
+
+private:
+    coder_buffer buffer_;
+};
+
+/*
+ * output stream buffer: what is written through it is compressed to the sink by close() or the destructor.
+ * The coder pulls its input and writes the header last, so the input is gathered before coding
+ */
+class ostreambuf : public std::streambuf {
+public:
+    explicit ostreambuf(std::ostream &sink, Encoder encoder = Encoder()) : sink_(&sink), encoder_(std::move(encoder)) {}
+
+    ~ostreambuf() override {
+        try {
+            close();
+        } catch(...) {
+            // the sink may throw on badbit itself: nothing leaves a destructor
+            try {
+                sink_->setstate(std::ios::badbit);
+            } catch(...) {
+            }
+        }
+    }
+
+    // compress and write to the sink, once. Throws if the compression fails
+    void close() {
+        if(closed_)
+            return;
+        closed_ = true;
+        bytes output = encoder_.compress(input_);
+        sink_->write(reinterpret_cast<const char *>(output.data()), static_cast<std::streamsize>(output.size()));
+        sink_->flush();
+        std::string().swap(input_);
+    }
+
+protected:
+    int_type overflow(int_type ch) override {
+        if(closed_)
+            return traits_type::eof();
+        if(!traits_type::eq_int_type(ch, traits_type::eof()))
+            input_.push_back(traits_type::to_char_type(ch));
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(const char *s, std::streamsize n) override {
+        if(closed_)
+            return 0;
+        input_.append(s, static_cast<std::size_t>(n));
+        return n;
+    }
+
+private:
+    std::ostream *sink_;
+    Encoder encoder_;
+    std::string input_;
+    bool closed_ = false;
+};
+
+/*
+ * input stream buffer: the compressed source is read to its end and decoded on the first read.
+ * The decoder needs the size of its input, so the source is not consumed incrementally
+ */
+class istreambuf : public std::streambuf {
+public:
+    explicit istreambuf(std::istream &source, Decoder decoder = Decoder())
+            : source_(&source), decoder_(std::move(decoder)) {}
+
+protected:
+    int_type underflow() override {
+        if(gptr() < egptr())
+            return traits_type::to_int_type(*gptr());
+        if(decoded_)
+            return traits_type::eof();
+
+        decoded_ = true;
+        std::string input((std::istreambuf_iterator<char>(*source_)), std::istreambuf_iterator<char>());
+        bytes output = decoder_.decompress(input);
+
+        // the get area is only read: the buffer of the decoder is not copied
+        char *begin = const_cast<char *>(reinterpret_cast<const char *>(output.data()));
+        setg(begin, begin, begin + output.size());
+        return output.empty() ? traits_type::eof() : traits_type::to_int_type(*gptr());
+    }
+
+private:
+    std::istream *source_;
+    Decoder decoder_;
+    bool decoded_ = false;
+};
+
+} // namespace adh
+
+#endif //ALGO_ADHUFF_HPP
@@ -0,0 +1,884 @@
+#define _GNU_SOURCE             // fopencookie, pread
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "adhuff_archive.h"
+#include "adhuff_compress.h"
+#include "adhuff_decompress.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    ARCHIVE_MAGIC_BYTES = 4,
+    ARCHIVE_HEADER_BYTES = ARCHIVE_MAGIC_BYTES + 1,
+    ARCHIVE_ENTRY_BYTES = 2 + 3 * 8,                    // without the path
+    ARCHIVE_TRAILER_BYTES = 4 + 8 + ARCHIVE_MAGIC_BYTES,
+    ARCHIVE_BUFFER_SIZE = 64 * 1024
+};
+
+static const uint64_t ARCHIVE_FAILED = UINT64_MAX;      // stream size sent by a worker that cannot compress its file
+static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+static const uint64_t FNV_PRIME = 1099511628211ull;
+
+/*
+ * a file of the archive
+ */
+typedef struct archive_entry {
+    char *                  file_name;                  // create: path on disk, extract: path in the archive
+    const char *            path;                       // relative to the directory, inside file_name
+    uint64_t                size;
+    uint64_t                hash;                       // create only, FNV-1a of the content
+    uint64_t                offset;                     // of the compressed stream
+    uint64_t                stored_size;                // of the compressed stream
+    struct archive_entry *  same_as;                    // create only, entry with the same content, NULL if stored
+} archive_entry_t;
+
+typedef struct {
+    archive_entry_t *       entries;
+    size_t                  count;
+    size_t                  capacity;
+} archive_list_t;
+
+/*
+ * worker process compressing the files, a socket to the parent:
+ * the parent sends the index of an entry (8 bytes), the worker answers the stream size (8 bytes) and the stream
+ */
+typedef struct {
+    pid_t                   pid;
+    int                     fd;
+    archive_entry_t *       entry;                      // being compressed, NULL if idle
+} archive_worker_t;
+
+/*
+ * stream on a part of the archive, for the decoder that seeks its input to get its size
+ */
+typedef struct {
+    int                     fd;
+    uint64_t                start;
+    uint64_t                size;
+    uint64_t                position;
+} archive_slice_t;
+
+//
+// private methods
+//
+int     archive_walk(const char *dir_name, size_t prefix_length, archive_list_t *list);
+int     archive_compare_paths(const void *a, const void *b);
+int     archive_compare_contents(const void *a, const void *b);
+int     archive_hash_file(archive_entry_t *entry);
+int     archive_same_content(const char *file_name1, const char *file_name2, bool *same);
+void    archive_dedup(archive_list_t *list);
+int     archive_compress_all(FILE *archive_fp, archive_list_t *list, const adh_options_t *options, int workers);
+int     archive_start_worker(archive_worker_t *pool, int index, const archive_list_t *list, const adh_options_t *options);
+int     archive_worker_main(int fd, const archive_list_t *list, const adh_options_t *options);
+int     archive_send_job(archive_worker_t *worker, const archive_list_t *list, archive_entry_t *entry);
+int     archive_receive_stream(archive_worker_t *worker, FILE *archive_fp);
+int     archive_write_directory(FILE *archive_fp, const archive_list_t *list);
+int     archive_read_directory(FILE *archive_fp, archive_list_t *list);
+int     archive_extract_entry(FILE *archive_fp, const archive_entry_t *entry, const char *output_dir);
+int     archive_make_parents(char *file_name);
+bool    archive_valid_path(const char *path);
+FILE *  archive_slice_open(archive_slice_t *slice, FILE *archive_fp, uint64_t start, uint64_t size);
+ssize_t archive_slice_read(void *cookie, char *data, size_t size);
+int     archive_slice_seek(void *cookie, off64_t *offset, int whence);
+int     archive_slice_close(void *cookie);
+void    archive_free_list(archive_list_t *list);
+
+/**
+ * archive the regular files under the directory
+ * @param archive_name
+ * @param dir_name
+ * @param options: NULL for default options
+ * @param workers: [1..ADH_ARCHIVE_MAX_WORKERS], 0 = one per online CPU
+ * @return RC_OK / RC_FAIL
+ */
+int adh_archive_create(const char *archive_name, const char *dir_name, const adh_options_t *options, int workers) {
+    if(workers == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus < 1 ? 1 : cpus > ADH_ARCHIVE_MAX_WORKERS ? ADH_ARCHIVE_MAX_WORKERS : (int)cpus;
+    }
+    if(workers < 1 || workers > ADH_ARCHIVE_MAX_WORKERS) {
+        log_error("adh_archive_create", "invalid number of workers %d\n", workers);
+        return RC_FAIL;
+    }
+
+    // the paths are stored without the directory and the trailing separators
+    size_t prefix_length = strlen(dir_name);
+    while(prefix_length > 1 && dir_name[prefix_length - 1] == '/')
+        prefix_length--;
+    char root[ADH_ARCHIVE_MAX_PATH];
+    if(prefix_length == 0 || prefix_length >= sizeof(root)) {
+        log_error("adh_archive_create", "invalid directory [%s]\n", dir_name);
+        return RC_FAIL;
+    }
+    memcpy(root, dir_name, prefix_length);
+    root[prefix_length] = 0;
+
+    archive_list_t list = {0};
+    int rc = archive_walk(root, prefix_length + (root[prefix_length - 1] != '/'), &list);
+    if(rc == RC_OK && list.count > 0)
+        qsort(list.entries, list.count, sizeof(archive_entry_t), archive_compare_paths);
+    for (size_t i = 0; i < list.count && rc == RC_OK; ++i) {
+        rc = archive_hash_file(&list.entries[i]);
+    }
+    if(rc == RC_OK)
+        archive_dedup(&list);
+
+    FILE *archive_fp = rc == RC_OK ? bin_open_create(archive_name) : NULL;
+    if(archive_fp == NULL)
+        rc = RC_FAIL;
+    if(rc == RC_OK) {
+        byte_t header[ARCHIVE_HEADER_BYTES] = { 0 };
+        memcpy(header, ADH_ARCHIVE_MAGIC, ARCHIVE_MAGIC_BYTES);
+        header[ARCHIVE_MAGIC_BYTES] = ADH_ARCHIVE_VERSION;
+        if(fwrite(header, 1, sizeof(header), archive_fp) != sizeof(header))
+            rc = RC_FAIL;
+    }
+    if(rc == RC_OK)
+        rc = archive_compress_all(archive_fp, &list, options, workers);
+    if(rc == RC_OK)
+        rc = archive_write_directory(archive_fp, &list);
+
+    if(archive_fp != NULL && adh_release(archive_fp, NULL) != RC_OK)
+        rc = RC_FAIL;
+    if(rc == RC_OK) {
+        uint64_t original = 0, stored = 0;
+        size_t streams = 0;
+        for (size_t i = 0; i < list.count; ++i) {
+            original += list.entries[i].size;
+            if(list.entries[i].same_as == NULL) {
+                stored += list.entries[i].stored_size;
+                streams++;
+            }
+        }
+        log_info("adh_archive_create", "%zu files, %zu streams, %" PRIu64 " -> %" PRIu64 " bytes\n",
+                 list.count, streams, original, stored);
+    } else {
+        log_error("adh_archive_create", "cannot archive [%s] to [%s]\n", dir_name, archive_name);
+    }
+
+    archive_free_list(&list);
+    return rc;
+}
+
+/**
+ * extract the archive, or one of its members
+ * @param archive_name
+ * @param output_dir: created if missing, with the subdirectories of the members
+ * @param member: path in the archive, NULL for all
+ * @return RC_OK / RC_FAIL, also if the member is not in the archive
+ */
+int adh_archive_extract(const char *archive_name, const char *output_dir, const char *member) {
+    FILE *archive_fp = bin_open_read(archive_name);
+    if(archive_fp == NULL)
+        return RC_FAIL;
+
+    archive_list_t list = {0};
+    int rc = archive_read_directory(archive_fp, &list);
+    bool found = false;
+    for (size_t i = 0; i < list.count && rc == RC_OK; ++i) {
+        if(member != NULL && strcmp(member, list.entries[i].path) != 0)
+            continue;
+        found = true;
+        rc = archive_extract_entry(archive_fp, &list.entries[i], output_dir);
+    }
+    if(rc == RC_OK && member != NULL && !found) {
+        log_error("adh_archive_extract", "[%s] is not in the archive\n", member);
+        rc = RC_FAIL;
+    }
+
+    archive_free_list(&list);
+    fclose(archive_fp);
+    return rc;
+}
+
+/**
+ * print the directory of the archive: offset and size of the stream, original size, path.
+ * The files with the same content have the same offset
+ * @param archive_name
+ * @param fp
+ * @return RC_OK / RC_FAIL
+ */
+int adh_archive_list(const char *archive_name, FILE *fp) {
+    FILE *archive_fp = bin_open_read(archive_name);
+    if(archive_fp == NULL)
+        return RC_FAIL;
+
+    archive_list_t list = {0};
+    int rc = archive_read_directory(archive_fp, &list);
+    for (size_t i = 0; i < list.count && rc == RC_OK; ++i) {
+        const archive_entry_t *entry = &list.entries[i];
+        fprintf(fp, "%12" PRIu64 " %12" PRIu64 " %12" PRIu64 "  %s\n", entry->offset, entry->stored_size, entry->size, entry->path);
+    }
+
+    archive_free_list(&list);
+    fclose(archive_fp);
+    return rc;
+}
+
+/**
+ * add the regular files under the directory to the list, recursively
+ * @param dir_name
+ * @param prefix_length: of the archived directory and its separator, removed from the paths
+ * @param list
+ * @return RC_OK / RC_FAIL
+ */
+int archive_walk(const char *dir_name, size_t prefix_length, archive_list_t *list) {
+    DIR *dir = opendir(dir_name);
+    if(dir == NULL) {
+        log_error("archive_walk", "cannot open directory [%s]: %s\n", dir_name, strerror(errno));
+        return RC_FAIL;
+    }
+
+    int rc = RC_OK;
+    size_t dir_length = strlen(dir_name);
+    const char *separator = dir_name[dir_length - 1] == '/' ? "" : "/";
+    struct dirent *item;
+    while(rc == RC_OK && (item = readdir(dir)) != NULL) {
+        if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+            continue;
+
+        char file_name[ADH_ARCHIVE_MAX_PATH];
+        if(snprintf(file_name, sizeof(file_name), "%s%s%s", dir_name, separator, item->d_name) >= (int)sizeof(file_name)) {
+            log_error("archive_walk", "path too long in [%s]\n", dir_name);
+            rc = RC_FAIL;
+            break;
+        }
+
+        struct stat file_stat;
+        if(lstat(file_name, &file_stat) != 0) {
+            log_error("archive_walk", "cannot stat [%s]: %s\n", file_name, strerror(errno));
+            rc = RC_FAIL;
+        } else if(S_ISDIR(file_stat.st_mode)) {
+            rc = archive_walk(file_name, prefix_length, list);
+        } else if(S_ISREG(file_stat.st_mode)) {
+            if(list->count == list->capacity) {
+                size_t capacity = list->capacity ? 2 * list->capacity : 64;
+                archive_entry_t *entries = realloc(list->entries, capacity * sizeof(archive_entry_t));
+                if(entries == NULL) {
+                    rc = RC_FAIL;
+                    break;
+                }
+                list->entries = entries;
+                list->capacity = capacity;
+            }
+
+            archive_entry_t *entry = &list->entries[list->count];
+            memset(entry, 0, sizeof(*entry));
+            entry->file_name = strdup(file_name);
+            if(entry->file_name == NULL) {
+                rc = RC_FAIL;
+                break;
+            }
+            entry->path = entry->file_name + prefix_length;
+            entry->size = (uint64_t)file_stat.st_size;
+            list->count++;
+        } else {
+            ADH_DEBUG("archive_walk", "skipped [%s]\n", file_name);
+        }
+    }
+
+    closedir(dir);
+    return rc;
+}
+
+/**
+ * qsort comparator of entries by path
+ */
+int archive_compare_paths(const void *a, const void *b) {
+    return strcmp(((const archive_entry_t *)a)->path, ((const archive_entry_t *)b)->path);
+}
+
+/**
+ * qsort comparator of entry pointers by size, hash, then position in the list
+ */
+int archive_compare_contents(const void *a, const void *b) {
+    const archive_entry_t *entry1 = *(archive_entry_t * const *)a;
+    const archive_entry_t *entry2 = *(archive_entry_t * const *)b;
+    if(entry1->size != entry2->size)
+        return entry1->size < entry2->size ? -1 : 1;
+    if(entry1->hash != entry2->hash)
+        return entry1->hash < entry2->hash ? -1 : 1;
+    return entry1 < entry2 ? -1 : entry1 > entry2;
+}
+
+/**
+ * hash the content of the file
+ * @param entry: its size is updated, in case the file changed since the walk
+ * @return RC_OK / RC_FAIL
+ */
+int archive_hash_file(archive_entry_t *entry) {
+    FILE *fp = bin_open_read(entry->file_name);
+    if(fp == NULL)
+        return RC_FAIL;
+
+    byte_t buffer[ARCHIVE_BUFFER_SIZE];
+    uint64_t hash = FNV_OFFSET, size = 0;
+    size_t n;
+    while((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            hash = (hash ^ buffer[i]) * FNV_PRIME;
+        }
+        size += n;
+    }
+    int rc = ferror(fp) ? RC_FAIL : RC_OK;
+    if(rc != RC_OK)
+        log_error("archive_hash_file", "cannot read [%s]\n", entry->file_name);
+    fclose(fp);
+
+    entry->hash = hash;
+    entry->size = size;
+    return rc;
+}
+
+/**
+ * compare the content of two files of the same size
+ * @param file_name1
+ * @param file_name2
+ * @param same
+ * @return RC_OK / RC_FAIL
+ */
+int archive_same_content(const char *file_name1, const char *file_name2, bool *same) {
+    FILE *fp1 = bin_open_read(file_name1);
+    FILE *fp2 = fp1 ? bin_open_read(file_name2) : NULL;
+    int rc = fp2 != NULL ? RC_OK : RC_FAIL;
+
+    byte_t buffer1[ARCHIVE_BUFFER_SIZE / 2], buffer2[ARCHIVE_BUFFER_SIZE / 2];
+    *same = rc == RC_OK;
+    while(rc == RC_OK && *same) {
+        size_t n1 = fread(buffer1, 1, sizeof(buffer1), fp1);
+        size_t n2 = fread(buffer2, 1, sizeof(buffer2), fp2);
+        *same = n1 == n2 && memcmp(buffer1, buffer2, n1) == 0;
+        if(n1 == 0 || n2 == 0)
+            break;
+    }
+    if(rc == RC_OK && (ferror(fp1) || ferror(fp2)))
+        rc = RC_FAIL;
+
+    if(fp1)
+        fclose(fp1);
+    if(fp2)
+        fclose(fp2);
+    return rc;
+}
+
+/**
+ * link each entry to the first entry, in path order, with the same content.
+ * Equal size and hash are confirmed by comparing the files, a file that cannot be compared is stored
+ * @param list
+ */
+void archive_dedup(archive_list_t *list) {
+    archive_entry_t **sorted = list->count > 0 ? malloc(list->count * sizeof(archive_entry_t *)) : NULL;
+    if(sorted == NULL)
+        return;
+    for (size_t i = 0; i < list->count; ++i) {
+        sorted[i] = &list->entries[i];
+    }
+    qsort(sorted, list->count, sizeof(archive_entry_t *), archive_compare_contents);
+
+    size_t group = 0;
+    for (size_t i = 1; i < list->count; ++i) {
+        if(sorted[i]->size != sorted[group]->size || sorted[i]->hash != sorted[group]->hash) {
+            group = i;
+            continue;
+        }
+        for (size_t j = group; j < i && sorted[i]->same_as == NULL; ++j) {
+            bool same = false;
+            if(sorted[j]->same_as == NULL
+               && archive_same_content(sorted[j]->file_name, sorted[i]->file_name, &same) == RC_OK && same)
+                sorted[i]->same_as = sorted[j];
+        }
+    }
+    free(sorted);
+}
+
+/**
+ * compress the stored entries with the pool of workers, appending their streams to the archive
+ * @param archive_fp
+ * @param list: offset and stored size of the entries are set
+ * @param options
+ * @param workers
+ * @return RC_OK / RC_FAIL
+ */
+int archive_compress_all(FILE *archive_fp, archive_list_t *list, const adh_options_t *options, int workers) {
+    size_t jobs = 0;
+    for (size_t i = 0; i < list->count; ++i) {
+        if(list->entries[i].same_as == NULL)
+            jobs++;
+    }
+    if((size_t)workers > jobs)
+        workers = (int)jobs;
+
+    archive_worker_t pool[ADH_ARCHIVE_MAX_WORKERS];
+    int rc = RC_OK, started = 0;
+    for (; started < workers && rc == RC_OK; ++started) {
+        rc = archive_start_worker(pool, started, list, options);
+    }
+    if(rc != RC_OK)
+        started--;
+
+    // a job to each idle worker, then wait for any of them
+    size_t next = 0;
+    int running = 0;
+    while(rc == RC_OK) {
+        for (int i = 0; i < started && rc == RC_OK; ++i) {
+            while(pool[i].entry == NULL && next < list->count && list->entries[next].same_as != NULL)
+                next++;
+            if(pool[i].entry == NULL && next < list->count) {
+                rc = archive_send_job(&pool[i], list, &list->entries[next++]);
+                running++;
+            }
+        }
+        if(rc != RC_OK || running == 0)
+            break;
+
+        struct pollfd fds[ADH_ARCHIVE_MAX_WORKERS];
+        for (int i = 0; i < started; ++i) {
+            fds[i].fd = pool[i].entry ? pool[i].fd : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+        }
+        if(poll(fds, (nfds_t)started, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            log_error("archive_compress_all", "poll failed: %s\n", strerror(errno));
+            rc = RC_FAIL;
+        }
+        for (int i = 0; i < started && rc == RC_OK; ++i) {
+            if(fds[i].revents == 0)
+                continue;
+            rc = archive_receive_stream(&pool[i], archive_fp);
+            running--;
+        }
+    }
+
+    // the workers exit when their socket is closed, at once after a failure
+    for (int i = 0; i < started; ++i) {
+        close(pool[i].fd);
+        if(rc != RC_OK)
+            kill(pool[i].pid, SIGTERM);
+    }
+    for (int i = 0; i < started; ++i) {
+        int status = 0;
+        while(waitpid(pool[i].pid, &status, 0) < 0 && errno == EINTR);
+        if(rc == RC_OK && (!WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+            log_error("archive_compress_all", "worker %d exited with status %d\n", (int)pool[i].pid, status);
+            rc = RC_FAIL;
+        }
+    }
+
+    for (size_t i = 0; i < list->count && rc == RC_OK; ++i) {
+        archive_entry_t *entry = &list->entries[i];
+        if(entry->same_as) {
+            entry->offset = entry->same_as->offset;
+            entry->stored_size = entry->same_as->stored_size;
+        }
+    }
+    return rc;
+}
+
+/**
+ * fork a worker, connected to the parent by a socket pair
+ * @param pool: the workers started before keep their sockets open in the parent only
+ * @param index: of the new worker in the pool
+ * @param list
+ * @param options
+ * @return RC_OK / RC_FAIL
+ */
+int archive_start_worker(archive_worker_t *pool, int index, const archive_list_t *list, const adh_options_t *options) {
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        log_error("archive_start_worker", "cannot create a socket pair: %s\n", strerror(errno));
+        return RC_FAIL;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if(pid < 0) {
+        log_error("archive_start_worker", "fork failed: %s\n", strerror(errno));
+        close(fds[0]);
+        close(fds[1]);
+        return RC_FAIL;
+    }
+    if(pid == 0) {
+        for (int i = 0; i < index; ++i) {
+            close(pool[i].fd);
+        }
+        close(fds[0]);
+        int rc = archive_worker_main(fds[1], list, options);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(rc == RC_OK ? 0 : 1);
+    }
+
+    close(fds[1]);
+    pool[index].pid = pid;
+    pool[index].fd = fds[0];
+    pool[index].entry = NULL;
+    return RC_OK;
+}
+
+/**
+ * worker: compress the entries sent by the parent into a spool file, then copy the stream to the socket,
+ * until the parent closes the socket
+ * @param fd
+ * @param list
+ * @param options
+ * @return RC_OK / RC_FAIL
+ */
+int archive_worker_main(int fd, const archive_list_t *list, const adh_options_t *options) {
+    FILE *spool = tmpfile();
+    if(spool == NULL) {
+        log_error("archive_worker_main", "cannot create a spool file: %s\n", strerror(errno));
+        return RC_FAIL;
+    }
+
+    int rc = RC_OK;
+    byte_t job[8];
+    byte_t buffer[ARCHIVE_BUFFER_SIZE];
+    while(rc == RC_OK && bin_read_all(fd, job, sizeof(job), NULL) == RC_OK) {
+        uint64_t index = bin_get_be(job, 8);
+        if(index >= list->count) {
+            rc = RC_FAIL;
+            break;
+        }
+
+        rewind(spool);
+        FILE *input_fp = ftruncate(fileno(spool), 0) == 0 ? adh_pipe_read(bin_open_read(list->entries[index].file_name)) : NULL;
+        int job_rc = input_fp != NULL ? adh_compress_stream(input_fp, spool, options) : RC_FAIL;
+        if(input_fp)
+            fclose(input_fp);
+        int64_t size = job_rc == RC_OK && fflush(spool) == 0 ? bin_tell(spool) : -1;
+        rewind(spool);
+
+        bin_put_be(job, size >= 0 ? (uint64_t)size : ARCHIVE_FAILED, 8);
+        rc = bin_write_all(fd, job, sizeof(job), NULL);
+        for (int64_t left = size; left > 0 && rc == RC_OK; ) {
+            size_t n = fread(buffer, 1, left < (int64_t)sizeof(buffer) ? (size_t)left : sizeof(buffer), spool);
+            rc = n > 0 ? bin_write_all(fd, buffer, n, NULL) : RC_FAIL;
+            left -= (int64_t)n;
+        }
+    }
+
+    fclose(spool);
+    return rc;
+}
+
+/**
+ * send an entry to compress to an idle worker
+ * @param worker
+ * @param list
+ * @param entry
+ * @return RC_OK / RC_FAIL
+ */
+int archive_send_job(archive_worker_t *worker, const archive_list_t *list, archive_entry_t *entry) {
+    byte_t job[8];
+    bin_put_be(job, (uint64_t)(entry - list->entries), 8);
+    worker->entry = entry;
+    if(bin_write_all(worker->fd, job, sizeof(job), NULL) != RC_OK) {
+        log_error("archive_send_job", "worker %d is gone\n", (int)worker->pid);
+        return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * append the stream of a worker to the archive, the worker becomes idle
+ * @param worker
+ * @param archive_fp
+ * @return RC_OK / RC_FAIL
+ */
+int archive_receive_stream(archive_worker_t *worker, FILE *archive_fp) {
+    archive_entry_t *entry = worker->entry;
+    worker->entry = NULL;
+
+    byte_t buffer[ARCHIVE_BUFFER_SIZE];
+    if(bin_read_all(worker->fd, buffer, 8, NULL) != RC_OK) {
+        log_error("archive_receive_stream", "worker %d is gone\n", (int)worker->pid);
+        return RC_FAIL;
+    }
+    uint64_t size = bin_get_be(buffer, 8);
+    if(size == ARCHIVE_FAILED) {
+        log_error("archive_receive_stream", "cannot compress [%s]\n", entry->file_name);
+        return RC_FAIL;
+    }
+
+    int64_t offset = bin_tell(archive_fp);
+    if(offset < 0)
+        return RC_FAIL;
+    entry->offset = (uint64_t)offset;
+    entry->stored_size = size;
+    for (uint64_t left = size; left > 0; ) {
+        size_t n = left < sizeof(buffer) ? (size_t)left : sizeof(buffer);
+        if(bin_read_all(worker->fd, buffer, n, NULL) != RC_OK || fwrite(buffer, 1, n, archive_fp) != n) {
+            log_error("archive_receive_stream", "cannot copy the stream of [%s]\n", entry->file_name);
+            return RC_FAIL;
+        }
+        left -= n;
+    }
+    return RC_OK;
+}
+
+/**
+ * append the directory and the trailer
+ * @param archive_fp
+ * @param list
+ * @return RC_OK / RC_FAIL
+ */
+int archive_write_directory(FILE *archive_fp, const archive_list_t *list) {
+    int64_t directory_offset = bin_tell(archive_fp);
+    if(directory_offset < 0 || list->count > UINT32_MAX)
+        return RC_FAIL;
+
+    byte_t buffer[ARCHIVE_ENTRY_BYTES];
+    for (size_t i = 0; i < list->count; ++i) {
+        const archive_entry_t *entry = &list->entries[i];
+        size_t path_length = strlen(entry->path);
+        if(path_length > UINT16_MAX) {
+            log_error("archive_write_directory", "path too long [%s]\n", entry->path);
+            return RC_FAIL;
+        }
+        bin_put_be(buffer, path_length, 2);
+        bin_put_be(buffer + 2, entry->size, 8);
+        bin_put_be(buffer + 10, entry->offset, 8);
+        bin_put_be(buffer + 18, entry->stored_size, 8);
+        if(fwrite(buffer, 1, 2, archive_fp) != 2 || fwrite(entry->path, 1, path_length, archive_fp) != path_length
+           || fwrite(buffer + 2, 1, ARCHIVE_ENTRY_BYTES - 2, archive_fp) != ARCHIVE_ENTRY_BYTES - 2)
+            return RC_FAIL;
+    }
+
+    byte_t trailer[ARCHIVE_TRAILER_BYTES];
+    bin_put_be(trailer, list->count, 4);
+    bin_put_be(trailer + 4, (uint64_t)directory_offset, 8);
+    memcpy(trailer + 12, ADH_ARCHIVE_MAGIC, ARCHIVE_MAGIC_BYTES);
+    return fwrite(trailer, 1, sizeof(trailer), archive_fp) == sizeof(trailer) ? RC_OK : RC_FAIL;
+}
+
+/**
+ * read the directory from the trailer, without reading the streams
+ * @param archive_fp
+ * @param list: the entries, path == file_name
+ * @return RC_OK / RC_FAIL
+ */
+int archive_read_directory(FILE *archive_fp, archive_list_t *list) {
+    byte_t header[ARCHIVE_HEADER_BYTES], trailer[ARCHIVE_TRAILER_BYTES];
+    int64_t archive_size = -1;
+    if(bin_seek(archive_fp, 0, SEEK_END) == RC_OK)
+        archive_size = bin_tell(archive_fp);
+    if(archive_size < ARCHIVE_HEADER_BYTES + ARCHIVE_TRAILER_BYTES
+       || bin_seek(archive_fp, 0, SEEK_SET) != RC_OK || fread(header, 1, sizeof(header), archive_fp) != sizeof(header)
+       || bin_seek(archive_fp, archive_size - ARCHIVE_TRAILER_BYTES, SEEK_SET) != RC_OK
+       || fread(trailer, 1, sizeof(trailer), archive_fp) != sizeof(trailer)
+       || memcmp(header, ADH_ARCHIVE_MAGIC, ARCHIVE_MAGIC_BYTES) != 0
+       || memcmp(trailer + 12, ADH_ARCHIVE_MAGIC, ARCHIVE_MAGIC_BYTES) != 0) {
+        log_error("archive_read_directory", "not an archive\n");
+        return RC_FAIL;
+    }
+    if(header[ARCHIVE_MAGIC_BYTES] != ADH_ARCHIVE_VERSION) {
+        log_error("archive_read_directory", "unsupported archive version %d\n", header[ARCHIVE_MAGIC_BYTES]);
+        return RC_FAIL;
+    }
+
+    uint64_t count = bin_get_be(trailer, 4);
+    uint64_t directory_offset = bin_get_be(trailer + 4, 8);
+    uint64_t directory_end = (uint64_t)archive_size - ARCHIVE_TRAILER_BYTES;
+    if(directory_offset < ARCHIVE_HEADER_BYTES || directory_offset > directory_end
+       || count > (directory_end - directory_offset) / ARCHIVE_ENTRY_BYTES
+       || bin_seek(archive_fp, (int64_t)directory_offset, SEEK_SET) != RC_OK) {
+        log_error("archive_read_directory", "invalid directory\n");
+        return RC_FAIL;
+    }
+
+    list->entries = count > 0 ? calloc((size_t)count, sizeof(archive_entry_t)) : NULL;
+    if(count > 0 && list->entries == NULL)
+        return RC_FAIL;
+    list->capacity = (size_t)count;
+
+    int rc = RC_OK;
+    byte_t buffer[ARCHIVE_ENTRY_BYTES];
+    for (uint64_t i = 0; i < count && rc == RC_OK; ++i) {
+        archive_entry_t *entry = &list->entries[i];
+        size_t path_length = fread(buffer, 1, 2, archive_fp) == 2 ? (size_t)bin_get_be(buffer, 2) : 0;
+        entry->file_name = path_length > 0 ? malloc(path_length + 1) : NULL;
+        if(entry->file_name == NULL) {
+            rc = RC_FAIL;
+            break;
+        }
+        list->count++;
+        if(fread(entry->file_name, 1, path_length, archive_fp) != path_length
+           || fread(buffer + 2, 1, ARCHIVE_ENTRY_BYTES - 2, archive_fp) != ARCHIVE_ENTRY_BYTES - 2) {
+            rc = RC_FAIL;
+            break;
+        }
+        entry->file_name[path_length] = 0;
+        entry->path = entry->file_name;
+        entry->size = bin_get_be(buffer + 2, 8);
+        entry->offset = bin_get_be(buffer + 10, 8);
+        entry->stored_size = bin_get_be(buffer + 18, 8);
+        if(entry->offset < ARCHIVE_HEADER_BYTES || entry->offset > directory_offset
+           || entry->stored_size > directory_offset - entry->offset || strlen(entry->path) != path_length)
+            rc = RC_FAIL;
+    }
+
+    if(rc != RC_OK)
+        log_error("archive_read_directory", "invalid directory entry %zu\n", list->count);
+    return rc;
+}
+
+/**
+ * decompress an entry to the output directory
+ * @param archive_fp
+ * @param entry
+ * @param output_dir
+ * @return RC_OK / RC_FAIL
+ */
+int archive_extract_entry(FILE *archive_fp, const archive_entry_t *entry, const char *output_dir) {
+    if(!archive_valid_path(entry->path)) {
+        log_error("archive_extract_entry", "unsafe path [%s]\n", entry->path);
+        return RC_FAIL;
+    }
+
+    char file_name[ADH_ARCHIVE_MAX_PATH];
+    int length = snprintf(file_name, sizeof(file_name), "%s/", output_dir);
+    if(length >= (int)sizeof(file_name)
+       || snprintf(file_name + length, sizeof(file_name) - length, "%s", entry->path) >= (int)sizeof(file_name) - length) {
+        log_error("archive_extract_entry", "path too long [%s]\n", entry->path);
+        return RC_FAIL;
+    }
+    if(archive_make_parents(file_name) != RC_OK)
+        return RC_FAIL;
+
+    archive_slice_t slice;
+    FILE *input_fp = archive_slice_open(&slice, archive_fp, entry->offset, entry->stored_size);
+    FILE *output_fp = input_fp ? adh_pipe_write(bin_open_create(file_name)) : NULL;
+    int rc = output_fp != NULL ? adh_decompress_stream(input_fp, output_fp) : RC_FAIL;
+    if(adh_release(output_fp, input_fp) != RC_OK)
+        rc = RC_FAIL;
+    if(rc != RC_OK)
+        log_error("archive_extract_entry", "cannot extract [%s]\n", entry->path);
+    return rc;
+}
+
+/**
+ * create the missing directories of a file (mkdir -p of its parent)
+ * @param file_name: separators restored on return
+ * @return RC_OK / RC_FAIL
+ */
+int archive_make_parents(char *file_name) {
+    for (char *separator = strchr(file_name + 1, '/'); separator != NULL; separator = strchr(separator + 1, '/')) {
+        *separator = 0;
+        int failed = mkdir(file_name, 0777) != 0 && errno != EEXIST;
+        if(failed)
+            log_error("archive_make_parents", "cannot create directory [%s]: %s\n", file_name, strerror(errno));
+        *separator = '/';
+        if(failed)
+            return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * @param path
+ * @return true if the path stays under the output directory: relative, without . or .. components
+ */
+bool archive_valid_path(const char *path) {
+    if(path[0] == '/' || path[0] == 0)
+        return false;
+    for (const char *component = path; component != NULL; ) {
+        const char *end = strchr(component, '/');
+        size_t length = end ? (size_t)(end - component) : strlen(component);
+        if(length == 0 || (length == 1 && component[0] == '.') || (length == 2 && strncmp(component, "..", 2) == 0))
+            return false;
+        component = end ? end + 1 : NULL;
+    }
+    return true;
+}
+
+/**
+ * open a read stream on a part of the archive, read with pread: the archive stream is not moved
+ * @param slice: state of the stream, kept by the caller until the stream is closed
+ * @param archive_fp
+ * @param start
+ * @param size
+ * @return the stream, NULL on error
+ */
+FILE *archive_slice_open(archive_slice_t *slice, FILE *archive_fp, uint64_t start, uint64_t size) {
+    slice->fd = fileno(archive_fp);
+    slice->start = start;
+    slice->size = size;
+    slice->position = 0;
+
+    cookie_io_functions_t functions = { archive_slice_read, NULL, archive_slice_seek, archive_slice_close };
+    FILE *file_ptr = fopencookie(slice, "r", functions);
+    if(file_ptr == NULL)
+        log_error("archive_slice_open", "cannot open a stream on the archive\n");
+    return file_ptr;
+}
+
+/**
+ * stream read
+ * @return bytes read, 0 at the end of the slice, -1 on error
+ */
+ssize_t archive_slice_read(void *cookie, char *data, size_t size) {
+    archive_slice_t *slice = cookie;
+    uint64_t available = slice->size - slice->position;
+    if(size > available)
+        size = (size_t)available;
+    if(size == 0)
+        return 0;
+    ssize_t n = pread(slice->fd, data, size, (off_t)(slice->start + slice->position));
+    if(n > 0)
+        slice->position += (uint64_t)n;
+    return n;
+}
+
+/**
+ * stream seek, within the slice
+ * @return 0 / -1
+ */
+int archive_slice_seek(void *cookie, off64_t *offset, int whence) {
+    archive_slice_t *slice = cookie;
+    off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (off64_t)slice->position : (off64_t)slice->size;
+    if(*offset < -base || base + *offset > (off64_t)slice->size) {
+        errno = EINVAL;
+        return -1;
+    }
+    slice->position = (uint64_t)(base + *offset);
+    *offset = (off64_t)slice->position;
+    return 0;
+}
+
+/**
+ * stream close, the state belongs to the caller and the archive stays open
+ * @return 0
+ */
+int archive_slice_close(void *cookie) {
+    (void)cookie;
+    return 0;
+}
+
+/**
+ * free the entries
+ * @param list
+ */
+void archive_free_list(archive_list_t *list) {
+    for (size_t i = 0; i < list->count; ++i) {
+        free(list->entries[i].file_name);
+    }
+    free(list->entries);
+    memset(list, 0, sizeof(*list));
+}
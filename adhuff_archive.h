@@ -0,0 +1,36 @@
+#ifndef ALGO_ADHUFF_ARCHIVE_H
+#define ALGO_ADHUFF_ARCHIVE_H
+
+#include "adhuff_common.h"
+
+/**
+ * constants
+ *
+ * archive of the regular files under a directory, each distinct content compressed once as an independent
+ * stream (the format of adh_compress_stream), the files with the same content share its stream.
+ *     ADH_ARCHIVE_MAGIC, version
+ *     the compressed streams, in the order the workers finish them
+ *     central directory, an entry per file sorted by path:
+ *         path length (2 bytes), path relative to the directory with '/' separators,
+ *         original size (8), offset (8) and size (8) of its stream
+ *     trailer: number of entries (4), offset of the directory (8), ADH_ARCHIVE_MAGIC
+ * integers are big endian. A member is extracted from the trailer, the directory and its own stream only
+ */
+enum {
+    ADH_ARCHIVE_VERSION     = 1,
+    ADH_ARCHIVE_MAX_WORKERS = 64,
+    ADH_ARCHIVE_MAX_PATH    = 4096
+};
+
+#define ADH_ARCHIVE_MAGIC   "ADHA"
+
+/*
+ * the files are hashed, and compared on equal hashes, then the distinct contents are compressed
+ * by a pool of worker processes (the coders keep their state in module variables).
+ * Symbolic links, devices and empty directories are not archived
+ */
+int         adh_archive_create(const char *archive_name, const char *dir_name, const adh_options_t *options, int workers);
+int         adh_archive_extract(const char *archive_name, const char *output_dir, const char *member);
+int         adh_archive_list(const char *archive_name, FILE *fp);
+
+#endif //ALGO_ADHUFF_ARCHIVE_H
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE             // fopencookie, open_memstream
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+
+#include "adhuff_buffer.h"
+#include "adhuff_compress.h"
+#include "adhuff_decompress.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    BUFFER_MIN_GROWTH   = 64 * 1024                     // first capacity of a growable buffer
+};
+
+/*
+ * caller buffer behind a stream: fmemopen reserves the last byte of the buffer for a null terminator
+ */
+typedef struct {
+    byte_t *            data;
+    size_t              capacity;
+    size_t              size;                           // end of the bytes read or written
+    size_t              position;
+    bool                growable;                       // data allocated with malloc, grown with realloc
+    bool                overflow;                       // a write went past the capacity
+} buffer_stream_t;
+
+//
+// private methods
+//
+FILE *  buffer_open(buffer_stream_t *stream, byte_t *data, size_t capacity, size_t size, const char *mode);
+ssize_t buffer_read(void *cookie, char *data, size_t size);
+ssize_t buffer_write(void *cookie, const char *data, size_t size);
+int     buffer_seek(void *cookie, off64_t *offset, int whence);
+int     buffer_close(void *cookie);
+int     buffer_grow(buffer_stream_t *stream, size_t needed);
+int     buffer_release(int rc, FILE *output_file_ptr, FILE *input_file_ptr, const buffer_stream_t *output, size_t *output_size);
+int     memory_release(int rc, FILE *output_file_ptr, FILE *input_file_ptr, byte_t **output, size_t *output_size);
+
+/**
+ * compress the input into the output buffer
+ * @param input
+ * @param input_size
+ * @param output
+ * @param output_capacity
+ * @param output_size: bytes written, 0 on failure
+ * @param options: NULL for default options
+ * @return RC_OK / RC_FAIL, also when the output buffer is too small
+ */
+int adh_compress_buffer(const byte_t *input, size_t input_size, byte_t *output, size_t output_capacity,
+                        size_t *output_size, const adh_options_t *options) {
+    buffer_stream_t input_stream, output_stream;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = buffer_open(&output_stream, output, output_capacity, 0, "w+");
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_compress_stream(input_file_ptr, output_file_ptr, options);
+    return buffer_release(rc, output_file_ptr, input_file_ptr, &output_stream, output_size);
+}
+
+/**
+ * decompress the input into the output buffer
+ * @param input
+ * @param input_size
+ * @param output
+ * @param output_capacity
+ * @param output_size: bytes written, 0 on failure
+ * @return RC_OK / RC_FAIL, also when the output buffer is too small
+ */
+int adh_decompress_buffer(const byte_t *input, size_t input_size, byte_t *output, size_t output_capacity,
+                          size_t *output_size) {
+    buffer_stream_t input_stream, output_stream;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = buffer_open(&output_stream, output, output_capacity, 0, "w+");
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_decompress_stream(input_file_ptr, output_file_ptr);
+    return buffer_release(rc, output_file_ptr, input_file_ptr, &output_stream, output_size);
+}
+
+/**
+ * compress the input to a new buffer
+ * @param input
+ * @param input_size
+ * @param output: allocated with malloc, NULL on failure
+ * @param output_size
+ * @param options: NULL for default options
+ * @return RC_OK / RC_FAIL
+ */
+int adh_compress_memory(const byte_t *input, size_t input_size, byte_t **output, size_t *output_size,
+                        const adh_options_t *options) {
+    buffer_stream_t input_stream;
+    *output = NULL;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = open_memstream((char **)output, output_size);
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_compress_stream(input_file_ptr, output_file_ptr, options);
+    return memory_release(rc, output_file_ptr, input_file_ptr, output, output_size);
+}
+
+/**
+ * decompress the input to a new buffer
+ * @param input
+ * @param input_size
+ * @param output: allocated with malloc, NULL on failure
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int adh_decompress_memory(const byte_t *input, size_t input_size, byte_t **output, size_t *output_size) {
+    buffer_stream_t input_stream;
+    *output = NULL;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = open_memstream((char **)output, output_size);
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_decompress_stream(input_file_ptr, output_file_ptr);
+    return memory_release(rc, output_file_ptr, input_file_ptr, output, output_size);
+}
+
+/**
+ * compress the input into a caller buffer grown as needed, without a failed attempt when the output does not fit
+ * @param input
+ * @param input_size
+ * @param buffer: allocated with malloc or NULL, may be moved by realloc, kept by the caller also on failure
+ * @param capacity: of the buffer, updated
+ * @param output_size: bytes written, 0 on failure
+ * @param options: NULL for default options
+ * @return RC_OK / RC_FAIL
+ */
+int adh_compress_realloc(const byte_t *input, size_t input_size, byte_t **buffer, size_t *capacity,
+                         size_t *output_size, const adh_options_t *options) {
+    buffer_stream_t input_stream, output_stream;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = buffer_open(&output_stream, *buffer, *buffer ? *capacity : 0, 0, "w+");
+    output_stream.growable = true;
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_compress_stream(input_file_ptr, output_file_ptr, options);
+    rc = buffer_release(rc, output_file_ptr, input_file_ptr, &output_stream, output_size);
+    *buffer = output_stream.data;
+    *capacity = output_stream.capacity;
+    return rc;
+}
+
+/**
+ * decompress the input into a caller buffer grown as needed
+ * @param input
+ * @param input_size
+ * @param buffer: allocated with malloc or NULL, may be moved by realloc, kept by the caller also on failure
+ * @param capacity: of the buffer, updated
+ * @param output_size: bytes written, 0 on failure
+ * @return RC_OK / RC_FAIL
+ */
+int adh_decompress_realloc(const byte_t *input, size_t input_size, byte_t **buffer, size_t *capacity,
+                           size_t *output_size) {
+    buffer_stream_t input_stream, output_stream;
+    FILE *input_file_ptr = buffer_open(&input_stream, (byte_t *)input, input_size, input_size, "r");
+    FILE *output_file_ptr = buffer_open(&output_stream, *buffer, *buffer ? *capacity : 0, 0, "w+");
+    output_stream.growable = true;
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+    if(rc == RC_OK)
+        rc = adh_decompress_stream(input_file_ptr, output_file_ptr);
+    rc = buffer_release(rc, output_file_ptr, input_file_ptr, &output_stream, output_size);
+    *buffer = output_stream.data;
+    *capacity = output_stream.capacity;
+    return rc;
+}
+
+/**
+ * open a stream on a caller buffer
+ * @param stream: state of the stream, kept by the caller until the stream is closed
+ * @param data
+ * @param capacity
+ * @param size: bytes readable
+ * @param mode: "r" or "w+"
+ * @return the stream, NULL on error
+ */
+FILE *buffer_open(buffer_stream_t *stream, byte_t *data, size_t capacity, size_t size, const char *mode) {
+    memset(stream, 0, sizeof(*stream));
+    stream->data = data;
+    stream->capacity = capacity;
+    stream->size = size;
+
+    cookie_io_functions_t functions = { buffer_read, buffer_write, buffer_seek, buffer_close };
+    FILE *file_ptr = fopencookie(stream, mode, functions);
+    if(file_ptr == NULL)
+        log_error("buffer_open", "cannot open a stream on the buffer\n");
+    return file_ptr;
+}
+
+/**
+ * stream read
+ * @return bytes read, 0 at the end of the buffer
+ */
+ssize_t buffer_read(void *cookie, char *data, size_t size) {
+    buffer_stream_t *stream = cookie;
+    size_t available = stream->position < stream->size ? stream->size - stream->position : 0;
+    if(size > available)
+        size = available;
+    if(size > 0)
+        memcpy(data, stream->data + stream->position, size);
+    stream->position += size;
+    return (ssize_t)size;
+}
+
+/**
+ * stream write, all or nothing
+ * @return bytes written, -1 past the capacity of a buffer that cannot grow
+ */
+ssize_t buffer_write(void *cookie, const char *data, size_t size) {
+    buffer_stream_t *stream = cookie;
+    if(size > stream->capacity - stream->position && buffer_grow(stream, stream->position + size) != RC_OK)
+        return -1;
+    memcpy(stream->data + stream->position, data, size);
+    stream->position += size;
+    if(stream->position > stream->size)
+        stream->size = stream->position;
+    return (ssize_t)size;
+}
+
+/**
+ * make room for a write: realloc a growable buffer, at least doubling it
+ * @param stream
+ * @param needed: capacity needed
+ * @return RC_OK / RC_FAIL with errno set, ENOSPC if the buffer cannot grow
+ */
+int buffer_grow(buffer_stream_t *stream, size_t needed) {
+    if(!stream->growable) {
+        stream->overflow = true;
+        errno = ENOSPC;
+        return RC_FAIL;
+    }
+
+    size_t capacity = stream->capacity < BUFFER_MIN_GROWTH ? BUFFER_MIN_GROWTH : 2 * stream->capacity;
+    if(capacity < needed)
+        capacity = needed;
+    byte_t *data = realloc(stream->data, capacity);
+    if(data == NULL) {
+        errno = ENOMEM;
+        return RC_FAIL;
+    }
+    stream->data = data;
+    stream->capacity = capacity;
+    return RC_OK;
+}
+
+/**
+ * stream seek, within the capacity
+ * @return 0 / -1
+ */
+int buffer_seek(void *cookie, off64_t *offset, int whence) {
+    buffer_stream_t *stream = cookie;
+    off64_t base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? (off64_t)stream->position : (off64_t)stream->size;
+    if(*offset < -base || base + *offset > (off64_t)stream->capacity) {
+        errno = EINVAL;
+        return -1;
+    }
+    stream->position = (size_t)(base + *offset);
+    *offset = (off64_t)stream->position;
+    return 0;
+}
+
+/**
+ * stream close, the state belongs to the caller
+ * @return 0
+ */
+int buffer_close(void *cookie) {
+    (void)cookie;
+    return 0;
+}
+
+/**
+ * close the streams of a buffer call
+ * @param rc: result of the coder
+ * @param output_file_ptr: may be NULL
+ * @param input_file_ptr: may be NULL
+ * @param output: state of the output stream
+ * @param output_size: bytes written, 0 on failure
+ * @return RC_OK / RC_FAIL
+ */
+int buffer_release(int rc, FILE *output_file_ptr, FILE *input_file_ptr, const buffer_stream_t *output, size_t *output_size) {
+    *output_size = 0;
+    if(output_file_ptr == NULL || adh_release(output_file_ptr, input_file_ptr) != RC_OK)
+        rc = RC_FAIL;
+    if(output_file_ptr == NULL)
+        adh_release(NULL, input_file_ptr);
+
+    if(output_file_ptr != NULL && output->overflow) {
+        log_error("buffer_release", "output buffer of %zu bytes too small\n", output->capacity);
+        rc = RC_FAIL;
+    }
+    if(rc == RC_OK)
+        *output_size = output->size;
+    return rc;
+}
+
+/**
+ * close the streams of a memory call, the memory stream sets the output when closed
+ * @param rc: result of the coder
+ * @param output_file_ptr: may be NULL
+ * @param input_file_ptr: may be NULL
+ * @param output: freed and set to NULL on failure
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int memory_release(int rc, FILE *output_file_ptr, FILE *input_file_ptr, byte_t **output, size_t *output_size) {
+    if(adh_release(output_file_ptr, input_file_ptr) != RC_OK)
+        rc = RC_FAIL;
+    if(rc != RC_OK) {
+        free(*output);
+        *output = NULL;
+        *output_size = 0;
+    }
+    return rc;
+}
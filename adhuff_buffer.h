@@ -0,0 +1,26 @@
+#ifndef ALGO_ADHUFF_BUFFER_H
+#define ALGO_ADHUFF_BUFFER_H
+
+#include "adhuff_common.h"
+
+/*
+ * in-memory coding, through memory streams on the buffers:
+ * - adh_*_buffer code into the caller buffer and fail if it is too small, *output_size is the size written
+ * - adh_*_memory allocate the output with malloc, the caller frees it
+ * - adh_*_realloc code into a buffer allocated with malloc and kept by the caller from a call to the next,
+ *   grown with realloc when the output does not fit (NULL to start), the caller frees it
+ * like the streams, they share the module state of the coders: one call at a time per process
+ */
+int         adh_compress_buffer(const byte_t *input, size_t input_size, byte_t *output, size_t output_capacity,
+                                size_t *output_size, const adh_options_t *options);
+int         adh_decompress_buffer(const byte_t *input, size_t input_size, byte_t *output, size_t output_capacity,
+                                  size_t *output_size);
+int         adh_compress_memory(const byte_t *input, size_t input_size, byte_t **output, size_t *output_size,
+                                const adh_options_t *options);
+int         adh_decompress_memory(const byte_t *input, size_t input_size, byte_t **output, size_t *output_size);
+int         adh_compress_realloc(const byte_t *input, size_t input_size, byte_t **buffer, size_t *capacity,
+                                 size_t *output_size, const adh_options_t *options);
+int         adh_decompress_realloc(const byte_t *input, size_t input_size, byte_t **buffer, size_t *capacity,
+                                   size_t *output_size);
+
+#endif //ALGO_ADHUFF_BUFFER_H
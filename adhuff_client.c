@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "adhuff_client.h"
+#include "log.h"
+
+/**
+ * connect to the server
+ * @param socket_path
+ * @return the connection, -1 on error
+ */
+int adh_client_connect(const char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        log_error("adh_client_connect", "socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+/**
+ * close the connection, the server drops the requests not answered yet
+ * @param fd: may be -1
+ */
+void adh_client_close(int fd) {
+    if(fd >= 0)
+        close(fd);
+}
+
+/**
+ * send a request without waiting for its answer
+ * @param fd
+ * @param operation: ADH_SERVE_COMPRESS / ADH_SERVE_DECOMPRESS
+ * @param options: compression options, NULL for default options
+ * @param data
+ * @param size: up to ADH_SERVE_MAX_PAYLOAD
+ * @return RC_OK / RC_FAIL
+ */
+int adh_client_send(int fd, byte_t operation, const adh_options_t *options, const byte_t *data, size_t size) {
+    if(size > ADH_SERVE_MAX_PAYLOAD) {
+        log_error("adh_client_send", "payload too large: %zu bytes\n", size);
+        return RC_FAIL;
+    }
+
+    byte_t params[3] = {0};
+    if(options) {
+        params[0] = options->flags;
+        params[1] = (byte_t)options->level;
+        params[2] = (byte_t)options->lanes;
+    }
+
+    byte_t header[ADH_SERVE_HEADER_BYTES];
+    adh_serve_put_header(header, operation, params, (uint32_t)size);
+    int rc = bin_write_all(fd, header, ADH_SERVE_HEADER_BYTES, NULL);
+    if(rc == RC_OK && size > 0)
+        rc = bin_write_all(fd, data, size, NULL);
+    if(rc != RC_OK)
+        log_error("adh_client_send", "cannot send the request: %s\n", strerror(errno));
+    return rc;
+}
+
+/**
+ * read the answer of the oldest request sent
+ * @param fd
+ * @param output: allocated with malloc, NULL on failure
+ * @param output_size
+ * @return RC_OK / RC_FAIL if the request failed (the message of the server is logged) or on a connection error
+ */
+int adh_client_receive(int fd, byte_t **output, size_t *output_size) {
+    *output = NULL;
+    *output_size = 0;
+
+    byte_t header[ADH_SERVE_HEADER_BYTES];
+    if(bin_read_all(fd, header, ADH_SERVE_HEADER_BYTES, NULL) != RC_OK) {
+        log_error("adh_client_receive", "connection closed by the server\n");
+        return RC_FAIL;
+    }
+
+    size_t size = adh_serve_get_length(header);
+    byte_t * payload = malloc(size + 1);
+    if(payload == NULL)
+        return RC_FAIL;
+    if(bin_read_all(fd, payload, size, NULL) != RC_OK) {
+        log_error("adh_client_receive", "truncated answer\n");
+        free(payload);
+        return RC_FAIL;
+    }
+
+    if(header[0] != ADH_SERVE_OK) {
+        payload[size] = 0;
+        log_error("adh_client_receive", "server error: %s\n", (char *)payload);
+        free(payload);
+        return RC_FAIL;
+    }
+
+    *output = payload;
+    *output_size = size;
+    return RC_OK;
+}
+
+/**
+ * send a request and wait for its answer
+ * @param fd
+ * @param operation: ADH_SERVE_COMPRESS / ADH_SERVE_DECOMPRESS
+ * @param options: compression options, NULL for default options
+ * @param data
+ * @param size
+ * @param output: allocated with malloc, NULL on failure
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int adh_client_call(int fd, byte_t operation, const adh_options_t *options, const byte_t *data, size_t size,
+                    byte_t **output, size_t *output_size) {
+    *output = NULL;
+    *output_size = 0;
+    int rc = adh_client_send(fd, operation, options, data, size);
+    if(rc == RC_OK)
+        rc = adh_client_receive(fd, output, output_size);
+    return rc;
+}
@@ -0,0 +1,19 @@
+#ifndef ALGO_ADHUFF_CLIENT_H
+#define ALGO_ADHUFF_CLIENT_H
+
+#include "adhuff_common.h"
+#include "adhuff_serve.h"
+
+/*
+ * client of the compression server (adhuff_serve.h), for services that code small payloads:
+ * a connection is reused for many requests, and several requests can be sent before reading the answers.
+ * The outputs are allocated with malloc, the caller frees them
+ */
+int         adh_client_connect(const char *socket_path);
+void        adh_client_close(int fd);
+int         adh_client_send(int fd, byte_t operation, const adh_options_t *options, const byte_t *data, size_t size);
+int         adh_client_receive(int fd, byte_t **output, size_t *output_size);
+int         adh_client_call(int fd, byte_t operation, const adh_options_t *options, const byte_t *data, size_t size,
+                            byte_t **output, size_t *output_size);
+
+#endif //ALGO_ADHUFF_CLIENT_H
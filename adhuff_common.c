@@ -1,78 +1,78 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 #include "adhuff_common.h"
+#include "adhuff_interleave.h"
+#include "adhuff_lz77.h"
+#include "adhuff_memory.h"
 #include "bin_io.h"
+#include "bin_pipe.h"
 #include "log.h"
 
-/**
- * constants
- */
-enum {
-    MAX_ORDER = MAX_CODE_BITS*2+1, //513
-    HASH_BUCKETS = 7919 //TODO: tune it. prime number or power of 2 ? see https://en.wikipedia.org/wiki/Hash_table
-};
-
-/**
- * hash entry for hash table
- */
-typedef struct hash_entry {
-    adh_node_t*             value;
-    struct hash_entry*      next;
-    struct hash_entry*      prev;
-} hash_entry_t;
-
-/**
- * hash table for quick search of nodes
- */
-typedef struct {
-    int             length;
-    //hash_entry_t    **buckets;            //heap
-    hash_entry_t    *buckets[HASH_BUCKETS]; //stack
-} hash_table_t;
-
-
-//
-// module variables
-//
-static adh_order_t          adh_next_order;
-static adh_node_t *         adh_root_node = NULL;
-static adh_node_t *         adh_nyt_node = NULL;
-static adh_node_t *         symbol_node_array[MAX_CODE_BITS] = {0};
-static hash_table_t         map_weight_nodes = {0};
-
 #ifdef _DEBUG
 static long                 collision = 0;
 #endif
 
+static bool                 stats_enabled = false;
+static bool                 timers_enabled = false;
+static adh_stats_t          stats;
+static uint64_t             calibration_ticks;      // ticks and nanoseconds when the timers were reset
+static uint64_t             calibration_ns;
+static uint32_t             timer_calls[ADH_PHASE_COUNT];
+static uint64_t             timer_overhead;         // ticks of an empty start / stop, removed from each sample
+
+static bool                 pipelined = false;
+static adh_tree_t *         priming_tree;           // copied as the order-0 tree of each stream, see adh_set_priming
+static uint32_t             priming_fingerprint;    // FNV-1a of the priming sample, recorded in the primed streams
+static adh_progress_fn      progress_callback;
+static void *               progress_ctx;
+static uint64_t             progress_every_bytes;
+static uint64_t             progress_every_ns;
+static adh_progress_t       progress;
+static uint64_t             progress_start_ns;
+static uint64_t             progress_last_ns;       // time and input bytes of the previous call
+static uint64_t             progress_last_bytes;
+static bool                 progress_cancelled;
+
+enum {
+    TIMER_SAMPLE_PERIOD     = 16    // the per symbol phases (model, bits) are timed once every 16 calls
+};
+
+// a single predictable branch when the counters are disabled
+#define STATS_ADD(field, value)     do { if(stats_enabled) stats.field += (value); } while(0)
+
 //
 // private methods
 //
-int             init_tree();
-void            destroy_tree();
-adh_node_t*     create_nyt();
-adh_node_t*     create_node(adh_symbol_t symbol);
-void            destroy_node(adh_node_t *node);
-void            update_node_encoding(adh_node_t *node);
-void            increase_weight(adh_node_t *node);
-
-void            hash_init();
-void            hash_release();
-void            hash_add(adh_node_t* node, hash_entry_t* entry);
-hash_entry_t*   hash_detach_entry(adh_node_t *node);
-unsigned int    hash_get_index(adh_weight_t weight);
-adh_node_t*     hash_get_value(adh_weight_t weight, adh_order_t order);
-void            hash_check_collision(adh_weight_t weight, int hash_index, const adh_node_t *node);
+adh_node_t*     create_nyt(adh_tree_t *tree);
+adh_node_t*     create_node(adh_tree_t *tree, adh_symbol_t symbol);
+size_t          tree_size(int num_symbols, int max_order);
+adh_node_t*     relocate_node(const adh_tree_t *from, adh_tree_t *to, adh_node_t *node);
+void            increase_weight(adh_tree_t *tree, adh_node_t *node);
+int             set_tree_batch(adh_tree_t *tree, uint32_t batch);
+void            rebuild_tree(adh_tree_t *tree);
+void            halve_weights(adh_tree_t *tree);
+int             escape_bits(const adh_tree_t *tree, uint32_t *short_codes);
+void            lookup_invalidate(adh_tree_t *tree, const adh_node_t *node);
 
-/**
- * get NYT node
- */
-adh_node_t*     get_nyt() {
-    return adh_nyt_node;
-}
+unsigned int    hash_get_index(adh_weight_t weight);
+void            hash_add(adh_tree_t *tree, adh_node_t *node);
+void            hash_remove(adh_tree_t *tree, adh_node_t *node);
+adh_node_t*     hash_get_value(const adh_tree_t *tree, adh_weight_t weight, adh_order_t order);
+void            hash_check_collision(const adh_tree_t *tree, adh_weight_t weight, int hash_index, const adh_node_t *node);
+void            stats_add_code(const adh_node_t *node, bool is_new_node);
+uint64_t        timer_ticks(void);
+uint64_t        timer_ns(void);
+int             progress_call(uint64_t now_ns);
 
 /**
- * Initialize the structure for Adaptive Huffman algorithm
+ * Open the input and output files
  * @param input_file_name
  * @param output_file_name
  * @param output_file_ptr
@@ -81,10 +81,8 @@ adh_node_t*     get_nyt() {
  */
 int adh_init(const char input_file_name[], const char output_file_name[],
              FILE **output_file_ptr, FILE **input_file_ptr) {
-    int rc = init_tree();
-    if(rc == RC_OK) {
-        hash_init();
-    }
+    int rc = RC_OK;
+    *output_file_ptr = NULL;
 
     *input_file_ptr = bin_open_read(input_file_name);
     if ((*input_file_ptr) == NULL) {
@@ -98,196 +96,512 @@ int adh_init(const char input_file_name[], const char output_file_name[],
         }
     }
 
+    if(rc == RC_OK) {
+        *input_file_ptr = adh_pipe_read(*input_file_ptr);
+        *output_file_ptr = adh_pipe_write(*output_file_ptr);
+    }
+
     return rc;
 }
 
+/**
+ * in pipelined mode, a reader thread around the input of a coder
+ * @param file: owned by the returned stream
+ * @return the pipelined stream, the file itself if not pipelined or the thread cannot start
+ */
+FILE * adh_pipe_read(FILE *file) {
+    FILE * input_pipe = pipelined && file != NULL ? bin_pipe_read(file) : NULL;
+    return input_pipe ? input_pipe : file;
+}
+
+/**
+ * in pipelined mode, a writer thread around the output of a coder
+ * @param file: owned by the returned stream
+ * @return the pipelined stream, the file itself if not pipelined or the thread cannot start
+ */
+FILE * adh_pipe_write(FILE *file) {
+    FILE * output_pipe = pipelined && file != NULL ? bin_pipe_write(file) : NULL;
+    return output_pipe ? output_pipe : file;
+}
+
+/**
+ * read and write the files of adh_compress_file / adh_decompress_file and of the archives from their own threads,
+ * so that the coder does not wait for the I/O, see bin_pipe.h
+ * @param enabled
+ */
+void adh_set_pipelined(bool enabled) {
+    pipelined = enabled;
+}
+
+/**
+ * pipelined files moved with io_uring: several large reads and writes in flight on registered buffers.
+ * Enables the pipelined mode, falls back to its stdio threads when io_uring is not available
+ * @param enabled
+ */
+void adh_set_io_uring(bool enabled) {
+    if(enabled)
+        pipelined = true;
+    bin_pipe_use_uring(enabled);
+}
+
 /**
  * Release allocated resources
  * @param output_file_ptr
  * @param input_file_ptr
+ * @return RC_OK / RC_FAIL if the output could not be written completely
  */
-void adh_release(FILE *output_file_ptr, FILE *input_file_ptr) {
-    if(output_file_ptr) {
-        fclose(output_file_ptr);
+int adh_release(FILE *output_file_ptr, FILE *input_file_ptr) {
+    int rc = RC_OK;
+    if(output_file_ptr && fclose(output_file_ptr) != 0) {
+        log_error("adh_release", "cannot write the output\n");
+        rc = RC_FAIL;
     }
 
     if(input_file_ptr) {
         fclose(input_file_ptr);
     }
 
-    destroy_tree();
-    hash_release();
+#ifdef _DEBUG
+    fprintf(stdout, "total number of collision: %ld\n", collision);
+    collision = 0;
+#endif
+    return rc;
 }
 
 /**
- * Initialize the tree with a single node: the NYT
+ * parse a compression option (argument starting with --)
+ * @param arg
+ * @param options
+ * @return RC_OK / RC_FAIL
  */
-int init_tree() {
-#ifdef _DEBUG
-    log_trace("adh_init_tree", "\n");
-#endif
+int adh_parse_option(const char *arg, adh_options_t *options) {
+    if (strcmp(arg, "--order1") == 0) {
+        options->flags |= ADH_FLAG_ORDER1;
+    }
+    else if (strcmp(arg, "--bwt") == 0) {
+        options->flags |= ADH_FLAG_BWT;
+    }
+    else if (strcmp(arg, "--range") == 0) {
+        options->flags |= ADH_FLAG_RANGE;
+    }
+    else if (strcmp(arg, "--compact-escape") == 0) {
+        options->flags |= ADH_FLAG_COMPACT_ESCAPE;
+    }
+    else if (strcmp(arg, "--static") == 0) {
+        options->flags |= ADH_FLAG_STATIC;
+    }
+    else if (strncmp(arg, "--interleave", 12) == 0 && (arg[12] == 0 || arg[12] == '=')) {
+        options->flags |= ADH_FLAG_INTERLEAVED;
+        if (arg[12] == '=') {
+            options->lanes = atoi(arg + 13);
+            if (options->lanes < 1 || options->lanes > INTERLEAVE_MAX_LANES)
+                return RC_FAIL;
+        }
+    }
+    else if (strncmp(arg, "--batched", 9) == 0 && (arg[9] == 0 || arg[9] == '=')) {
+        options->flags |= ADH_FLAG_BATCHED;
+        if (arg[9] == '=') {
+            options->batch = atoi(arg + 10);
+            if (options->batch < 1 || options->batch > ADH_BATCH_MAX)
+                return RC_FAIL;
+        }
+    }
+    else if (strncmp(arg, "--lz77", 6) == 0 && (arg[6] == 0 || arg[6] == '=')) {
+        options->flags |= ADH_FLAG_LZ77;
+        if (arg[6] == '=') {
+            options->level = atoi(arg + 7);
+            if (options->level < 1 || options->level > LZ77_MAX_LEVEL)
+                return RC_FAIL;
+        }
+    }
+    else {
+        return RC_FAIL;
+    }
+    return RC_OK;
+}
 
-    for (int i = 0; i < MAX_CODE_BITS; ++i) {
-        symbol_node_array[i] = NULL;
+/**
+ * Initialize the model: the order-0 tree is created immediately,
+ * order-1 trees are created on first use
+ * @param model
+ * @param flags: ADH_FLAG_*
+ * @return RC_OK / RC_FAIL
+ */
+int adh_model_init(adh_model_t *model, byte_t flags) {
+    memset(model, 0, sizeof(adh_model_t));
+    model->flags = flags;
+
+    // the lanes have their own trees, the static codes none
+    if(flags & (ADH_FLAG_INTERLEAVED | ADH_FLAG_STATIC))
+        return RC_OK;
+
+    if(flags & ADH_FLAG_LZ77) {
+        model->order0 = adh_create_tree(LZ77_LITLEN_BITS);
+        model->distances = adh_create_tree(LZ77_DISTANCE_BITS);
+        return model->order0 != NULL && model->distances != NULL ? RC_OK : RC_FAIL;
     }
 
-    adh_next_order = MAX_ORDER;
-    if(adh_root_node != NULL) {
-        perror("init_tree: root already initialized");
+    model->order0 = priming_tree && adh_priming_recorded(flags) ? adh_copy_tree(priming_tree) : adh_create_tree(SYMBOL_BITS);
+    return model->order0 != NULL ? RC_OK : RC_FAIL;
+}
+
+/**
+ * start the order-0 byte tree of each stream from a tree trained on sample data instead of an empty tree:
+ * short inputs that look like the sample start with short codes and few escapes.
+ * The streams record the fingerprint of the sample, the decoder must be primed with the same data.
+ * LZ77, range, interleaved and static streams are not primed
+ * @param data: NULL to stop priming
+ * @param length
+ * @return RC_OK / RC_FAIL
+ */
+int adh_set_priming(const byte_t *data, size_t length) {
+    adh_destroy_tree(priming_tree);
+    priming_tree = NULL;
+    priming_fingerprint = 0;
+    if(data == NULL || length == 0)
+        return RC_OK;
+
+    adh_tree_t * tree = adh_create_tree(SYMBOL_BITS);
+    if(tree == NULL)
         return RC_FAIL;
+
+    for (size_t i = 0; i < length; ++i) {
+        adh_node_t * node = adh_search_symbol_in_tree(tree, data[i]);
+        bool is_new_node = node == NULL;
+        if(is_new_node)
+            node = adh_create_node_and_append(tree, data[i]);
+        if(node == NULL) {
+            adh_destroy_tree(tree);
+            return RC_FAIL;
+        }
+        adh_update_tree(tree, node, is_new_node);
     }
 
-    adh_nyt_node = adh_root_node = create_nyt();
+    uint32_t fingerprint = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        fingerprint = (fingerprint ^ data[i]) * 16777619u;
+    }
+    priming_tree = tree;
+    priming_fingerprint = fingerprint;
     return RC_OK;
 }
 
 /**
- * Destroy Tree and reset pointers
+ * @param flags: format flags ADH_FLAG_*
+ * @return true if the stream records its priming: its bytes are coded with the order-0 tree
  */
-void destroy_tree() {
-#ifdef _DEBUG
-    log_trace("adh_destroy_tree", "\n");
-#endif
+bool adh_priming_recorded(byte_t flags) {
+    return (flags & (ADH_FLAG_LZ77 | ADH_FLAG_RANGE | ADH_FLAG_INTERLEAVED | ADH_FLAG_STATIC)) == 0;
+}
 
-    destroy_node(adh_root_node);
-    adh_root_node = NULL;
-    adh_nyt_node = NULL;
+/**
+ * @param fingerprint: of the priming sample, 0 without priming
+ * @return true if the streams are primed
+ */
+bool adh_priming_get(uint32_t *fingerprint) {
+    *fingerprint = priming_fingerprint;
+    return priming_tree != NULL;
 }
 
 /**
- * release resources for the passed node and its children
- * @param node: should start from the root
+ * decoder: start the order-0 tree like the encoder of the stream did, the priming of the decoder
+ * must be the sample of the stream
+ * @param model: initialized with the flags of the stream
+ * @param primed: the stream was primed
+ * @param fingerprint: of the sample of the stream
+ * @return RC_OK / RC_FAIL
  */
-void destroy_node(adh_node_t *node) {
-    if(node == NULL)
-        return;
+int adh_model_set_primed(adh_model_t *model, bool primed, uint32_t fingerprint) {
+    if(primed && (priming_tree == NULL || fingerprint != priming_fingerprint)) {
+        log_error("adh_model_set_primed", "the stream is primed with another sample (fingerprint %08X)\n", fingerprint);
+        return RC_FAIL;
+    }
+    if(!primed && priming_tree != NULL) {
+        adh_destroy_tree(model->order0);
+        model->order0 = adh_create_tree(SYMBOL_BITS);
+    }
+    return model->order0 != NULL ? RC_OK : RC_FAIL;
+}
 
-#ifdef _DEBUG
-    log_trace(" destroy_node", "%s\n", fmt_node(node));
-#endif
+/**
+ * rebuild the trees of the model every batch of symbols, instead of updating them after each symbol:
+ * the trees created so far and those created later
+ * @param model
+ * @param batch: [1..ADH_BATCH_MAX]
+ * @return RC_OK / RC_FAIL
+ */
+int adh_model_set_batch(adh_model_t *model, uint32_t batch) {
+    model->batch = batch;
+    int rc = set_tree_batch(model->order0, batch);
+    if(rc == RC_OK)
+        rc = set_tree_batch(model->distances, batch);
+    return rc;
+}
+
+/**
+ * make the tree batched
+ * @param tree: may be NULL
+ * @param batch: symbols between two rebuilds
+ * @return RC_OK / RC_FAIL
+ */
+int set_tree_batch(adh_tree_t *tree, uint32_t batch) {
+    if(tree == NULL || batch == 0)
+        return RC_OK;
+
+    tree->batch_counts = adh_calloc(tree->num_symbols, sizeof(uint32_t));
+    if(tree->batch_counts == NULL)
+        return RC_FAIL;
+    tree->batch_size = batch;
+    return RC_OK;
+}
+
+/**
+ * Release all the trees of the model
+ * @param model
+ */
+void adh_model_release(adh_model_t *model) {
+    adh_destroy_tree(model->order0);
+    model->order0 = NULL;
+    adh_destroy_tree(model->distances);
+    model->distances = NULL;
+
+    for (int i = 0; i < ADH_MAX_SYMBOLS; ++i) {
+        adh_destroy_tree(model->contexts[i]);
+        model->contexts[i] = NULL;
+    }
+}
+
+/**
+ * get the tree of the current context (the previous symbol), create it if needed
+ * @param model
+ * @return the tree, NULL in case of error
+ */
+adh_tree_t * adh_model_get_context_tree(adh_model_t *model) {
+    adh_tree_t * tree = model->contexts[model->context];
+    if(tree == NULL) {
+        tree = adh_create_tree(SYMBOL_BITS);
+        if(tree != NULL && set_tree_batch(tree, model->batch) != RC_OK) {
+            adh_destroy_tree(tree);
+            tree = NULL;
+        }
+        model->contexts[model->context] = tree;
+    }
+    return tree;
+}
+
+/**
+ * Create a tree with a single node: the NYT
+ * @param symbol_bits: the tree stores symbols in [0..2^symbol_bits)
+ * @return the new tree, NULL in case of error
+ */
+adh_tree_t * adh_create_tree(int symbol_bits) {
+    ADH_DEBUG("adh_create_tree", "symbol_bits=%d\n", symbol_bits);
+
+    int num_symbols = 1 << symbol_bits;
+    int max_order = num_symbols * 2 + 1;
+    adh_tree_t * tree = adh_calloc(1, tree_size(num_symbols, max_order));
+    if(tree == NULL) {
+        log_error("adh_create_tree", "cannot allocate tree\n");
+        return NULL;
+    }
+
+    tree->num_symbols = (uint16_t)num_symbols;
+    tree->symbol_bits = (byte_t)symbol_bits;
+    tree->max_order = (adh_order_t)max_order;
+    tree->symbol_nodes = (adh_node_t **)&tree->nodes[max_order];
+    tree->next_order = tree->max_order;
+    tree->nyt = tree->root = create_nyt(tree);
+    tree->weight_limit = ADH_WEIGHT_LIMIT;
+    return tree;
+}
+
+/**
+ * bytes of the single allocation of a tree: the tree, the node pool, then symbol_nodes
+ * @param num_symbols
+ * @param max_order
+ * @return the size
+ */
+size_t tree_size(int num_symbols, int max_order) {
+    return sizeof(adh_tree_t) + max_order * sizeof(adh_node_t) + num_symbols * sizeof(adh_node_t *);
+}
 
-    if(node->left != NULL) {
-        destroy_node(node->left);
-        node->left = NULL;
+/**
+ * copy the tree with its nodes, the links between the nodes are moved to the copy
+ * @param tree
+ * @return the copy, NULL in case of error
+ */
+adh_tree_t * adh_copy_tree(const adh_tree_t *tree) {
+    size_t size = tree_size(tree->num_symbols, tree->max_order);
+    adh_tree_t * copy = adh_malloc(size);
+    if(copy == NULL) {
+        log_error("adh_copy_tree", "cannot allocate tree\n");
+        return NULL;
     }
 
-    if(node->right != NULL) {
-        destroy_node(node->right);
-        node->right = NULL;
+    memcpy(copy, tree, size);
+    copy->batch_size = 0;
+    copy->batch_pending = 0;
+    copy->batch_counts = NULL;
+    copy->lookup = NULL;
+    copy->lookup_score = 0;
+    copy->lookup_weight = 0;
+    copy->root = relocate_node(tree, copy, tree->root);
+    copy->nyt = relocate_node(tree, copy, tree->nyt);
+    copy->symbol_nodes = (adh_node_t **)&copy->nodes[copy->max_order];
+    for (int i = 0; i < copy->max_order; ++i) {
+        adh_node_t * node = &copy->nodes[i];
+        node->left = relocate_node(tree, copy, node->left);
+        node->right = relocate_node(tree, copy, node->right);
+        node->parent = relocate_node(tree, copy, node->parent);
+        node->hash_next = relocate_node(tree, copy, node->hash_next);
+        node->hash_prev = relocate_node(tree, copy, node->hash_prev);
+    }
+    for (int i = 0; i < copy->num_symbols; ++i) {
+        copy->symbol_nodes[i] = relocate_node(tree, copy, copy->symbol_nodes[i]);
+    }
+    for (int i = 0; i < HASH_BUCKETS; ++i) {
+        copy->buckets[i] = relocate_node(tree, copy, copy->buckets[i]);
     }
+    return copy;
+}
 
-    free(node);
+/**
+ * the node of the copy at the same place as node in the original
+ * @param from: original tree
+ * @param to: copy
+ * @param node: node of the original, may be NULL
+ * @return the node of the copy, NULL if node is NULL
+ */
+adh_node_t * relocate_node(const adh_tree_t *from, adh_tree_t *to, adh_node_t *node) {
+    if(node == NULL)
+        return NULL;
+    return (adh_node_t *)((byte_t *)to + ((const byte_t *)node - (const byte_t *)from));
+}
+
+/**
+ * Destroy the tree and all its nodes
+ * @param tree
+ */
+void adh_destroy_tree(adh_tree_t *tree) {
+    if(tree)
+        ADH_DEBUG("adh_destroy_tree", "\n");
+
+    // nodes are stored in the tree pool
+    if(tree) {
+        adh_free(tree->batch_counts);
+        adh_free(tree->lookup);
+    }
+    adh_free(tree);
 }
 
 /**
  * Create a new node and append it to the NYT (Not Yet Transmitted)
  * NB: this method must be used only for new symbols (not present in the tree)
+ * @param tree
  * @param symbol
  * @return the new node, NULL in case of error
  */
-adh_node_t * adh_create_node_and_append(adh_symbol_t symbol) {
-#ifdef _DEBUG
-    log_trace("    adh_create_node_and_append", "%s (1,%d)\n", fmt_symbol(symbol), adh_next_order);
-#endif
+adh_node_t * adh_create_node_and_append(adh_tree_t *tree, adh_symbol_t symbol) {
+    ADH_TRACE("    adh_create_node_and_append", "symbol=%lld (1,%lld)\n", symbol, tree->next_order);
 
     // IMPORTANT: right node must be created before left node because
-    //            create_node() decrease adh_next_order each time it's called
+    //            create_node() decrease next_order each time it's called
 
     // create right leaf node with passed symbol (and weight 1)
-    adh_node_t * newNode = create_node(symbol);
+    adh_node_t * newNode = create_node(tree, symbol);
     if(newNode) {
-        increase_weight(newNode);
-        newNode->parent = adh_nyt_node;
-        adh_nyt_node->right = newNode;
+        // the NYT leaf becomes an internal node: the codes through it are one bit longer
+        if(tree->lookup)
+            lookup_invalidate(tree, tree->nyt);
+
+        STATS_ADD(escapes, 1);
+        bitmap_set(tree->seen, symbol);
+        tree->num_seen++;
+        increase_weight(tree, newNode);
+        newNode->parent = tree->nyt;
+        tree->nyt->right = newNode;
 
         // create left leaf node with no symbol
-        adh_node_t * newNYT = create_nyt();
-        newNYT->parent = adh_nyt_node;
-        adh_nyt_node->left = newNYT;
+        adh_node_t * newNYT = create_nyt(tree);
+        newNYT->parent = tree->nyt;
+        tree->nyt->left = newNYT;
 
         // the new left node is the new NYT node
-        adh_nyt_node = newNYT;
+        tree->nyt = newNYT;
         // reset old NYT symbol, since is not a NYT anymore
         newNYT->parent->symbol = ADH_OLD_NYT_CODE;
-
-        update_node_encoding(newNode);  // update bit_array
-        update_node_encoding(newNYT);    // update bit_array
     }
     return newNode;
 }
 
 /**
  * create a new node with the NYT code
+ * @param tree
  * @return the new node
  */
-adh_node_t * create_nyt() {
-#ifdef _DEBUG
-    log_trace("    create_nyt", "%s (0,%d)\n", fmt_symbol(ADH_NYT_CODE), adh_next_order);
-#endif
+adh_node_t * create_nyt(adh_tree_t *tree) {
+    ADH_TRACE("    create_nyt", "NYT (0,%lld)\n", tree->next_order);
 
-    return create_node(ADH_NYT_CODE);
+    return create_node(tree, ADH_NYT_CODE);
 }
 
 /**
- * create a new node and initialize it
+ * take a new node from the tree pool and initialize it
+ * @param tree
  * @param symbol: the symbol that the node will store
  * @return the new node, NULL in case of error
  */
-adh_node_t * create_node(adh_symbol_t symbol) {
-    if(adh_next_order == 0) {
-        log_error("create_node", "unexpected new node creation, adh_next_order = 0, symbol = %d \n", symbol);
+adh_node_t * create_node(adh_tree_t *tree, adh_symbol_t symbol) {
+    if(tree->next_order == 0) {
+        log_error("create_node", "unexpected new node creation, next_order = 0, symbol = %d \n", symbol);
         return NULL;
     }
 
-#ifdef _DEBUG
-    log_trace("     create_node", "%s (0,%d)\n", fmt_symbol(symbol), adh_next_order);
-#endif
+    ADH_TRACE("     create_node", "symbol=%lld (0,%lld)\n", symbol, tree->next_order);
 
-    adh_node_t* node = malloc (sizeof(adh_node_t));
+    // nodes are taken from the pool in creation order
+    adh_node_t* node = &tree->nodes[tree->max_order - tree->next_order];
 
     // if the new node is a symbol node
-    // save its reference in the symbol_node_array to improve searches
+    // save its reference in the symbol_nodes to improve searches
     if(symbol > ADH_NYT_CODE)
-        symbol_node_array[symbol] = node;
+        tree->symbol_nodes[symbol] = node;
 
-    node->left = NULL;
-    node->right = NULL;
-    node->parent = NULL;
-    node->order = adh_next_order;
-    node->weight = 0;
+    memset(node, 0, sizeof(adh_node_t));
+    node->order = tree->next_order;
     node->symbol = symbol;
-    memset(&(node->bit_array), 0, sizeof(bit_array_t));
 
-    adh_next_order--;
+    tree->next_order--;
 
+    hash_add(tree, node);
     return node;
 }
 
 /**
  * search for a node with the given weight and an higher order
+ * @param tree
  * @param weight
  * @param order
  * @return a node that respect the given criteria. NULL if not found
  */
-adh_node_t * find_higher_order_same_weight(adh_weight_t weight, adh_order_t order) {
+adh_node_t * find_higher_order_same_weight(const adh_tree_t *tree, adh_weight_t weight, adh_order_t order) {
     // small optimization: only NYT and new nodes have weight 0
     // so they are already ordered, don't swap
     if(weight == 0)
         return NULL;
 
-    return hash_get_value(weight, order);
+    return hash_get_value(tree, weight, order);
 }
 
 /**
  * search a node that contains the given symbol
+ * @param tree
  * @param symbol
  * @return the node that respect the given criteria. NULL if not found
  */
-adh_node_t * adh_search_symbol_in_tree(adh_symbol_t symbol) {
-#ifdef _DEBUG
-    log_trace("  adh_search_symbol_in_tree", "%s\n", fmt_symbol(symbol));
-#endif
-    return symbol_node_array[symbol];
+adh_node_t * adh_search_symbol_in_tree(const adh_tree_t *tree, adh_symbol_t symbol) {
+    ADH_TRACE("  adh_search_symbol_in_tree", "symbol=%lld\n", symbol);
+    return tree->symbol_nodes[symbol];
 }
 
 /**
@@ -301,12 +615,8 @@ void swap_nodes(adh_node_t *node1, adh_node_t *node2){
         return;
     }
 
-#ifdef _DEBUG
-    char str1[MAX_SYMBOL_STR];
-    strcpy (str1,fmt_node(node1));
-
-    log_debug("    swap_nodes", "%s <-> %s\n", str1, fmt_node(node2));
-#endif
+    ADH_TRACE("    swap_nodes", "symbol=%lld order=%lld <-> symbol=%lld order=%lld\n",
+              node1->symbol, node1->order, node2->symbol, node2->order);
 
     bool is_node1_left = node1->parent->left == node1;
     bool is_node2_left = node2->parent->left == node2;
@@ -338,88 +648,367 @@ void swap_nodes(adh_node_t *node1, adh_node_t *node2){
     adh_order_t temp_order = node1->order;
     node1->order = node2->order;
     node2->order = temp_order;
-
-    update_node_encoding(node1);  // update bit_array
-    update_node_encoding(node2);  // update bit_array
 }
 
 /**
  * Update Tree, fix sibling property
+ * @param tree
  * @param node: the node that has been updated
  * @param is_new_node: true if node is new, false if node is not new.
  */
-void adh_update_tree(adh_node_t *node, bool is_new_node) {
-#ifdef _DEBUG
-    log_debug("  adh_update_tree", "%s is_new=%d\n",
-              fmt_node(node), is_new_node);
-#endif
+void adh_update_tree(adh_tree_t *tree, adh_node_t *node, bool is_new_node) {
+    ADH_TRACE("  adh_update_tree", "symbol=%lld order=%lld weight=%lld is_new=%lld\n",
+              node->symbol, node->order, node->weight, is_new_node);
+
+    uint64_t start = adh_timer_start(ADH_PHASE_MODEL);
+    if(stats_enabled)
+        stats_add_code(node, is_new_node);
+
+    // batched: the symbol is counted, the tree waits for the rebuild. A new leaf is inserted at once
+    if(tree->batch_size && !is_new_node) {
+        tree->batch_counts[node->symbol]++;
+        if(++tree->batch_pending >= tree->batch_size)
+            rebuild_tree(tree);
+        if(tree->root->weight >= tree->weight_limit)
+            halve_weights(tree);
+        adh_timer_stop(ADH_PHASE_MODEL, start);
+        return;
+    }
 
     // create node_to_check
     adh_node_t * node_to_check = is_new_node ? node->parent : node;
-    while(node_to_check != NULL && node_to_check != adh_root_node) {
+    while(node_to_check != NULL && node_to_check != tree->root) {
+        STATS_ADD(nodes_visited, 1);
+
         // search in tree node with same weight and higher order
-        adh_node_t * node_to_swap = find_higher_order_same_weight(node_to_check->weight,
+        adh_node_t * node_to_swap = find_higher_order_same_weight(tree,
+                                                                  node_to_check->weight,
                                                                   node_to_check->order);
 
 
         // if node_to_swap == NULL, then no swap is needed
         if (node_to_swap != NULL) {
-#ifdef _DEBUG
-            log_tree();
+#if ADH_LOG_LEVEL >= LOG_TRACE
+            log_tree(tree);
 #endif
+            STATS_ADD(swaps, 1);
             swap_nodes(node_to_check, node_to_swap);
+            if(tree->lookup) {
+                lookup_invalidate(tree, node_to_check);
+                lookup_invalidate(tree, node_to_swap);
+            }
         }
         // now we can safely update the weight of the node
-        increase_weight(node_to_check);
+        increase_weight(tree, node_to_check);
 
         // continue ascending the tree
         node_to_check = node_to_check->parent;
     }
 
-    increase_weight(node_to_check);
+    increase_weight(tree, node_to_check);
+    if(tree->batch_size && ++tree->batch_pending >= tree->batch_size)
+        rebuild_tree(tree);
+    if(tree->root->weight >= tree->weight_limit)
+        halve_weights(tree);
+    adh_timer_stop(ADH_PHASE_MODEL, start);
 
-#ifdef _DEBUG
-    log_tree();
+#if ADH_LOG_LEVEL >= LOG_TRACE
+    log_tree(tree);
 #endif
 }
 
 /**
- * calculate the encoded symbol of passed node and its children
- * fill bit_array from left (MSB) to right (LSB)
- * 0 = left node, 1 = right node
- * @param node
+ * halve the weights of the leaves, a seen symbol keeps a weight of at least 1, and rebuild the tree:
+ * the weights do not grow past the width of the format, and the old counts weigh less than the new ones
+ * @param tree
  */
-void update_node_encoding(adh_node_t *node) {
-    if(node != NULL) {
-        update_node_encoding(node->left);
-        update_node_encoding(node->right);
+void halve_weights(adh_tree_t *tree) {
+    for (int i = 0; i < tree->max_order - tree->next_order; ++i) {
+        adh_node_t * node = &tree->nodes[i];
+        if(node->left == NULL)
+            node->weight = (node->weight + 1) / 2;
+    }
+    tree->lookup_weight /= 2;
+    rebuild_tree(tree);
+}
 
-        bit_array_t* bit_array = &(node->bit_array);
-        bit_array->length = 0;
+/**
+ * add the batched counts to the leaves and rebuild the tree in a single pass: the leaves sorted by weight
+ * are merged two by two (Huffman), the merged nodes queued in creation order are already sorted.
+ * The internal nodes and their orders are reused: the nodes get the orders in the order they are merged,
+ * so that the tree keeps the sibling property for the next updates, and the hash table is rebuilt
+ * @param tree: batched, or not to only rebuild it from the weights of the leaves
+ */
+void rebuild_tree(adh_tree_t *tree) {
+    tree->batch_pending = 0;
+    int num_nodes = tree->max_order - tree->next_order;
+    if(num_nodes < 3)
+        return;
 
-        adh_node_t * parent = node->parent;
-        while(parent != NULL) {
-            if(bit_array->length == MAX_CODE_BITS) {
-                log_error("update_node_encoding", "bit_array->length == MAX_CODE_BITS");
+    // the nodes by order: the leaves come out sorted by their weights of the last rebuild,
+    // the insertion sort only moves those counted more in this batch. Equal weights stay by order
+    adh_node_t * by_order[2 * SEEN_WORDS * BITMAP_WORD_BITS + 1];
+    adh_node_t * leaves[SEEN_WORDS * BITMAP_WORD_BITS + 1];
+    adh_node_t * internals[SEEN_WORDS * BITMAP_WORD_BITS];
+    adh_node_t * relinked[SEEN_WORDS * BITMAP_WORD_BITS];
+    for (int i = 0; i < num_nodes; ++i) {
+        by_order[tree->nodes[i].order - tree->next_order - 1] = &tree->nodes[i];
+    }
 
-                //TODO: exit properly, need to release resources
-                exit(1);
-            }
+    int num_leaves = 0, num_internals = 0;
+    for (int i = 0; i < num_nodes; ++i) {
+        adh_node_t * node = by_order[i];
+        if(node->left != NULL) {
+            internals[num_internals++] = node;
+            continue;
+        }
+        if(node->symbol >= 0 && tree->batch_counts != NULL) {
+            node->weight += tree->batch_counts[node->symbol];
+            tree->batch_counts[node->symbol] = 0;
+        }
 
-            // 0 = left node, 1 = right node
-            bit_array->buffer[bit_array->length] = (parent->right == node) ? BIT_1 : BIT_0;
-            bit_array->length++;
+        int j = num_leaves++;
+        for (; j > 0 && leaves[j - 1]->weight > node->weight; --j) {
+            leaves[j] = leaves[j - 1];
+        }
+        leaves[j] = node;
+    }
 
-            node = parent;
-            parent = node->parent;
+    // the merged nodes are queued in internals, from head. On equal weights they come before the leaves:
+    // the parent of the NYT is not the last node of the weight of its other child, which could not swap with it
+    adh_node_t * old_root = tree->root;
+    adh_order_t order = tree->next_order;
+    int next_leaf = 0, head = 0, num_relinked = 0;
+    for (int i = 0; i < num_internals; ++i) {
+        adh_node_t * children[2];
+        for (int j = 0; j < 2; ++j) {
+            if(next_leaf < num_leaves && (head == i || leaves[next_leaf]->weight < internals[head]->weight))
+                children[j] = leaves[next_leaf++];
+            else
+                children[j] = internals[head++];
+            children[j]->order = ++order;
         }
 
-#ifdef _DEBUG
-        log_trace("  update_node_encoding", "%s bin=%s\n",
-                fmt_node(node),
-                fmt_bit_array(bit_array));
-#endif
+        adh_node_t * parent = internals[i];
+        if(parent->left != children[0] || parent->right != children[1])
+            relinked[num_relinked++] = parent;
+        parent->left = children[0];
+        parent->right = children[1];
+        parent->weight = children[0]->weight + children[1]->weight;
+        children[0]->parent = parent;
+        children[1]->parent = parent;
+    }
+
+    tree->root = internals[num_internals - 1];
+    tree->root->parent = NULL;
+    tree->root->order = ++order;
+
+    memset(tree->buckets, 0, sizeof(tree->buckets));
+    for (int i = 0; i < num_nodes; ++i) {
+        hash_add(tree, &tree->nodes[i]);
+    }
+
+    // the lookup entries walk the same nodes as before, except below the nodes with new children
+    if(tree->lookup && tree->root != old_root) {
+        memset(tree->lookup, 0, ADH_LOOKUP_SIZE * sizeof(uint16_t));
+    } else if(tree->lookup) {
+        for (int i = 0; i < num_relinked; ++i) {
+            lookup_invalidate(tree, relinked[i]);
+        }
+    }
+}
+
+/**
+ * allocate the lookup table of the tree, filled on demand by adh_lookup_fill.
+ * The table follows the tree: the entries through a node that moves are cleared, see lookup_invalidate
+ * @param tree
+ * @return RC_OK / RC_FAIL
+ */
+int adh_lookup_enable(adh_tree_t *tree) {
+    if(tree->lookup != NULL)
+        return RC_OK;
+
+    tree->lookup = adh_calloc(ADH_LOOKUP_SIZE, sizeof(uint16_t));
+    if(tree->lookup == NULL) {
+        log_error("adh_lookup_enable", "cannot allocate lookup table\n");
+        return RC_FAIL;
+    }
+    tree->lookup_score = 0;
+    return RC_OK;
+}
+
+/**
+ * free the lookup table of the tree, when it misses more than it saves: the entries through the nodes
+ * that keep moving are cleared as often as they are used. It is tried again once the root weight doubled
+ * @param tree
+ */
+void adh_lookup_disable(adh_tree_t *tree) {
+    adh_free(tree->lookup);
+    tree->lookup = NULL;
+    tree->lookup_score = 0;
+    tree->lookup_weight = 2 * tree->root->weight;
+}
+
+/**
+ * walk the tree from the root with the bits of the index, most significant first,
+ * until a leaf or ADH_LOOKUP_BITS levels, and store the entry
+ * @param tree: with a lookup table, the root is not a leaf
+ * @param index: the next ADH_LOOKUP_BITS input bits
+ * @return the entry
+ */
+uint16_t adh_lookup_fill(adh_tree_t *tree, uint32_t index) {
+    const adh_node_t * node = tree->root;
+    int bits = 0;
+    while(node->left != NULL && bits < ADH_LOOKUP_BITS) {
+        node = (index >> (ADH_LOOKUP_BITS - 1 - bits)) & 1 ? node->right : node->left;
+        bits++;
+    }
+
+    uint16_t entry = (uint16_t)((node - tree->nodes) << ADH_LOOKUP_LENGTH_BITS | bits);
+    tree->lookup[index] = entry;
+    return entry;
+}
+
+/**
+ * clear the lookup entries whose walk reaches the place of the node: the entries starting with its code,
+ * if the code is not longer than ADH_LOOKUP_BITS. Below, the entries stop at an ancestor which does not move
+ * @param tree
+ * @param node: swapped, or the NYT about to be split
+ */
+void lookup_invalidate(adh_tree_t *tree, const adh_node_t *node) {
+    uint32_t code = 0;
+    int depth = 0;
+    for (; node->parent != NULL; node = node->parent, ++depth) {
+        if(depth < ADH_LOOKUP_BITS && node->parent->right == node)
+            code |= 1u << depth;
+    }
+    if(depth > ADH_LOOKUP_BITS)
+        return;
+
+    int free_bits = ADH_LOOKUP_BITS - depth;
+    memset(&tree->lookup[code << free_bits], 0, (sizeof(uint16_t) << free_bits));
+}
+
+/**
+ * a compact escape is the index of the new symbol among the n symbols not yet seen, in truncated binary:
+ * with k = floor(log2(n)), the first 2^(k+1)-n indices take k bits, the others k+1 bits
+ * @param tree: at least a symbol not yet seen
+ * @param short_codes: number of indices coded with k bits
+ * @return k
+ */
+int escape_bits(const adh_tree_t *tree, uint32_t *short_codes) {
+    uint32_t unseen = (uint32_t)(tree->num_symbols - tree->num_seen);
+    int bits = floor_log2(unseen);
+    *short_codes = (2u << bits) - unseen;
+    return bits;
+}
+
+/**
+ * encoder: the bits following the NYT for a new symbol, its binary value using the symbol bits of the tree
+ * or, with compact escapes, its index among the symbols not yet seen
+ * @param tree
+ * @param flags: ADH_FLAG_*
+ * @param symbol: not yet seen in the tree
+ * @param bit_array
+ */
+void adh_escape_encode(const adh_tree_t *tree, byte_t flags, adh_symbol_t symbol, bit_array_t *bit_array) {
+    if(!(flags & ADH_FLAG_COMPACT_ESCAPE)) {
+        value_to_bits((uint32_t)symbol, tree->symbol_bits, bit_array);
+        return;
+    }
+
+    uint32_t short_codes;
+    int num_bits = escape_bits(tree, &short_codes);
+    uint32_t index = (uint32_t)(symbol - bitmap_rank(tree->seen, symbol));
+    if(index < short_codes)
+        value_to_bits(index, num_bits, bit_array);
+    else
+        value_to_bits(index + short_codes, num_bits + 1, bit_array);
+}
+
+/**
+ * decoder: read the bits following the NYT, the counterpart of adh_escape_encode
+ * @param tree
+ * @param flags: ADH_FLAG_*
+ * @param read_bits: called for each value, most significant bit first
+ * @param io_ctx: passed to read_bits
+ * @param symbol: the decoded symbol
+ * @return RC_OK / RC_FAIL
+ */
+int adh_escape_decode(const adh_tree_t *tree, byte_t flags, adh_read_bits_fn read_bits, void *io_ctx,
+                      adh_symbol_t *symbol) {
+    if(!(flags & ADH_FLAG_COMPACT_ESCAPE)) {
+        uint32_t value = 0;
+        int rc = read_bits(io_ctx, tree->symbol_bits, &value);
+        *symbol = (adh_symbol_t)value;
+        return rc;
+    }
+
+    if(tree->num_seen == tree->num_symbols) {
+        log_error("adh_escape_decode", "escape with all the symbols already seen\n");
+        return RC_FAIL;
+    }
 
+    // truncated binary: short codes have num_bits bits, the others one more
+    uint32_t short_codes;
+    int num_bits = escape_bits(tree, &short_codes);
+    uint32_t value = 0;
+    int rc = read_bits(io_ctx, num_bits, &value);
+    if(rc == RC_OK && value >= short_codes) {
+        uint32_t last_bit = 0;
+        rc = read_bits(io_ctx, 1, &last_bit);
+        value = ((value << 1) | last_bit) - short_codes;
+    }
+    if(rc != RC_OK)
+        return rc;
+
+    int index = bitmap_select_zero(tree->seen, (tree->num_symbols + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS, (int)value);
+    if(index < 0 || index >= tree->num_symbols) {
+        log_error("adh_escape_decode", "invalid escape index %u\n", value);
+        return RC_FAIL;
+    }
+    *symbol = (adh_symbol_t)index;
+    return RC_OK;
+}
+
+/**
+ * decoder: the width of the weights recorded in a stream of the trees must be the width of the format
+ * @param weight_bits
+ * @return RC_OK / RC_FAIL
+ */
+int adh_check_weight_bits(uint32_t weight_bits) {
+    if(weight_bits != ADH_FORMAT_WEIGHT_BITS) {
+        log_error("adh_check_weight_bits", "unsupported weights of %u bits\n", weight_bits);
+        return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * calculate the encoded symbol of the passed node
+ * fill bit_array from right (LSB, the leaf) to left (MSB, the root)
+ * 0 = left node, 1 = right node
+ * @param node
+ * @param bit_array
+ */
+void adh_get_node_encoding(const adh_node_t *node, bit_array_t *bit_array) {
+    bit_array->length = 0;
+
+    const adh_node_t * parent = node->parent;
+    while(parent != NULL) {
+        if(bit_array->length == MAX_CODE_BITS) {
+            log_error("adh_get_node_encoding", "bit_array->length == MAX_CODE_BITS");
+
+            //TODO: exit properly, need to release resources
+            exit(1);
+        }
+
+        // 0 = left node, 1 = right node
+        bit_array->buffer[bit_array->length] = (parent->right == node) ? BIT_1 : BIT_0;
+        bit_array->length++;
+
+        node = parent;
+        parent = node->parent;
     }
 }
 
@@ -429,9 +1018,7 @@ void update_node_encoding(adh_node_t *node) {
  * @return the level
  */
 int get_node_level(const adh_node_t *node) {
-#ifdef _DEBUG
-    log_trace("  get_node_level", "%s \n", fmt_node(node));
-#endif
+    ADH_TRACE("  get_node_level", "symbol=%lld order=%lld\n", node->symbol, node->order);
 
     int level = 0;
     adh_node_t * parent = node->parent;
@@ -443,45 +1030,272 @@ int get_node_level(const adh_node_t *node) {
 }
 
 /**
- * search for a leaf node that is represented by the given bit array
- * @param bit_array
- * @return the node if found, NULL otherwise
+ * increase the weight of the given node and update the hashing table
+ * @param tree
+ * @param node
+ */
+void increase_weight(adh_tree_t *tree, adh_node_t *node) {
+    if(node == NULL)
+        return;
+
+    hash_remove(tree, node);
+    node->weight++;
+    hash_add(tree, node);
+}
+
+/**
+ * turn the hot path counters and the phase timers on or off
+ * @param what: ADH_STATS_COUNTERS, ADH_STATS_TIMERS, both or 0
  */
-adh_node_t* adh_search_leaf_by_encoding(const bit_array_t *bit_array) {
-    adh_node_t* nextNode = adh_root_node;
-    for(int i = bit_array->length-1; i >= 0 && nextNode; i--) {
-        if(bit_array->buffer[i] == BIT_1) {
-            nextNode = nextNode->right;
-        } else
-            nextNode = nextNode->left;
+void adh_stats_enable(int what) {
+    stats_enabled = (what & ADH_STATS_COUNTERS) != 0;
+    timers_enabled = (what & ADH_STATS_TIMERS) != 0;
+    if(timers_enabled && calibration_ns == 0) {
+        calibration_ticks = timer_ticks();
+        calibration_ns = timer_ns();
+
+        timer_overhead = UINT64_MAX;
+        for (int i = 0; i < 64; ++i) {
+            uint64_t start = timer_ticks();
+            uint64_t elapsed = timer_ticks() - start;
+            if(elapsed < timer_overhead)
+                timer_overhead = elapsed;
+        }
     }
+}
 
-    // if it's a leaf return it
-    if(nextNode && nextNode->right == NULL && nextNode->left == NULL)
-        return nextNode;
+/**
+ * set all the counters and timers to zero
+ */
+void adh_stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+    calibration_ticks = timer_ticks();
+    calibration_ns = timer_ns();
+}
 
-    return NULL;
+/**
+ * @return the counters and timers collected since the last reset
+ */
+const adh_stats_t * adh_stats_get(void) {
+    // ticks to seconds, with the clock elapsed since the reset
+    uint64_t elapsed_ticks = timer_ticks() - calibration_ticks;
+    uint64_t elapsed_ns = timer_ns() - calibration_ns;
+    double seconds_per_tick = elapsed_ticks > 0 ? elapsed_ns / 1e9 / elapsed_ticks : 0;
+    for (int i = 0; i < ADH_PHASE_COUNT; ++i) {
+        stats.phase_seconds[i] = stats.phase_ticks[i] * seconds_per_tick;
+    }
+    return &stats;
 }
 
 /**
- * increase the weight of the given node and update the hashing table
- * @param node
+ * @param phase
+ * @return true if the phase runs once per symbol: it is sampled to keep the overhead low
  */
-void increase_weight(adh_node_t *node) {
-    if(node == NULL)
+static inline bool timer_is_sampled(adh_phase_t phase) {
+    return phase == ADH_PHASE_MODEL || phase == ADH_PHASE_BITS;
+}
+
+/**
+ * @param phase
+ * @return the start time of the phase, 0 if the timers are disabled or the call is not sampled
+ */
+uint64_t adh_timer_start(adh_phase_t phase) {
+    if(!timers_enabled)
+        return 0;
+    if(timer_is_sampled(phase) && ++timer_calls[phase] % TIMER_SAMPLE_PERIOD != 0)
+        return 0;
+    return timer_ticks();
+}
+
+/**
+ * add the time elapsed since start to the phase, scaled by the sample period for the sampled phases
+ * @param phase
+ * @param start: returned by adh_timer_start
+ */
+void adh_timer_stop(adh_phase_t phase, uint64_t start) {
+    if(start == 0)
         return;
 
-    hash_entry_t* entry = hash_detach_entry(node);
-    node->weight++;
-    hash_add(node, entry);
+    uint64_t elapsed = timer_ticks() - start;
+    elapsed = elapsed > timer_overhead ? elapsed - timer_overhead : 0;
+    stats.phase_ticks[phase] += timer_is_sampled(phase) ? elapsed * TIMER_SAMPLE_PERIOD : elapsed;
+}
+
+/**
+ * register the progress callback of the streams, called when every_bytes input bytes
+ * or every_ms milliseconds have passed since the previous call, then once at the end of the stream
+ * the time is checked at each buffer read or written, a few KB
+ * @param callback: NULL to remove it
+ * @param ctx: passed back to the callback
+ * @param every_bytes: 0 = not by size
+ * @param every_ms: 0 = not by time
+ */
+void adh_set_progress(adh_progress_fn callback, void *ctx, uint64_t every_bytes, uint32_t every_ms) {
+    progress_callback = callback;
+    progress_ctx = ctx;
+    progress_every_bytes = every_bytes;
+    progress_every_ns = every_ms * 1000000ull;
+}
+
+/**
+ * @return true if the callback cancelled the last stream
+ */
+bool adh_progress_cancelled(void) {
+    return progress_cancelled;
+}
+
+/**
+ * start counting the bytes of a new stream
+ */
+void adh_progress_start(void) {
+    memset(&progress, 0, sizeof(progress));
+    progress_cancelled = false;
+    progress_last_bytes = 0;
+    if(progress_callback)
+        progress_start_ns = progress_last_ns = timer_ns();
+}
+
+/**
+ * count the bytes read and written, call the callback when it is due
+ * @param bytes_in
+ * @param bytes_out
+ * @return RC_OK, RC_FAIL if the callback cancelled the stream
+ */
+int adh_progress_update(uint64_t bytes_in, uint64_t bytes_out) {
+    progress.bytes_in += bytes_in;
+    progress.bytes_out += bytes_out;
+    if(progress_callback == NULL)
+        return RC_OK;
+
+    bool due = progress_every_bytes > 0 && progress.bytes_in - progress_last_bytes >= progress_every_bytes;
+    uint64_t now_ns = due || progress_every_ns > 0 ? timer_ns() : 0;
+    if(!due && (progress_every_ns == 0 || now_ns - progress_last_ns < progress_every_ns))
+        return RC_OK;
+
+    if(progress_call(now_ns) != ADH_PROGRESS_CONTINUE) {
+        log_info("adh_progress_update", "cancelled after %" PRIu64 " bytes\n", progress.bytes_in);
+        progress_cancelled = true;
+        return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * last call of the callback, with the totals of the stream
+ */
+void adh_progress_end(void) {
+    if(progress_callback == NULL)
+        return;
+
+    progress.done = true;
+    progress_call(timer_ns());
 }
 
+/**
+ * fill the times and call the callback
+ * @param now_ns
+ * @return the callback result
+ */
+int progress_call(uint64_t now_ns) {
+    double interval = (now_ns - progress_last_ns) / 1e9;
+    progress.seconds = (now_ns - progress_start_ns) / 1e9;
+    progress.mbps = interval > 0 ? (progress.bytes_in - progress_last_bytes) / interval / 1e6 : 0;
+    progress_last_ns = now_ns;
+    progress_last_bytes = progress.bytes_in;
+    return progress_callback(progress_ctx, &progress);
+}
+
+/**
+ * @return time stamp counter where available (a few cycles to read), otherwise nanoseconds
+ */
+uint64_t timer_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return timer_ns();
+#endif
+}
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+uint64_t timer_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * count the code of the symbol being coded: the depth of its leaf, or of the NYT for a new symbol
+ * @param node
+ * @param is_new_node
+ */
+void stats_add_code(const adh_node_t *node, bool is_new_node) {
+    uint32_t depth = 0;
+    for (const adh_node_t * parent = node->parent; parent != NULL; parent = parent->parent) {
+        depth++;
+    }
+
+    stats.symbols++;
+    if(depth > stats.max_depth)
+        stats.max_depth = depth;
+
+    // a new leaf is one level below the NYT that was coded
+    uint32_t length = is_new_node ? depth - 1 : depth;
+    stats.code_lengths[length < ADH_STATS_MAX_LENGTH ? length : ADH_STATS_MAX_LENGTH - 1]++;
+}
+
+/**
+ * print the counters and the averages per symbol
+ * @param fp
+ */
+void adh_stats_print(FILE *fp) {
+    double symbols = stats.symbols ? (double)stats.symbols : 1;
+    double lookups = stats.hash_lookups ? (double)stats.hash_lookups : 1;
+
+    fprintf(fp, "symbols            %" PRIu64 "\n", stats.symbols);
+    fprintf(fp, "escapes (NYT)      %" PRIu64 "\n", stats.escapes);
+    fprintf(fp, "swaps              %" PRIu64 " (%.3f per symbol)\n", stats.swaps, stats.swaps / symbols);
+    fprintf(fp, "nodes visited      %" PRIu64 " (%.3f per symbol)\n", stats.nodes_visited, stats.nodes_visited / symbols);
+    fprintf(fp, "hash lookups       %" PRIu64 ", chain length avg %.3f max %u, collisions %" PRIu64 "\n",
+            stats.hash_lookups, stats.hash_probes / lookups, stats.max_hash_chain, stats.hash_collisions);
+    fprintf(fp, "max tree depth     %u\n", stats.max_depth);
+
+    uint64_t total_bits = 0;
+    for (int i = 0; i < ADH_STATS_MAX_LENGTH; ++i) {
+        total_bits += stats.code_lengths[i] * (uint64_t)i;
+    }
+    fprintf(fp, "code length        avg %.3f bits\n", total_bits / symbols);
+    for (int i = 0; i < ADH_STATS_MAX_LENGTH; ++i) {
+        if(stats.code_lengths[i] > 0)
+            fprintf(fp, "  %2d%s bits        %" PRIu64 "\n", i, i == ADH_STATS_MAX_LENGTH - 1 ? "+" : " ",
+                    stats.code_lengths[i]);
+    }
+
+    // what is not in a phase: tree search and encoding, filters, LZ77 matching, range coding
+    static const char * PHASE_NAMES[ADH_PHASE_STREAM] = { "read", "model", "bits", "write" };
+    adh_stats_get();
+    double stream = stats.phase_seconds[ADH_PHASE_STREAM] > 0 ? stats.phase_seconds[ADH_PHASE_STREAM] : 1;
+    double other = stats.phase_seconds[ADH_PHASE_STREAM];
+    fprintf(fp, "time               %.6f s\n", stats.phase_seconds[ADH_PHASE_STREAM]);
+    for (int i = 0; i < ADH_PHASE_STREAM; ++i) {
+        fprintf(fp, "  %-16s %.6f s (%5.1f%%)\n", PHASE_NAMES[i], stats.phase_seconds[i],
+                100.0 * stats.phase_seconds[i] / stream);
+        other -= stats.phase_seconds[i];
+    }
+    // model and bits are sampled estimates, their sum may slightly exceed the stream time
+    if(other < 0)
+        other = 0;
+    fprintf(fp, "  %-16s %.6f s (%5.1f%%)\n", "other", other, 100.0 * other / stream);
+    adh_memory_print(fp);
+}
 
 /**
  * print in a nice way the current status of the tree (DEBUG purpose)
+ * @param tree
  */
-void print_tree() {
-    print_sub_tree(adh_root_node, 0);
+void print_tree(const adh_tree_t *tree) {
+    print_sub_tree(tree->root, 0);
     fprintf(stdout, "\n");
 }
 
@@ -495,7 +1309,7 @@ void print_sub_tree(const adh_node_t *node, int depth)
     if(node==NULL)
         return;
 
-    static int nodes[MAX_ORDER];
+    static int nodes[MAX_CODE_BITS+1];
     printf("  ");
 
     // unicode chars for box drawing (doesn't work well under windows CLion)
@@ -507,7 +1321,9 @@ void print_sub_tree(const adh_node_t *node, int depth)
             printf("%s       ", nodes[i] ? "|" : " ");
     }
 
-    printf("%s  %s\n", fmt_node(node), fmt_bit_array(&(node->bit_array)));
+    bit_array_t bit_array;
+    adh_get_node_encoding(node, &bit_array);
+    printf("%s  %s\n", fmt_node(node, FMT_BUFFER), fmt_bit_array(&bit_array, FMT_BUFFER));
 
     nodes[depth]=1;
     print_sub_tree(node->left, depth + 1);
@@ -525,134 +1341,96 @@ inline unsigned int hash_get_index(adh_weight_t weight) {
 }
 
 /**
- * initialize the hash table
- */
-void hash_init() {
-    map_weight_nodes.length = HASH_BUCKETS;
-    //moved to stack with fixed size
-    //map_weight_nodes.buckets = calloc(HASH_BUCKETS, HASH_BUCKETS * sizeof(map_weight_nodes.buckets));
-    memset(&map_weight_nodes.buckets, 0, sizeof(map_weight_nodes.buckets));
-}
-
-/**
- * release resources used by the hash table
- */
-void hash_release() {
-    for (int i = 0; i < map_weight_nodes.length; ++i) {
-        hash_entry_t  *entry = map_weight_nodes.buckets[i];
-        while(entry) {
-            hash_entry_t  *next = entry->next;
-            free(entry);
-            entry = next;
-        }
-    }
-    //moved to stack with fixed size
-    //free(map_weight_nodes.buckets);
-
-#ifdef _DEBUG
-    fprintf(stdout, "total number of collision: %ld\n", collision);
-    collision = 0;
-#endif
-}
-
-/**
- * detach the entry storing the given node, so we can reuse it in the next hash_add
+ * remove the node from its hash bucket
+ * @param tree
  * @param node: a node that was previously added to the hash table
- * @return the entry or NULL if the node is not stored in the hash table.
  */
-hash_entry_t* hash_detach_entry(adh_node_t *node) {
-    int hash_index = hash_get_index(node->weight);
-
-    hash_entry_t  *entry = map_weight_nodes.buckets[hash_index];
-    while(entry) {
-        if(entry->value == node) {
-            if(entry->prev == NULL) {
-                map_weight_nodes.buckets[hash_index] = entry->next;
-            }
-            else {
-                entry->prev->next = entry->next;
-            }
+void hash_remove(adh_tree_t *tree, adh_node_t *node) {
+    if(node->hash_prev == NULL) {
+        tree->buckets[hash_get_index(node->weight)] = node->hash_next;
+    }
+    else {
+        node->hash_prev->hash_next = node->hash_next;
+    }
 
-            if(entry->next)
-                entry->next->prev = entry->prev;
+    if(node->hash_next)
+        node->hash_next->hash_prev = node->hash_prev;
 
-            entry->prev = NULL;
-            entry->next = NULL;
-            return entry;
-        }
-        entry = entry->next;
-    }
-    return NULL;
+    node->hash_prev = NULL;
+    node->hash_next = NULL;
 }
 
 /**
  * add the node in the hash table.
  * the key will be the node weight, the value will be the node
+ * @param tree
  * @param node: the value of the hash table
- * @param entry: if NULL a new entry wil be created. if provided it will reuse it
  */
-void hash_add(adh_node_t* node, hash_entry_t *entry){
-    int hash_index = hash_get_index(node->weight);
+void hash_add(adh_tree_t *tree, adh_node_t *node){
+    unsigned int hash_index = hash_get_index(node->weight);
 
-    hash_entry_t  *new_entry = entry != NULL ? entry : calloc(1, sizeof(hash_entry_t));
-    new_entry->value = node;
+    adh_node_t *first = tree->buckets[hash_index];
+    node->hash_prev = NULL;
+    node->hash_next = first;
+    if(first != NULL)
+        first->hash_prev = node;
 
-    hash_entry_t  *last = map_weight_nodes.buckets[hash_index];
-    if(last == NULL) {
-        map_weight_nodes.buckets[hash_index] = new_entry;
-    }
-    else {
-        while(last->next) {
-            last = last->next;
-        }
-
-        last->next = new_entry;
-        new_entry->prev = last;
-    }
+    tree->buckets[hash_index] = node;
 }
 
 /**
  * search in the hash table, a node with given weight and a higher order (skip root)
+ * @param tree
  * @param weight
  * @param order
  * @return the node that respects the criteria. otherwise NULL
  */
-adh_node_t* hash_get_value(adh_weight_t weight, adh_order_t order) {
+adh_node_t* hash_get_value(const adh_tree_t *tree, adh_weight_t weight, adh_order_t order) {
     adh_node_t* node_result = NULL;
     int hash_index = hash_get_index(weight);
-    hash_entry_t* entry = map_weight_nodes.buckets[hash_index];
-    while(entry) {
-        adh_node_t* current_node = entry->value;
-
+    adh_node_t* current_node = tree->buckets[hash_index];
+    uint32_t chain = 0;
+    while(current_node) {
+        chain++;
         if(current_node->weight != weight) {
+            STATS_ADD(hash_collisions, 1);
 #ifdef _DEBUG
             collision++;
-            hash_check_collision(weight, hash_index, current_node);
+            hash_check_collision(tree, weight, hash_index, current_node);
 #endif
         }
-        else if(current_node->order > order && current_node != adh_root_node) {
+        else if(current_node->order > order && current_node != tree->root) {
             node_result = current_node;
             order = node_result->order;
         }
-        entry = entry->next;
+        current_node = current_node->hash_next;
+    }
+
+    if(stats_enabled) {
+        stats.hash_lookups++;
+        stats.hash_probes += chain;
+        if(chain > stats.max_hash_chain)
+            stats.max_hash_chain = chain;
     }
     return node_result;
 }
 
 /**
  * utility function to log number of collisions (only DEBUG purpose)
+ * @param tree
  * @param weight
  * @param hash_index
  * @param node
  */
-void hash_check_collision(adh_weight_t weight, int hash_index, const adh_node_t *node) {
+void hash_check_collision(const adh_tree_t *tree, adh_weight_t weight, int hash_index, const adh_node_t *node) {
     if(node->weight != weight) {
         int size = 0;
-        hash_entry_t* he = map_weight_nodes.buckets[hash_index];
+        adh_node_t* he = tree->buckets[hash_index];
         while(he != NULL) {
             size++;
-            he = he->next;
+            he = he->hash_next;
         }
-        log_info("hash_check_collision", "collision, size:%d w1:%d w2:%d\n", size, weight, node->weight);
+        log_info("hash_check_collision", "collision, size:%d w1:%" PRIu64 " w2:%" PRIu64 "\n", size,
+                 (uint64_t)weight, (uint64_t)node->weight);
     }
 }
@@ -5,9 +5,44 @@
 
 enum {
     HEADER_BITS         = 3,
-    HEADER_DATA_BITS    = 5
+    HEADER_DATA_BITS    = 5,
+    FLAGS_BYTES         = 1,    // format flags, stored before the bit stream
+    ADH_MAX_SYMBOLS     = 256,  // number of byte symbols
+    MAX_ORDER           = ADH_MAX_SYMBOLS*2+1, //513, max number of nodes in a byte tree
+    HASH_BUCKETS        = 251,  // prime number, close to the number of internal nodes
+    SEEN_WORDS          = 2 * ADH_MAX_SYMBOLS / BITMAP_WORD_BITS   // up to 512 symbols (LZ77 literal/length tree)
 };
 
+/*
+ * Format flags (first byte of compressed file)
+ */
+enum {
+    ADH_FLAG_ORDER1     = 0x01, // one tree per preceding byte, escape to order-0 tree
+    ADH_FLAG_BWT        = 0x02, // blocks filtered with BWT, move-to-front and zero-run coding
+    ADH_FLAG_LZ77       = 0x04, // literals and (length, distance) matches, see adhuff_lz77.h
+    ADH_FLAG_RANGE      = 0x08, // range coder with frequency models instead of the trees, see adhuff_range.h
+    ADH_FLAG_COMPACT_ESCAPE = 0x10, // a new symbol is coded as its index among the symbols not yet seen
+    ADH_FLAG_INTERLEAVED = 0x20,    // bytes coded round-robin by independent lanes, see adhuff_interleave.h
+    ADH_FLAG_BATCHED    = 0x40,     // the trees are rebuilt every batch of symbols instead of updated after each one
+    ADH_FLAG_STATIC     = 0x80      // canonical codes built from the counts of each block, see adhuff_static.h
+};
+
+/*
+ * batched updates: the batch size is the next field of the bit stream (ADH_BATCH_BITS, size - 1)
+ */
+enum {
+    ADH_BATCH_BITS      = 16,
+    ADH_BATCH_MAX       = 1 << ADH_BATCH_BITS,
+    ADH_BATCH_DEFAULT   = 1024
+};
+
+/*
+ * priming (adh_set_priming): the byte streams of the trees (not LZ77, range, interleaved or static)
+ * start with a bit set if the order-0 tree was primed, followed by the fingerprint of the sample (ADH_PRIMING_BITS)
+ */
+enum {
+    ADH_PRIMING_BITS    = 32
+};
 
 /*
  * Header of compressed file
@@ -34,38 +69,230 @@ typedef union
  */
 typedef int16_t     adh_symbol_t;
 typedef uint16_t    adh_order_t;
+
+/*
+ * build time width of the node weights: 64 (default) or 32 bits, both code the same streams.
+ * The root weight is the number of symbols coded by the tree: when it reaches ADH_WEIGHT_LIMIT the leaf weights
+ * are halved and the tree rebuilt, leaving room for a batch, so that the weights always fit ADH_FORMAT_WEIGHT_BITS.
+ * The streams of the trees record ADH_FORMAT_WEIGHT_BITS (ADH_WEIGHT_FIELD_BITS) and the decoders check it
+ */
+enum {
+    ADH_FORMAT_WEIGHT_BITS  = 32,
+    ADH_WEIGHT_FIELD_BITS   = 8
+};
+
+#ifndef ADH_WEIGHT_BITS
+#define ADH_WEIGHT_BITS     64
+#endif
+
+#if ADH_WEIGHT_BITS == 64
+typedef uint64_t    adh_weight_t;
+#elif ADH_WEIGHT_BITS == 32
 typedef uint32_t    adh_weight_t;
+#else
+#error "ADH_WEIGHT_BITS must be 32 or 64"
+#endif
+
+#define ADH_WEIGHT_LIMIT    ((adh_weight_t)1 << (ADH_FORMAT_WEIGHT_BITS - 1))
+
+/*
+ * build time width of the decoder lookup tables [8..12]: the next ADH_LOOKUP_BITS input bits index a table
+ * of the tree giving the leaf they reach, or the node at that depth to continue from, in one step.
+ * The format does not depend on it
+ */
+#ifndef ADH_LOOKUP_BITS
+#define ADH_LOOKUP_BITS     10
+#endif
+
+#if ADH_LOOKUP_BITS < 8 || ADH_LOOKUP_BITS > 12
+#error "ADH_LOOKUP_BITS must be in [8..12]"
+#endif
+
+/*
+ * lookup table entry: index of the node in the pool << ADH_LOOKUP_LENGTH_BITS | bits consumed, 0 = not filled
+ */
+enum {
+    ADH_LOOKUP_SIZE         = 1 << ADH_LOOKUP_BITS,
+    ADH_LOOKUP_LENGTH_BITS  = 4,
+    ADH_LOOKUP_LENGTH_MASK  = (1 << ADH_LOOKUP_LENGTH_BITS) - 1
+};
 
 /*
  * adh_node_t struct
+ * the encoding is not stored in the node, it is calculated on demand walking up to the root
  */
 typedef struct adh_node {
-    adh_symbol_t        symbol;
     adh_weight_t        weight;
+    adh_symbol_t        symbol;
     adh_order_t         order;
     struct adh_node *   left;
     struct adh_node *   right;
     struct adh_node *   parent;
-    bit_array_t         bit_array;
+    struct adh_node *   hash_next;  // next node in the same hash bucket
+    struct adh_node *   hash_prev;  // previous node in the same hash bucket
 } adh_node_t;
 
+/*
+ * adh_tree_t struct
+ * a tree and all its nodes live in a single allocation,
+ * so that switching between trees touches few cache lines
+ */
+typedef struct {
+    uint16_t            num_symbols;                    // symbols in [0..num_symbols)
+    byte_t              symbol_bits;                    // bits of a new symbol, after the NYT
+    adh_order_t         max_order;                      // max number of nodes
+    adh_order_t         next_order;
+    adh_node_t *        root;
+    adh_node_t *        nyt;
+    adh_weight_t        weight_limit;                   // root weight at which the weights are halved, ADH_WEIGHT_LIMIT
+    uint32_t            batch_size;                     // symbols between two rebuilds, 0 = updated after each symbol
+    uint32_t            batch_pending;                  // symbols coded since the last rebuild
+    uint32_t *          batch_counts;                   // occurrences of each symbol since the last rebuild
+    uint16_t *          lookup;                         // decoder lookup table (ADH_LOOKUP_SIZE entries), NULL if unused
+    int32_t             lookup_score;                   // decoder: hits less the cost of the misses of the table
+    adh_weight_t        lookup_weight;                  // decoder: root weight before which the table is not tried again
+    adh_node_t **       symbol_nodes;                   // leaf of each symbol, NULL if not yet seen
+    uint16_t            num_seen;
+    uint64_t            seen[SEEN_WORDS];               // bitmap of the symbols in the tree
+    adh_node_t *        buckets[HASH_BUCKETS];          // nodes hashed by weight
+    adh_node_t          nodes[];                        // node pool (max_order), then symbol_nodes
+} adh_tree_t;
+
+/*
+ * adh_model_t struct
+ * order-0: a single tree
+ * order-1: a tree for each preceding byte, created on first use.
+ *          a symbol not yet seen in the context escapes (NYT) to the order-0 tree
+ * lz77:    order-0 tree of literals and match lengths, a tree of distance slots
+ */
+typedef struct {
+    byte_t              flags;
+    byte_t              context;                        // previous symbol
+    adh_tree_t *        order0;
+    adh_tree_t *        contexts[ADH_MAX_SYMBOLS];
+    adh_tree_t *        distances;
+    uint32_t            batch;                          // batch size of the trees, 0 = not batched
+} adh_model_t;
+
+/*
+ * compression options
+ */
+typedef struct {
+    byte_t              flags;                          // ADH_FLAG_*
+    int                 level;                          // LZ77 match search effort [1..9], 0 = default
+    int                 lanes;                          // interleaved lanes [1..INTERLEAVE_MAX_LANES], 0 = default
+    int                 batch;                          // batched symbols [1..ADH_BATCH_MAX], 0 = ADH_BATCH_DEFAULT
+} adh_options_t;
+
+/*
+ * hot path counters of the tree engine and phase timers, updated only when enabled (adh_stats_enable)
+ */
+enum {
+    ADH_STATS_MAX_LENGTH = 64,  // buckets of the code length histogram
+    ADH_STATS_COUNTERS  = 0x01,
+    ADH_STATS_TIMERS    = 0x02,
+    ADH_STATS_ALL       = ADH_STATS_COUNTERS | ADH_STATS_TIMERS
+};
+
+/*
+ * timed phases of compression and decompression, the stream phase is the whole call
+ */
+typedef enum {
+    ADH_PHASE_READ = 0,                                 // input file reads
+    ADH_PHASE_MODEL,                                    // adh_update_tree
+    ADH_PHASE_BITS,                                     // bit packing (compress) / tree walk and bit reads (decompress)
+    ADH_PHASE_WRITE,                                    // output file writes
+    ADH_PHASE_STREAM,
+    ADH_PHASE_COUNT
+} adh_phase_t;
+
+typedef struct {
+    uint64_t            symbols;                        // tree updates, one per symbol coded in a tree
+    uint64_t            escapes;                        // NYT escapes (new symbols)
+    uint64_t            swaps;
+    uint64_t            nodes_visited;                  // nodes walked up in adh_update_tree
+    uint64_t            hash_lookups;
+    uint64_t            hash_probes;                    // nodes walked in the hash chains
+    uint64_t            hash_collisions;                // probed nodes with a different weight
+    uint32_t            max_hash_chain;
+    uint32_t            max_depth;                      // deepest leaf coded
+    uint64_t            code_lengths[ADH_STATS_MAX_LENGTH]; // NYT code for escapes, last bucket = longer codes
+    uint64_t            phase_ticks[ADH_PHASE_COUNT];   // TSC cycles, or nanoseconds without TSC
+    double              phase_seconds[ADH_PHASE_COUNT]; // converted by adh_stats_get
+} adh_stats_t;
+
+/*
+ * progress of the current stream, passed to the progress callback
+ */
+typedef struct {
+    uint64_t            bytes_in;                       // read from the input stream
+    uint64_t            bytes_out;                      // written to the output stream
+    double              seconds;                        // since the start of the stream
+    double              mbps;                           // input MB/s since the previous call
+    bool                done;                           // last call, the stream is complete
+} adh_progress_t;
+
+enum {
+    ADH_PROGRESS_CONTINUE = 0,
+    ADH_PROGRESS_CANCEL = 1                             // the coder stops and fails, the return value of a done call is ignored
+};
+
+typedef int (*adh_progress_fn)(void *ctx, const adh_progress_t *progress);
+typedef int (*adh_read_bits_fn)(void *ctx, int num_bits, uint32_t *value);
+
 static const adh_symbol_t   ADH_NYT_CODE = -1;
 static const adh_symbol_t   ADH_OLD_NYT_CODE = -2;
 
-void            adh_release(FILE *output_file_ptr, FILE *input_file_ptr);
+int             adh_release(FILE *output_file_ptr, FILE *input_file_ptr);
+int             adh_parse_option(const char *arg, adh_options_t *options);
 int             adh_init(const char input_file_name[],
                          const char output_file_name[],
                          FILE **output_file_ptr,
                          FILE **input_file_ptr);
-adh_node_t*     get_nyt();
-void            adh_update_tree(adh_node_t *node, bool is_new_node);
-adh_node_t *    adh_search_leaf_by_encoding(const bit_array_t *bit_array);
-adh_node_t *    adh_search_symbol_in_tree(adh_symbol_t symbol);
-adh_node_t *    adh_create_node_and_append(adh_symbol_t symbol);
+void            adh_set_pipelined(bool enabled);
+void            adh_set_io_uring(bool enabled);
+FILE *          adh_pipe_read(FILE *file);
+FILE *          adh_pipe_write(FILE *file);
+
+adh_tree_t *    adh_create_tree(int symbol_bits);
+void            adh_destroy_tree(adh_tree_t *tree);
+adh_tree_t *    adh_copy_tree(const adh_tree_t *tree);
+void            adh_update_tree(adh_tree_t *tree, adh_node_t *node, bool is_new_node);
+adh_node_t *    adh_search_symbol_in_tree(const adh_tree_t *tree, adh_symbol_t symbol);
+adh_node_t *    adh_create_node_and_append(adh_tree_t *tree, adh_symbol_t symbol);
+int             adh_lookup_enable(adh_tree_t *tree);
+void            adh_lookup_disable(adh_tree_t *tree);
+uint16_t        adh_lookup_fill(adh_tree_t *tree, uint32_t index);
+void            adh_get_node_encoding(const adh_node_t *node, bit_array_t *bit_array);
+void            adh_escape_encode(const adh_tree_t *tree, byte_t flags, adh_symbol_t symbol, bit_array_t *bit_array);
+int             adh_escape_decode(const adh_tree_t *tree, byte_t flags, adh_read_bits_fn read_bits, void *io_ctx,
+                                  adh_symbol_t *symbol);
+int             adh_check_weight_bits(uint32_t weight_bits);
+
+int             adh_model_init(adh_model_t *model, byte_t flags);
+int             adh_model_set_batch(adh_model_t *model, uint32_t batch);
+void            adh_model_release(adh_model_t *model);
+adh_tree_t *    adh_model_get_context_tree(adh_model_t *model);
+int             adh_set_priming(const byte_t *data, size_t length);
+bool            adh_priming_recorded(byte_t flags);
+bool            adh_priming_get(uint32_t *fingerprint);
+int             adh_model_set_primed(adh_model_t *model, bool primed, uint32_t fingerprint);
+
+void            adh_stats_enable(int what);
+void            adh_stats_reset(void);
+const adh_stats_t * adh_stats_get(void);
+void            adh_stats_print(FILE *fp);
+uint64_t        adh_timer_start(adh_phase_t phase);
+void            adh_timer_stop(adh_phase_t phase, uint64_t start);
+
+void            adh_set_progress(adh_progress_fn callback, void *ctx, uint64_t every_bytes, uint32_t every_ms);
+bool            adh_progress_cancelled(void);
+void            adh_progress_start(void);
+int             adh_progress_update(uint64_t bytes_in, uint64_t bytes_out);
+void            adh_progress_end(void);
 
 // debugging methods
 void            print_sub_tree(const adh_node_t *node, int depth);
-void            print_tree();
-void            print_node_array();
+void            print_tree(const adh_tree_t *tree);
 
 #endif //ALGO_ADHUFF_COMMON_H
@@ -1,6 +1,12 @@
 #include <string.h>
 #include "adhuff_compress.h"
 #include "adhuff_common.h"
+#include "adhuff_filter.h"
+#include "adhuff_interleave.h"
+#include "adhuff_lz77.h"
+#include "adhuff_memory.h"
+#include "adhuff_range.h"
+#include "adhuff_static.h"
 #include "bin_io.h"
 #include "log.h"
 
@@ -11,51 +17,182 @@ enum {
     BUFFER_SIZE  = 1024
 };
 
+/*
+ * destination of the range coder bytes
+ */
+typedef struct {
+    byte_t *            output_buffer;
+    FILE *              output_file_ptr;
+} range_output_t;
+
 //
 // modules variables
 //
-static int      out_bit_idx;
-static byte_t   first_byte_written;
-static bool     is_first_byte = true;
+static int          out_bit_idx;        // bit index in output_buffer, reset at each flush
+static byte_t       first_byte_written;
+static bool         is_first_byte = true;
+static adh_model_t  model;
+static adh_range_coder_t range_coder;
+static range_output_t range_output;
 
 //
 // private methods
 //
 int     process_symbol(byte_t symbol, byte_t *output_buffer, FILE* output_file_ptr);
+int     process_blocks(FILE* input_file_ptr, byte_t *output_buffer, FILE* output_file_ptr);
+int     process_tokens(FILE* input_file_ptr, int level, byte_t *output_buffer, FILE* output_file_ptr);
+int     encode_symbol(adh_tree_t *tree, adh_tree_t *escape_tree, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr);
+int     encode_token_symbol(adh_tree_t *tree, adh_freq_t *freq, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr);
+int     encode_value(uint32_t value, int num_bits, byte_t *output_buffer, FILE* output_file_ptr);
+int     encode_range_symbol(int symbol);
+int     encode_range_end(void);
+int     range_write_byte(void *ctx, byte_t value);
 int     output_bit_array(const bit_array_t * bit_array, byte_t *output_buffer, FILE* output_file_ptr);
-int     output_new_symbol(byte_t symbol, byte_t *output_buffer, FILE* output_file_ptr);
+int     output_new_symbol(const adh_tree_t *tree, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr);
+int     output_value(uint32_t value, int num_bits, byte_t *output_buffer, FILE* output_file_ptr);
 int     flush_data(byte_t *output_buffer, FILE* output_file_ptr);
 int     flush_header(FILE* output_file_ptr);
-int     output_existing_symbol(byte_t symbol, adh_node_t *node, byte_t *output_buffer, FILE* output_file_ptr);
-int     output_nyt(byte_t *output_buffer, FILE *output_file_ptr);
+int     output_flags(FILE* output_file_ptr);
+int     output_existing_symbol(adh_tree_t *tree, adh_node_t *node, byte_t *output_buffer, FILE* output_file_ptr);
+int     output_nyt(const adh_tree_t *tree, byte_t *output_buffer, FILE *output_file_ptr);
 
 /**
  * the main method for compression
  * @param input_file_name
  * @param output_file_name
+ * @param options: NULL for default options
  * @return RC_OK / RC_FAIL
  */
-int adh_compress_file(const char input_file_name[], const char output_file_name[]) {
+int adh_compress_file(const char input_file_name[], const char output_file_name[], const adh_options_t *options) {
     log_info("adh_compress_file", "%-40s %s\n", input_file_name, output_file_name);
 
     FILE *output_file_ptr, *input_file_ptr;
     int rc = adh_init(input_file_name, output_file_name, &output_file_ptr, &input_file_ptr);
+    if (rc == RC_OK)
+        rc = adh_compress_stream(input_file_ptr, output_file_ptr, options);
+
+    int release_rc = adh_release(output_file_ptr, input_file_ptr);
+    return rc == RC_OK ? release_rc : rc;
+}
+
+/**
+ * compress the input stream to the output stream, the output must be seekable (the header is written last)
+ * the streams are not closed
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @param options: NULL for default options
+ * @return RC_OK / RC_FAIL
+ */
+int adh_compress_stream(FILE *input_file_ptr, FILE *output_file_ptr, const adh_options_t *options) {
+    uint64_t stream_start = adh_timer_start(ADH_PHASE_STREAM);
+    adh_memory_reset_peak();
+    adh_progress_start();
+    int rc = RC_OK;
+    byte_t flags = options ? options->flags : 0;
+    if((flags & ADH_FLAG_LZ77) && (flags & (ADH_FLAG_ORDER1 | ADH_FLAG_BWT))) {
+        log_error("adh_compress_file", "LZ77 cannot be combined with order-1 or BWT\n");
+        rc = RC_FAIL;
+        goto error_handling;
+    }
+    if((flags & ADH_FLAG_INTERLEAVED) && (flags & ~(ADH_FLAG_INTERLEAVED | ADH_FLAG_COMPACT_ESCAPE))) {
+        log_error("adh_compress_file", "interleaved lanes can only be combined with compact escapes\n");
+        rc = RC_FAIL;
+        goto error_handling;
+    }
+    if((flags & ADH_FLAG_STATIC) && flags != ADH_FLAG_STATIC) {
+        log_error("adh_compress_file", "static codes cannot be combined with other options\n");
+        rc = RC_FAIL;
+        goto error_handling;
+    }
+    if((flags & ADH_FLAG_BATCHED) && ((flags & ADH_FLAG_RANGE) || options->batch < 0 || options->batch > ADH_BATCH_MAX)) {
+        log_error("adh_compress_file", "batched updates need the trees and a batch of 1 to %d symbols\n", ADH_BATCH_MAX);
+        rc = RC_FAIL;
+        goto error_handling;
+    }
+
+    rc = adh_model_init(&model, flags);
     if (rc != RC_OK) goto error_handling;
 
+    rc = output_flags(output_file_ptr);
+    if (rc != RC_OK) goto error_handling;
+
+    if(model.flags & (ADH_FLAG_INTERLEAVED | ADH_FLAG_STATIC)) {
+        // the lanes and the static blocks are written whole, there is no bit stream header to patch
+        if(model.flags & ADH_FLAG_STATIC)
+            rc = adh_static_encode(input_file_ptr, output_file_ptr);
+        else
+            rc = adh_interleave_encode(input_file_ptr, output_file_ptr, model.flags, options->lanes);
+        if (rc != RC_OK) goto error_handling;
+
+        print_final_stats(input_file_ptr, output_file_ptr);
+        adh_progress_end();
+        goto error_handling;
+    }
+
     byte_t output_buffer[BUFFER_SIZE] = {0};
     byte_t input_buffer[BUFFER_SIZE] = {0};
 
+    if(model.flags & ADH_FLAG_RANGE) {
+        range_output.output_buffer = output_buffer;
+        range_output.output_file_ptr = output_file_ptr;
+        rc = adh_range_init_encoder(&range_coder, model.flags, range_write_byte, &range_output);
+        if (rc != RC_OK) goto error_handling;
+    }
+
     // reserve first 3 bits for header
     out_bit_idx = HEADER_BITS;
     is_first_byte = true;
 
-    size_t bytesRead = 0;
-    while ((bytesRead = fread(input_buffer, sizeof(byte_t), BUFFER_SIZE, input_file_ptr)) > 0)
-    {
-        for(int i=0;i<bytesRead;i++) {
-            rc = process_symbol(input_buffer[i], output_buffer, output_file_ptr);
+    // the decoder checks the width of the weights, and that it is primed with the same sample
+    if(!(model.flags & ADH_FLAG_RANGE)) {
+        rc = output_value(ADH_FORMAT_WEIGHT_BITS, ADH_WEIGHT_FIELD_BITS, output_buffer, output_file_ptr);
+        if (rc != RC_OK) goto error_handling;
+    }
+    if(adh_priming_recorded(model.flags)) {
+        uint32_t fingerprint = 0;
+        bool primed = adh_priming_get(&fingerprint);
+        rc = output_value(primed, 1, output_buffer, output_file_ptr);
+        if (rc == RC_OK && primed)
+            rc = output_value(fingerprint, ADH_PRIMING_BITS, output_buffer, output_file_ptr);
+        if (rc != RC_OK) goto error_handling;
+    }
+
+    // the decoder rebuilds its trees after the same number of symbols
+    if(model.flags & ADH_FLAG_BATCHED) {
+        uint32_t batch = options->batch ? (uint32_t)options->batch : ADH_BATCH_DEFAULT;
+        rc = adh_model_set_batch(&model, batch);
+        if (rc == RC_OK)
+            rc = output_value(batch - 1, ADH_BATCH_BITS, output_buffer, output_file_ptr);
+        if (rc != RC_OK) goto error_handling;
+    }
+
+    if(model.flags & ADH_FLAG_BWT) {
+        rc = process_blocks(input_file_ptr, output_buffer, output_file_ptr);
+        if (rc != RC_OK) goto error_handling;
+    } else if(model.flags & ADH_FLAG_LZ77) {
+        rc = process_tokens(input_file_ptr, options->level, output_buffer, output_file_ptr);
+        if (rc != RC_OK) goto error_handling;
+    } else {
+        size_t bytesRead = 0;
+        uint64_t read_start = adh_timer_start(ADH_PHASE_READ);
+        while ((bytesRead = fread(input_buffer, sizeof(byte_t), BUFFER_SIZE, input_file_ptr)) > 0)
+        {
+            adh_timer_stop(ADH_PHASE_READ, read_start);
+            rc = adh_progress_update(bytesRead, 0);
             if (rc != RC_OK) goto error_handling;
+
+            for(int i=0;i<bytesRead;i++) {
+                rc = process_symbol(input_buffer[i], output_buffer, output_file_ptr);
+                if (rc != RC_OK) goto error_handling;
+            }
+            read_start = adh_timer_start(ADH_PHASE_READ);
         }
+        adh_timer_stop(ADH_PHASE_READ, read_start);
+    }
+
+    if(model.flags & ADH_FLAG_RANGE) {
+        rc = encode_range_end();
+        if (rc != RC_OK) goto error_handling;
     }
 
     // flush remaining data to file
@@ -64,19 +201,97 @@ int adh_compress_file(const char input_file_name[], const char output_file_name[
 
     print_final_stats(input_file_ptr, output_file_ptr);
 
-    // close and reopen in update mode
-    fclose(output_file_ptr);
-    output_file_ptr = bin_open_update(output_file_name);
-    if (output_file_ptr == NULL) goto error_handling;
-
     rc = flush_header(output_file_ptr);
+    if (rc == RC_OK)
+        adh_progress_end();
 
 error_handling:
-    adh_release(output_file_ptr, input_file_ptr);
+    adh_range_release(&range_coder);
+    adh_model_release(&model);
+    adh_timer_stop(ADH_PHASE_STREAM, stream_start);
 
     return rc;
 }
 
+/**
+ * read the input in blocks, filter each block and process the filtered symbols
+ * each block is preceded by its filtered length
+ * @param input_file_ptr
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int process_blocks(FILE* input_file_ptr, byte_t *output_buffer, FILE* output_file_ptr) {
+    adh_pipeline_t pipeline;
+    byte_t * block = adh_malloc(FILTER_BLOCK_SIZE);
+    int rc = adh_pipeline_init(&pipeline, model.flags);
+    if(block == NULL)
+        rc = RC_FAIL;
+
+    size_t block_len = 0;
+    uint64_t read_start = adh_timer_start(ADH_PHASE_READ);
+    while (rc == RC_OK && (block_len = fread(block, sizeof(byte_t), FILTER_BLOCK_SIZE, input_file_ptr)) > 0) {
+        adh_timer_stop(ADH_PHASE_READ, read_start);
+        const byte_t * filtered = NULL;
+        size_t filtered_len = 0;
+        rc = adh_progress_update(block_len, 0);
+        if(rc == RC_OK)
+            rc = adh_pipeline_forward(&pipeline, block, block_len, &filtered, &filtered_len);
+        if(rc == RC_OK)
+            rc = encode_value((uint32_t)filtered_len, FILTER_BLOCK_BITS, output_buffer, output_file_ptr);
+
+        for (size_t i = 0; i < filtered_len && rc == RC_OK; ++i) {
+            rc = process_symbol(filtered[i], output_buffer, output_file_ptr);
+        }
+        read_start = adh_timer_start(ADH_PHASE_READ);
+    }
+    adh_timer_stop(ADH_PHASE_READ, read_start);
+
+    adh_free(block);
+    adh_pipeline_release(&pipeline);
+    return rc;
+}
+
+/**
+ * parse the input in LZ77 literals and matches, code them with the literal/length and distance trees
+ * @param input_file_ptr
+ * @param level: match search effort
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int process_tokens(FILE* input_file_ptr, int level, byte_t *output_buffer, FILE* output_file_ptr) {
+    adh_lz77_t lz;
+    int rc = adh_lz77_init(&lz, level);
+
+    adh_lz77_token_t token;
+    bool has_token = true;
+    while(rc == RC_OK) {
+        rc = adh_lz77_next_token(&lz, input_file_ptr, &token, &has_token);
+        if(rc != RC_OK || !has_token)
+            break;
+
+        if(token.length == 0) {
+            rc = encode_token_symbol(model.order0, range_coder.order0, token.literal, output_buffer, output_file_ptr);
+            continue;
+        }
+
+        // length, then distance slot and the distance bits below the slot
+        int slot = adh_lz77_distance_slot(token.distance);
+        rc = encode_token_symbol(model.order0, range_coder.order0,
+                                 (adh_symbol_t)(LZ77_LENGTH_BASE + token.length - LZ77_MIN_MATCH),
+                                 output_buffer, output_file_ptr);
+        if(rc == RC_OK)
+            rc = encode_token_symbol(model.distances, range_coder.distances, (adh_symbol_t)slot,
+                                     output_buffer, output_file_ptr);
+        if(rc == RC_OK && slot > 0)
+            rc = encode_value(token.distance - (1u << slot), slot, output_buffer, output_file_ptr);
+    }
+
+    adh_lz77_release(&lz);
+    return rc;
+}
+
 /**
  * process the given symbol
  * @param symbol
@@ -85,96 +300,212 @@ error_handling:
  * @return RC_OK / RC_FAIL
  */
 int process_symbol(byte_t symbol, byte_t *output_buffer, FILE* output_file_ptr) {
-#ifdef _DEBUG
-    log_debug(" process_symbol", "%s out_bit_idx=%-8d\n",
-            fmt_symbol(symbol),
-            out_bit_idx);
-#endif
+    ADH_TRACE(" process_symbol", "symbol=%lld out_bit_idx=%lld\n", symbol, out_bit_idx);
+    if(model.flags & ADH_FLAG_RANGE)
+        return encode_range_symbol(symbol);
+
     int rc;
-    adh_node_t* node = adh_search_symbol_in_tree(symbol);
-    if(node == NULL) {
-        // symbol not present in tree
-        rc = output_nyt(output_buffer, output_file_ptr);
-        if(rc == RC_OK) {
-            rc = output_new_symbol(symbol, output_buffer, output_file_ptr);
-        }
+    if(model.flags & ADH_FLAG_ORDER1) {
+        // code with the tree of the previous symbol, escape to the order-0 tree
+        adh_tree_t* tree = adh_model_get_context_tree(&model);
+        if(tree == NULL)
+            return RC_FAIL;
+
+        rc = encode_symbol(tree, model.order0, symbol, output_buffer, output_file_ptr);
+        model.context = symbol;
     } else {
-        // symbol already present in tree
-        rc = output_existing_symbol(symbol, node, output_buffer, output_file_ptr);
+        rc = encode_symbol(model.order0, NULL, symbol, output_buffer, output_file_ptr);
     }
     return rc;
 }
 
 /**
- * write to output the encoding of an existing symbol. then update tree
+ * encode a literal/length or distance symbol with the tree, or with the frequency model in range mode
+ * @param tree
+ * @param freq
  * @param symbol
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int encode_token_symbol(adh_tree_t *tree, adh_freq_t *freq, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr) {
+    if(model.flags & ADH_FLAG_RANGE)
+        return adh_range_encode(&range_coder, freq, NULL, symbol);
+    return encode_symbol(tree, NULL, symbol, output_buffer, output_file_ptr);
+}
+
+/**
+ * encode a raw value, in the bit stream or with the range coder
+ * @param value
+ * @param num_bits
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int encode_value(uint32_t value, int num_bits, byte_t *output_buffer, FILE* output_file_ptr) {
+    if(model.flags & ADH_FLAG_RANGE)
+        return adh_range_encode_bits(&range_coder, value, num_bits);
+    return output_value(value, num_bits, output_buffer, output_file_ptr);
+}
+
+/**
+ * encode a byte (or the end of stream) with the range coder
+ * @param symbol: [0..ADH_MAX_SYMBOLS], ADH_MAX_SYMBOLS = end of stream
+ * @return RC_OK / RC_FAIL
+ */
+int encode_range_symbol(int symbol) {
+    if(!(model.flags & ADH_FLAG_ORDER1))
+        return adh_range_encode(&range_coder, range_coder.order0, NULL, symbol);
+
+    // code with the model of the previous symbol, escape to the order-0 model
+    adh_freq_t * freq = adh_range_get_context_model(&range_coder);
+    if(freq == NULL)
+        return RC_FAIL;
+
+    range_coder.context = (byte_t)symbol;
+    return adh_range_encode(&range_coder, freq, range_coder.order0, symbol);
+}
+
+/**
+ * the decoder can't find the end of the range coded data from the bit count:
+ * write an end of stream marker (a zero length block in BWT mode), then the pending bytes
+ * @return RC_OK / RC_FAIL
+ */
+int encode_range_end(void) {
+    int rc;
+    if(model.flags & ADH_FLAG_BWT)
+        rc = adh_range_encode_bits(&range_coder, 0, FILTER_BLOCK_BITS);
+    else if(model.flags & ADH_FLAG_LZ77)
+        rc = adh_range_encode(&range_coder, range_coder.order0, NULL, range_coder.order0->num_symbols);
+    else
+        rc = encode_range_symbol(ADH_MAX_SYMBOLS);
+
+    if(rc == RC_OK)
+        rc = adh_range_flush(&range_coder);
+    return rc;
+}
+
+/**
+ * write a range coder byte to the bit stream
+ * @param ctx: range_output_t
+ * @param value
+ * @return RC_OK / RC_FAIL
+ */
+int range_write_byte(void *ctx, byte_t value) {
+    range_output_t * output = ctx;
+    return output_value(value, SYMBOL_BITS, output->output_buffer, output->output_file_ptr);
+}
+
+/**
+ * encode the symbol with the given tree. then update tree
+ * a symbol not present in tree is written as NYT followed by
+ * its encoding in the escape_tree or, without escape_tree, by its binary value
+ * @param tree
+ * @param escape_tree: may be NULL
+ * @param symbol
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int encode_symbol(adh_tree_t *tree, adh_tree_t *escape_tree, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr) {
+    adh_node_t* node = adh_search_symbol_in_tree(tree, symbol);
+    if(node != NULL) {
+        // symbol already present in tree
+        return output_existing_symbol(tree, node, output_buffer, output_file_ptr);
+    }
+
+    // symbol not present in tree
+    int rc = output_nyt(tree, output_buffer, output_file_ptr);
+    if(rc != RC_OK)
+        return rc;
+
+    if(escape_tree != NULL)
+        rc = encode_symbol(escape_tree, NULL, symbol, output_buffer, output_file_ptr);
+    else
+        rc = output_new_symbol(tree, symbol, output_buffer, output_file_ptr);
+    if(rc != RC_OK)
+        return rc;
+
+    adh_node_t* new_node = adh_create_node_and_append(tree, symbol);
+    if(new_node == NULL)
+        return RC_FAIL;
+
+    adh_update_tree(tree, new_node, true);
+    return RC_OK;
+}
+
+/**
+ * write to output the encoding of an existing symbol. then update tree
+ * @param tree
  * @param node
  * @param output_buffer
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int output_existing_symbol(byte_t symbol, adh_node_t *node, byte_t *output_buffer, FILE* output_file_ptr) {
+int output_existing_symbol(adh_tree_t *tree, adh_node_t *node, byte_t *output_buffer, FILE* output_file_ptr) {
     // write symbol code
-    adh_node_t* nodeSymbol = adh_search_symbol_in_tree(symbol);
+    bit_array_t bit_array;
+    adh_get_node_encoding(node, &bit_array);
 
-#ifdef _DEBUG
-    log_debug("  output_existing_symbol", "%s out_bit_idx=%-8d bin=%s\n",
-             fmt_symbol(symbol),
-             out_bit_idx,
-             fmt_bit_array(&nodeSymbol->bit_array));
-#endif
+    ADH_TRACE("  output_existing_symbol", "symbol=%lld out_bit_idx=%lld bits=%lld\n",
+              node->symbol, out_bit_idx, bit_array.length);
 
-    int rc = output_bit_array(&(nodeSymbol->bit_array), output_buffer, output_file_ptr);
+    int rc = output_bit_array(&bit_array, output_buffer, output_file_ptr);
     if(rc != RC_OK)
         return rc;
 
-    adh_update_tree(node, false);
+    adh_update_tree(tree, node, false);
     return RC_OK;
 }
 
 /**
- * write to output the binary version of the symbol. then update tree
+ * write to output the binary version of the symbol, using the symbol bits of the tree
+ * with compact escapes, write the index of the symbol among the symbols not yet seen
+ * @param tree
  * @param symbol
  * @param output_buffer
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int output_new_symbol(byte_t symbol, byte_t *output_buffer, FILE* output_file_ptr) {
+int output_new_symbol(const adh_tree_t *tree, adh_symbol_t symbol, byte_t *output_buffer, FILE* output_file_ptr) {
     // write symbol code
     bit_array_t bit_array = {0};
-    symbol_to_bits(symbol, &bit_array);
+    adh_escape_encode(tree, model.flags, symbol, &bit_array);
 
-#ifdef _DEBUG
-    log_debug("  output_new_symbol", "%s out_bit_idx=%-8d bin=%s\n",
-              fmt_symbol(symbol), out_bit_idx,
-              fmt_bit_array(&bit_array));
-#endif
-    int rc = output_bit_array(&bit_array, output_buffer, output_file_ptr);
-    if(rc != RC_OK)
-        return rc;
+    ADH_TRACE("  output_new_symbol", "symbol=%lld out_bit_idx=%lld bits=%lld\n",
+              symbol, out_bit_idx, bit_array.length);
+    return output_bit_array(&bit_array, output_buffer, output_file_ptr);
+}
 
-    adh_node_t* new_node = adh_create_node_and_append(symbol);
-    adh_update_tree(new_node, true);
-    return rc;
+/**
+ * write to output the binary version of the value
+ * @param value
+ * @param num_bits
+ * @param output_buffer
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int output_value(uint32_t value, int num_bits, byte_t *output_buffer, FILE* output_file_ptr) {
+    bit_array_t bit_array;
+    value_to_bits(value, num_bits, &bit_array);
+    return output_bit_array(&bit_array, output_buffer, output_file_ptr);
 }
 
 /**
  * write to output the encoding of the NYT node
+ * @param tree
  * @param output_buffer
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int output_nyt(byte_t *output_buffer, FILE *output_file_ptr) {
+int output_nyt(const adh_tree_t *tree, byte_t *output_buffer, FILE *output_file_ptr) {
     // write NYT code
-    adh_node_t* nyt = get_nyt();
+    bit_array_t bit_array;
+    adh_get_node_encoding(tree->nyt, &bit_array);
 
-#ifdef _DEBUG
-    log_debug("  output_nyt", "%3s out_bit_idx=%-8d NYT=%s\n", "",
-             out_bit_idx,
-             fmt_bit_array(&nyt->bit_array));
-#endif
+    ADH_TRACE("  output_nyt", "out_bit_idx=%lld bits=%lld\n", out_bit_idx, bit_array.length);
 
-    return output_bit_array(&(nyt->bit_array), output_buffer, output_file_ptr);
+    return output_bit_array(&bit_array, output_buffer, output_file_ptr);
 }
 
 /**
@@ -185,9 +516,10 @@ int output_nyt(byte_t *output_buffer, FILE *output_file_ptr) {
  * @return RC_OK / RC_FAIL
  */
 int output_bit_array(const bit_array_t* bit_array, byte_t *output_buffer, FILE* output_file_ptr) {
+    uint64_t start = adh_timer_start(ADH_PHASE_BITS);
     for(int i = bit_array->length-1; i>=0; i--) {
         // calculate the current position (in byte) of the output_buffer
-        long buffer_byte_idx = bit_idx_to_byte_idx(out_bit_idx);
+        uint64_t buffer_byte_idx = bit_idx_to_byte_idx(out_bit_idx);
 
         // calculate which bit to change in the byte 11100000
         int bit_pos = bit_pos_in_current_byte(out_bit_idx);
@@ -199,9 +531,12 @@ int output_bit_array(const bit_array_t* bit_array, byte_t *output_buffer, FILE*
 
         // buffer full, flush data to file
         if(out_bit_idx+1 == BUFFER_SIZE * SYMBOL_BITS) {
+            // the write is timed by flush_data
+            adh_timer_stop(ADH_PHASE_BITS, start);
             int rc = flush_data(output_buffer, output_file_ptr);
             if(rc != RC_OK)
                 return rc;
+            start = adh_timer_start(ADH_PHASE_BITS);
 
             // reset buffer index
             out_bit_idx = 0;
@@ -211,6 +546,7 @@ int output_bit_array(const bit_array_t* bit_array, byte_t *output_buffer, FILE*
         }
     }
 
+    adh_timer_stop(ADH_PHASE_BITS, start);
     return RC_OK;
 }
 
@@ -222,19 +558,21 @@ int output_bit_array(const bit_array_t* bit_array, byte_t *output_buffer, FILE*
  */
 int flush_data(byte_t *output_buffer, FILE* output_file_ptr) {
     if(out_bit_idx > 0) {
-        long num_bytes_to_write = bit_idx_to_byte_idx(out_bit_idx);
+        uint64_t num_bytes_to_write = bit_idx_to_byte_idx(out_bit_idx);
 
         if (get_available_bits(out_bit_idx) < SYMBOL_BITS)
             num_bytes_to_write++;   // reserve the space for odd bits
 
-#ifdef _DEBUG
-        log_debug("flush_data", "out_bit_idx=%-8d num_bytes_to_write=%d\n", out_bit_idx, num_bytes_to_write);
+        ADH_DEBUG("flush_data", "out_bit_idx=%-8d num_bytes_to_write=%" PRIu64 "\n", out_bit_idx, num_bytes_to_write);
 
-        for (int i = 0; i < num_bytes_to_write; i++)
+#if ADH_LOG_LEVEL >= LOG_TRACE
+        for (uint64_t i = 0; i < num_bytes_to_write; i++)
             log_trace_char_bin(output_buffer[i]);
 #endif
 
+        uint64_t start = adh_timer_start(ADH_PHASE_WRITE);
         size_t bytesWritten = fwrite(output_buffer, sizeof(byte_t), num_bytes_to_write, output_file_ptr);
+        adh_timer_stop(ADH_PHASE_WRITE, start);
         if (bytesWritten != num_bytes_to_write) {
             perror("failed to write compressed file");
             return RC_FAIL;
@@ -244,33 +582,39 @@ int flush_data(byte_t *output_buffer, FILE* output_file_ptr) {
             first_byte_written = output_buffer[0];
             is_first_byte = false;
         }
+        return adh_progress_update(0, num_bytes_to_write);
     }
     return RC_OK;
 }
 
+/**
+ * write the format flags, before the bit stream
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int output_flags(FILE* output_file_ptr) {
+    size_t bytesWritten = fwrite(&model.flags, sizeof(byte_t), FLAGS_BYTES, output_file_ptr);
+    if(bytesWritten != FLAGS_BYTES) {
+        perror("failed to write flags");
+        return RC_FAIL;
+    }
+    return adh_progress_update(0, FLAGS_BYTES);
+}
+
 /*!
- * flush header to file
+ * flush header to file, then move back to the end of the output
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
 int flush_header(FILE* output_file_ptr) {
-#ifdef _DEBUG
-    log_trace("flush_header", "old_bits=");
-    log_trace_char_bin(first_byte_written);
-#endif
-
     first_byte_union first_byte;
     first_byte.raw = first_byte_written;
     first_byte.split.header = (byte_t)get_available_bits(out_bit_idx);
 
-#ifdef _DEBUG
-    log_trace("flush_header", "new_bits=");
-    log_trace_char_bin(first_byte.raw);
-#endif
-
-    fputc(first_byte.raw, output_file_ptr);
+    ADH_TRACE("flush_header", "old_bits=%02llX new_bits=%02llX\n", first_byte_written, first_byte.raw);
 
-    if ( fseek(output_file_ptr, 0L, SEEK_SET) != 0 ) {
+    int64_t end = bin_tell(output_file_ptr);
+    if ( end < 0 || bin_seek(output_file_ptr, FLAGS_BYTES, SEEK_SET) != RC_OK ) {
         perror("error moving file ptr to beginning");
         return RC_FAIL;
     }
@@ -281,5 +625,9 @@ int flush_header(FILE* output_file_ptr) {
         return RC_FAIL;
     }
 
+    if ( bin_seek(output_file_ptr, end, SEEK_SET) != RC_OK ) {
+        perror("error moving file ptr to end");
+        return RC_FAIL;
+    }
     return RC_OK;
 }
@@ -1,9 +1,12 @@
 #ifndef ALGO_ADHUFF_COMPRESS_H
 #define ALGO_ADHUFF_COMPRESS_H
 
+#include "adhuff_common.h"
+
 //
 // public methods
 //
-int adh_compress_file(const char input_file_name[], const char output_file_name[]);
+int adh_compress_file(const char input_file_name[], const char output_file_name[], const adh_options_t *options);
+int adh_compress_stream(FILE *input_file_ptr, FILE *output_file_ptr, const adh_options_t *options);
 
 #endif //ALGO_ADHUFF_COMPRESS_H
@@ -3,6 +3,12 @@
 
 #include "adhuff_decompress.h"
 #include "adhuff_common.h"
+#include "adhuff_filter.h"
+#include "adhuff_interleave.h"
+#include "adhuff_lz77.h"
+#include "adhuff_memory.h"
+#include "adhuff_range.h"
+#include "adhuff_static.h"
 #include "bin_io.h"
 #include "log.h"
 
@@ -10,8 +16,11 @@
  * constants
  */
 enum {
-    MAX_CODE_BYTES  = MAX_CODE_BITS / SYMBOL_BITS,  //32
-    BUFFER_SIZE     = 1024
+    BUFFER_SIZE         = 1024,
+    INPUT_BUFFER_SIZE   = 64 * 1024,
+    LOOKUP_MIN_WEIGHT   = 4 * ADH_LOOKUP_SIZE,  // symbols a tree codes before its lookup table pays off
+    LOOKUP_MISS_COST    = 2,                    // a miss walks the tree and fills the entry, a hit saves the walk
+    LOOKUP_MAX_SCORE    = 2 * ADH_LOOKUP_SIZE   // the table is dropped at -LOOKUP_MAX_SCORE
 };
 
 /*
@@ -19,24 +28,44 @@ enum {
  */
 static byte_t           output_buffer[BUFFER_SIZE];
 static unsigned int     output_byte_idx;
-static long             in_bit_idx;
+static byte_t *         input_buffer;       // window of INPUT_BUFFER_SIZE bytes on the compressed stream
+static FILE *           input_stream;
+static int64_t          input_start_bit;    // bit index of input_buffer[0] in the stream
+static int64_t          input_end_bit;      // first bit index after the window
+static int64_t          input_last_bit;     // last bit index readable without refilling the window
+static int64_t          in_bit_idx;
 static unsigned int     bits_to_ignore;
-static long             last_bit_idx;
+static int              num_lanes;          // interleaved format: the header byte is the number of lanes
+static int              static_version;     // static format: the header byte is the version of the block format
+static int64_t          last_bit_idx;
+static int              range_past_end;     // zero bytes given to the range decoder past last_bit_idx
+static adh_model_t      model;
+static adh_range_coder_t range_coder;
 
 /*
  * Private methods
  */
-void    read_header(FILE *inputFilePtr);
-long    get_file_size(FILE *input_file_ptr);
-int     read_data_cross_bytes(const byte_t input_buffer[], int max_bits_to_read, byte_t sub_buffer[]);
-int     decode_new_symbol(const byte_t input_buffer[]);
-int     decode_existing_symbol(const byte_t input_buffer[]);
+int     read_header(FILE *inputFilePtr);
+int64_t get_file_size(FILE *input_file_ptr);
+int     fill_input();
+int     decode_next_symbol(byte_t *symbol);
+int     decode_symbol(adh_tree_t *tree, adh_tree_t *escape_tree, adh_symbol_t *symbol);
+int     decode_new_symbol(const adh_tree_t *tree, adh_symbol_t *symbol);
+int     read_escape_bits(void *ctx, int num_bits, uint32_t *value);
+int     decode_tokens(FILE *output_file_ptr);
+adh_node_t* read_node(adh_tree_t *tree);
+adh_node_t* read_lookup(adh_tree_t *tree);
 int     flush_uncompressed(FILE *output_file_ptr);
-int     skip_nyt_bits(int nyt_size);
 void    output_symbol(byte_t symbol);
-int     process_bits(const byte_t *input_buffer, FILE *output_file_ptr);
-bool    compare_input_and_nyt(const byte_t *input_buffer, long in_bit_idx, long last_bit_idx,
-                              const bit_array_t *bit_array_nyt);
+int     process_bits(FILE *output_file_ptr);
+int     decode_blocks(FILE *output_file_ptr);
+int     read_value(int num_bits, uint32_t *value);
+int     decode_value(int num_bits, uint32_t *value);
+int     decode_token_symbol(adh_tree_t *tree, adh_freq_t *freq, adh_symbol_t *symbol);
+int     decode_range_symbol(int *symbol);
+int     decode_range_stream(FILE *output_file_ptr);
+int     range_read_byte(void *ctx, byte_t *value);
+
 /**
  * the main method for decompression
  * @param input_file_name
@@ -46,73 +75,144 @@ bool    compare_input_and_nyt(const byte_t *input_buffer, long in_bit_idx, long
 int adh_decompress_file(const char input_file_name[], const char output_file_name[]) {
     log_info("adh_decompress_file", "%-40s %s\n", input_file_name, output_file_name);
 
-    byte_t* input_buffer = NULL;
     FILE *output_file_ptr = NULL;
     FILE *input_file_ptr = NULL;
 
     int rc = adh_init(input_file_name, output_file_name, &output_file_ptr, &input_file_ptr);
+    if (rc == RC_OK)
+        rc = adh_decompress_stream(input_file_ptr, output_file_ptr);
+
+    int release_rc = adh_release(output_file_ptr, input_file_ptr);
+    return rc == RC_OK ? release_rc : rc;
+}
+
+/**
+ * decompress the input stream to the output stream, the input must be seekable
+ * the input is read through a window of INPUT_BUFFER_SIZE bytes, bit indices are 64 bits
+ * the streams are not closed
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int adh_decompress_stream(FILE *input_file_ptr, FILE *output_file_ptr) {
+    uint64_t stream_start = adh_timer_start(ADH_PHASE_STREAM);
+    adh_memory_reset_peak();
+    adh_progress_start();
+
+    int rc = read_header(input_file_ptr);
     if (rc == RC_FAIL) goto error_handling;
 
-    read_header(input_file_ptr);
+    if(model.flags & (ADH_FLAG_INTERLEAVED | ADH_FLAG_STATIC)) {
+        // blocks read in sequence, the input size is not needed
+        if(model.flags & ADH_FLAG_STATIC)
+            rc = adh_static_decode(input_file_ptr, output_file_ptr, static_version);
+        else
+            rc = adh_interleave_decode(input_file_ptr, output_file_ptr, model.flags, num_lanes);
+        if (rc == RC_FAIL) goto error_handling;
+
+        print_final_stats(input_file_ptr, output_file_ptr);
+        adh_progress_end();
+        goto error_handling;
+    }
 
-    // TODO: handle big files, don't read entire file in memory
-    long input_size = get_file_size(input_file_ptr);
-    int bytes_to_read = input_size;
+    int64_t input_size = get_file_size(input_file_ptr);
+    if (input_size < 0) {
+        log_error("adh_decompress_file", "cannot get the input size\n");
+        rc = RC_FAIL;
+        goto error_handling;
+    }
 
     memset(output_buffer, 0, sizeof(output_buffer));
-    input_buffer = (byte_t*) malloc(input_size);
 
-    // read up to sizeof(buffer) bytes
-    size_t bytes_read = fread(input_buffer, sizeof(byte_t), bytes_to_read, input_file_ptr);
-    //while ((bytes_read = fread(input_buffer, sizeof(byte_t), bytes_to_read, input_file_ptr)) > 0)
-    {
-        if(bytes_read != bytes_to_read) {
-            rc = RC_FAIL;
-            log_error("adh_decompress_file", "bytes_read (%zu) != bytes_to_read (%d)\n", bytes_read, bytes_to_read);
-            goto error_handling;
-        }
+    // the window is filled on the first read, from the beginning of the stream
+    input_buffer = adh_malloc(INPUT_BUFFER_SIZE);
+    if (input_buffer == NULL) {
+        rc = RC_FAIL;
+        goto error_handling;
+    }
+    input_stream = input_file_ptr;
+    input_start_bit = 0;
+    input_end_bit = 0;
+    input_last_bit = -1;
+
+    last_bit_idx = (input_size * SYMBOL_BITS) - bits_to_ignore -1;
+    ADH_DEBUG("adh_decompress_file", "last_bit_idx=%" PRId64 "\n", last_bit_idx);
+
+    if(model.flags & ADH_FLAG_RANGE) {
+        range_past_end = 0;
+        rc = adh_range_init_decoder(&range_coder, model.flags, range_read_byte, NULL);
+        if(rc == RC_FAIL) goto error_handling;
+    }
 
-        last_bit_idx = (input_size * SYMBOL_BITS) - bits_to_ignore -1;
-#ifdef _DEBUG
-        log_debug("adh_decompress_file", "last_bit_idx=%d\n", last_bit_idx);
-#endif
+    if(!(model.flags & ADH_FLAG_RANGE)) {
+        uint32_t weight_bits = 0;
+        rc = decode_value(ADH_WEIGHT_FIELD_BITS, &weight_bits);
+        if(rc == RC_OK)
+            rc = adh_check_weight_bits(weight_bits);
+        if(rc == RC_FAIL) goto error_handling;
+    }
 
+    if(adh_priming_recorded(model.flags)) {
+        uint32_t primed = 0, fingerprint = 0;
+        rc = decode_value(1, &primed);
+        if(rc == RC_OK && primed)
+            rc = decode_value(ADH_PRIMING_BITS, &fingerprint);
+        if(rc == RC_OK)
+            rc = adh_model_set_primed(&model, primed, fingerprint);
+        if(rc == RC_FAIL) goto error_handling;
+    }
+
+    if(model.flags & ADH_FLAG_BATCHED) {
+        uint32_t batch = 0;
+        rc = decode_value(ADH_BATCH_BITS, &batch);
+        if(rc == RC_OK)
+            rc = adh_model_set_batch(&model, batch + 1);
+        if(rc == RC_FAIL) goto error_handling;
+    }
+
+    if(model.flags & ADH_FLAG_BWT) {
+        rc = decode_blocks(output_file_ptr);
+        if(rc == RC_FAIL) goto error_handling;
+    } else if(model.flags & ADH_FLAG_LZ77) {
+        rc = decode_tokens(output_file_ptr);
+        if(rc == RC_FAIL) goto error_handling;
+    } else if(model.flags & ADH_FLAG_RANGE) {
+        rc = decode_range_stream(output_file_ptr);
+        if(rc == RC_FAIL) goto error_handling;
+    } else {
         while(in_bit_idx <= last_bit_idx) {
-            rc = process_bits(input_buffer, output_file_ptr);
+            rc = process_bits(output_file_ptr);
             if(rc == RC_FAIL) goto error_handling;
         }
     }
 
-    flush_uncompressed(output_file_ptr);
+    rc = flush_uncompressed(output_file_ptr);
+    if(rc == RC_FAIL) goto error_handling;
+
     print_final_stats(input_file_ptr, output_file_ptr);
+    adh_progress_end();
 
 error_handling:
-    free(input_buffer);
-    adh_release(output_file_ptr, input_file_ptr);
+    adh_free(input_buffer);
+    input_buffer = NULL;
+    adh_range_release(&range_coder);
+    adh_model_release(&model);
+    adh_timer_stop(ADH_PHASE_STREAM, stream_start);
 
     return rc;
 }
 
 /**
- * process the input buffer bit per bit
- * @param input_buffer
+ * decode the next symbol from the input buffer
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int process_bits(const byte_t *input_buffer, FILE *output_file_ptr) {
-    int rc;
-    adh_node_t* nyt = get_nyt();
-    bool is_nyt_code = compare_input_and_nyt(input_buffer, in_bit_idx, last_bit_idx, &(nyt->bit_array));
-    if(is_nyt_code) {
-        rc = skip_nyt_bits(nyt->bit_array.length);
-        if(rc == RC_FAIL) return rc;
+int process_bits(FILE *output_file_ptr) {
+    byte_t symbol;
+    int rc = decode_next_symbol(&symbol);
+    if(rc == RC_FAIL) return rc;
 
-        rc = decode_new_symbol(input_buffer);
-        if(rc == RC_FAIL) return rc;
-    } else {
-        rc = decode_existing_symbol(input_buffer);
-        if(rc == RC_FAIL) return rc;
-    }
+    output_symbol(symbol);
 
     if(output_byte_idx == BUFFER_SIZE -1) {
         rc = flush_uncompressed(output_file_ptr);
@@ -122,248 +222,479 @@ int process_bits(const byte_t *input_buffer, FILE *output_file_ptr) {
 }
 
 /**
- * forward the input bit index by the given NYT size
- * @param nyt_size
+ * decode the filtered blocks, each block is preceded by its filtered length
+ * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int skip_nyt_bits(int nyt_size) {
-#ifdef _DEBUG
-    log_debug("skip_nyt_bits", "in_bit_idx=%-8u nyt_size=%d\n", in_bit_idx, nyt_size);
-#endif
+int decode_blocks(FILE *output_file_ptr) {
+    adh_pipeline_t pipeline;
+    byte_t * block = adh_malloc(FILTER_BUFFER_SIZE);
+    int rc = adh_pipeline_init(&pipeline, model.flags);
+    if(block == NULL)
+        rc = RC_FAIL;
+
+    while(rc == RC_OK && in_bit_idx <= last_bit_idx) {
+        uint32_t block_len = 0;
+        rc = decode_value(FILTER_BLOCK_BITS, &block_len);
+        if(rc != RC_OK)
+            break;
 
-    in_bit_idx += nyt_size;
+        // in range mode, the stream ends with a zero length block
+        if(block_len == 0 && (model.flags & ADH_FLAG_RANGE))
+            break;
 
-    if(in_bit_idx > last_bit_idx) {
-        log_error("adh_decompress_file", "too many bits read: in_bit_idx (%u) > last_bit_idx (%u)", in_bit_idx, last_bit_idx);
-        return RC_FAIL;
+        if(block_len > FILTER_BUFFER_SIZE) {
+            log_error("decode_blocks", "block too large: %u\n", block_len);
+            rc = RC_FAIL;
+            break;
+        }
+
+        for (uint32_t i = 0; i < block_len && rc == RC_OK; ++i) {
+            rc = decode_next_symbol(&block[i]);
+        }
+
+        const byte_t * original = NULL;
+        size_t original_len = 0;
+        if(rc == RC_OK)
+            rc = adh_pipeline_inverse(&pipeline, block, block_len, &original, &original_len);
+
+        uint64_t write_start = adh_timer_start(ADH_PHASE_WRITE);
+        if(rc == RC_OK && fwrite(original, sizeof(byte_t), original_len, output_file_ptr) != original_len) {
+            log_error("decode_blocks", "cannot write %zu bytes\n", original_len);
+            rc = RC_FAIL;
+        }
+        adh_timer_stop(ADH_PHASE_WRITE, write_start);
+        if(rc == RC_OK)
+            rc = adh_progress_update(0, original_len);
     }
-    return RC_OK;
+
+    adh_free(block);
+    adh_pipeline_release(&pipeline);
+    return rc;
 }
 
 /**
- * flush output buffer to file
+ * decode LZ77 literals and matches, matches are copied from the last LZ77_WINDOW_SIZE output bytes
  * @param output_file_ptr
  * @return RC_OK / RC_FAIL
  */
-int flush_uncompressed(FILE *output_file_ptr) {
-#ifdef _DEBUG
-    log_debug("flush_uncompressed", "in_bit_idx=%-8u output_byte_idx=%d\n", in_bit_idx, output_byte_idx);
-#endif
+int decode_tokens(FILE *output_file_ptr) {
+    byte_t * window = adh_malloc(LZ77_WINDOW_SIZE);
+    if(window == NULL)
+        return RC_FAIL;
 
-    size_t bytes_written = fwrite(output_buffer, sizeof(byte_t), output_byte_idx, output_file_ptr);
-    if(bytes_written != output_byte_idx) {
-        log_error("flush_uncompressed", "bytes_written (%zu) != out_byte_idx (%u)\n", bytes_written, output_byte_idx);
+    uint64_t window_pos = 0;
+    int rc = RC_OK;
+    while(rc == RC_OK && in_bit_idx <= last_bit_idx) {
+        adh_symbol_t symbol = 0;
+        rc = decode_token_symbol(model.order0, range_coder.order0, &symbol);
+        if(rc != RC_OK)
+            break;
+
+        // end of stream, range mode only
+        if(symbol == 1 << LZ77_LITLEN_BITS)
+            break;
+
+        unsigned int length = 1;
+        unsigned int distance = 0;
+        if(symbol >= LZ77_LENGTH_BASE) {
+            length = symbol - LZ77_LENGTH_BASE + LZ77_MIN_MATCH;
+
+            adh_symbol_t slot = 0;
+            rc = decode_token_symbol(model.distances, range_coder.distances, &slot);
+            if(rc != RC_OK)
+                break;
+
+            uint32_t offset = 0;
+            rc = decode_value(slot, &offset);
+            if(rc != RC_OK)
+                break;
+
+            distance = (1u << slot) + offset;
+            if(distance >= LZ77_WINDOW_SIZE || distance > window_pos) {
+                log_error("decode_tokens", "invalid distance %u at output position %" PRIu64 "\n", distance, window_pos);
+                rc = RC_FAIL;
+                break;
+            }
+        }
+
+        for (unsigned int i = 0; i < length && rc == RC_OK; ++i) {
+            byte_t c = distance ? window[(window_pos - distance) & (LZ77_WINDOW_SIZE - 1)] : (byte_t)symbol;
+            window[window_pos & (LZ77_WINDOW_SIZE - 1)] = c;
+            window_pos++;
+
+            output_symbol(c);
+            if(output_byte_idx == BUFFER_SIZE -1)
+                rc = flush_uncompressed(output_file_ptr);
+        }
+    }
+
+    adh_free(window);
+    return rc;
+}
+
+/**
+ * decode the next symbol with the model
+ * @param symbol: the decoded symbol
+ * @return RC_OK / RC_FAIL
+ */
+int decode_next_symbol(byte_t *symbol) {
+    int rc;
+    adh_symbol_t decoded = 0;
+    if(model.flags & ADH_FLAG_RANGE) {
+        int range_symbol = 0;
+        rc = decode_range_symbol(&range_symbol);
+        if(rc == RC_OK && range_symbol == ADH_MAX_SYMBOLS) {
+            log_error("decode_next_symbol", "unexpected end of stream\n");
+            rc = RC_FAIL;
+        }
+        decoded = (adh_symbol_t)range_symbol;
+    } else if(model.flags & ADH_FLAG_ORDER1) {
+        // decode with the tree of the previous symbol, escape to the order-0 tree
+        adh_tree_t* tree = adh_model_get_context_tree(&model);
+        if(tree == NULL) return RC_FAIL;
+
+        rc = decode_symbol(tree, model.order0, &decoded);
+        model.context = (byte_t)decoded;
+    } else {
+        rc = decode_symbol(model.order0, NULL, &decoded);
+    }
+
+    *symbol = (byte_t)decoded;
+    return rc;
+}
+
+/**
+ * decode a byte (or the end of stream) with the range coder
+ * @param symbol: [0..ADH_MAX_SYMBOLS], ADH_MAX_SYMBOLS = end of stream
+ * @return RC_OK / RC_FAIL
+ */
+int decode_range_symbol(int *symbol) {
+    if(!(model.flags & ADH_FLAG_ORDER1))
+        return adh_range_decode(&range_coder, range_coder.order0, NULL, symbol);
+
+    // decode with the model of the previous symbol, escape to the order-0 model
+    adh_freq_t * freq = adh_range_get_context_model(&range_coder);
+    if(freq == NULL)
         return RC_FAIL;
+
+    int rc = adh_range_decode(&range_coder, freq, range_coder.order0, symbol);
+    range_coder.context = (byte_t)*symbol;
+    return rc;
+}
+
+/**
+ * decode range coded bytes until the end of stream symbol
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int decode_range_stream(FILE *output_file_ptr) {
+    int rc = RC_OK;
+    while(rc == RC_OK) {
+        int symbol = 0;
+        rc = decode_range_symbol(&symbol);
+        if(rc != RC_OK || symbol == ADH_MAX_SYMBOLS)
+            break;
+
+        output_symbol((byte_t)symbol);
+        if(output_byte_idx == BUFFER_SIZE -1)
+            rc = flush_uncompressed(output_file_ptr);
     }
+    return rc;
+}
 
-    output_byte_idx = 0;
-    return RC_OK;
+/**
+ * decode a literal/length or distance symbol with the tree, or with the frequency model in range mode
+ * @param tree
+ * @param freq
+ * @param symbol: the decoded symbol
+ * @return RC_OK / RC_FAIL
+ */
+int decode_token_symbol(adh_tree_t *tree, adh_freq_t *freq, adh_symbol_t *symbol) {
+    if(!(model.flags & ADH_FLAG_RANGE))
+        return decode_symbol(tree, NULL, symbol);
+
+    int value = 0;
+    int rc = adh_range_decode(&range_coder, freq, NULL, &value);
+    *symbol = (adh_symbol_t)value;
+    return rc;
 }
 
 /**
- * interpret the input as existing symbol, then update the tree
- * @param input_buffer
+ * decode a raw value, from the bit stream or with the range coder
+ * @param num_bits
+ * @param value
  * @return RC_OK / RC_FAIL
  */
-int decode_existing_symbol(const byte_t input_buffer[]) {
-    long original_input_buffer_bit_idx = in_bit_idx;
-
-    adh_node_t* node = NULL;
-    bit_array_t bit_array = {0};
-    byte_t  sub_buffer[MAX_CODE_BYTES] = {0};
-    long missing = last_bit_idx - in_bit_idx + 1;
-
-#ifdef _DEBUG
-    log_debug("decode_existing_symbol", "in_bit_idx=%-8u last_bit_idx=%u missing=%d\n",
-              in_bit_idx, last_bit_idx, missing);
-#endif
-
-    int max_bits = MAX_CODE_BITS < missing ? MAX_CODE_BITS : missing;
-    int num_bytes = read_data_cross_bytes(input_buffer, max_bits, sub_buffer);
-
-    for (int byte_idx = 0; byte_idx < num_bytes && node == NULL; ++byte_idx) {
-        for (int bit_idx = 0; bit_idx < SYMBOL_BITS && node == NULL; ++bit_idx) {
-            if(bit_array.length > MAX_CODE_BITS) {
-                log_error("decode_existing_symbol", "bit_array_size (%d) >= MAX_CODE_BITS (%d)", bit_array.length, MAX_CODE_BITS);
-                return RC_FAIL;
-            }
+int decode_value(int num_bits, uint32_t *value) {
+    if(model.flags & ADH_FLAG_RANGE)
+        return adh_range_decode_bits(&range_coder, value, num_bits);
 
-            // shift left previous bits
-            for (int i = bit_array.length; i > 0; --i) {
-                bit_array.buffer[i] = bit_array.buffer[i-1];
-            }
+    if(last_bit_idx - in_bit_idx + 1 < num_bits) {
+        log_error("decode_value", "expected %d bits: in_bit_idx=%" PRId64 " last_bit_idx=%" PRId64 "\n", num_bits, in_bit_idx, last_bit_idx);
+        return RC_FAIL;
+    }
+    return read_value(num_bits, value);
+}
 
-            bit_array.buffer[0] = bit_check(sub_buffer[byte_idx], SYMBOL_BITS - bit_idx -1);
-            bit_array.length++;
-            node = adh_search_leaf_by_encoding(&bit_array);
+/**
+ * read the next range coder byte from the bit stream, zeros past the end.
+ * A valid stream ends within the flush of the encoder: more zeros mean a truncated or corrupt stream
+ * @param ctx: unused
+ * @param value
+ * @return RC_OK / RC_FAIL
+ */
+int range_read_byte(void *ctx, byte_t *value) {
+    (void) ctx;
+    if(last_bit_idx - in_bit_idx + 1 < SYMBOL_BITS) {
+        in_bit_idx = last_bit_idx + 1;
+        *value = 0;
+        if(++range_past_end > RANGE_INIT_BYTES) {
+            log_error("range_read_byte", "truncated or corrupt stream: no end of stream symbol\n");
+            return RC_FAIL;
         }
+        return RC_OK;
     }
+    uint32_t byte_value = 0;
+    int rc = read_value(SYMBOL_BITS, &byte_value);
+    *value = (byte_t)byte_value;
+    return rc;
+}
 
-    if(node == NULL) {
-        log_error("decode_existing_symbol", "cannot find node: in_bit_idx=%u last_bit_idx=%u bin=%s\n",
-                in_bit_idx, last_bit_idx, fmt_bit_array(&bit_array) );
+/**
+ * decode a symbol with the given tree, then update the tree
+ * the NYT is followed by the symbol encoded with the escape_tree or,
+ * without escape_tree, by the symbol binary value
+ * @param tree
+ * @param escape_tree: may be NULL
+ * @param symbol: the decoded symbol
+ * @return RC_OK / RC_FAIL
+ */
+int decode_symbol(adh_tree_t *tree, adh_tree_t *escape_tree, adh_symbol_t *symbol) {
+    adh_node_t* node = read_node(tree);
+    if(node == NULL)
         return RC_FAIL;
+
+    if(node != tree->nyt) {
+        *symbol = node->symbol;
+        adh_update_tree(tree, node, false);
+        return RC_OK;
     }
 
-#ifdef _DEBUG
-    log_debug("decode_existing_symbol", "%s bin=%s\n", fmt_symbol(node->symbol), fmt_bit_array(&bit_array));
-#endif
+    int rc;
+    if(escape_tree != NULL)
+        rc = decode_symbol(escape_tree, NULL, symbol);
+    else
+        rc = decode_new_symbol(tree, symbol);
+    if(rc == RC_FAIL)
+        return rc;
+
+    node = adh_create_node_and_append(tree, *symbol);
+    if(node == NULL)
+        return RC_FAIL;
 
-    in_bit_idx = original_input_buffer_bit_idx + bit_array.length;
-    output_symbol((byte_t)node->symbol);
-    adh_update_tree(node, false);
+    adh_update_tree(tree, node, true);
     return RC_OK;
 }
 
+/**
+ * walk the tree from the root until a leaf is reached, 0 = left node, 1 = right node:
+ * first through the lookup table of the tree if any (see read_lookup), then one input bit per level
+ * @param tree
+ * @return the leaf, NULL if the input ends before reaching a leaf
+ */
+adh_node_t* read_node(adh_tree_t *tree) {
+    ADH_TRACE("read_node", "in_bit_idx=%lld last_bit_idx=%lld\n", in_bit_idx, last_bit_idx);
+
+    uint64_t start = adh_timer_start(ADH_PHASE_BITS);
+    adh_node_t* node = tree->root;
+    if(node->left != NULL && node->weight >= LOOKUP_MIN_WEIGHT && node->weight >= tree->lookup_weight
+       && in_bit_idx + ADH_LOOKUP_BITS - 1 <= input_last_bit)
+        node = read_lookup(tree);
+
+    while(node != NULL && node->left != NULL) {
+        if(in_bit_idx > input_last_bit && fill_input() != RC_OK) {
+            log_error("read_node", "too many bits read: in_bit_idx (%" PRId64 ") > last_bit_idx (%" PRId64 ")\n", in_bit_idx, last_bit_idx);
+            node = NULL;
+            break;
+        }
+
+        byte_t input_byte = input_buffer[bit_idx_to_byte_idx(in_bit_idx - input_start_bit)];
+        byte_t value = bit_check(input_byte, (unsigned int)bit_pos_in_current_byte(in_bit_idx));
+        node = (value == BIT_1) ? node->right : node->left;
+        in_bit_idx++;
+    }
+    adh_timer_stop(ADH_PHASE_BITS, start);
+    return node;
+}
+
+/**
+ * consume the next ADH_LOOKUP_BITS bits, or the shorter code they start with, in a single table lookup.
+ * The table is allocated on first use and filled on demand; it is dropped when its misses cost more
+ * than its hits save, in the trees whose nodes keep swapping
+ * @param tree: the window holds the next ADH_LOOKUP_BITS bits
+ * @return the leaf, or the node to continue from, NULL if the table cannot be allocated
+ */
+adh_node_t* read_lookup(adh_tree_t *tree) {
+    if(tree->lookup == NULL && adh_lookup_enable(tree) != RC_OK)
+        return NULL;
+
+    uint32_t index = bit_peek(input_buffer, (uint64_t)(in_bit_idx - input_start_bit), ADH_LOOKUP_BITS);
+    uint16_t entry = tree->lookup[index];
+    if(entry != 0) {
+        if(tree->lookup_score < LOOKUP_MAX_SCORE)
+            tree->lookup_score++;
+    } else {
+        entry = adh_lookup_fill(tree, index);
+        tree->lookup_score -= LOOKUP_MISS_COST;
+    }
+
+    adh_node_t* node = &tree->nodes[entry >> ADH_LOOKUP_LENGTH_BITS];
+    in_bit_idx += entry & ADH_LOOKUP_LENGTH_MASK;
+    if(tree->lookup_score <= -LOOKUP_MAX_SCORE)
+        adh_lookup_disable(tree);
+    return node;
+}
+
+/**
+ * flush output buffer to file
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int flush_uncompressed(FILE *output_file_ptr) {
+    ADH_DEBUG("flush_uncompressed", "in_bit_idx=%-8" PRId64 " output_byte_idx=%d\n", in_bit_idx, output_byte_idx);
+
+    uint64_t start = adh_timer_start(ADH_PHASE_WRITE);
+    size_t bytes_written = fwrite(output_buffer, sizeof(byte_t), output_byte_idx, output_file_ptr);
+    adh_timer_stop(ADH_PHASE_WRITE, start);
+    if(bytes_written != output_byte_idx) {
+        log_error("flush_uncompressed", "bytes_written (%zu) != out_byte_idx (%u)\n", bytes_written, output_byte_idx);
+        return RC_FAIL;
+    }
+
+    output_byte_idx = 0;
+    return adh_progress_update(0, bytes_written);
+}
+
 /**
  * write to output buffer the symbol
  * @param symbol
  */
 void output_symbol(byte_t symbol) {
-#ifdef _DEBUG
-    log_debug("  output_symbol", "%s in_bit_idx=%-8u\n",
-            fmt_symbol(symbol),
-            in_bit_idx);
-#endif
+    ADH_TRACE("  output_symbol", "symbol=%lld in_bit_idx=%lld\n", symbol, in_bit_idx);
 
     output_buffer[output_byte_idx] = symbol;
     output_byte_idx++;
 }
 
 /**
- * interpret the input as a new symbol, then update the tree
- * @param input_buffer
+ * read the binary value of a new symbol, using the symbol bits of the tree
+ * with compact escapes, read the index of the symbol among the symbols not yet seen
+ * @param tree
+ * @param symbol: the decoded symbol
  * @return RC_OK / RC_FAIL
  */
-int decode_new_symbol(const byte_t input_buffer[]) {
-#ifdef _DEBUG
-    log_debug("decode_new_symbol", "in_bit_idx=%-8u\n", in_bit_idx);
-#endif
-
-    byte_t  new_symbol[1] = {0};
-    int     num_bytes = read_data_cross_bytes(input_buffer, SYMBOL_BITS, new_symbol);
-    if(num_bytes > 1) {
-        log_error("decode_new_symbol", "expected 1 byte received %d bytes", num_bytes);
-        return RC_FAIL;
-    }
-
-    output_symbol(new_symbol[0]);
-    adh_node_t * node = adh_create_node_and_append(new_symbol[0]);
-    adh_update_tree(node, true);
-    return RC_OK;
+int decode_new_symbol(const adh_tree_t *tree, adh_symbol_t *symbol) {
+    ADH_TRACE("decode_new_symbol", "in_bit_idx=%lld\n", in_bit_idx);
+    return adh_escape_decode(tree, model.flags, read_escape_bits, NULL, symbol);
 }
 
 /**
- * copy the input to an auxiliary buffer (sub_buffer)
- * since the input could start in the middle of a byte
- * it will be easier to process the aux buffer
- * @param input_buffer
- * @param max_bits_to_read
- * @param sub_buffer
+ * read the bits of an escape from the bit stream
+ * @param ctx: unused
+ * @param num_bits
+ * @param value
  * @return RC_OK / RC_FAIL
  */
-int read_data_cross_bytes(const byte_t input_buffer[], int max_bits_to_read, byte_t sub_buffer[]) {
-#ifdef _DEBUG
-    log_debug("  read_data_cross_bytes", "in_bit_idx=%-8u last_bit_idx=%u max_bits_to_read=%-8d\n",
-            in_bit_idx, last_bit_idx, max_bits_to_read);
-#endif
-
-    int sub_buffer_bit_idx = 0;
-    while(max_bits_to_read > 0) {
-        if(in_bit_idx > last_bit_idx) {
-#ifdef _DEBUG
-            log_debug("  read_data_cross_bytes",
-                    "in_bit_idx=%-8u last_bit_idx=%u max_bits_to_read=%-8d (in_bit_idx > last_bit_idx) break\n",
-                    in_bit_idx, last_bit_idx, max_bits_to_read);
-#endif
-            break;
-        }
+int read_escape_bits(void *ctx, int num_bits, uint32_t *value) {
+    (void) ctx;
+    return decode_value(num_bits, value);
+}
 
-        int in_available_bits = get_available_bits(in_bit_idx);
-        int bits_to_copy = in_available_bits > max_bits_to_read ? max_bits_to_read : in_available_bits;
+/**
+ * read a value written with the most significant bit first
+ * @param num_bits: up to 32, must be available in input
+ * @param value
+ * @return RC_OK / RC_FAIL if the input cannot be read
+ */
+int read_value(int num_bits, uint32_t *value) {
+    uint64_t start = adh_timer_start(ADH_PHASE_BITS);
+    int rc = RC_OK;
+    *value = 0;
+    for (int i = 0; i < num_bits; ++i) {
+        if(in_bit_idx > input_last_bit && (rc = fill_input()) != RC_OK)
+            break;
 
-        int read_bit_idx = bit_pos_in_current_byte(in_bit_idx);
-        int write_bit_idx = bit_pos_in_current_byte(sub_buffer_bit_idx);
-        long sub_byte_idx = bit_idx_to_byte_idx(sub_buffer_bit_idx);
+        byte_t input_byte = input_buffer[bit_idx_to_byte_idx(in_bit_idx - input_start_bit)];
+        byte_t bit = bit_check(input_byte, (unsigned int)bit_pos_in_current_byte(in_bit_idx));
+        *value = (*value << 1) | (bit == BIT_1 ? 1u : 0u);
+        in_bit_idx++;
+    }
+    adh_timer_stop(ADH_PHASE_BITS, start);
+    return rc;
+}
 
-        // copy bits from most significant bit to least significant
-        // e.g. from 5th and size 4 -> 5,4,3,2
-        long input_byte_idx = bit_idx_to_byte_idx(in_bit_idx);
-        bit_copy(input_buffer[input_byte_idx], &sub_buffer[sub_byte_idx], read_bit_idx, write_bit_idx, bits_to_copy);
+/**
+ * move the input window to the next INPUT_BUFFER_SIZE bytes of the stream
+ * the bits are read in sequence: in_bit_idx is the first bit after the current window
+ * @return RC_OK / RC_FAIL at the end of the bit stream or on read error
+ */
+int fill_input() {
+    if(in_bit_idx > last_bit_idx)
+        return RC_FAIL;
 
-        in_bit_idx += bits_to_copy;
-        sub_buffer_bit_idx += bits_to_copy;
-        max_bits_to_read -= bits_to_copy;
+    uint64_t start = adh_timer_start(ADH_PHASE_READ);
+    size_t bytes_read = fread(input_buffer, sizeof(byte_t), INPUT_BUFFER_SIZE, input_stream);
+    adh_timer_stop(ADH_PHASE_READ, start);
+    if(bytes_read == 0) {
+        log_error("fill_input", "cannot read the input at bit %" PRId64 "\n", in_bit_idx);
+        return RC_FAIL;
     }
 
-    return bit_idx_to_byte_idx(sub_buffer_bit_idx-1) + 1;
+    input_start_bit = input_end_bit;
+    input_end_bit += (int64_t)bytes_read * SYMBOL_BITS;
+    input_last_bit = input_end_bit - 1 < last_bit_idx ? input_end_bit - 1 : last_bit_idx;
+    return adh_progress_update(bytes_read, 0);
 }
 
 /**
- * get the file size (in bytes)
+ * get the file size (in bytes), then rewind
  * @param input_file_ptr
- * @return the file size
+ * @return the file size, -1 on error
  */
-long get_file_size(FILE *input_file_ptr) {
-    fseek(input_file_ptr, 0 , SEEK_END);
-    long file_size = ftell(input_file_ptr);
-    fseek(input_file_ptr, 0 , SEEK_SET);
+int64_t get_file_size(FILE *input_file_ptr) {
+    if(bin_seek(input_file_ptr, 0, SEEK_END) != RC_OK)
+        return -1;
+    int64_t file_size = bin_tell(input_file_ptr);
+    if(bin_seek(input_file_ptr, 0, SEEK_SET) != RC_OK)
+        return -1;
     return file_size;
 }
 
 /**
- * read the compressed file header
+ * read the compressed file header: the format flags, then the first byte of the bit stream
  * @param inputFilePtr
+ * @return RC_OK / RC_FAIL
  */
-void read_header(FILE *inputFilePtr) {
+int read_header(FILE *inputFilePtr) {
+    byte_t flags;
     byte_t header;
-    fread(&header, sizeof(byte_t), 1, inputFilePtr);
+    if(fread(&flags, sizeof(byte_t), FLAGS_BYTES, inputFilePtr) != FLAGS_BYTES
+       || fread(&header, sizeof(byte_t), 1, inputFilePtr) != 1) {
+        log_error("read_header", "cannot read header\n");
+        return RC_FAIL;
+    }
 
     first_byte_union first_byte;
     first_byte.raw = header;
 
     bits_to_ignore = first_byte.split.header;
-    in_bit_idx = HEADER_BITS;
+    num_lanes = (flags & ADH_FLAG_INTERLEAVED) ? header : 0;
+    static_version = (flags & ADH_FLAG_STATIC) ? header : 0;
+    in_bit_idx = FLAGS_BYTES * SYMBOL_BITS + HEADER_BITS;
     output_byte_idx = 0;
 
-#ifdef _DEBUG
-    log_debug("read_header", "bits_to_ignore=%d\n", bits_to_ignore);
-#endif
-}
+    ADH_DEBUG("read_header", "flags=%02X bits_to_ignore=%d\n", flags, bits_to_ignore);
 
-/**
- * compare bit by bit, the input and nyt coding
- * @param input_buffer
- * @param in_bit_idx
- * @param last_bit_idx
- * @param bit_array_nyt
- * @return true if they are equals, otherwise false
- */
-bool compare_input_and_nyt(const byte_t *input_buffer,
-        long in_bit_idx,
-        long last_bit_idx,
-        const bit_array_t *bit_array_nyt) {
-    int size = bit_array_nyt->length;
-    if(last_bit_idx - in_bit_idx < size)
-        return false;
-
-#ifdef _DEBUG
-        log_debug("compare_input_and_nyt", "in_bit_idx=%-8d NYT=%s\n",
-              in_bit_idx,
-              fmt_bit_array(bit_array_nyt));
-#endif
-
-    bool have_same_bits = true;
-    for(int offset=0; offset<size; offset++) {
-        long byte_idx = bit_idx_to_byte_idx(in_bit_idx + offset);
-        byte_t input_byte = input_buffer[byte_idx];
-
-        int input_byte_bit_idx = bit_pos_in_current_byte(in_bit_idx + offset);
-        byte_t value = bit_check(input_byte, (unsigned int)input_byte_bit_idx);
-        if(value != bit_array_nyt->buffer[size-offset-1]) {
-            have_same_bits = false;
-            break;
-        }
-    }
-    return have_same_bits;
+    return adh_model_init(&model, flags);
 }
@@ -4,6 +4,9 @@
 //
 // public methods
 //
+#include <stdio.h>
+
 int adh_decompress_file(const char input_file_name[], const char output_file_name[]);
+int adh_decompress_stream(FILE *input_file_ptr, FILE *output_file_ptr);
 
 #endif //ALGO_ADHUFF_DECOMPRESS_H
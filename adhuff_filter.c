@@ -0,0 +1,598 @@
+#include <string.h>
+
+#include "adhuff_filter.h"
+#include "adhuff_common.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    BWT_INDEX_BYTES     = 4,    // primary index, stored before the transformed block
+    SAIS_ALPHABET       = ADH_MAX_SYMBOLS + 1,  // bytes + sentinel
+    ZRLE_MAX_COUNT      = 255
+};
+
+//
+// private methods
+//
+int     bwt_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     bwt_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     mtf_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     mtf_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     zrle_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     zrle_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+int     sais(const int s[], int sa[], int n, int k);
+
+//
+// available filters
+//
+const adh_filter_t ADH_FILTER_BWT  = { "bwt",  bwt_forward,  bwt_inverse };
+const adh_filter_t ADH_FILTER_MTF  = { "mtf",  mtf_forward,  mtf_inverse };
+const adh_filter_t ADH_FILTER_ZRLE = { "zrle", zrle_forward, zrle_inverse };
+
+/**
+ * initialize the pipeline with the filters selected by the format flags
+ * @param pipeline
+ * @param flags: ADH_FLAG_*
+ * @return RC_OK / RC_FAIL
+ */
+int adh_pipeline_init(adh_pipeline_t *pipeline, byte_t flags) {
+    memset(pipeline, 0, sizeof(adh_pipeline_t));
+
+    pipeline->buffers[0] = adh_malloc(FILTER_BUFFER_SIZE);
+    pipeline->buffers[1] = adh_malloc(FILTER_BUFFER_SIZE);
+    if(pipeline->buffers[0] == NULL || pipeline->buffers[1] == NULL) {
+        log_error("adh_pipeline_init", "cannot allocate filter buffers\n");
+        return RC_FAIL;
+    }
+
+    int rc = RC_OK;
+    if(flags & ADH_FLAG_BWT) {
+        rc = adh_pipeline_add(pipeline, &ADH_FILTER_BWT);
+        if(rc == RC_OK) rc = adh_pipeline_add(pipeline, &ADH_FILTER_MTF);
+        if(rc == RC_OK) rc = adh_pipeline_add(pipeline, &ADH_FILTER_ZRLE);
+    }
+    return rc;
+}
+
+/**
+ * release the pipeline buffers
+ * @param pipeline
+ */
+void adh_pipeline_release(adh_pipeline_t *pipeline) {
+    adh_free(pipeline->buffers[0]);
+    adh_free(pipeline->buffers[1]);
+    pipeline->buffers[0] = NULL;
+    pipeline->buffers[1] = NULL;
+    pipeline->length = 0;
+}
+
+/**
+ * append a filter to the pipeline
+ * @param pipeline
+ * @param filter
+ * @return RC_OK / RC_FAIL
+ */
+int adh_pipeline_add(adh_pipeline_t *pipeline, const adh_filter_t *filter) {
+    if(pipeline->length == MAX_FILTERS) {
+        log_error("adh_pipeline_add", "too many filters, cannot add %s\n", filter->name);
+        return RC_FAIL;
+    }
+
+    pipeline->filters[pipeline->length] = filter;
+    pipeline->length++;
+    return RC_OK;
+}
+
+/**
+ * apply the filters to a block (at most FILTER_BLOCK_SIZE bytes)
+ * @param pipeline
+ * @param in
+ * @param in_len
+ * @param out: points to the filtered block, owned by the pipeline
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int adh_pipeline_forward(adh_pipeline_t *pipeline, const byte_t in[], size_t in_len,
+                         const byte_t **out, size_t *out_len) {
+    *out = in;
+    *out_len = in_len;
+
+    for (int i = 0; i < pipeline->length; ++i) {
+        byte_t * buffer = pipeline->buffers[i % 2];
+        int rc = pipeline->filters[i]->forward(*out, *out_len, buffer, FILTER_BUFFER_SIZE, out_len);
+        if(rc != RC_OK) {
+            log_error("adh_pipeline_forward", "filter %s failed\n", pipeline->filters[i]->name);
+            return rc;
+        }
+        *out = buffer;
+    }
+    return RC_OK;
+}
+
+/**
+ * restore a filtered block, applying the inverse filters in reverse order
+ * @param pipeline
+ * @param in
+ * @param in_len
+ * @param out: points to the original block, owned by the pipeline
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int adh_pipeline_inverse(adh_pipeline_t *pipeline, const byte_t in[], size_t in_len,
+                         const byte_t **out, size_t *out_len) {
+    *out = in;
+    *out_len = in_len;
+
+    for (int i = pipeline->length - 1; i >= 0; --i) {
+        byte_t * buffer = pipeline->buffers[i % 2];
+        if(buffer == *out)
+            buffer = pipeline->buffers[(i + 1) % 2];
+
+        int rc = pipeline->filters[i]->inverse(*out, *out_len, buffer, FILTER_BUFFER_SIZE, out_len);
+        if(rc != RC_OK) {
+            log_error("adh_pipeline_inverse", "filter %s failed\n", pipeline->filters[i]->name);
+            return rc;
+        }
+        *out = buffer;
+    }
+    return RC_OK;
+}
+
+//
+// Burrows-Wheeler transform
+//
+
+/**
+ * block sorting transform, the suffix array is built with SA-IS in linear time
+ * output: primary index (4 bytes, big endian) followed by the last column without the sentinel
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int bwt_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    if(in_len + BWT_INDEX_BYTES > out_capacity || in_len >= INT_MAX) {
+        log_error("bwt_forward", "block too large: %zu\n", in_len);
+        return RC_FAIL;
+    }
+
+    if(in_len == 0) {
+        memset(out, 0, BWT_INDEX_BYTES);
+        *out_len = BWT_INDEX_BYTES;
+        return RC_OK;
+    }
+
+    int n = (int)in_len + 1;
+    int * s = adh_malloc(n * sizeof(int));
+    int * sa = adh_malloc(n * sizeof(int));
+    if(s == NULL || sa == NULL) {
+        adh_free(s);
+        adh_free(sa);
+        log_error("bwt_forward", "cannot allocate suffix array\n");
+        return RC_FAIL;
+    }
+
+    // shift bytes by one, 0 is the sentinel (unique and smallest)
+    for (int i = 0; i < n - 1; ++i) {
+        s[i] = in[i] + 1;
+    }
+    s[n - 1] = 0;
+
+    int rc = sais(s, sa, n, SAIS_ALPHABET);
+
+    uint32_t primary = 0;
+    size_t j = BWT_INDEX_BYTES;
+    for (int i = 0; i < n && rc == RC_OK; ++i) {
+        if(sa[i] == 0) {
+            primary = (uint32_t)i;  // the row of the sentinel, not stored
+        } else {
+            out[j] = in[sa[i] - 1];
+            j++;
+        }
+    }
+
+    bin_put_be(out, primary, BWT_INDEX_BYTES);
+    *out_len = j;
+
+    adh_free(s);
+    adh_free(sa);
+    return rc;
+}
+
+/**
+ * inverse block sorting transform, follows the LF mapping from the last row
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int bwt_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    if(in_len < BWT_INDEX_BYTES || in_len - BWT_INDEX_BYTES > out_capacity || in_len >= INT_MAX) {
+        log_error("bwt_inverse", "invalid block length: %zu\n", in_len);
+        return RC_FAIL;
+    }
+
+    uint32_t primary = (uint32_t)bin_get_be(in, BWT_INDEX_BYTES);
+    const byte_t * last = in + BWT_INDEX_BYTES;
+    int n = (int)(in_len - BWT_INDEX_BYTES);
+    *out_len = n;
+    if(n == 0)
+        return RC_OK;
+
+    if(primary == 0 || primary > (uint32_t)n) {
+        log_error("bwt_inverse", "invalid primary index: %u\n", primary);
+        return RC_FAIL;
+    }
+
+    int * lf = adh_malloc((n + 1) * sizeof(int));
+    if(lf == NULL) {
+        log_error("bwt_inverse", "cannot allocate LF mapping\n");
+        return RC_FAIL;
+    }
+
+    // first row of each symbol, the sentinel is the first row
+    int first[ADH_MAX_SYMBOLS] = {0};
+    for (int i = 0; i < n; ++i) {
+        first[last[i]]++;
+    }
+    int sum = 1;
+    for (int c = 0; c < ADH_MAX_SYMBOLS; ++c) {
+        int count = first[c];
+        first[c] = sum;
+        sum += count;
+    }
+
+    // the row of the sentinel (primary) is skipped in the stored column
+    for (int row = 0, i = 0; row <= n; ++row) {
+        if(row == (int)primary) {
+            lf[row] = 0;
+            continue;
+        }
+        lf[row] = first[last[i]]++;
+        i++;
+    }
+
+    // row 0 ends with the last symbol, walk backwards
+    int row = 0;
+    for (int k = n - 1; k >= 0; --k) {
+        byte_t c = last[row < (int)primary ? row : row - 1];
+        out[k] = c;
+        row = lf[row];
+    }
+
+    adh_free(lf);
+    return RC_OK;
+}
+
+//
+// Move-to-front
+//
+
+/**
+ * replace each byte with its position in a list of recently used bytes
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int mtf_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    if(in_len > out_capacity)
+        return RC_FAIL;
+
+    byte_t list[ADH_MAX_SYMBOLS];
+    for (int i = 0; i < ADH_MAX_SYMBOLS; ++i) {
+        list[i] = (byte_t)i;
+    }
+
+    for (size_t i = 0; i < in_len; ++i) {
+        byte_t c = in[i];
+        int pos = 0;
+        while(list[pos] != c) {
+            pos++;
+        }
+        memmove(&list[1], &list[0], pos);
+        list[0] = c;
+        out[i] = (byte_t)pos;
+    }
+
+    *out_len = in_len;
+    return RC_OK;
+}
+
+/**
+ * replace each position with the byte stored there in the list of recently used bytes
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int mtf_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    if(in_len > out_capacity)
+        return RC_FAIL;
+
+    byte_t list[ADH_MAX_SYMBOLS];
+    for (int i = 0; i < ADH_MAX_SYMBOLS; ++i) {
+        list[i] = (byte_t)i;
+    }
+
+    for (size_t i = 0; i < in_len; ++i) {
+        int pos = in[i];
+        byte_t c = list[pos];
+        memmove(&list[1], &list[0], pos);
+        list[0] = c;
+        out[i] = c;
+    }
+
+    *out_len = in_len;
+    return RC_OK;
+}
+
+//
+// Zero-run length encoding
+//
+
+/**
+ * a single zero is kept, a run of L >= 2 zeros becomes 0 0 followed by L-2,
+ * written as a sequence of 255 terminated by a byte < 255
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int zrle_forward(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    size_t j = 0;
+    size_t i = 0;
+    while(i < in_len) {
+        // worst case: a run of 2 zeros needs 3 bytes
+        if(j + 3 > out_capacity)
+            return RC_FAIL;
+
+        if(in[i] != 0) {
+            out[j++] = in[i++];
+            continue;
+        }
+
+        size_t run = 0;
+        while(i < in_len && in[i] == 0) {
+            run++;
+            i++;
+        }
+
+        out[j++] = 0;
+        if(run == 1)
+            continue;
+
+        out[j++] = 0;
+        size_t count = run - 2;
+        while(count >= ZRLE_MAX_COUNT) {
+            if(j + 2 > out_capacity)
+                return RC_FAIL;
+            out[j++] = ZRLE_MAX_COUNT;
+            count -= ZRLE_MAX_COUNT;
+        }
+        out[j++] = (byte_t)count;
+    }
+
+    *out_len = j;
+    return RC_OK;
+}
+
+/**
+ * expand the zero runs
+ * @param in
+ * @param in_len
+ * @param out
+ * @param out_capacity
+ * @param out_len
+ * @return RC_OK / RC_FAIL
+ */
+int zrle_inverse(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len) {
+    size_t j = 0;
+    size_t i = 0;
+    while(i < in_len) {
+        size_t run = 1;
+        if(in[i] == 0 && i + 1 < in_len && in[i + 1] == 0) {
+            // 0 0 count...
+            i += 2;
+            run = 2;
+            while(i < in_len && in[i] == ZRLE_MAX_COUNT) {
+                run += ZRLE_MAX_COUNT;
+                i++;
+            }
+            if(i == in_len) {
+                log_error("zrle_inverse", "truncated zero run\n");
+                return RC_FAIL;
+            }
+            run += in[i];
+        }
+
+        if(j + run > out_capacity) {
+            log_error("zrle_inverse", "block too large\n");
+            return RC_FAIL;
+        }
+
+        byte_t c = in[i];
+        if(run > 1)
+            c = 0;
+        memset(&out[j], c, run);
+        j += run;
+        i++;
+    }
+
+    *out_len = j;
+    return RC_OK;
+}
+
+//
+// SA-IS suffix array construction
+// G. Nong, S. Zhang, W. H. Chan, "Two Efficient Algorithms for Linear Time Suffix Array Construction"
+//
+
+#define IS_LMS(t, i)    ((i) > 0 && (t)[i] && !(t)[(i) - 1])
+
+/**
+ * compute the start (or the end) of each bucket
+ * @param s
+ * @param n
+ * @param k
+ * @param bkt
+ * @param end
+ */
+void sais_get_buckets(const int s[], int n, int k, int bkt[], bool end) {
+    memset(bkt, 0, k * sizeof(int));
+    for (int i = 0; i < n; ++i) {
+        bkt[s[i]]++;
+    }
+
+    int sum = 0;
+    for (int c = 0; c < k; ++c) {
+        sum += bkt[c];
+        bkt[c] = end ? sum : sum - bkt[c];
+    }
+}
+
+/**
+ * induced sort of the L-type and then the S-type suffixes
+ * @param s
+ * @param t: suffix types, 1 = S, 0 = L
+ * @param sa
+ * @param n
+ * @param k
+ * @param bkt
+ */
+void sais_induce(const int s[], const byte_t t[], int sa[], int n, int k, int bkt[]) {
+    sais_get_buckets(s, n, k, bkt, false);
+    for (int i = 0; i < n; ++i) {
+        int j = sa[i] - 1;
+        if(sa[i] > 0 && !t[j])
+            sa[bkt[s[j]]++] = j;
+    }
+
+    sais_get_buckets(s, n, k, bkt, true);
+    for (int i = n - 1; i >= 0; --i) {
+        int j = sa[i] - 1;
+        if(sa[i] > 0 && t[j])
+            sa[--bkt[s[j]]] = j;
+    }
+}
+
+/**
+ * build the suffix array of s, the last symbol must be a unique 0 sentinel
+ * @param s
+ * @param sa
+ * @param n: length of s (including the sentinel)
+ * @param k: alphabet size
+ * @return RC_OK / RC_FAIL
+ */
+int sais(const int s[], int sa[], int n, int k) {
+    byte_t * t = adh_malloc(n);
+    int * bkt = adh_malloc(k * sizeof(int));
+    if(t == NULL || bkt == NULL) {
+        adh_free(t);
+        adh_free(bkt);
+        log_error("sais", "cannot allocate buffers\n");
+        return RC_FAIL;
+    }
+
+    // classify suffixes: the sentinel is S-type
+    t[n - 1] = 1;
+    for (int i = n - 2; i >= 0; --i) {
+        t[i] = (byte_t)(s[i] < s[i + 1] || (s[i] == s[i + 1] && t[i + 1]));
+    }
+
+    // sort the LMS substrings
+    sais_get_buckets(s, n, k, bkt, true);
+    for (int i = 0; i < n; ++i) {
+        sa[i] = -1;
+    }
+    for (int i = 1; i < n; ++i) {
+        if(IS_LMS(t, i))
+            sa[--bkt[s[i]]] = i;
+    }
+    sais_induce(s, t, sa, n, k, bkt);
+
+    // compact the sorted LMS substrings in the first n1 items
+    int n1 = 0;
+    for (int i = 0; i < n; ++i) {
+        if(IS_LMS(t, sa[i]))
+            sa[n1++] = sa[i];
+    }
+
+    // name the LMS substrings
+    for (int i = n1; i < n; ++i) {
+        sa[i] = -1;
+    }
+    int name = 0;
+    int prev = -1;
+    for (int i = 0; i < n1; ++i) {
+        int pos = sa[i];
+        bool diff = false;
+        for (int d = 0; d < n; ++d) {
+            if(prev == -1 || s[pos + d] != s[prev + d] || t[pos + d] != t[prev + d]) {
+                diff = true;
+                break;
+            }
+            if(d > 0 && (IS_LMS(t, pos + d) || IS_LMS(t, prev + d)))
+                break;
+        }
+        if(diff) {
+            name++;
+            prev = pos;
+        }
+        sa[n1 + pos / 2] = name - 1;
+    }
+    for (int i = n - 1, j = n - 1; i >= n1; --i) {
+        if(sa[i] >= 0)
+            sa[j--] = sa[i];
+    }
+
+    // sort the reduced string, recursively if names are not unique
+    int rc = RC_OK;
+    int * sa1 = sa;
+    int * s1 = sa + n - n1;
+    if(name < n1) {
+        rc = sais(s1, sa1, n1, name);
+    } else {
+        for (int i = 0; i < n1; ++i) {
+            sa1[s1[i]] = i;
+        }
+    }
+
+    // induce the suffix array from the sorted LMS suffixes
+    if(rc == RC_OK) {
+        sais_get_buckets(s, n, k, bkt, true);
+        for (int i = 1, j = 0; i < n; ++i) {
+            if(IS_LMS(t, i))
+                s1[j++] = i;
+        }
+        for (int i = 0; i < n1; ++i) {
+            sa1[i] = s1[sa1[i]];
+        }
+        for (int i = n1; i < n; ++i) {
+            sa[i] = -1;
+        }
+        for (int i = n1 - 1; i >= 0; --i) {
+            int j = sa[i];
+            sa[i] = -1;
+            sa[--bkt[s[j]]] = j;
+        }
+        sais_induce(s, t, sa, n, k, bkt);
+    }
+
+    adh_free(t);
+    adh_free(bkt);
+    return rc;
+}
@@ -0,0 +1,49 @@
+#ifndef ALGO_ADHUFF_FILTER_H
+#define ALGO_ADHUFF_FILTER_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ */
+enum {
+    FILTER_BLOCK_SIZE   = 512 * 1024,                   // input bytes per block
+    FILTER_BUFFER_SIZE  = FILTER_BLOCK_SIZE * 2 + 64,   // room for the expansion of any filter
+    FILTER_BLOCK_BITS   = 32,                           // bits to store the length of a filtered block
+    MAX_FILTERS         = 4
+};
+
+/*
+ * a filter transforms a block of bytes, inverse must restore the original block
+ * side information (e.g. BWT primary index) is stored inside the output block
+ */
+typedef int (*adh_filter_fn)(const byte_t in[], size_t in_len, byte_t out[], size_t out_capacity, size_t *out_len);
+
+typedef struct {
+    const char *        name;
+    adh_filter_fn       forward;
+    adh_filter_fn       inverse;
+} adh_filter_t;
+
+/*
+ * filters applied in order before the coder, in reverse order after the decoder
+ */
+typedef struct {
+    int                 length;
+    const adh_filter_t* filters[MAX_FILTERS];
+    byte_t *            buffers[2];                     // ping-pong buffers of FILTER_BUFFER_SIZE
+} adh_pipeline_t;
+
+extern const adh_filter_t   ADH_FILTER_BWT;
+extern const adh_filter_t   ADH_FILTER_MTF;
+extern const adh_filter_t   ADH_FILTER_ZRLE;
+
+int         adh_pipeline_init(adh_pipeline_t *pipeline, byte_t flags);
+void        adh_pipeline_release(adh_pipeline_t *pipeline);
+int         adh_pipeline_add(adh_pipeline_t *pipeline, const adh_filter_t *filter);
+int         adh_pipeline_forward(adh_pipeline_t *pipeline, const byte_t in[], size_t in_len,
+                                 const byte_t **out, size_t *out_len);
+int         adh_pipeline_inverse(adh_pipeline_t *pipeline, const byte_t in[], size_t in_len,
+                                 const byte_t **out, size_t *out_len);
+
+#endif //ALGO_ADHUFF_FILTER_H
@@ -0,0 +1,461 @@
+#include <string.h>
+
+#include "adhuff_interleave.h"
+#include "adhuff_common.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    BLOCK_COUNT_BYTES   = 4,
+    MAX_HEADER_BYTES    = BLOCK_COUNT_BYTES * (1 + INTERLEAVE_MAX_LANES),
+    LANE_INITIAL_BYTES  = 2 * INTERLEAVE_LANE_SYMBOLS     // 16 bits per symbol, grown if needed
+};
+
+/*
+ * a lane: the tree and the bit stream of one symbol out of K
+ */
+typedef struct {
+    adh_tree_t *        tree;
+    byte_t *            data;           // encoder: bit stream of the current block
+    size_t              capacity;
+    const byte_t *      input;          // decoder: bit stream of the current block, in the block buffer
+    uint64_t            bit_idx;        // bits written / read in the current block
+    uint64_t            bit_len;        // decoder: bits of the lane in the current block
+} interleave_lane_t;
+
+typedef struct {
+    byte_t              flags;
+    int                 num_lanes;
+    interleave_lane_t   lanes[INTERLEAVE_MAX_LANES];
+    byte_t *            block;          // input bytes (encoder) or decoded bytes (decoder) of a block
+    byte_t *            streams;        // decoder: the bit streams of a block
+    size_t              streams_capacity;
+} interleave_t;
+
+//
+// private methods
+//
+int     interleave_init(interleave_t *il, byte_t flags, int num_lanes, bool encoder);
+void    interleave_release(interleave_t *il);
+int     interleave_encode_symbol(interleave_t *il, interleave_lane_t *lane, adh_symbol_t symbol);
+int     interleave_put_bits(interleave_lane_t *lane, const bit_array_t *bit_array);
+int     interleave_write_block(interleave_t *il, size_t num_symbols, FILE *output_file_ptr);
+int     interleave_read_block(interleave_t *il, FILE *input_file_ptr, size_t *num_symbols);
+int     interleave_decode_block(interleave_t *il, size_t num_symbols);
+int     interleave_read_bits(void *ctx, int num_bits, uint32_t *value);
+int     interleave_read_value(interleave_lane_t *lane, int num_bits, uint32_t *value);
+
+/**
+ * code the input with num_lanes lanes, after the format flags already written
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @param flags: ADH_FLAG_*, compact escapes are the only option used by the lanes
+ * @param num_lanes: [1..INTERLEAVE_MAX_LANES], 0 = default
+ * @return RC_OK / RC_FAIL
+ */
+int adh_interleave_encode(FILE *input_file_ptr, FILE *output_file_ptr, byte_t flags, int num_lanes) {
+    if(num_lanes == 0)
+        num_lanes = INTERLEAVE_DEFAULT_LANES;
+
+    interleave_t il;
+    int rc = interleave_init(&il, flags, num_lanes, true);
+
+    byte_t header[2] = { (byte_t)num_lanes, ADH_FORMAT_WEIGHT_BITS };
+    if(rc == RC_OK && fwrite(header, sizeof(byte_t), 2, output_file_ptr) != 2) {
+        log_error("adh_interleave_encode", "cannot write the number of lanes\n");
+        rc = RC_FAIL;
+    }
+    if(rc == RC_OK)
+        rc = adh_progress_update(0, 2);
+
+    size_t block_size = (size_t)num_lanes * INTERLEAVE_LANE_SYMBOLS;
+    size_t num_symbols = 0;
+    uint64_t read_start = adh_timer_start(ADH_PHASE_READ);
+    while (rc == RC_OK && (num_symbols = fread(il.block, sizeof(byte_t), block_size, input_file_ptr)) > 0) {
+        adh_timer_stop(ADH_PHASE_READ, read_start);
+        rc = adh_progress_update(num_symbols, 0);
+
+        for (int j = 0; j < num_lanes; ++j) {
+            il.lanes[j].bit_idx = 0;
+        }
+
+        // round-robin over the lanes
+        int j = 0;
+        for (size_t i = 0; i < num_symbols && rc == RC_OK; ++i) {
+            rc = interleave_encode_symbol(&il, &il.lanes[j], il.block[i]);
+            if(++j == num_lanes)
+                j = 0;
+        }
+
+        if(rc == RC_OK)
+            rc = interleave_write_block(&il, num_symbols, output_file_ptr);
+        read_start = adh_timer_start(ADH_PHASE_READ);
+    }
+    adh_timer_stop(ADH_PHASE_READ, read_start);
+
+    interleave_release(&il);
+    return rc;
+}
+
+/**
+ * decode the blocks of num_lanes lanes, after the format flags and the number of lanes already read,
+ * starting with the width of the weights
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @param flags: ADH_FLAG_*
+ * @param num_lanes
+ * @return RC_OK / RC_FAIL
+ */
+int adh_interleave_decode(FILE *input_file_ptr, FILE *output_file_ptr, byte_t flags, int num_lanes) {
+    if(num_lanes < 1 || num_lanes > INTERLEAVE_MAX_LANES) {
+        log_error("adh_interleave_decode", "invalid number of lanes %d\n", num_lanes);
+        return RC_FAIL;
+    }
+
+    byte_t weight_bits = 0;
+    if(fread(&weight_bits, sizeof(byte_t), 1, input_file_ptr) != 1 || adh_check_weight_bits(weight_bits) != RC_OK)
+        return RC_FAIL;
+
+    interleave_t il;
+    int rc = interleave_init(&il, flags, num_lanes, false);
+    while(rc == RC_OK) {
+        size_t num_symbols = 0;
+        rc = interleave_read_block(&il, input_file_ptr, &num_symbols);
+        if(rc != RC_OK || num_symbols == 0)
+            break;
+
+        rc = interleave_decode_block(&il, num_symbols);
+
+        uint64_t write_start = adh_timer_start(ADH_PHASE_WRITE);
+        if(rc == RC_OK && fwrite(il.block, sizeof(byte_t), num_symbols, output_file_ptr) != num_symbols) {
+            log_error("adh_interleave_decode", "cannot write %zu bytes\n", num_symbols);
+            rc = RC_FAIL;
+        }
+        adh_timer_stop(ADH_PHASE_WRITE, write_start);
+        if(rc == RC_OK)
+            rc = adh_progress_update(0, num_symbols);
+    }
+
+    interleave_release(&il);
+    return rc;
+}
+
+/**
+ * create the tree of each lane and the block buffers
+ * @param il
+ * @param flags
+ * @param num_lanes: [1..INTERLEAVE_MAX_LANES]
+ * @param encoder: the lanes own a growing bit stream buffer
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_init(interleave_t *il, byte_t flags, int num_lanes, bool encoder) {
+    memset(il, 0, sizeof(interleave_t));
+    if(num_lanes < 1 || num_lanes > INTERLEAVE_MAX_LANES) {
+        log_error("interleave_init", "invalid number of lanes %d\n", num_lanes);
+        return RC_FAIL;
+    }
+
+    il->flags = flags;
+    il->num_lanes = num_lanes;
+    il->block = adh_malloc((size_t)num_lanes * INTERLEAVE_LANE_SYMBOLS);
+    if(il->block == NULL)
+        return RC_FAIL;
+
+    for (int j = 0; j < num_lanes; ++j) {
+        interleave_lane_t * lane = &il->lanes[j];
+        lane->tree = adh_create_tree(SYMBOL_BITS);
+        if(lane->tree == NULL)
+            return RC_FAIL;
+
+        if(encoder) {
+            lane->data = adh_malloc(LANE_INITIAL_BYTES);
+            if(lane->data == NULL)
+                return RC_FAIL;
+            lane->capacity = LANE_INITIAL_BYTES;
+        }
+    }
+    return RC_OK;
+}
+
+/**
+ * release the trees and the buffers
+ * @param il
+ */
+void interleave_release(interleave_t *il) {
+    for (int j = 0; j < il->num_lanes; ++j) {
+        adh_destroy_tree(il->lanes[j].tree);
+        adh_free(il->lanes[j].data);
+    }
+    adh_free(il->block);
+    adh_free(il->streams);
+    memset(il, 0, sizeof(interleave_t));
+}
+
+/**
+ * encode the symbol with the tree of the lane, then update the tree
+ * a new symbol is written as NYT followed by its binary value, or its compact escape
+ * @param il
+ * @param lane
+ * @param symbol
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_encode_symbol(interleave_t *il, interleave_lane_t *lane, adh_symbol_t symbol) {
+    bit_array_t bit_array;
+    adh_node_t * node = adh_search_symbol_in_tree(lane->tree, symbol);
+    if(node != NULL) {
+        adh_get_node_encoding(node, &bit_array);
+        int rc = interleave_put_bits(lane, &bit_array);
+        if(rc == RC_OK)
+            adh_update_tree(lane->tree, node, false);
+        return rc;
+    }
+
+    adh_get_node_encoding(lane->tree->nyt, &bit_array);
+    int rc = interleave_put_bits(lane, &bit_array);
+    if(rc != RC_OK)
+        return rc;
+
+    adh_escape_encode(lane->tree, il->flags, symbol, &bit_array);
+    rc = interleave_put_bits(lane, &bit_array);
+    if(rc != RC_OK)
+        return rc;
+
+    node = adh_create_node_and_append(lane->tree, symbol);
+    if(node == NULL)
+        return RC_FAIL;
+
+    adh_update_tree(lane->tree, node, true);
+    return RC_OK;
+}
+
+/**
+ * append the bit array to the bit stream of the lane, most significant bit first
+ * @param lane
+ * @param bit_array
+ * @return RC_OK / RC_FAIL if the bit stream cannot grow
+ */
+int interleave_put_bits(interleave_lane_t *lane, const bit_array_t *bit_array) {
+    uint64_t start = adh_timer_start(ADH_PHASE_BITS);
+    if((lane->bit_idx + bit_array->length + 7) / 8 > lane->capacity) {
+        byte_t * data = adh_malloc(2 * lane->capacity);
+        if(data == NULL)
+            return RC_FAIL;
+        memcpy(data, lane->data, lane->capacity);
+        adh_free(lane->data);
+        lane->data = data;
+        lane->capacity *= 2;
+    }
+
+    for(int i = bit_array->length - 1; i >= 0; i--) {
+        uint64_t byte_idx = lane->bit_idx >> 3;
+        if((lane->bit_idx & 7) == 0)
+            lane->data[byte_idx] = 0;
+        if(bit_array->buffer[i] == BIT_1)
+            lane->data[byte_idx] |= (byte_t)(0x80 >> (lane->bit_idx & 7));
+        lane->bit_idx++;
+    }
+    adh_timer_stop(ADH_PHASE_BITS, start);
+    return RC_OK;
+}
+
+/**
+ * write the block header, then the bit stream of each lane
+ * @param il
+ * @param num_symbols
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_write_block(interleave_t *il, size_t num_symbols, FILE *output_file_ptr) {
+    byte_t header[MAX_HEADER_BYTES];
+    size_t header_len = BLOCK_COUNT_BYTES * (1 + (size_t)il->num_lanes);
+    bin_put_be(header, num_symbols, BLOCK_COUNT_BYTES);
+    for (int j = 0; j < il->num_lanes; ++j) {
+        bin_put_be(header + BLOCK_COUNT_BYTES * (1 + j), (il->lanes[j].bit_idx + 7) / 8, BLOCK_COUNT_BYTES);
+    }
+
+    uint64_t start = adh_timer_start(ADH_PHASE_WRITE);
+    size_t total = header_len;
+    int rc = fwrite(header, sizeof(byte_t), header_len, output_file_ptr) == header_len ? RC_OK : RC_FAIL;
+    for (int j = 0; j < il->num_lanes && rc == RC_OK; ++j) {
+        size_t lane_len = (size_t)((il->lanes[j].bit_idx + 7) / 8);
+        if(fwrite(il->lanes[j].data, sizeof(byte_t), lane_len, output_file_ptr) != lane_len)
+            rc = RC_FAIL;
+        total += lane_len;
+    }
+    adh_timer_stop(ADH_PHASE_WRITE, start);
+
+    if(rc != RC_OK) {
+        log_error("interleave_write_block", "cannot write a block of %zu symbols\n", num_symbols);
+        return rc;
+    }
+    return adh_progress_update(0, total);
+}
+
+/**
+ * read the next block header and the bit streams of the lanes
+ * @param il
+ * @param input_file_ptr
+ * @param num_symbols: 0 at the end of the stream
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_read_block(interleave_t *il, FILE *input_file_ptr, size_t *num_symbols) {
+    byte_t header[MAX_HEADER_BYTES];
+    size_t header_len = BLOCK_COUNT_BYTES * (1 + (size_t)il->num_lanes);
+    *num_symbols = 0;
+
+    uint64_t start = adh_timer_start(ADH_PHASE_READ);
+    size_t bytes_read = fread(header, sizeof(byte_t), header_len, input_file_ptr);
+    adh_timer_stop(ADH_PHASE_READ, start);
+    if(bytes_read == 0 && !ferror(input_file_ptr))
+        return RC_OK;
+    if(bytes_read != header_len) {
+        log_error("interleave_read_block", "truncated block header\n");
+        return RC_FAIL;
+    }
+
+    size_t count = (size_t)bin_get_be(header, BLOCK_COUNT_BYTES);
+    if(count == 0 || count > (size_t)il->num_lanes * INTERLEAVE_LANE_SYMBOLS) {
+        log_error("interleave_read_block", "invalid block of %zu symbols\n", count);
+        return RC_FAIL;
+    }
+
+    // a code is at most MAX_CODE_BITS bits, plus the escape of a new symbol
+    uint64_t max_lane_len = ((uint64_t)INTERLEAVE_LANE_SYMBOLS * (MAX_CODE_BITS + 2 * SYMBOL_BITS) + 7) / 8;
+    uint64_t total = 0;
+    for (int j = 0; j < il->num_lanes; ++j) {
+        uint64_t lane_len = bin_get_be(header + BLOCK_COUNT_BYTES * (1 + j), BLOCK_COUNT_BYTES);
+        if(lane_len > max_lane_len) {
+            log_error("interleave_read_block", "invalid length %" PRIu64 " of lane %d\n", lane_len, j);
+            return RC_FAIL;
+        }
+        il->lanes[j].bit_len = lane_len * SYMBOL_BITS;
+        il->lanes[j].bit_idx = 0;
+        total += lane_len;
+    }
+
+    if(total > il->streams_capacity) {
+        adh_free(il->streams);
+        il->streams = adh_malloc((size_t)total);
+        il->streams_capacity = il->streams ? (size_t)total : 0;
+        if(il->streams == NULL)
+            return RC_FAIL;
+    }
+
+    start = adh_timer_start(ADH_PHASE_READ);
+    bytes_read = fread(il->streams, sizeof(byte_t), (size_t)total, input_file_ptr);
+    adh_timer_stop(ADH_PHASE_READ, start);
+    if(bytes_read != total) {
+        log_error("interleave_read_block", "truncated block: %zu bytes of %" PRIu64 "\n", bytes_read, total);
+        return RC_FAIL;
+    }
+
+    const byte_t * input = il->streams;
+    for (int j = 0; j < il->num_lanes; ++j) {
+        il->lanes[j].input = input;
+        input += il->lanes[j].bit_len / SYMBOL_BITS;
+    }
+
+    *num_symbols = count;
+    return adh_progress_update(header_len + total, 0);
+}
+
+/**
+ * decode the symbols of a block, one symbol of each lane per round.
+ * the tree walks of the lanes are independent: they advance one level each per iteration,
+ * so that the loads of the K walks overlap instead of waiting for each other
+ * @param il
+ * @param num_symbols
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_decode_block(interleave_t *il, size_t num_symbols) {
+    adh_node_t * nodes[INTERLEAVE_MAX_LANES];
+    for (size_t i = 0; i < num_symbols; i += (size_t)il->num_lanes) {
+        int active = num_symbols - i < (size_t)il->num_lanes ? (int)(num_symbols - i) : il->num_lanes;
+
+        uint64_t start = adh_timer_start(ADH_PHASE_BITS);
+        bool walking = false;
+        for (int j = 0; j < active; ++j) {
+            nodes[j] = il->lanes[j].tree->root;
+            walking |= nodes[j]->left != NULL;
+        }
+
+        while(walking) {
+            walking = false;
+            for (int j = 0; j < active; ++j) {
+                adh_node_t * node = nodes[j];
+                if(node->left == NULL)
+                    continue;
+
+                interleave_lane_t * lane = &il->lanes[j];
+                if(lane->bit_idx >= lane->bit_len) {
+                    log_error("interleave_decode_block", "lane %d: too many bits read (%" PRIu64 ")\n", j, lane->bit_idx);
+                    return RC_FAIL;
+                }
+                byte_t bit = lane->input[lane->bit_idx >> 3] & (byte_t)(0x80 >> (lane->bit_idx & 7));
+                lane->bit_idx++;
+
+                // 0 = left node, 1 = right node
+                node = bit ? node->right : node->left;
+                nodes[j] = node;
+                walking |= node->left != NULL;
+            }
+        }
+        adh_timer_stop(ADH_PHASE_BITS, start);
+
+        for (int j = 0; j < active; ++j) {
+            interleave_lane_t * lane = &il->lanes[j];
+            adh_symbol_t symbol = nodes[j]->symbol;
+            if(nodes[j] != lane->tree->nyt) {
+                adh_update_tree(lane->tree, nodes[j], false);
+            } else {
+                int rc = adh_escape_decode(lane->tree, il->flags, interleave_read_bits, lane, &symbol);
+                if(rc != RC_OK)
+                    return rc;
+
+                adh_node_t * node = adh_create_node_and_append(lane->tree, symbol);
+                if(node == NULL)
+                    return RC_FAIL;
+                adh_update_tree(lane->tree, node, true);
+            }
+            il->block[i + (size_t)j] = (byte_t)symbol;
+        }
+    }
+    return RC_OK;
+}
+
+/**
+ * read the bits of an escape from the bit stream of the lane
+ * @param ctx: the lane
+ * @param num_bits
+ * @param value
+ * @return RC_OK / RC_FAIL
+ */
+int interleave_read_bits(void *ctx, int num_bits, uint32_t *value) {
+    return interleave_read_value(ctx, num_bits, value);
+}
+
+/**
+ * read a value written with the most significant bit first from the bit stream of the lane
+ * @param lane
+ * @param num_bits: up to 32
+ * @param value
+ * @return RC_OK / RC_FAIL past the end of the lane
+ */
+int interleave_read_value(interleave_lane_t *lane, int num_bits, uint32_t *value) {
+    if(lane->bit_len - lane->bit_idx < (uint64_t)num_bits) {
+        log_error("interleave_read_value", "expected %d bits: bit_idx=%" PRIu64 " bit_len=%" PRIu64 "\n",
+                  num_bits, lane->bit_idx, lane->bit_len);
+        return RC_FAIL;
+    }
+
+    *value = 0;
+    for (int i = 0; i < num_bits; ++i) {
+        byte_t bit = lane->input[lane->bit_idx >> 3] & (byte_t)(0x80 >> (lane->bit_idx & 7));
+        *value = (*value << 1) | (bit ? 1u : 0u);
+        lane->bit_idx++;
+    }
+    return RC_OK;
+}
@@ -0,0 +1,27 @@
+#ifndef ALGO_ADHUFF_INTERLEAVE_H
+#define ALGO_ADHUFF_INTERLEAVE_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ *
+ * interleaved format (ADH_FLAG_INTERLEAVED): byte i of the input is coded by lane i mod K,
+ * each lane with its own order-0 tree and its own bit stream, so that the decoder walks the K trees
+ * in the same loop instead of one long chain of dependent walks.
+ * After the format flags, one byte holds K, one byte ADH_FORMAT_WEIGHT_BITS, then the input is coded in blocks of K * INTERLEAVE_LANE_SYMBOLS bytes:
+ * - 4 bytes: number of symbols in the block
+ * - K x 4 bytes: length in bytes of the bit stream of each lane
+ * - the K bit streams, one after the other, the last byte of each padded with zeros
+ * the values are big endian, the trees go on from a block to the next
+ */
+enum {
+    INTERLEAVE_DEFAULT_LANES = 4,
+    INTERLEAVE_MAX_LANES    = 16,
+    INTERLEAVE_LANE_SYMBOLS = 16 * 1024
+};
+
+int         adh_interleave_encode(FILE *input_file_ptr, FILE *output_file_ptr, byte_t flags, int num_lanes);
+int         adh_interleave_decode(FILE *input_file_ptr, FILE *output_file_ptr, byte_t flags, int num_lanes);
+
+#endif //ALGO_ADHUFF_INTERLEAVE_H
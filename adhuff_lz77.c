@@ -0,0 +1,246 @@
+#include <string.h>
+
+#include "adhuff_lz77.h"
+#include "adhuff_common.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    HASH_SIZE           = 1 << LZ77_HASH_BITS,
+    WINDOW_MASK         = LZ77_WINDOW_SIZE - 1,
+    NO_POS              = -1
+};
+
+/*
+ * match search effort for each level
+ */
+static const struct {
+    int     max_chain;
+    int     nice_length;
+} LEVELS[LZ77_MAX_LEVEL + 1] = {
+        {   0,   0},    // 0 = default level
+        {   4,   8},
+        {   8,  16},
+        {  16,  32},
+        {  32,  64},
+        {  64, 128},
+        { 128, 128},
+        { 256, 258},
+        {1024, 258},
+        {4096, 258}
+};
+
+//
+// private methods
+//
+int     lz77_fill(adh_lz77_t *lz, FILE *input_file_ptr);
+void    lz77_insert(adh_lz77_t *lz, int pos);
+int     lz77_longest_match(const adh_lz77_t *lz, int pos, int *distance);
+
+/**
+ * initialize the match finder
+ * @param lz
+ * @param level: [1..9], 0 = default
+ * @return RC_OK / RC_FAIL
+ */
+int adh_lz77_init(adh_lz77_t *lz, int level) {
+    memset(lz, 0, sizeof(adh_lz77_t));
+
+    if(level <= 0)
+        level = LZ77_DEFAULT_LEVEL;
+    if(level > LZ77_MAX_LEVEL)
+        level = LZ77_MAX_LEVEL;
+
+    lz->max_chain = LEVELS[level].max_chain;
+    lz->nice_length = LEVELS[level].nice_length;
+
+    lz->window = adh_malloc(2 * LZ77_WINDOW_SIZE);
+    lz->head = adh_malloc(HASH_SIZE * sizeof(int));
+    lz->prev = adh_malloc(LZ77_WINDOW_SIZE * sizeof(int));
+    if(lz->window == NULL || lz->head == NULL || lz->prev == NULL) {
+        log_error("adh_lz77_init", "cannot allocate window\n");
+        return RC_FAIL;
+    }
+
+    for (int i = 0; i < HASH_SIZE; ++i) {
+        lz->head[i] = NO_POS;
+    }
+    for (int i = 0; i < LZ77_WINDOW_SIZE; ++i) {
+        lz->prev[i] = NO_POS;
+    }
+    return RC_OK;
+}
+
+/**
+ * release the match finder buffers
+ * @param lz
+ */
+void adh_lz77_release(adh_lz77_t *lz) {
+    adh_free(lz->window);
+    adh_free(lz->head);
+    adh_free(lz->prev);
+    lz->window = NULL;
+    lz->head = NULL;
+    lz->prev = NULL;
+}
+
+/**
+ * @param distance: [1..2^16)
+ * @return floor(log2(distance))
+ */
+int adh_lz77_distance_slot(int distance) {
+    int slot = 0;
+    while(distance > 1) {
+        distance >>= 1;
+        slot++;
+    }
+    return slot;
+}
+
+/**
+ * find the next literal or match (greedy parsing)
+ * @param lz
+ * @param input_file_ptr
+ * @param token
+ * @param has_token: false at the end of input
+ * @return RC_OK / RC_FAIL
+ */
+int adh_lz77_next_token(adh_lz77_t *lz, FILE *input_file_ptr, adh_lz77_token_t *token, bool *has_token) {
+    int rc = lz77_fill(lz, input_file_ptr);
+    if(rc != RC_OK)
+        return rc;
+
+    *has_token = lz->pos < lz->end;
+    if(!*has_token)
+        return RC_OK;
+
+    int distance = 0;
+    int length = lz77_longest_match(lz, lz->pos, &distance);
+    lz77_insert(lz, lz->pos);
+
+    if(length >= LZ77_MIN_MATCH) {
+        token->length = (uint16_t)length;
+        token->distance = (uint16_t)distance;
+
+        for (int i = 1; i < length; ++i) {
+            lz77_insert(lz, lz->pos + i);
+        }
+        lz->pos += length;
+    } else {
+        token->length = 0;
+        token->literal = lz->window[lz->pos];
+        lz->pos++;
+    }
+
+    return RC_OK;
+}
+
+/**
+ * make sure there are at least LZ77_MAX_MATCH bytes after the current position (unless at end of input)
+ * the window slides by LZ77_WINDOW_SIZE when full
+ * @param lz
+ * @param input_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int lz77_fill(adh_lz77_t *lz, FILE *input_file_ptr) {
+    while(!lz->eof && lz->end - lz->pos < LZ77_MAX_MATCH) {
+        if(lz->end == 2 * LZ77_WINDOW_SIZE) {
+            // slide: drop the oldest half of the window
+            memmove(lz->window, lz->window + LZ77_WINDOW_SIZE, LZ77_WINDOW_SIZE);
+            lz->pos -= LZ77_WINDOW_SIZE;
+            lz->end -= LZ77_WINDOW_SIZE;
+
+            for (int i = 0; i < HASH_SIZE; ++i) {
+                lz->head[i] = lz->head[i] >= LZ77_WINDOW_SIZE ? lz->head[i] - LZ77_WINDOW_SIZE : NO_POS;
+            }
+            for (int i = 0; i < LZ77_WINDOW_SIZE; ++i) {
+                lz->prev[i] = lz->prev[i] >= LZ77_WINDOW_SIZE ? lz->prev[i] - LZ77_WINDOW_SIZE : NO_POS;
+            }
+        }
+
+        uint64_t start = adh_timer_start(ADH_PHASE_READ);
+        size_t bytes_read = fread(lz->window + lz->end, sizeof(byte_t),
+                                  2 * LZ77_WINDOW_SIZE - lz->end, input_file_ptr);
+        adh_timer_stop(ADH_PHASE_READ, start);
+        if(bytes_read == 0) {
+            if(ferror(input_file_ptr)) {
+                log_error("lz77_fill", "cannot read input\n");
+                return RC_FAIL;
+            }
+            lz->eof = true;
+        }
+        lz->end += (int)bytes_read;
+        if(adh_progress_update(bytes_read, 0) != RC_OK)
+            return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * @param window
+ * @param pos
+ * @return hash of the LZ77_MIN_MATCH bytes at pos
+ */
+static inline int lz77_hash(const byte_t *window, int pos) {
+    return ((window[pos] << 10) ^ (window[pos + 1] << 5) ^ window[pos + 2]) & (HASH_SIZE - 1);
+}
+
+/**
+ * add the position to its hash chain
+ * @param lz
+ * @param pos
+ */
+void lz77_insert(adh_lz77_t *lz, int pos) {
+    if(pos + LZ77_MIN_MATCH > lz->end)
+        return;
+
+    int hash = lz77_hash(lz->window, pos);
+    lz->prev[pos & WINDOW_MASK] = lz->head[hash];
+    lz->head[hash] = pos;
+}
+
+/**
+ * walk the hash chain of pos looking for the longest match
+ * @param lz
+ * @param pos
+ * @param distance: distance of the longest match
+ * @return length of the longest match, 0 if not found
+ */
+int lz77_longest_match(const adh_lz77_t *lz, int pos, int *distance) {
+    int max_length = lz->end - pos;
+    if(max_length < LZ77_MIN_MATCH)
+        return 0;
+    if(max_length > LZ77_MAX_MATCH)
+        max_length = LZ77_MAX_MATCH;
+
+    const byte_t * window = lz->window;
+    const byte_t * current = window + pos;
+    int best_length = 0;
+    int limit = pos - LZ77_WINDOW_SIZE;
+    int chain = lz->max_chain;
+
+    int candidate = lz->head[lz77_hash(window, pos)];
+    while(candidate > limit && candidate != NO_POS && chain-- > 0) {
+        const byte_t * match = window + candidate;
+
+        // quick reject: the byte after the best match must match
+        if(match[best_length] == current[best_length] && match[0] == current[0]) {
+            int length = 0;
+            while(length < max_length && match[length] == current[length]) {
+                length++;
+            }
+
+            if(length > best_length) {
+                best_length = length;
+                *distance = pos - candidate;
+                if(length >= lz->nice_length || length == max_length)
+                    break;
+            }
+        }
+        candidate = lz->prev[candidate & WINDOW_MASK];
+    }
+    return best_length;
+}
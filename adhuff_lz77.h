@@ -0,0 +1,55 @@
+#ifndef ALGO_ADHUFF_LZ77_H
+#define ALGO_ADHUFF_LZ77_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ *
+ * a token is coded with the literal/length tree:
+ * - [0..255]   literal byte
+ * - [256..511] match of length (symbol - 256 + LZ77_MIN_MATCH), followed by
+ *              the distance slot (distance tree) and slot bits of the distance (raw)
+ */
+enum {
+    LZ77_WINDOW_BITS    = 15,
+    LZ77_WINDOW_SIZE    = 1 << LZ77_WINDOW_BITS,    // 32 KB
+    LZ77_MIN_MATCH      = 3,
+    LZ77_MAX_MATCH      = 258,
+    LZ77_LITLEN_BITS    = 9,                        // literals and match lengths
+    LZ77_LENGTH_BASE    = 256,                      // first match length symbol
+    LZ77_DISTANCE_BITS  = 4,                        // distance slot = floor(log2(distance))
+    LZ77_HASH_BITS      = 15,
+    LZ77_DEFAULT_LEVEL  = 6,
+    LZ77_MAX_LEVEL      = 9
+};
+
+/*
+ * a literal (length = 0) or a match
+ */
+typedef struct {
+    uint16_t            length;
+    uint16_t            distance;
+    byte_t              literal;
+} adh_lz77_token_t;
+
+/*
+ * hash chain match finder over a sliding window
+ */
+typedef struct {
+    byte_t *            window;         // 2 * LZ77_WINDOW_SIZE bytes
+    int *               head;           // last position of each hash
+    int *               prev;           // previous position with the same hash
+    int                 pos;            // current position in window
+    int                 end;            // end of valid data in window
+    bool                eof;
+    int                 max_chain;      // max number of candidates to check
+    int                 nice_length;    // stop searching when a match is at least this long
+} adh_lz77_t;
+
+int         adh_lz77_init(adh_lz77_t *lz, int level);
+void        adh_lz77_release(adh_lz77_t *lz);
+int         adh_lz77_next_token(adh_lz77_t *lz, FILE *input_file_ptr, adh_lz77_token_t *token, bool *has_token);
+int         adh_lz77_distance_slot(int distance);
+
+#endif //ALGO_ADHUFF_LZ77_H
@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "adhuff_memory.h"
+#include "log.h"
+
+/*
+ * each block starts with its size, so that adh_free can account it
+ * the union keeps the data aligned as malloc would
+ */
+typedef union {
+    size_t              size;
+    long double         align_float;
+    void *              align_pointer;
+    uint64_t            align_integer;
+} block_header_t;
+
+static adh_memory_t     memory;
+static adh_allocator_t  allocator;              // alloc == NULL: malloc / free
+
+/**
+ * set the allocator of the coder, the blocks allocated before must be released first
+ * @param new_allocator: NULL restores malloc / free
+ */
+void adh_set_allocator(const adh_allocator_t *new_allocator) {
+    if(memory.current > 0)
+        log_error("adh_set_allocator", "%" PRIu64 " bytes still allocated\n", memory.current);
+
+    if(new_allocator == NULL || new_allocator->alloc == NULL || new_allocator->release == NULL)
+        memset(&allocator, 0, sizeof(allocator));
+    else
+        allocator = *new_allocator;
+}
+
+/**
+ * set the max bytes the coder can hold at the same time, an allocation over the limit fails
+ * and the stream with it, as on an out of memory
+ * @param limit: 0 = no limit
+ */
+void adh_set_memory_limit(uint64_t limit) {
+    memory.limit = limit;
+}
+
+/**
+ * @return the current and peak usage, always updated
+ */
+const adh_memory_t * adh_memory_get(void) {
+    return &memory;
+}
+
+/**
+ * restart the peak from the current usage, done at the start of each stream
+ */
+void adh_memory_reset_peak(void) {
+    memory.peak = memory.current;
+}
+
+/**
+ * print the usage
+ * @param fp
+ */
+void adh_memory_print(FILE *fp) {
+    fprintf(fp, "memory             peak %" PRIu64 " bytes, current %" PRIu64, memory.peak, memory.current);
+    if(memory.limit > 0)
+        fprintf(fp, ", limit %" PRIu64 " (%" PRIu64 " refused)", memory.limit, memory.refused);
+    fputc('\n', fp);
+}
+
+/**
+ * allocate through the allocator hook, within the memory limit
+ * @param size
+ * @return the block, NULL if over the limit or on failure
+ */
+void * adh_malloc(size_t size) {
+    if(size > SIZE_MAX - sizeof(block_header_t) ||
+       (memory.limit > 0 && memory.current + size > memory.limit)) {
+        log_error("adh_malloc", "%zu bytes over the memory limit of %" PRIu64 " bytes\n", size, memory.limit);
+        memory.refused++;
+        return NULL;
+    }
+
+    size_t total = sizeof(block_header_t) + size;
+    block_header_t * header = allocator.alloc ? allocator.alloc(allocator.ctx, total) : malloc(total);
+    if(header == NULL) {
+        memory.refused++;
+        return NULL;
+    }
+
+    header->size = size;
+    memory.current += size;
+    if(memory.current > memory.peak)
+        memory.peak = memory.current;
+    return header + 1;
+}
+
+/**
+ * allocate through the allocator hook and clear the block
+ * @param count
+ * @param size
+ * @return the block, NULL if over the limit or on failure
+ */
+void * adh_calloc(size_t count, size_t size) {
+    if(size > 0 && count > SIZE_MAX / size)
+        return NULL;
+
+    void * ptr = adh_malloc(count * size);
+    if(ptr != NULL)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+/**
+ * release a block of adh_malloc / adh_calloc
+ * @param ptr: may be NULL
+ */
+void adh_free(void *ptr) {
+    if(ptr == NULL)
+        return;
+
+    block_header_t * header = (block_header_t *)ptr - 1;
+    memory.current -= header->size;
+    if(allocator.release)
+        allocator.release(allocator.ctx, header);
+    else
+        free(header);
+}
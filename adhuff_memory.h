@@ -0,0 +1,36 @@
+#ifndef ALGO_ADHUFF_MEMORY_H
+#define ALGO_ADHUFF_MEMORY_H
+
+#include "bin_io.h"
+
+/*
+ * allocator hook: trees, hash entries, frequency models, LZ77 and filter buffers and the input window
+ * of the decoder are all allocated through it, so that the memory of a stream can be measured and capped
+ */
+typedef struct {
+    void *              (*alloc)(void *ctx, size_t size);   // NULL on failure
+    void                (*release)(void *ctx, void *ptr);
+    void *              ctx;                                // passed back to alloc and release
+} adh_allocator_t;
+
+/*
+ * bytes requested by the coder, without the allocator overhead
+ */
+typedef struct {
+    uint64_t            current;
+    uint64_t            peak;                           // max of current since the start of the last stream
+    uint64_t            limit;                          // 0 = no limit
+    uint64_t            refused;                        // allocations over the limit or failed
+} adh_memory_t;
+
+void                    adh_set_allocator(const adh_allocator_t *allocator);
+void                    adh_set_memory_limit(uint64_t limit);
+const adh_memory_t *    adh_memory_get(void);
+void                    adh_memory_reset_peak(void);
+void                    adh_memory_print(FILE *fp);
+
+void *                  adh_malloc(size_t size);
+void *                  adh_calloc(size_t count, size_t size);
+void                    adh_free(void *ptr);
+
+#endif //ALGO_ADHUFF_MEMORY_H
@@ -0,0 +1,446 @@
+#include <string.h>
+
+#include "adhuff_range.h"
+#include "adhuff_common.h"
+#include "adhuff_lz77.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    ESCAPE_WEIGHT       = 1
+};
+
+//
+// private methods
+//
+adh_freq_t *    freq_create(int num_symbols);
+void            freq_add(adh_freq_t *model, int symbol, uint32_t delta);
+uint32_t        freq_prefix(const adh_freq_t *model, int symbol);
+uint32_t        freq_weight(const adh_freq_t *model, int symbol);
+int             freq_find(const adh_freq_t *model, uint32_t target);
+void            freq_update(adh_freq_t *model, int symbol);
+void            freq_rescale(adh_freq_t *model);
+void            freq_add_new(adh_freq_t *model, int symbol);
+
+int             range_init_models(adh_range_coder_t *coder, byte_t flags);
+int             range_encode_interval(adh_range_coder_t *coder, uint32_t start, uint32_t size, uint32_t total);
+int             range_shift_low(adh_range_coder_t *coder);
+uint32_t        range_decode_target(adh_range_coder_t *coder, uint32_t total);
+int             range_decode_interval(adh_range_coder_t *coder, uint32_t start, uint32_t size);
+
+/**
+ * initialize the range encoder
+ * @param coder
+ * @param flags: ADH_FLAG_*
+ * @param write_byte: called for each output byte
+ * @param io_ctx: passed to write_byte
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_init_encoder(adh_range_coder_t *coder, byte_t flags, adh_write_byte_fn write_byte, void *io_ctx) {
+    int rc = range_init_models(coder, flags);
+    coder->write_byte = write_byte;
+    coder->io_ctx = io_ctx;
+    coder->low = 0;
+    coder->range = 0xFFFFFFFFu;
+    coder->cache = 0;
+    coder->cache_size = 1;
+    return rc;
+}
+
+/**
+ * initialize the range decoder, read the first bytes of the input
+ * @param coder
+ * @param flags: ADH_FLAG_*
+ * @param read_byte: called for each input byte
+ * @param io_ctx: passed to read_byte
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_init_decoder(adh_range_coder_t *coder, byte_t flags, adh_read_byte_fn read_byte, void *io_ctx) {
+    int rc = range_init_models(coder, flags);
+    coder->read_byte = read_byte;
+    coder->io_ctx = io_ctx;
+    coder->range = 0xFFFFFFFFu;
+    coder->code = 0;
+
+    for (int i = 0; i < RANGE_INIT_BYTES && rc == RC_OK; ++i) {
+        byte_t value;
+        rc = read_byte(io_ctx, &value);
+        coder->code = (coder->code << 8) | value;
+    }
+    return rc;
+}
+
+/**
+ * release the models
+ * @param coder
+ */
+void adh_range_release(adh_range_coder_t *coder) {
+    adh_free(coder->order0);
+    adh_free(coder->distances);
+    coder->order0 = NULL;
+    coder->distances = NULL;
+
+    for (int i = 0; i < 256; ++i) {
+        adh_free(coder->contexts[i]);
+        coder->contexts[i] = NULL;
+    }
+}
+
+/**
+ * create the models selected by the flags, order-1 models are created on first use
+ * @param coder
+ * @param flags
+ * @return RC_OK / RC_FAIL
+ */
+int range_init_models(adh_range_coder_t *coder, byte_t flags) {
+    memset(coder, 0, sizeof(adh_range_coder_t));
+    coder->flags = flags;
+
+    if(flags & ADH_FLAG_LZ77) {
+        coder->order0 = freq_create(1 << LZ77_LITLEN_BITS);
+        coder->distances = freq_create(1 << LZ77_DISTANCE_BITS);
+        return coder->order0 != NULL && coder->distances != NULL ? RC_OK : RC_FAIL;
+    }
+
+    coder->order0 = freq_create(ADH_MAX_SYMBOLS);
+    return coder->order0 != NULL ? RC_OK : RC_FAIL;
+}
+
+/**
+ * get the model of the current context (the previous symbol), create it if needed
+ * @param coder
+ * @return the model, NULL in case of error
+ */
+adh_freq_t * adh_range_get_context_model(adh_range_coder_t *coder) {
+    adh_freq_t * model = coder->contexts[coder->context];
+    if(model == NULL) {
+        model = freq_create(ADH_MAX_SYMBOLS);
+        coder->contexts[coder->context] = model;
+    }
+    return model;
+}
+
+/**
+ * encode the symbol with the model. then update the model
+ * a symbol with weight 0 is coded as escape followed by
+ * its encoding in the escape_model or, without escape_model, by its uniform encoding
+ * @param coder
+ * @param model
+ * @param escape_model: may be NULL
+ * @param symbol: [0..num_symbols], num_symbols = end of stream
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_encode(adh_range_coder_t *coder, adh_freq_t *model, adh_freq_t *escape_model, int symbol) {
+    uint32_t weight = symbol < model->num_symbols ? freq_weight(model, symbol) : 0;
+    if(weight > 0) {
+        int rc = range_encode_interval(coder, freq_prefix(model, symbol), weight, model->total);
+        freq_update(model, symbol);
+        return rc;
+    }
+
+    int rc = range_encode_interval(coder, model->total - ESCAPE_WEIGHT, ESCAPE_WEIGHT, model->total);
+    if(rc != RC_OK)
+        return rc;
+
+    if(escape_model != NULL) {
+        rc = adh_range_encode(coder, escape_model, NULL, symbol);
+    } else if(coder->flags & ADH_FLAG_COMPACT_ESCAPE) {
+        uint32_t unseen = (uint32_t)(model->num_symbols - model->num_seen);
+        uint32_t index = symbol < model->num_symbols ? (uint32_t)(symbol - bitmap_rank(model->seen, symbol)) : unseen;
+        rc = range_encode_interval(coder, index, 1, unseen + 1);
+    } else {
+        rc = range_encode_interval(coder, (uint32_t)symbol, 1, model->num_symbols + 1u);
+    }
+
+    if(symbol < model->num_symbols)
+        freq_add_new(model, symbol);
+    return rc;
+}
+
+/**
+ * decode a symbol with the model. then update the model
+ * @param coder
+ * @param model
+ * @param escape_model: may be NULL
+ * @param symbol: [0..num_symbols], num_symbols = end of stream
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_decode(adh_range_coder_t *coder, adh_freq_t *model, adh_freq_t *escape_model, int *symbol) {
+    uint32_t target = range_decode_target(coder, model->total);
+    if(target < model->total - ESCAPE_WEIGHT) {
+        int s = freq_find(model, target);
+        int rc = range_decode_interval(coder, freq_prefix(model, s), freq_weight(model, s));
+        freq_update(model, s);
+        *symbol = s;
+        return rc;
+    }
+
+    int rc = range_decode_interval(coder, model->total - ESCAPE_WEIGHT, ESCAPE_WEIGHT);
+    if(rc != RC_OK)
+        return rc;
+
+    if(escape_model != NULL) {
+        rc = adh_range_decode(coder, escape_model, NULL, symbol);
+    } else if(coder->flags & ADH_FLAG_COMPACT_ESCAPE) {
+        uint32_t unseen = (uint32_t)(model->num_symbols - model->num_seen);
+        uint32_t index = range_decode_target(coder, unseen + 1);
+        rc = range_decode_interval(coder, index, 1);
+        *symbol = index == unseen ? model->num_symbols
+                                  : bitmap_select_zero(model->seen, RANGE_SEEN_WORDS, (int)index);
+    } else {
+        *symbol = (int)range_decode_target(coder, model->num_symbols + 1u);
+        rc = range_decode_interval(coder, (uint32_t)*symbol, 1);
+    }
+
+    if(rc == RC_OK && *symbol < model->num_symbols) {
+        if(*symbol < 0 || freq_weight(model, *symbol) > 0) {
+            log_error("adh_range_decode", "escape decoded a known symbol %d\n", *symbol);
+            return RC_FAIL;
+        }
+        freq_add_new(model, *symbol);
+    }
+    return rc;
+}
+
+/**
+ * encode a value with uniform probability
+ * @param coder
+ * @param value
+ * @param num_bits: up to 32
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_encode_bits(adh_range_coder_t *coder, uint32_t value, int num_bits) {
+    int rc = RC_OK;
+    while(num_bits > 0 && rc == RC_OK) {
+        int bits = num_bits > RANGE_MAX_RAW_BITS ? RANGE_MAX_RAW_BITS : num_bits;
+        num_bits -= bits;
+        rc = range_encode_interval(coder, (value >> num_bits) & ((1u << bits) - 1), 1, 1u << bits);
+    }
+    return rc;
+}
+
+/**
+ * decode a value with uniform probability
+ * @param coder
+ * @param value
+ * @param num_bits: up to 32
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_decode_bits(adh_range_coder_t *coder, uint32_t *value, int num_bits) {
+    int rc = RC_OK;
+    *value = 0;
+    while(num_bits > 0 && rc == RC_OK) {
+        int bits = num_bits > RANGE_MAX_RAW_BITS ? RANGE_MAX_RAW_BITS : num_bits;
+        num_bits -= bits;
+        uint32_t part = range_decode_target(coder, 1u << bits);
+        rc = range_decode_interval(coder, part, 1);
+        *value = (*value << bits) | part;
+    }
+    return rc;
+}
+
+/**
+ * write the pending bytes of the encoder
+ * @param coder
+ * @return RC_OK / RC_FAIL
+ */
+int adh_range_flush(adh_range_coder_t *coder) {
+    int rc = RC_OK;
+    for (int i = 0; i < RANGE_INIT_BYTES && rc == RC_OK; ++i) {
+        rc = range_shift_low(coder);
+    }
+    return rc;
+}
+
+/**
+ * narrow the range to [start, start+size) of total
+ * @param coder
+ * @param start
+ * @param size
+ * @param total: up to RANGE_MAX_TOTAL
+ * @return RC_OK / RC_FAIL
+ */
+int range_encode_interval(adh_range_coder_t *coder, uint32_t start, uint32_t size, uint32_t total) {
+    coder->range /= total;
+    coder->low += (uint64_t)start * coder->range;
+    coder->range *= size;
+
+    int rc = RC_OK;
+    while(coder->range < RANGE_TOP && rc == RC_OK) {
+        coder->range <<= 8;
+        rc = range_shift_low(coder);
+    }
+    return rc;
+}
+
+/**
+ * output the top byte of low, delaying 0xFF bytes until the carry is known
+ * @param coder
+ * @return RC_OK / RC_FAIL
+ */
+int range_shift_low(adh_range_coder_t *coder) {
+    int rc = RC_OK;
+    if((uint32_t)coder->low < 0xFF000000u || (coder->low >> 32) != 0) {
+        byte_t carry = (byte_t)(coder->low >> 32);
+        byte_t value = coder->cache;
+        do {
+            if(rc == RC_OK)
+                rc = coder->write_byte(coder->io_ctx, (byte_t)(value + carry));
+            value = 0xFF;
+        } while(--coder->cache_size != 0);
+        coder->cache = (byte_t)(coder->low >> 24);
+    }
+    coder->cache_size++;
+    coder->low = (coder->low & 0x00FFFFFFu) << 8;
+    return rc;
+}
+
+/**
+ * @param coder
+ * @param total
+ * @return the position of the code in [0..total)
+ */
+uint32_t range_decode_target(adh_range_coder_t *coder, uint32_t total) {
+    coder->range /= total;
+    uint32_t target = coder->code / coder->range;
+    return target < total ? target : total - 1;
+}
+
+/**
+ * consume the interval [start, start+size) found with range_decode_target
+ * @param coder
+ * @param start
+ * @param size
+ * @return RC_OK / RC_FAIL
+ */
+int range_decode_interval(adh_range_coder_t *coder, uint32_t start, uint32_t size) {
+    coder->code -= start * coder->range;
+    coder->range *= size;
+
+    int rc = RC_OK;
+    while(coder->range < RANGE_TOP && rc == RC_OK) {
+        byte_t value;
+        rc = coder->read_byte(coder->io_ctx, &value);
+        coder->code = (coder->code << 8) | value;
+        coder->range <<= 8;
+    }
+    return rc;
+}
+
+/**
+ * create a model where all symbols are unseen
+ * @param num_symbols
+ * @return the model, NULL in case of error
+ */
+adh_freq_t * freq_create(int num_symbols) {
+    adh_freq_t * model = adh_calloc(1, sizeof(adh_freq_t) + (num_symbols + 1) * sizeof(uint32_t));
+    if(model == NULL) {
+        log_error("freq_create", "cannot allocate model\n");
+        return NULL;
+    }
+
+    model->num_symbols = (uint16_t)num_symbols;
+    model->total = ESCAPE_WEIGHT;
+    return model;
+}
+
+/**
+ * @param model
+ * @param symbol
+ * @param delta: added to the weight of the symbol
+ */
+void freq_add(adh_freq_t *model, int symbol, uint32_t delta) {
+    for (int i = symbol + 1; i <= model->num_symbols; i += i & -i) {
+        model->fenwick[i] += delta;
+    }
+}
+
+/**
+ * @param model
+ * @param symbol
+ * @return sum of the weights of the symbols before the given one
+ */
+uint32_t freq_prefix(const adh_freq_t *model, int symbol) {
+    uint32_t sum = 0;
+    for (int i = symbol; i > 0; i -= i & -i) {
+        sum += model->fenwick[i];
+    }
+    return sum;
+}
+
+/**
+ * @param model
+ * @param symbol
+ * @return the weight of the symbol
+ */
+uint32_t freq_weight(const adh_freq_t *model, int symbol) {
+    return freq_prefix(model, symbol + 1) - freq_prefix(model, symbol);
+}
+
+/**
+ * @param model
+ * @param target: less than the sum of the symbol weights
+ * @return the symbol whose interval contains target
+ */
+int freq_find(const adh_freq_t *model, uint32_t target) {
+    int pos = 0;
+    int mask = 1;
+    while(mask * 2 <= model->num_symbols) {
+        mask *= 2;
+    }
+
+    for (; mask > 0; mask >>= 1) {
+        int next = pos + mask;
+        if(next <= model->num_symbols && model->fenwick[next] <= target) {
+            pos = next;
+            target -= model->fenwick[next];
+        }
+    }
+    return pos;
+}
+
+/**
+ * increase the weight of the symbol, halve all the weights when the total is too large
+ * @param model
+ * @param symbol
+ */
+void freq_update(adh_freq_t *model, int symbol) {
+    freq_add(model, symbol, 1);
+    model->total++;
+
+    if(model->total > RANGE_MAX_TOTAL)
+        freq_rescale(model);
+}
+
+/**
+ * add a symbol not yet seen to the model
+ * @param model
+ * @param symbol
+ */
+void freq_add_new(adh_freq_t *model, int symbol) {
+    bitmap_set(model->seen, symbol);
+    model->num_seen++;
+    freq_update(model, symbol);
+}
+
+/**
+ * halve all the weights, a seen symbol keeps a weight of at least 1
+ * @param model
+ */
+void freq_rescale(adh_freq_t *model) {
+    uint32_t weights[1 << LZ77_LITLEN_BITS];
+    for (int s = 0; s < model->num_symbols; ++s) {
+        weights[s] = freq_weight(model, s);
+    }
+
+    memset(model->fenwick, 0, (model->num_symbols + 1) * sizeof(uint32_t));
+    model->total = ESCAPE_WEIGHT;
+    for (int s = 0; s < model->num_symbols; ++s) {
+        uint32_t weight = (weights[s] + 1) / 2;
+        freq_add(model, s, weight);
+        model->total += weight;
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef ALGO_ADHUFF_RANGE_H
+#define ALGO_ADHUFF_RANGE_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ */
+enum {
+    RANGE_TOP           = 1 << 24,      // renormalize when range is below
+    RANGE_INIT_BYTES    = 5,            // bytes read by the decoder before the first symbol, written by the flush
+    RANGE_MAX_TOTAL     = 1 << 16,      // halve the weights when the total is above
+    RANGE_MAX_RAW_BITS  = 16,           // max bits coded in a single step
+    RANGE_SEEN_WORDS    = 512 / BITMAP_WORD_BITS    // up to 512 symbols (LZ77 literal/length model)
+};
+
+typedef int (*adh_write_byte_fn)(void *ctx, byte_t value);
+typedef int (*adh_read_byte_fn)(void *ctx, byte_t *value);
+
+/*
+ * adaptive frequency model, the counterpart of an adh_tree_t:
+ * each symbol has a weight increased by one when coded, unseen symbols have weight 0.
+ * the escape (NYT) has weight 1 and is followed by the symbol coded uniformly
+ * in [0..num_symbols], num_symbols being the end of stream.
+ * with compact escapes, the uniform value is the index among the unseen symbols (end of stream last)
+ */
+typedef struct {
+    uint16_t            num_symbols;
+    uint32_t            total;          // sum of the weights, escape included
+    uint16_t            num_seen;
+    uint64_t            seen[RANGE_SEEN_WORDS];     // bitmap of the symbols with weight > 0
+    uint32_t            fenwick[];      // binary indexed tree of the weights, 1-based
+} adh_freq_t;
+
+/*
+ * range coder with carry propagation and its models (order-0, order-1 contexts, LZ77 distances)
+ */
+typedef struct {
+    byte_t              flags;
+    byte_t              context;        // previous symbol
+    adh_freq_t *        order0;
+    adh_freq_t *        contexts[256];
+    adh_freq_t *        distances;
+
+    uint64_t            low;
+    uint32_t            range;
+    uint32_t            code;
+    byte_t              cache;
+    uint64_t            cache_size;
+
+    adh_write_byte_fn   write_byte;
+    adh_read_byte_fn    read_byte;
+    void *              io_ctx;
+} adh_range_coder_t;
+
+int             adh_range_init_encoder(adh_range_coder_t *coder, byte_t flags, adh_write_byte_fn write_byte, void *io_ctx);
+int             adh_range_init_decoder(adh_range_coder_t *coder, byte_t flags, adh_read_byte_fn read_byte, void *io_ctx);
+void            adh_range_release(adh_range_coder_t *coder);
+adh_freq_t *    adh_range_get_context_model(adh_range_coder_t *coder);
+
+int             adh_range_encode(adh_range_coder_t *coder, adh_freq_t *model, adh_freq_t *escape_model, int symbol);
+int             adh_range_decode(adh_range_coder_t *coder, adh_freq_t *model, adh_freq_t *escape_model, int *symbol);
+int             adh_range_encode_bits(adh_range_coder_t *coder, uint32_t value, int num_bits);
+int             adh_range_decode_bits(adh_range_coder_t *coder, uint32_t *value, int num_bits);
+int             adh_range_flush(adh_range_coder_t *coder);
+
+#endif //ALGO_ADHUFF_RANGE_H
@@ -0,0 +1,330 @@
+#define _GNU_SOURCE             // sigaction
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "adhuff_serve.h"
+#include "adhuff_common.h"
+#include "adhuff_buffer.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    SERVE_BACKLOG       = 64,
+    SERVE_RESPAWN_MS    = 100       // delay before replacing a worker that died, in case it dies at once again
+};
+
+static volatile sig_atomic_t serve_stopping = 0;
+
+//
+// private methods
+//
+int     serve_listen(const char *socket_path);
+int     serve_start_worker(int listen_fd, const sigset_t *worker_signals, pid_t *pid);
+int     serve_worker_main(int listen_fd);
+void    serve_connection(int fd);
+int     serve_request(const byte_t *header, const byte_t *payload, size_t length, byte_t **decoded,
+                      byte_t **output, size_t *output_size);
+int     serve_respond(int fd, byte_t status, const void *payload, size_t length);
+void    serve_on_signal(int signal_number);
+
+/**
+ * listen on the socket and answer the requests with a pool of worker processes, until SIGTERM or SIGINT
+ * a worker that dies is replaced
+ * @param socket_path: an existing socket at this path is replaced
+ * @param workers: [1..ADH_SERVE_MAX_WORKERS], 0 = ADH_SERVE_DEFAULT_WORKERS
+ * @return RC_OK / RC_FAIL
+ */
+int adh_serve(const char *socket_path, int workers) {
+    if(workers == 0)
+        workers = ADH_SERVE_DEFAULT_WORKERS;
+    if(workers < 1 || workers > ADH_SERVE_MAX_WORKERS) {
+        log_error("adh_serve", "invalid number of workers %d\n", workers);
+        return RC_FAIL;
+    }
+
+    // workers: no SA_RESTART, their blocking calls return on a stop
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = serve_on_signal;
+    sigemptyset(&action.sa_mask);
+    serve_stopping = 0;
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    // the server waits for the signals instead: none is lost between two waits
+    sigset_t signals, previous_signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &signals, &previous_signals);
+
+    int listen_fd = serve_listen(socket_path);
+    if(listen_fd < 0) {
+        sigprocmask(SIG_SETMASK, &previous_signals, NULL);
+        return RC_FAIL;
+    }
+
+    pid_t pids[ADH_SERVE_MAX_WORKERS] = {0};
+    int rc = RC_OK;
+    for (int i = 0; i < workers && rc == RC_OK; ++i) {
+        rc = serve_start_worker(listen_fd, &previous_signals, &pids[i]);
+    }
+    if(rc == RC_OK)
+        log_info("adh_serve", "%s, %d workers\n", socket_path, workers);
+
+    while(rc == RC_OK) {
+        int signal_number = sigwaitinfo(&signals, NULL);
+        if(signal_number == SIGTERM || signal_number == SIGINT)
+            break;
+        if(signal_number != SIGCHLD)
+            continue;
+
+        int status = 0;
+        pid_t pid;
+        while(rc == RC_OK && (pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < workers && rc == RC_OK; ++i) {
+                if(pids[i] != pid)
+                    continue;
+
+                log_error("adh_serve", "worker %d exited with status %d, restarting it\n", (int)pid, status);
+                struct timespec delay = { 0, SERVE_RESPAWN_MS * 1000000L };
+                nanosleep(&delay, NULL);
+                rc = serve_start_worker(listen_fd, &previous_signals, &pids[i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < workers; ++i) {
+        if(pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    }
+    for (int i = 0; i < workers; ++i) {
+        if(pids[i] > 0)
+            while(waitpid(pids[i], NULL, 0) < 0 && errno == EINTR);
+    }
+
+    close(listen_fd);
+    unlink(socket_path);
+    sigprocmask(SIG_SETMASK, &previous_signals, NULL);
+    log_info("adh_serve", "stopped\n");
+    return rc;
+}
+
+/**
+ * write a request or response header
+ * @param header: ADH_SERVE_HEADER_BYTES
+ * @param code: operation or status
+ * @param params: flags, level and lanes of a request, NULL for zeros
+ * @param length: of the payload
+ */
+void adh_serve_put_header(byte_t *header, byte_t code, const byte_t params[3], uint32_t length) {
+    header[0] = code;
+    for (int i = 0; i < 3; ++i) {
+        header[1 + i] = params ? params[i] : 0;
+    }
+    bin_put_be(header + 4, length, 4);
+}
+
+/**
+ * @param header: ADH_SERVE_HEADER_BYTES
+ * @return the payload length
+ */
+uint32_t adh_serve_get_length(const byte_t *header) {
+    return (uint32_t)bin_get_be(header + 4, 4);
+}
+
+/**
+ * create the socket, replacing a socket left at the same path
+ * @param socket_path
+ * @return the listening socket, -1 on error
+ */
+int serve_listen(const char *socket_path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(strlen(socket_path) >= sizeof(address.sun_path)) {
+        log_error("serve_listen", "socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+
+    struct stat path_stat;
+    if(stat(socket_path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode))
+        unlink(socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SERVE_BACKLOG) != 0) {
+        log_error("serve_listen", "cannot listen on %s: %s\n", socket_path, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * fork a worker
+ * @param listen_fd
+ * @param worker_signals: signal mask of the worker
+ * @param pid: the worker
+ * @return RC_OK / RC_FAIL
+ */
+int serve_start_worker(int listen_fd, const sigset_t *worker_signals, pid_t *pid) {
+    fflush(stdout);
+    fflush(stderr);
+    *pid = fork();
+    if(*pid < 0) {
+        log_error("serve_start_worker", "fork failed: %s\n", strerror(errno));
+        *pid = 0;
+        return RC_FAIL;
+    }
+    if(*pid == 0) {
+        sigprocmask(SIG_SETMASK, worker_signals, NULL);
+        _exit(serve_worker_main(listen_fd) == RC_OK ? 0 : 1);
+    }
+    return RC_OK;
+}
+
+/**
+ * worker: accept the connections one at a time, until a stop
+ * @param listen_fd
+ * @return RC_OK / RC_FAIL
+ */
+int serve_worker_main(int listen_fd) {
+    // the errors of a bad request are printed at once, the worker goes on with the next one
+    set_log_error_delay(0);
+    while(!serve_stopping) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED)
+                continue;
+            log_error("serve_worker_main", "accept failed: %s\n", strerror(errno));
+            return RC_FAIL;
+        }
+
+        serve_connection(fd);
+        close(fd);
+    }
+    return RC_OK;
+}
+
+/**
+ * answer the requests of a connection in order, until the client closes it or an invalid request
+ * the request buffer and the decompression buffer are kept from a request to the next
+ * @param fd
+ */
+void serve_connection(int fd) {
+    byte_t * payload = NULL;
+    byte_t * decoded = NULL;
+    size_t capacity = 0;
+    byte_t header[ADH_SERVE_HEADER_BYTES];
+    while(!serve_stopping && bin_read_all(fd, header, ADH_SERVE_HEADER_BYTES, &serve_stopping) == RC_OK) {
+        size_t length = adh_serve_get_length(header);
+        if(length > ADH_SERVE_MAX_PAYLOAD) {
+            const char message[] = "payload too large";
+            serve_respond(fd, ADH_SERVE_ERROR, message, sizeof(message) - 1);
+            break;
+        }
+
+        if(length > capacity || payload == NULL) {
+            free(payload);
+            capacity = length > 0 ? length : 1;
+            payload = malloc(capacity);
+            if(payload == NULL)
+                break;
+        }
+        if(bin_read_all(fd, payload, length, &serve_stopping) != RC_OK)
+            break;
+
+        byte_t * output = NULL;
+        size_t output_size = 0;
+        int rc = serve_request(header, payload, length, &decoded, &output, &output_size);
+        if(rc == RC_OK) {
+            rc = serve_respond(fd, ADH_SERVE_OK, output, output_size);
+        } else {
+            const char * message = header[0] == ADH_SERVE_DECOMPRESS ? "cannot decompress" : "cannot compress";
+            rc = serve_respond(fd, ADH_SERVE_ERROR, message, strlen(message));
+        }
+        if(output != decoded)
+            free(output);
+        if(rc != RC_OK)
+            break;
+    }
+    free(payload);
+    free(decoded);
+}
+
+/**
+ * compress or decompress the payload.
+ * The decompressed output is capped at ADH_SERVE_MAX_PAYLOAD: a small payload can expand without limit
+ * @param header: the request header
+ * @param payload
+ * @param length
+ * @param decoded: the decompression buffer of ADH_SERVE_MAX_PAYLOAD bytes, allocated on the first use
+ * @param output: the compressed output allocated with malloc, or *decoded; NULL on failure
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int serve_request(const byte_t *header, const byte_t *payload, size_t length, byte_t **decoded,
+                  byte_t **output, size_t *output_size) {
+    *output = NULL;
+    if(header[0] == ADH_SERVE_COMPRESS) {
+        adh_options_t options = { .flags = header[1], .level = header[2], .lanes = header[3] };
+        return adh_compress_memory(payload, length, output, output_size, &options);
+    }
+    if(header[0] == ADH_SERVE_DECOMPRESS) {
+        if(*decoded == NULL && (*decoded = malloc(ADH_SERVE_MAX_PAYLOAD)) == NULL)
+            return RC_FAIL;
+        int rc = adh_decompress_buffer(payload, length, *decoded, ADH_SERVE_MAX_PAYLOAD, output_size);
+        *output = rc == RC_OK ? *decoded : NULL;
+        return rc;
+    }
+
+    log_error("serve_request", "unknown operation %d\n", header[0]);
+    return RC_FAIL;
+}
+
+/**
+ * write a response
+ * @param fd
+ * @param status: ADH_SERVE_OK / ADH_SERVE_ERROR
+ * @param payload
+ * @param length: over UINT32_MAX, an error is answered instead
+ * @return RC_OK / RC_FAIL
+ */
+int serve_respond(int fd, byte_t status, const void *payload, size_t length) {
+    const char too_large[] = "output too large";
+    if(length > UINT32_MAX) {
+        log_error("serve_respond", "output of %zu bytes over the protocol limit\n", length);
+        status = ADH_SERVE_ERROR;
+        payload = too_large;
+        length = sizeof(too_large) - 1;
+    }
+    byte_t header[ADH_SERVE_HEADER_BYTES];
+    adh_serve_put_header(header, status, NULL, (uint32_t)length);
+    int rc = bin_write_all(fd, header, ADH_SERVE_HEADER_BYTES, &serve_stopping);
+    if(rc == RC_OK && length > 0)
+        rc = bin_write_all(fd, payload, length, &serve_stopping);
+    return rc;
+}
+
+/**
+ * SIGTERM, SIGINT: stop the server, or the worker
+ * @param signal_number
+ */
+void serve_on_signal(int signal_number) {
+    (void)signal_number;
+    serve_stopping = 1;
+}
@@ -0,0 +1,45 @@
+#ifndef ALGO_ADHUFF_SERVE_H
+#define ALGO_ADHUFF_SERVE_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ *
+ * protocol over a Unix domain stream socket: the client sends requests, the server answers each one in order.
+ * A client can send several requests before reading the answers (pipelining), as long as it reads
+ * the answers before the socket buffers fill up.
+ * request:  ADH_SERVE_HEADER_BYTES, then the payload
+ *     byte 0       ADH_SERVE_COMPRESS / ADH_SERVE_DECOMPRESS
+ *     byte 1       format flags ADH_FLAG_* (compress)
+ *     byte 2       LZ77 level (compress)
+ *     byte 3       interleaved lanes (compress)
+ *     bytes 4..7   payload length, big endian
+ * response: ADH_SERVE_HEADER_BYTES, then the payload
+ *     byte 0       ADH_SERVE_OK / ADH_SERVE_ERROR
+ *     bytes 1..3   0
+ *     bytes 4..7   payload length, big endian: the output, or the error message
+ */
+enum {
+    ADH_SERVE_HEADER_BYTES  = 8,
+    ADH_SERVE_MAX_PAYLOAD   = 64 * 1024 * 1024,
+    ADH_SERVE_DEFAULT_WORKERS = 4,
+    ADH_SERVE_MAX_WORKERS   = 64,
+    ADH_SERVE_COMPRESS      = 'c',
+    ADH_SERVE_DECOMPRESS    = 'd',
+    ADH_SERVE_OK            = 0,
+    ADH_SERVE_ERROR         = 1
+};
+
+/*
+ * the server: a pool of worker processes accepting the connections on the socket, each one
+ * with its own coder (the coders keep their state in module variables) reused for all its requests.
+ * adh_serve returns on SIGTERM or SIGINT, after stopping the workers and removing the socket
+ */
+int         adh_serve(const char *socket_path, int workers);
+
+// protocol helpers, shared with the client (adhuff_client.h)
+void        adh_serve_put_header(byte_t *header, byte_t code, const byte_t params[3], uint32_t length);
+uint32_t    adh_serve_get_length(const byte_t *header);
+
+#endif //ALGO_ADHUFF_SERVE_H
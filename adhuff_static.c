@@ -0,0 +1,475 @@
+#include <string.h>
+
+#include "adhuff_static.h"
+#include "adhuff_common.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+/**
+ * constants
+ */
+enum {
+    BLOCK_COUNT_BYTES   = 4,
+    BLOCK_HEADER_BYTES  = 2 * BLOCK_COUNT_BYTES + STATIC_LENGTHS_BYTES,
+    MAX_STREAM_BYTES    = STATIC_BLOCK_SIZE / SYMBOL_BITS * STATIC_MAX_CODE_BITS,
+    PADDING_BYTES       = 8,                                    // read past the last bit, see bit_window
+    WINDOW_CODES        = 3,                                    // codes decoded from a 64 bits window (57 valid bits)
+    ROOT_BITS           = ADH_LOOKUP_BITS,                      // first level of the decoding table
+    SUB_BITS            = STATIC_MAX_CODE_BITS - ROOT_BITS,     // second level, for the longer codes
+    TABLE_ENTRIES       = (1 << ROOT_BITS) + ADH_MAX_SYMBOLS * (1 << SUB_BITS),
+    ENTRY_LENGTH_BITS   = 4,
+    ENTRY_LENGTH_MASK   = (1 << ENTRY_LENGTH_BITS) - 1
+};
+
+/*
+ * the buffers of a block, and its codes.
+ * A table entry is the symbol << ENTRY_LENGTH_BITS | its code length, or, for the codes longer than ROOT_BITS,
+ * the offset of the second level table of the prefix << ENTRY_LENGTH_BITS (length 0)
+ */
+typedef struct {
+    byte_t *            block;          // input bytes (encoder) or decoded bytes (decoder) of a block
+    byte_t *            stream;         // bit stream of a block, then PADDING_BYTES
+    uint32_t *          table;          // decoder: the two levels of TABLE_ENTRIES
+    byte_t              lengths[ADH_MAX_SYMBOLS];
+    uint32_t            codes[ADH_MAX_SYMBOLS];
+} static_coder_t;
+
+//
+// private methods
+//
+int     static_init(static_coder_t *sc, bool decoder);
+void    static_release(static_coder_t *sc);
+size_t  static_encode_block(static_coder_t *sc, size_t num_symbols);
+int     static_write_block(static_coder_t *sc, size_t num_symbols, size_t stream_bytes, FILE *output_file_ptr);
+int     static_read_block(static_coder_t *sc, FILE *input_file_ptr, size_t *num_symbols, size_t *stream_bytes);
+int     static_decode_block(static_coder_t *sc, size_t num_symbols, size_t stream_bytes);
+void    static_code_lengths(const uint64_t counts[], byte_t lengths[]);
+void    static_canonical_codes(const byte_t lengths[], uint32_t codes[]);
+void    static_build_table(static_coder_t *sc);
+static inline uint32_t static_lookup(const uint32_t *table, uint64_t window);
+
+/**
+ * code the input in blocks with static codes, after the format flags already written
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int adh_static_encode(FILE *input_file_ptr, FILE *output_file_ptr) {
+    static_coder_t sc;
+    int rc = static_init(&sc, false);
+
+    byte_t version = STATIC_VERSION;
+    if(rc == RC_OK && fwrite(&version, sizeof(byte_t), 1, output_file_ptr) != 1) {
+        log_error("adh_static_encode", "cannot write the format version\n");
+        rc = RC_FAIL;
+    }
+    if(rc == RC_OK)
+        rc = adh_progress_update(0, 1);
+
+    size_t num_symbols = 0;
+    uint64_t read_start = adh_timer_start(ADH_PHASE_READ);
+    while (rc == RC_OK && (num_symbols = fread(sc.block, sizeof(byte_t), STATIC_BLOCK_SIZE, input_file_ptr)) > 0) {
+        adh_timer_stop(ADH_PHASE_READ, read_start);
+        rc = adh_progress_update(num_symbols, 0);
+
+        if(rc == RC_OK) {
+            size_t stream_bytes = static_encode_block(&sc, num_symbols);
+            rc = static_write_block(&sc, num_symbols, stream_bytes, output_file_ptr);
+        }
+        read_start = adh_timer_start(ADH_PHASE_READ);
+    }
+    adh_timer_stop(ADH_PHASE_READ, read_start);
+
+    static_release(&sc);
+    return rc;
+}
+
+/**
+ * decode the blocks, after the format flags and the version already read
+ * @param input_file_ptr
+ * @param output_file_ptr
+ * @param version: of the static format, from the header byte
+ * @return RC_OK / RC_FAIL
+ */
+int adh_static_decode(FILE *input_file_ptr, FILE *output_file_ptr, int version) {
+    if(version != STATIC_VERSION) {
+        log_error("adh_static_decode", "unsupported static format version %d\n", version);
+        return RC_FAIL;
+    }
+
+    static_coder_t sc;
+    int rc = static_init(&sc, true);
+    while(rc == RC_OK) {
+        size_t num_symbols = 0, stream_bytes = 0;
+        rc = static_read_block(&sc, input_file_ptr, &num_symbols, &stream_bytes);
+        if(rc != RC_OK || num_symbols == 0)
+            break;
+
+        rc = static_decode_block(&sc, num_symbols, stream_bytes);
+
+        uint64_t write_start = adh_timer_start(ADH_PHASE_WRITE);
+        if(rc == RC_OK && fwrite(sc.block, sizeof(byte_t), num_symbols, output_file_ptr) != num_symbols) {
+            log_error("adh_static_decode", "cannot write %zu bytes\n", num_symbols);
+            rc = RC_FAIL;
+        }
+        adh_timer_stop(ADH_PHASE_WRITE, write_start);
+        if(rc == RC_OK)
+            rc = adh_progress_update(0, num_symbols);
+    }
+
+    static_release(&sc);
+    return rc;
+}
+
+/**
+ * allocate the block buffers
+ * @param sc
+ * @param decoder: with the decoding table
+ * @return RC_OK / RC_FAIL
+ */
+int static_init(static_coder_t *sc, bool decoder) {
+    memset(sc, 0, sizeof(static_coder_t));
+    sc->block = adh_malloc(STATIC_BLOCK_SIZE);
+    sc->stream = adh_malloc(MAX_STREAM_BYTES + PADDING_BYTES);
+    if(decoder)
+        sc->table = adh_malloc(TABLE_ENTRIES * sizeof(uint32_t));
+    return sc->block != NULL && sc->stream != NULL && (sc->table != NULL || !decoder) ? RC_OK : RC_FAIL;
+}
+
+/**
+ * release the buffers
+ * @param sc
+ */
+void static_release(static_coder_t *sc) {
+    adh_free(sc->block);
+    adh_free(sc->stream);
+    adh_free(sc->table);
+    memset(sc, 0, sizeof(static_coder_t));
+}
+
+/**
+ * first pass over the block: count the bytes and build their codes, second pass: write the codes
+ * @param sc
+ * @param num_symbols: in the block
+ * @return the bytes of the bit stream, 0 for a single byte value
+ */
+size_t static_encode_block(static_coder_t *sc, size_t num_symbols) {
+    uint64_t start = adh_timer_start(ADH_PHASE_MODEL);
+    uint64_t counts[ADH_MAX_SYMBOLS] = {0};
+    for (size_t i = 0; i < num_symbols; ++i) {
+        counts[sc->block[i]]++;
+    }
+
+    static_code_lengths(counts, sc->lengths);
+    static_canonical_codes(sc->lengths, sc->codes);
+
+    int num_used = 0;
+    for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+        num_used += sc->lengths[s] != 0;
+    }
+    adh_timer_stop(ADH_PHASE_MODEL, start);
+    if(num_used == 1)
+        return 0;
+
+    start = adh_timer_start(ADH_PHASE_BITS);
+    const byte_t * lengths = sc->lengths;
+    const uint32_t * codes = sc->codes;
+    bit_writer_t writer;
+    bit_writer_init(&writer, sc->stream);
+    for (size_t i = 0; i < num_symbols; ++i) {
+        byte_t symbol = sc->block[i];
+        bit_writer_put(&writer, codes[symbol], lengths[symbol]);
+    }
+    size_t stream_bytes = (size_t)(bit_writer_flush(&writer) - sc->stream);
+    adh_timer_stop(ADH_PHASE_BITS, start);
+    return stream_bytes;
+}
+
+/**
+ * write the block header with the code lengths, then the bit stream
+ * @param sc
+ * @param num_symbols
+ * @param stream_bytes
+ * @param output_file_ptr
+ * @return RC_OK / RC_FAIL
+ */
+int static_write_block(static_coder_t *sc, size_t num_symbols, size_t stream_bytes, FILE *output_file_ptr) {
+    byte_t header[BLOCK_HEADER_BYTES];
+    bin_put_be(header, num_symbols, BLOCK_COUNT_BYTES);
+    bin_put_be(header + BLOCK_COUNT_BYTES, stream_bytes, BLOCK_COUNT_BYTES);
+    for (int i = 0; i < STATIC_LENGTHS_BYTES; ++i) {
+        header[2 * BLOCK_COUNT_BYTES + i] = (byte_t)(sc->lengths[2 * i] << 4 | sc->lengths[2 * i + 1]);
+    }
+
+    uint64_t start = adh_timer_start(ADH_PHASE_WRITE);
+    int rc = fwrite(header, sizeof(byte_t), BLOCK_HEADER_BYTES, output_file_ptr) == BLOCK_HEADER_BYTES
+             && fwrite(sc->stream, sizeof(byte_t), stream_bytes, output_file_ptr) == stream_bytes ? RC_OK : RC_FAIL;
+    adh_timer_stop(ADH_PHASE_WRITE, start);
+
+    if(rc != RC_OK) {
+        log_error("static_write_block", "cannot write a block of %zu symbols\n", num_symbols);
+        return rc;
+    }
+    return adh_progress_update(0, BLOCK_HEADER_BYTES + stream_bytes);
+}
+
+/**
+ * read the next block header and its bit stream
+ * @param sc
+ * @param input_file_ptr
+ * @param num_symbols: 0 at the end of the stream
+ * @param stream_bytes
+ * @return RC_OK / RC_FAIL
+ */
+int static_read_block(static_coder_t *sc, FILE *input_file_ptr, size_t *num_symbols, size_t *stream_bytes) {
+    byte_t header[BLOCK_HEADER_BYTES];
+    *num_symbols = 0;
+
+    uint64_t start = adh_timer_start(ADH_PHASE_READ);
+    size_t bytes_read = fread(header, sizeof(byte_t), BLOCK_HEADER_BYTES, input_file_ptr);
+    adh_timer_stop(ADH_PHASE_READ, start);
+    if(bytes_read == 0 && !ferror(input_file_ptr))
+        return RC_OK;
+    if(bytes_read != BLOCK_HEADER_BYTES) {
+        log_error("static_read_block", "truncated block header\n");
+        return RC_FAIL;
+    }
+
+    size_t count = (size_t)bin_get_be(header, BLOCK_COUNT_BYTES);
+    size_t length = (size_t)bin_get_be(header + BLOCK_COUNT_BYTES, BLOCK_COUNT_BYTES);
+    if(count == 0 || count > STATIC_BLOCK_SIZE || length > (count * STATIC_MAX_CODE_BITS + SYMBOL_BITS - 1) / SYMBOL_BITS) {
+        log_error("static_read_block", "invalid block of %zu symbols in %zu bytes\n", count, length);
+        return RC_FAIL;
+    }
+    for (int i = 0; i < STATIC_LENGTHS_BYTES; ++i) {
+        sc->lengths[2 * i] = header[2 * BLOCK_COUNT_BYTES + i] >> 4;
+        sc->lengths[2 * i + 1] = header[2 * BLOCK_COUNT_BYTES + i] & 0x0F;
+    }
+
+    start = adh_timer_start(ADH_PHASE_READ);
+    bytes_read = fread(sc->stream, sizeof(byte_t), length, input_file_ptr);
+    adh_timer_stop(ADH_PHASE_READ, start);
+    if(bytes_read != length) {
+        log_error("static_read_block", "truncated block: %zu bytes of %zu\n", bytes_read, length);
+        return RC_FAIL;
+    }
+    memset(sc->stream + length, 0, PADDING_BYTES);
+
+    *num_symbols = count;
+    *stream_bytes = length;
+    return adh_progress_update(BLOCK_HEADER_BYTES + length, 0);
+}
+
+/**
+ * decode the symbols of a block, WINDOW_CODES codes from each window of the bit stream (see static_lookup)
+ * @param sc
+ * @param num_symbols
+ * @param stream_bytes
+ * @return RC_OK / RC_FAIL
+ */
+int static_decode_block(static_coder_t *sc, size_t num_symbols, size_t stream_bytes) {
+    // the lengths of a complete prefix code, or a single symbol without bits
+    int num_used = 0, last_used = 0;
+    uint32_t kraft_sum = 0;
+    for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+        if(sc->lengths[s] == 0)
+            continue;
+        num_used++;
+        last_used = s;
+        kraft_sum += 1u << (STATIC_MAX_CODE_BITS - sc->lengths[s]);
+    }
+    if(num_used == 1 && stream_bytes == 0) {
+        memset(sc->block, last_used, num_symbols);
+        return RC_OK;
+    }
+    if(num_used < 2 || kraft_sum != 1u << STATIC_MAX_CODE_BITS) {
+        log_error("static_decode_block", "invalid code lengths: %d symbols\n", num_used);
+        return RC_FAIL;
+    }
+
+    uint64_t start = adh_timer_start(ADH_PHASE_MODEL);
+    static_build_table(sc);
+    adh_timer_stop(ADH_PHASE_MODEL, start);
+
+    start = adh_timer_start(ADH_PHASE_BITS);
+    const uint32_t * table = sc->table;
+    const byte_t * stream = sc->stream;
+    byte_t * block = sc->block;
+    uint64_t bit_idx = 0;
+    size_t i = 0;
+    for (; i + WINDOW_CODES <= num_symbols; i += WINDOW_CODES) {
+        uint64_t window = bit_window(stream, bit_idx);
+        for (int k = 0; k < WINDOW_CODES; ++k) {
+            uint32_t entry = static_lookup(table, window);
+            int length = (int)(entry & ENTRY_LENGTH_MASK);
+            block[i + k] = (byte_t)(entry >> ENTRY_LENGTH_BITS);
+            window <<= length;
+            bit_idx += (uint64_t)length;
+        }
+    }
+    for (; i < num_symbols; ++i) {
+        uint32_t entry = static_lookup(table, bit_window(stream, bit_idx));
+        block[i] = (byte_t)(entry >> ENTRY_LENGTH_BITS);
+        bit_idx += entry & ENTRY_LENGTH_MASK;
+    }
+    adh_timer_stop(ADH_PHASE_BITS, start);
+
+    if(bit_idx > (uint64_t)stream_bytes * SYMBOL_BITS) {
+        log_error("static_decode_block", "too many bits read: %" PRIu64 " > %zu\n", bit_idx, stream_bytes * SYMBOL_BITS);
+        return RC_FAIL;
+    }
+    return RC_OK;
+}
+
+/**
+ * a lookup of the first ROOT_BITS bits of the window resolves the codes up to ROOT_BITS bits,
+ * the longer ones take a second lookup of the next SUB_BITS bits
+ * @param table
+ * @param window: the next bits, most significant first
+ * @return the entry of the code, with its symbol and length
+ */
+static inline uint32_t static_lookup(const uint32_t *table, uint64_t window) {
+    uint32_t bits = (uint32_t)(window >> (64 - STATIC_MAX_CODE_BITS));
+    uint32_t entry = table[bits >> SUB_BITS];
+    if((entry & ENTRY_LENGTH_MASK) == 0)
+        entry = table[(entry >> ENTRY_LENGTH_BITS) + (bits & ((1u << SUB_BITS) - 1))];
+    return entry;
+}
+
+/**
+ * Huffman code lengths of the counted bytes, limited to STATIC_MAX_CODE_BITS: while the longest code is too long,
+ * the counts are halved (a present byte keeps at least 1) and the codes built again, which flattens the distribution.
+ * The leaves sorted by count are merged two by two, the merged nodes queued in creation order are already sorted
+ * @param counts: occurrences of each byte, at least one byte present
+ * @param lengths: the code length of each byte, 0 if absent
+ */
+void static_code_lengths(const uint64_t counts[], byte_t lengths[]) {
+    uint64_t scaled[ADH_MAX_SYMBOLS];
+    int symbols[ADH_MAX_SYMBOLS];
+    uint64_t weights[2 * ADH_MAX_SYMBOLS];
+    int parents[2 * ADH_MAX_SYMBOLS];
+    byte_t depths[2 * ADH_MAX_SYMBOLS];
+    memcpy(scaled, counts, sizeof(scaled));
+
+    for (;;) {
+        int num_leaves = 0;
+        for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+            if(scaled[s] == 0)
+                continue;
+            int j = num_leaves++;
+            for (; j > 0 && scaled[symbols[j - 1]] > scaled[s]; --j) {
+                symbols[j] = symbols[j - 1];
+            }
+            symbols[j] = s;
+        }
+
+        memset(lengths, 0, ADH_MAX_SYMBOLS);
+        if(num_leaves == 1) {
+            lengths[symbols[0]] = 1;
+            return;
+        }
+
+        for (int i = 0; i < num_leaves; ++i) {
+            weights[i] = scaled[symbols[i]];
+        }
+        int num_nodes = 2 * num_leaves - 1;
+        int next_leaf = 0, head = num_leaves;
+        for (int k = num_leaves; k < num_nodes; ++k) {
+            weights[k] = 0;
+            for (int j = 0; j < 2; ++j) {
+                int child;
+                if(next_leaf < num_leaves && (head == k || weights[next_leaf] <= weights[head]))
+                    child = next_leaf++;
+                else
+                    child = head++;
+                parents[child] = k;
+                weights[k] += weights[child];
+            }
+        }
+
+        // the root is the last node, the parents come after their children
+        int max_length = 0;
+        depths[num_nodes - 1] = 0;
+        for (int k = num_nodes - 2; k >= 0; --k) {
+            depths[k] = (byte_t)(depths[parents[k]] + 1);
+        }
+        for (int i = 0; i < num_leaves; ++i) {
+            lengths[symbols[i]] = depths[i];
+            if(depths[i] > max_length)
+                max_length = depths[i];
+        }
+        if(max_length <= STATIC_MAX_CODE_BITS)
+            return;
+
+        for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+            scaled[s] = (scaled[s] + 1) / 2;
+        }
+    }
+}
+
+/**
+ * canonical codes from the lengths: the codes of a length are consecutive in byte order,
+ * and follow the codes of the shorter lengths
+ * @param lengths
+ * @param codes: of the bytes present
+ */
+void static_canonical_codes(const byte_t lengths[], uint32_t codes[]) {
+    uint32_t length_count[STATIC_MAX_CODE_BITS + 1] = {0};
+    for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+        length_count[lengths[s]]++;
+    }
+    length_count[0] = 0;
+
+    uint32_t next_code[STATIC_MAX_CODE_BITS + 1] = {0};
+    uint32_t code = 0;
+    for (int length = 1; length <= STATIC_MAX_CODE_BITS; ++length) {
+        code = (code + length_count[length - 1]) << 1;
+        next_code[length] = code;
+    }
+
+    for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+        if(lengths[s] != 0)
+            codes[s] = next_code[lengths[s]]++;
+    }
+}
+
+/**
+ * fill the decoding table from the code lengths, a complete prefix code:
+ * a code of length l up to ROOT_BITS fills the 2^(ROOT_BITS-l) entries starting with it,
+ * a longer code fills the entries of the second level table of its first ROOT_BITS bits
+ * @param sc
+ */
+void static_build_table(static_coder_t *sc) {
+    static_canonical_codes(sc->lengths, sc->codes);
+    uint32_t * table = sc->table;
+    memset(table, 0, (1 << ROOT_BITS) * sizeof(uint32_t));
+
+    uint32_t next_sub = 1 << ROOT_BITS;
+    for (int s = 0; s < ADH_MAX_SYMBOLS; ++s) {
+        int length = sc->lengths[s];
+        if(length == 0)
+            continue;
+
+        uint32_t entry = (uint32_t)s << ENTRY_LENGTH_BITS | (uint32_t)length;
+        uint32_t code = sc->codes[s];
+        if(length <= ROOT_BITS) {
+            uint32_t first = code << (ROOT_BITS - length);
+            for (uint32_t j = 0; j < 1u << (ROOT_BITS - length); ++j) {
+                table[first + j] = entry;
+            }
+            continue;
+        }
+
+        uint32_t prefix = code >> (length - ROOT_BITS);
+        if(table[prefix] == 0) {
+            table[prefix] = next_sub << ENTRY_LENGTH_BITS;
+            memset(&table[next_sub], 0, (1 << SUB_BITS) * sizeof(uint32_t));
+            next_sub += 1 << SUB_BITS;
+        }
+        uint32_t * sub_table = &table[table[prefix] >> ENTRY_LENGTH_BITS];
+        uint32_t first = (code & ((1u << (length - ROOT_BITS)) - 1)) << (STATIC_MAX_CODE_BITS - length);
+        for (uint32_t j = 0; j < 1u << (STATIC_MAX_CODE_BITS - length); ++j) {
+            sub_table[first + j] = entry;
+        }
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef ALGO_ADHUFF_STATIC_H
+#define ALGO_ADHUFF_STATIC_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ *
+ * static format (ADH_FLAG_STATIC): each block of STATIC_BLOCK_SIZE input bytes is read twice in memory,
+ * a first pass counts the bytes, the second codes them with canonical Huffman codes of at most STATIC_MAX_CODE_BITS bits.
+ * The header byte after the format flags holds STATIC_VERSION instead of the bits to ignore, then the blocks:
+ * - 4 bytes: number of symbols in the block
+ * - 4 bytes: length in bytes of the bit stream
+ * - STATIC_LENGTHS_BYTES bytes: the code length of each byte value, 4 bits each (high nibble first), 0 = absent
+ * - the bit stream, most significant bit first, the last byte padded with zeros
+ * the values are big endian. The codes are rebuilt from the lengths alone; a block of a single byte value
+ * gives it the length 1 and has an empty bit stream
+ */
+enum {
+    STATIC_VERSION          = 1,
+    STATIC_BLOCK_SIZE       = 1 << 20,
+    STATIC_MAX_CODE_BITS    = 15,
+    STATIC_LENGTHS_BYTES    = 256 / 2
+};
+
+int         adh_static_encode(FILE *input_file_ptr, FILE *output_file_ptr);
+int         adh_static_decode(FILE *input_file_ptr, FILE *output_file_ptr, int version);
+
+#endif //ALGO_ADHUFF_STATIC_H
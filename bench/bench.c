@@ -0,0 +1,733 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../adhuff_compress.h"
+#include "../adhuff_decompress.h"
+#include "../log.h"
+
+/**
+ * constants
+ */
+enum {
+    DEFAULT_ITERATIONS  = 5,
+    MAX_FILES           = 256,
+    MAX_FILE_NAME       = 512,
+    OUTPUT_SLACK        = 4096,     // compressed buffer = input + input/8 + slack
+    CALIBRATION_NODES   = 1 << 14,  // 64 KB of links
+    CALIBRATION_STEPS   = 1 << 22,
+    CALIBRATION_RUNS    = 11,
+    PERF_ATTEMPTS       = 3         // measures of a file before reporting a slowdown
+};
+
+static const double DEFAULT_TOLERANCE = 0.25;   // allowed throughput drop, fraction of the baseline
+static const double RATIO_TOLERANCE = 0.001;    // the ratio is deterministic, only rounding is allowed
+
+/*
+ * timing of one phase (compress or decompress) over the iterations
+ */
+typedef struct {
+    double              median_mbps;
+    double              best_mbps;      // fastest run, the least disturbed by the other processes
+    double              p95_mbps;       // throughput of the 95th percentile (slow) run
+    double              cycles_per_byte;
+    double              worst_cycles_per_byte;  // slowest run, the latency ceiling on this input
+} phase_stats_t;
+
+/*
+ * results of a file
+ */
+typedef struct {
+    char                name[MAX_FILE_NAME];
+    size_t              size;
+    size_t              compressed_size;
+    double              compress_seconds;   // median
+    double              decompress_seconds; // median
+    phase_stats_t       compress;
+    phase_stats_t       decompress;
+    long                peak_rss_kb;
+    double              calibration_mbps;   // measured just before the file, the machine speed drifts
+} file_stats_t;
+
+//
+// private methods
+//
+void        print_usage();
+int         add_path(const char *path, char files[][MAX_FILE_NAME], int *num_files);
+int         load_file(const char *file_name, byte_t **data, size_t *size);
+int         bench_file(const char *file_name, const adh_options_t *options, int iterations, file_stats_t *stats);
+int         run_compress(const byte_t *data, size_t size, const adh_options_t *options,
+                         byte_t *output, size_t capacity, size_t *output_size);
+int         run_decompress(const byte_t *data, size_t size, byte_t *output, size_t capacity, size_t *output_size);
+void        summarize(double seconds[], uint64_t cycles[], int iterations, size_t size, phase_stats_t *stats, double *median);
+int         compare_name(const void *a, const void *b);
+int         compare_double(const void *a, const void *b);
+int         compare_uint64(const void *a, const void *b);
+double      now_seconds();
+uint64_t    now_cycles();
+long        peak_rss_kb();
+void        print_table(const file_stats_t stats[], int num_files, const file_stats_t *total);
+int         write_json(const char *file_name, const adh_options_t *options, int iterations, double calibration_mbps,
+                       const file_stats_t stats[], int num_files, const file_stats_t *total);
+void        write_json_file_stats(FILE *fp, const file_stats_t *stats);
+double      calibrate();
+int         check_baseline(const char *file_name, const adh_options_t *options, int iterations, double tolerance,
+                           double calibration_mbps, file_stats_t stats[], int num_files);
+int         check_file(const char *name, const char *object, double baseline_calibration_mbps,
+                       const file_stats_t *stats, double tolerance, bool print);
+int         check_phase(const char *name, const char *phase, double mbps, double baseline_mbps,
+                        double calibration_mbps, double baseline_calibration_mbps, double tolerance, bool print);
+char *      load_text(const char *file_name);
+const char *base_name(const char *path);
+double      json_number(const char *json, const char *key);
+
+/**
+ * benchmark compression and decompression in memory
+ * usage: adhuff_bench [options] [-n iterations] [--json file|-] [--baseline file [--tolerance t]] path...
+ */
+int main(int argc, char* argv[]) {
+    set_log_level(LOG_ERROR);
+
+    adh_options_t options = {0};
+    int iterations = DEFAULT_ITERATIONS;
+    const char * json_file_name = NULL;
+    const char * baseline_file_name = NULL;
+    double tolerance = DEFAULT_TOLERANCE;
+    static char files[MAX_FILES][MAX_FILE_NAME];
+    int num_files = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            iterations = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+            json_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+            baseline_file_name = argv[++i];
+        } else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            if (adh_parse_option(argv[i], &options) != RC_OK) {
+                log_error("main", "Unexpected option %s\n", argv[i]);
+                print_usage();
+                return 2;
+            }
+        } else if (add_path(argv[i], files, &num_files) != RC_OK) {
+            return 2;
+        }
+    }
+
+    if (num_files == 0 || iterations < 1) {
+        print_usage();
+        return 2;
+    }
+
+    static file_stats_t stats[MAX_FILES];
+    file_stats_t total = { .name = "TOTAL" };
+    double total_compress_cycles = 0;
+    double total_decompress_cycles = 0;
+    double calibration_mbps = 0;
+    for (int i = 0; i < num_files; ++i) {
+        // speed of this machine, the throughputs are compared relative to it
+        double file_calibration_mbps = calibrate();
+        if (bench_file(files[i], &options, iterations, &stats[i]) != RC_OK)
+            return 1;
+
+        stats[i].calibration_mbps = file_calibration_mbps;
+        calibration_mbps += file_calibration_mbps / num_files;
+
+        total.size += stats[i].size;
+        total.compressed_size += stats[i].compressed_size;
+        total.compress_seconds += stats[i].compress_seconds;
+        total.decompress_seconds += stats[i].decompress_seconds;
+        total_compress_cycles += stats[i].compress.cycles_per_byte * stats[i].size;
+        total_decompress_cycles += stats[i].decompress.cycles_per_byte * stats[i].size;
+
+        // the total keeps the worst file: the latency ceiling over all the inputs
+        if (stats[i].compress.worst_cycles_per_byte > total.compress.worst_cycles_per_byte)
+            total.compress.worst_cycles_per_byte = stats[i].compress.worst_cycles_per_byte;
+        if (stats[i].decompress.worst_cycles_per_byte > total.decompress.worst_cycles_per_byte)
+            total.decompress.worst_cycles_per_byte = stats[i].decompress.worst_cycles_per_byte;
+    }
+
+    // the total is the sum of the medians: median and p95 are not additive, report the same value
+    if (total.size > 0) {
+        total.compress.median_mbps = total.compress.p95_mbps = total.size / total.compress_seconds / 1e6;
+        total.decompress.median_mbps = total.decompress.p95_mbps = total.size / total.decompress_seconds / 1e6;
+        total.compress.cycles_per_byte = total_compress_cycles / total.size;
+        total.decompress.cycles_per_byte = total_decompress_cycles / total.size;
+    }
+    total.peak_rss_kb = peak_rss_kb();
+
+    // JSON on stdout replaces the table
+    if (json_file_name == NULL || strcmp(json_file_name, "-") != 0)
+        print_table(stats, num_files, &total);
+    if (json_file_name != NULL && write_json(json_file_name, &options, iterations, calibration_mbps,
+                                             stats, num_files, &total) != RC_OK)
+        return 1;
+    if (baseline_file_name != NULL)
+        return check_baseline(baseline_file_name, &options, iterations, tolerance, calibration_mbps, stats, num_files);
+    return 0;
+}
+
+/**
+ * Print usage
+ */
+void print_usage() {
+    puts("Usage:");
+    puts("\tadhuff_bench [compression options] [-n iterations] [--json <file>|-] <file|directory>...");
+    puts("\t             [--baseline <file> [--tolerance <fraction>]]");
+    puts("\tcompression options are the ones of adaptive_huffman, e.g. --range --lz77=9");
+    puts("\t--baseline compares with the JSON of a previous run: fails if the ratio grows, or if the");
+    puts("\tthroughput relative to the calibration loop drops by more than the tolerance (default 0.25)");
+}
+
+/**
+ * add a file, or all the regular files of a directory
+ * @param path
+ * @param files
+ * @param num_files
+ * @return RC_OK / RC_FAIL
+ */
+int add_path(const char *path, char files[][MAX_FILE_NAME], int *num_files) {
+    struct stat path_stat;
+    if (stat(path, &path_stat) != 0) {
+        log_error("add_path", "cannot stat %s\n", path);
+        return RC_FAIL;
+    }
+
+    if (!S_ISDIR(path_stat.st_mode)) {
+        if (*num_files == MAX_FILES) {
+            log_error("add_path", "too many files\n");
+            return RC_FAIL;
+        }
+        snprintf(files[(*num_files)++], MAX_FILE_NAME, "%s", path);
+        return RC_OK;
+    }
+
+    DIR * dir = opendir(path);
+    if (dir == NULL) {
+        log_error("add_path", "cannot open directory %s\n", path);
+        return RC_FAIL;
+    }
+
+    int first = *num_files;
+    struct dirent * entry;
+    int rc = RC_OK;
+    while (rc == RC_OK && (entry = readdir(dir)) != NULL) {
+        char file_name[MAX_FILE_NAME];
+        snprintf(file_name, MAX_FILE_NAME, "%s/%s", path, entry->d_name);
+        if (stat(file_name, &path_stat) == 0 && S_ISREG(path_stat.st_mode))
+            rc = add_path(file_name, files, num_files);
+    }
+    closedir(dir);
+
+    // sort the entries, so that runs are comparable
+    qsort(files[first], (size_t)(*num_files - first), MAX_FILE_NAME, compare_name);
+    return rc;
+}
+
+/**
+ * read the whole file in memory
+ * @param file_name
+ * @param data: allocated, to be freed by the caller
+ * @param size
+ * @return RC_OK / RC_FAIL
+ */
+int load_file(const char *file_name, byte_t **data, size_t *size) {
+    FILE * fp = bin_open_read(file_name);
+    if (fp == NULL)
+        return RC_FAIL;
+
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t)ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    // at least one byte, fmemopen doesn't accept empty buffers
+    *data = malloc(*size + 1);
+    int rc = *data != NULL && fread(*data, 1, *size, fp) == *size ? RC_OK : RC_FAIL;
+    fclose(fp);
+    if (rc != RC_OK)
+        log_error("load_file", "cannot read %s\n", file_name);
+    return rc;
+}
+
+/**
+ * compress and decompress the file in memory, check the round trip
+ * @param file_name
+ * @param options
+ * @param iterations
+ * @param stats
+ * @return RC_OK / RC_FAIL
+ */
+int bench_file(const char *file_name, const adh_options_t *options, int iterations, file_stats_t *stats) {
+    memset(stats, 0, sizeof(file_stats_t));
+    snprintf(stats->name, MAX_FILE_NAME, "%s", file_name);
+
+    byte_t * data = NULL;
+    int rc = load_file(file_name, &data, &stats->size);
+    if (rc != RC_OK) {
+        free(data);
+        return rc;
+    }
+
+    size_t compressed_capacity = stats->size + stats->size / 8 + OUTPUT_SLACK;
+    size_t decompressed_capacity = stats->size + 1;
+    byte_t * compressed = malloc(compressed_capacity);
+    byte_t * decompressed = malloc(decompressed_capacity);
+    double * seconds = malloc(iterations * sizeof(double));
+    uint64_t * cycles = malloc(iterations * sizeof(uint64_t));
+    if (compressed == NULL || decompressed == NULL || seconds == NULL || cycles == NULL)
+        rc = RC_FAIL;
+
+    for (int i = 0; i < iterations && rc == RC_OK; ++i) {
+        double start = now_seconds();
+        uint64_t start_cycles = now_cycles();
+        rc = run_compress(data, stats->size, options, compressed, compressed_capacity, &stats->compressed_size);
+        cycles[i] = now_cycles() - start_cycles;
+        seconds[i] = now_seconds() - start;
+    }
+    if (rc == RC_OK)
+        summarize(seconds, cycles, iterations, stats->size, &stats->compress, &stats->compress_seconds);
+
+    for (int i = 0; i < iterations && rc == RC_OK; ++i) {
+        size_t decompressed_size = 0;
+        double start = now_seconds();
+        uint64_t start_cycles = now_cycles();
+        rc = run_decompress(compressed, stats->compressed_size, decompressed, decompressed_capacity, &decompressed_size);
+        cycles[i] = now_cycles() - start_cycles;
+        seconds[i] = now_seconds() - start;
+
+        if (rc == RC_OK && (decompressed_size != stats->size || memcmp(data, decompressed, stats->size) != 0)) {
+            log_error("bench_file", "round trip failed for %s\n", file_name);
+            rc = RC_FAIL;
+        }
+    }
+    if (rc == RC_OK)
+        summarize(seconds, cycles, iterations, stats->size, &stats->decompress, &stats->decompress_seconds);
+
+    stats->peak_rss_kb = peak_rss_kb();
+
+    free(data);
+    free(compressed);
+    free(decompressed);
+    free(seconds);
+    free(cycles);
+    return rc;
+}
+
+/**
+ * compress a buffer to a buffer
+ * @param data
+ * @param size
+ * @param options
+ * @param output
+ * @param capacity
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int run_compress(const byte_t *data, size_t size, const adh_options_t *options,
+                 byte_t *output, size_t capacity, size_t *output_size) {
+    FILE * input_file_ptr = fmemopen((void *)data, size > 0 ? size : 1, "rb");
+    FILE * output_file_ptr = fmemopen(output, capacity, "w+b");
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+
+    // an empty file is opened as a single byte, start at the end
+    if (rc == RC_OK && size == 0)
+        fseek(input_file_ptr, 0, SEEK_END);
+
+    if (rc == RC_OK)
+        rc = adh_compress_stream(input_file_ptr, output_file_ptr, options);
+    if (rc == RC_OK)
+        *output_size = (size_t)ftell(output_file_ptr);
+
+    adh_release(output_file_ptr, input_file_ptr);
+    return rc;
+}
+
+/**
+ * decompress a buffer to a buffer
+ * @param data
+ * @param size
+ * @param output
+ * @param capacity
+ * @param output_size
+ * @return RC_OK / RC_FAIL
+ */
+int run_decompress(const byte_t *data, size_t size, byte_t *output, size_t capacity, size_t *output_size) {
+    FILE * input_file_ptr = fmemopen((void *)data, size, "rb");
+    FILE * output_file_ptr = fmemopen(output, capacity, "wb");
+    int rc = input_file_ptr != NULL && output_file_ptr != NULL ? RC_OK : RC_FAIL;
+
+    if (rc == RC_OK)
+        rc = adh_decompress_stream(input_file_ptr, output_file_ptr);
+    if (rc == RC_OK)
+        *output_size = (size_t)ftell(output_file_ptr);
+
+    adh_release(output_file_ptr, input_file_ptr);
+    return rc;
+}
+
+/**
+ * median and 95th percentile of the runs
+ * @param seconds: sorted in place
+ * @param cycles: sorted in place
+ * @param iterations
+ * @param size: bytes processed by each run
+ * @param stats
+ * @param median: median seconds
+ */
+void summarize(double seconds[], uint64_t cycles[], int iterations, size_t size, phase_stats_t *stats, double *median) {
+    qsort(seconds, (size_t)iterations, sizeof(double), compare_double);
+    qsort(cycles, (size_t)iterations, sizeof(uint64_t), compare_uint64);
+
+    int p95 = (iterations * 95 + 99) / 100 - 1;
+    *median = seconds[iterations / 2];
+    if (size == 0)
+        return;
+
+    stats->median_mbps = size / seconds[iterations / 2] / 1e6;
+    stats->p95_mbps = size / seconds[p95] / 1e6;
+    stats->best_mbps = size / seconds[0] / 1e6;
+    stats->cycles_per_byte = (double)cycles[iterations / 2] / size;
+    stats->worst_cycles_per_byte = (double)cycles[iterations - 1] / size;
+}
+
+int compare_name(const void *a, const void *b) {
+    return strcmp((const char *)a, (const char *)b);
+}
+
+int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+int compare_uint64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @return monotonic time in seconds
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return time stamp counter, 0 where not available
+ */
+uint64_t now_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/**
+ * @return peak resident set size of the process (KB)
+ */
+long peak_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_maxrss;
+}
+
+/**
+ * print the results as a table
+ * @param stats
+ * @param num_files
+ * @param total
+ */
+void print_table(const file_stats_t stats[], int num_files, const file_stats_t *total) {
+    printf("%-40s %10s %10s %7s | %8s %8s %8s %8s | %8s %8s %8s %8s | %9s\n",
+           "file", "size", "compressed", "ratio",
+           "c MB/s", "c p95", "c cyc/B", "c max", "d MB/s", "d p95", "d cyc/B", "d max", "peak KB");
+
+    for (int i = 0; i <= num_files; ++i) {
+        const file_stats_t * s = i < num_files ? &stats[i] : total;
+        const char * name = base_name(s->name);
+        double ratio = s->size ? (double)s->compressed_size / s->size : 0;
+        printf("%-40s %10zu %10zu %7.3f | %8.2f %8.2f %8.1f %8.1f | %8.2f %8.2f %8.1f %8.1f | %9ld\n",
+               name, s->size, s->compressed_size, ratio,
+               s->compress.median_mbps, s->compress.p95_mbps, s->compress.cycles_per_byte,
+               s->compress.worst_cycles_per_byte,
+               s->decompress.median_mbps, s->decompress.p95_mbps, s->decompress.cycles_per_byte,
+               s->decompress.worst_cycles_per_byte, s->peak_rss_kb);
+    }
+}
+
+/**
+ * write the results as JSON
+ * @param file_name: "-" for stdout
+ * @param options
+ * @param iterations
+ * @param calibration_mbps
+ * @param stats
+ * @param num_files
+ * @param total
+ * @return RC_OK / RC_FAIL
+ */
+int write_json(const char *file_name, const adh_options_t *options, int iterations, double calibration_mbps,
+               const file_stats_t stats[], int num_files, const file_stats_t *total) {
+    FILE * fp = strcmp(file_name, "-") == 0 ? stdout : fopen(file_name, "w");
+    if (fp == NULL) {
+        log_error("write_json", "cannot create %s\n", file_name);
+        return RC_FAIL;
+    }
+
+    fprintf(fp, "{\n  \"flags\": %d,\n  \"level\": %d,\n  \"iterations\": %d,\n  \"calibration_mbps\": %.3f,\n  \"files\": [\n",
+            options->flags, options->level, iterations, calibration_mbps);
+    for (int i = 0; i < num_files; ++i) {
+        write_json_file_stats(fp, &stats[i]);
+        fputs(i + 1 < num_files ? ",\n" : "\n", fp);
+    }
+    fputs("  ],\n  \"total\":\n", fp);
+    write_json_file_stats(fp, total);
+    fputs("\n}\n", fp);
+
+    if (fp != stdout)
+        fclose(fp);
+    return RC_OK;
+}
+
+/**
+ * write the results of a file as a JSON object
+ * @param fp
+ * @param stats
+ */
+void write_json_file_stats(FILE *fp, const file_stats_t *stats) {
+    const phase_stats_t * phases[] = { &stats->compress, &stats->decompress };
+    const char * names[] = { "compress", "decompress" };
+
+    fprintf(fp, "    {\"name\": \"%s\", \"size\": %zu, \"compressed\": %zu, \"ratio\": %.6f, \"peak_rss_kb\": %ld",
+            stats->name, stats->size, stats->compressed_size,
+            stats->size ? (double)stats->compressed_size / stats->size : 0, stats->peak_rss_kb);
+    if (stats->calibration_mbps > 0)
+        fprintf(fp, ", \"calibration_mbps\": %.3f", stats->calibration_mbps);
+    for (int i = 0; i < 2; ++i) {
+        fprintf(fp, ", \"%s\": {\"median_mbps\": %.3f, \"p95_mbps\": %.3f, \"best_mbps\": %.3f, \"cycles_per_byte\": %.2f"
+                    ", \"worst_cycles_per_byte\": %.2f}",
+                names[i], phases[i]->median_mbps, phases[i]->p95_mbps, phases[i]->best_mbps, phases[i]->cycles_per_byte,
+                phases[i]->worst_cycles_per_byte);
+    }
+    fputs("}", fp);
+}
+
+/**
+ * time a fixed loop of dependent loads through a random cycle of 64 KB, like the tree walks of the coder.
+ * latency bound loops are the least sensitive to the other processes sharing the core
+ * @return millions of steps per second of the fastest run
+ */
+double calibrate() {
+    static uint32_t next[CALIBRATION_NODES];
+    double seconds[CALIBRATION_RUNS];
+
+    // Sattolo shuffle: a single cycle through all the nodes
+    uint64_t state = 1;
+    for (uint32_t i = 0; i < CALIBRATION_NODES; ++i)
+        next[i] = i;
+    for (uint32_t i = CALIBRATION_NODES - 1; i > 0; --i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t j = (uint32_t)((state >> 33) % i);
+        uint32_t tmp = next[i];
+        next[i] = next[j];
+        next[j] = tmp;
+    }
+
+    volatile uint32_t sink = 0;
+    for (int run = 0; run < CALIBRATION_RUNS; ++run) {
+        uint32_t node = 0;
+        uint32_t sum = 0;
+        double start = now_seconds();
+        for (uint32_t i = 0; i < CALIBRATION_STEPS; ++i) {
+            node = next[node];
+            sum += (node & 1) ? node : 1;
+        }
+        seconds[run] = now_seconds() - start;
+        sink += sum + node;
+    }
+
+    qsort(seconds, CALIBRATION_RUNS, sizeof(double), compare_double);
+    return CALIBRATION_STEPS / seconds[0] / 1e6;
+}
+
+/**
+ * compare the results with the JSON written by a previous run, files are matched by base name
+ * @param file_name
+ * @param options: must be the ones of the baseline
+ * @param iterations: to measure again the files that look slower
+ * @param tolerance: allowed drop of the normalized throughput, fraction of the baseline
+ * @param calibration_mbps
+ * @param stats: replaced by the new measure of the files measured again
+ * @param num_files
+ * @return 0 no regression, 1 regression or error
+ */
+int check_baseline(const char *file_name, const adh_options_t *options, int iterations, double tolerance,
+                   double calibration_mbps, file_stats_t stats[], int num_files) {
+    char * json = load_text(file_name);
+    if (json == NULL)
+        return 1;
+
+    if ((int)json_number(json, "\"flags\"") != options->flags || (int)json_number(json, "\"level\"") != options->level) {
+        log_error("check_baseline", "%s was measured with other compression options\n", file_name);
+        free(json);
+        return 1;
+    }
+
+    double baseline_calibration_mbps = json_number(json, "\"calibration_mbps\"");
+    if (baseline_calibration_mbps <= 0) {
+        log_error("check_baseline", "no calibration_mbps in %s\n", file_name);
+        free(json);
+        return 1;
+    }
+    printf("calibration: %.1f MB/s, baseline %.1f MB/s, tolerance %.0f%%\n",
+           calibration_mbps, baseline_calibration_mbps, tolerance * 100);
+
+    int failures = 0;
+    for (int i = 0; i < num_files; ++i) {
+        const char * name = base_name(stats[i].name);
+
+        // the object of the file: its name is name or ends with /name
+        char key[MAX_FILE_NAME + 4];
+        snprintf(key, sizeof(key), "/%s\"", name);
+        const char * object = strstr(json, key);
+        if (object == NULL) {
+            snprintf(key, sizeof(key), "\"%s\"", name);
+            object = strstr(json, key);
+        }
+        if (object == NULL) {
+            printf("%-30s not in the baseline, skipped\n", name);
+            continue;
+        }
+
+        // a slower machine moment looks like a regression: measure again before reporting it
+        int file_failures = check_file(name, object, baseline_calibration_mbps, &stats[i], tolerance, false);
+        for (int attempt = 1; file_failures > 0 && attempt < PERF_ATTEMPTS; ++attempt) {
+            printf("%-30s slower than the baseline, measuring again\n", name);
+            file_stats_t again;
+            again.calibration_mbps = calibrate();
+            if (bench_file(stats[i].name, options, iterations, &again) != RC_OK)
+                break;
+            stats[i] = again;
+            file_failures = check_file(name, object, baseline_calibration_mbps, &stats[i], tolerance, false);
+        }
+        failures += check_file(name, object, baseline_calibration_mbps, &stats[i], tolerance, true);
+    }
+
+    free(json);
+    printf("%d regression(s)\n", failures);
+    return failures ? 1 : 0;
+}
+
+/**
+ * compare the ratio and the throughput of a file with its object in the baseline
+ * @param name
+ * @param object: the file object in the baseline JSON
+ * @param baseline_calibration_mbps: global calibration of the baseline, for files without their own
+ * @param stats
+ * @param tolerance
+ * @param print: print the comparison
+ * @return the number of regressions
+ */
+int check_file(const char *name, const char *object, double baseline_calibration_mbps,
+               const file_stats_t *stats, double tolerance, bool print) {
+    int failures = 0;
+    double ratio = stats->size ? (double)stats->compressed_size / stats->size : 0;
+    double baseline_ratio = json_number(object, "\"ratio\"");
+    if (ratio > baseline_ratio + RATIO_TOLERANCE) {
+        if (print)
+            printf("%-30s ratio       %8.4f > baseline %8.4f  REGRESSION\n", name, ratio, baseline_ratio);
+        failures++;
+    }
+
+    const char * compress = strstr(object, "\"compress\"");
+    const char * decompress = strstr(object, "\"decompress\"");
+    if (compress == NULL || decompress == NULL)
+        return failures;
+
+    // the calibration of the file, the global one for older baselines
+    const char * end = strchr(object, '\n');
+    const char * file_calibration = strstr(object, "\"calibration_mbps\"");
+    double baseline_file_mbps = file_calibration && (end == NULL || file_calibration < end)
+                                ? json_number(file_calibration, "\"calibration_mbps\"") : baseline_calibration_mbps;
+
+    failures += check_phase(name, "compress", stats->compress.best_mbps,
+                            json_number(compress, "\"best_mbps\""),
+                            stats->calibration_mbps, baseline_file_mbps, tolerance, print);
+    failures += check_phase(name, "decompress", stats->decompress.best_mbps,
+                            json_number(decompress, "\"best_mbps\""),
+                            stats->calibration_mbps, baseline_file_mbps, tolerance, print);
+    return failures;
+}
+
+/**
+ * compare the fastest run with the baseline, both relative to the calibration of their machine
+ * @return 1 if it dropped by more than the tolerance, 0 otherwise
+ */
+int check_phase(const char *name, const char *phase, double mbps, double baseline_mbps,
+                double calibration_mbps, double baseline_calibration_mbps, double tolerance, bool print) {
+    if (baseline_mbps <= 0)
+        return 0;
+
+    double change = (mbps / calibration_mbps) / (baseline_mbps / baseline_calibration_mbps) - 1;
+    bool regression = change < -tolerance;
+    if (print)
+        printf("%-30s %-11s %8.2f MB/s (%+6.1f%% normalized)%s\n", name, phase, mbps, change * 100,
+               regression ? "  REGRESSION" : "");
+    return regression ? 1 : 0;
+}
+
+/**
+ * @param file_name
+ * @return the file content, null terminated, to be freed by the caller. NULL on error
+ */
+char * load_text(const char *file_name) {
+    byte_t * data = NULL;
+    size_t size = 0;
+    if (load_file(file_name, &data, &size) != RC_OK) {
+        free(data);
+        return NULL;
+    }
+    data[size] = 0;
+    return (char *)data;
+}
+
+/**
+ * @param path
+ * @return the file name after the last /
+ */
+const char * base_name(const char *path) {
+    const char * slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/**
+ * the number after the first occurrence of key: in the JSON text
+ * @param json
+ * @param key: with the quotes
+ * @return the number, 0 if not found
+ */
+double json_number(const char *json, const char *key) {
+    const char * found = strstr(json, key);
+    if (found == NULL)
+        return 0;
+    found += strlen(key);
+    while (*found == ' ' || *found == ':')
+        found++;
+    return atof(found);
+}
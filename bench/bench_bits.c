@@ -0,0 +1,421 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../bin_io.h"
+#include "../log.h"
+
+/**
+ * constants
+ */
+enum {
+    DEFAULT_RUNS        = 5,
+    KERNEL_OPS          = 1 << 22,  // calls per run of a single kernel
+    SEQUENCE_SYMBOLS    = 1 << 18,  // codes per run of an emit / read sequence
+    INPUT_ENTRIES       = 1 << 12,  // pseudo random arguments, cycled
+    INPUT_MASK          = INPUT_ENTRIES - 1,
+    SEQUENCE_BYTES      = 1 << 16,  // bit buffer of the sequences, as the decoder input window
+    BITMAP_WORDS        = 4,
+    NUM_ALIGNMENTS      = SYMBOL_BITS
+};
+
+static const int CODE_LENGTHS[] = { 1, 2, 3, 5, 8, 12, 16, 24, 32 };
+#define NUM_CODE_LENGTHS    ((int)(sizeof(CODE_LENGTHS) / sizeof(CODE_LENGTHS[0])))
+
+/*
+ * pseudo random arguments of the kernels, so that branches and results are not predictable
+ */
+static byte_t       input_bytes[INPUT_ENTRIES];
+static byte_t       input_positions[INPUT_ENTRIES];     // [0..7]
+static byte_t       input_sizes[INPUT_ENTRIES];         // [1..8], bit_copy sizes
+static uint32_t     input_values[INPUT_ENTRIES];
+static byte_t       input_lengths[INPUT_ENTRIES];       // [1..32], value_to_bits lengths
+static uint64_t     input_bit_indices[INPUT_ENTRIES];
+static uint64_t     input_bitmap[BITMAP_WORDS];
+static byte_t       sequence_buffer[SEQUENCE_BYTES];
+
+// results of the kernels end up here, so that the calls are not optimized out
+static volatile uint64_t sink;
+
+/*
+ * a kernel run: op calls, returns a checksum of the results
+ */
+typedef uint64_t (*kernel_fn)(int ops);
+
+typedef struct {
+    const char *        name;
+    kernel_fn           run;
+} kernel_t;
+
+//
+// private methods
+//
+void        print_usage();
+void        fill_inputs();
+double      measure(kernel_fn run, int ops, int runs, double *cycles_per_op);
+double      measure_sequence(uint64_t (*run)(int length, int alignment), int length, int alignment, int runs);
+uint64_t    run_bit_check(int ops);
+uint64_t    run_bit_set_one(int ops);
+uint64_t    run_bit_set_zero(int ops);
+uint64_t    run_bit_copy(int ops);
+uint64_t    run_bit_idx_to_byte_idx(int ops);
+uint64_t    run_bit_pos_in_current_byte(int ops);
+uint64_t    run_get_available_bits(int ops);
+uint64_t    run_symbol_to_bits(int ops);
+uint64_t    run_value_to_bits(int ops);
+uint64_t    run_bitmap_rank(int ops);
+uint64_t    run_bitmap_select_zero(int ops);
+uint64_t    run_floor_log2(int ops);
+uint64_t    run_emit(int length, int alignment);
+uint64_t    run_read(int length, int alignment);
+double      now_seconds();
+uint64_t    now_cycles();
+
+static const kernel_t KERNELS[] = {
+        { "bit_check",                  run_bit_check },
+        { "bit_set_one",                run_bit_set_one },
+        { "bit_set_zero",               run_bit_set_zero },
+        { "bit_copy",                   run_bit_copy },
+        { "bit_idx_to_byte_idx",        run_bit_idx_to_byte_idx },
+        { "bit_pos_in_current_byte",    run_bit_pos_in_current_byte },
+        { "get_available_bits",         run_get_available_bits },
+        { "symbol_to_bits",             run_symbol_to_bits },
+        { "value_to_bits",              run_value_to_bits },
+        { "bitmap_rank",                run_bitmap_rank },
+        { "bitmap_select_zero",         run_bitmap_select_zero },
+        { "floor_log2",                 run_floor_log2 }
+};
+#define NUM_KERNELS     ((int)(sizeof(KERNELS) / sizeof(KERNELS[0])))
+
+/**
+ * microbenchmark of the bit manipulation kernels of bin_io.c: ns per call of each kernel,
+ * then the emit / read sequences of the coders for a whole code, by code length and bit alignment
+ * usage: adhuff_bench_bits [-n runs]
+ */
+int main(int argc, char* argv[]) {
+    set_log_level(LOG_ERROR);
+
+    int runs = DEFAULT_RUNS;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            runs = atoi(argv[++i]);
+        } else {
+            print_usage();
+            return 2;
+        }
+    }
+    if (runs < 1) {
+        print_usage();
+        return 2;
+    }
+
+    fill_inputs();
+
+    printf("%-26s %10s %10s\n", "kernel", "ns/op", "cycles/op");
+    for (int i = 0; i < NUM_KERNELS; ++i) {
+        double cycles_per_op = 0;
+        double ns_per_op = measure(KERNELS[i].run, KERNEL_OPS, runs, &cycles_per_op);
+        printf("%-26s %10.3f %10.2f\n", KERNELS[i].name, ns_per_op, cycles_per_op);
+    }
+
+    // a code written bit by bit as output_bit_array does, read back as read_node / read_value do
+    const char * SEQUENCE_NAMES[] = { "emit", "read" };
+    uint64_t (*SEQUENCES[])(int, int) = { run_emit, run_read };
+    for (int s = 0; s < 2; ++s) {
+        printf("\n%s ns/code %17s", SEQUENCE_NAMES[s], "alignment");
+        for (int alignment = 0; alignment < NUM_ALIGNMENTS; ++alignment) {
+            printf(" %7d", alignment);
+        }
+        printf(" %8s\n", "ns/bit");
+
+        for (int l = 0; l < NUM_CODE_LENGTHS; ++l) {
+            printf("  %2d bits %22s", CODE_LENGTHS[l], "");
+            double total = 0;
+            for (int alignment = 0; alignment < NUM_ALIGNMENTS; ++alignment) {
+                double ns = measure_sequence(SEQUENCES[s], CODE_LENGTHS[l], alignment, runs);
+                total += ns;
+                printf(" %7.2f", ns);
+            }
+            printf(" %8.3f\n", total / NUM_ALIGNMENTS / CODE_LENGTHS[l]);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Print usage
+ */
+void print_usage() {
+    puts("Usage:");
+    puts("\tadhuff_bench_bits [-n runs]");
+    puts("\tns and cycles per call of each bit kernel of bin_io.c, then ns per code written and read");
+    puts("\tbit by bit as the coders do, by code length and bit alignment. The fastest run is reported");
+}
+
+/**
+ * fill the kernel arguments with a fixed pseudo random sequence, runs are comparable
+ */
+void fill_inputs() {
+    uint64_t state = 0x9E3779B97F4A7C15ull;
+    for (int i = 0; i < INPUT_ENTRIES; ++i) {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        uint32_t x = (uint32_t)(state >> 32);
+        input_bytes[i] = (byte_t)x;
+        input_positions[i] = (byte_t)((x >> 8) % SYMBOL_BITS);
+        input_sizes[i] = (byte_t)((x >> 11) % SYMBOL_BITS + 1);
+        input_values[i] = x ^ (uint32_t)state;
+        input_lengths[i] = (byte_t)((x >> 14) % 32 + 1);
+        input_bit_indices[i] = state >> 20;
+    }
+    for (int i = 0; i < BITMAP_WORDS; ++i) {
+        input_bitmap[i] = input_values[i] * 0x100000001ull;
+    }
+    for (int i = 0; i < SEQUENCE_BYTES; ++i) {
+        sequence_buffer[i] = input_bytes[i & INPUT_MASK];
+    }
+}
+
+/**
+ * @param run
+ * @param ops: calls per run
+ * @param runs
+ * @param cycles_per_op: of the fastest run, 0 without time stamp counter
+ * @return ns per call of the fastest run
+ */
+double measure(kernel_fn run, int ops, int runs, double *cycles_per_op) {
+    double best = 0;
+    uint64_t best_cycles = 0;
+    sink += run(ops / 16);      // warm up
+    for (int i = 0; i < runs; ++i) {
+        uint64_t start_cycles = now_cycles();
+        double start = now_seconds();
+        sink += run(ops);
+        double seconds = now_seconds() - start;
+        uint64_t cycles = now_cycles() - start_cycles;
+        if (i == 0 || seconds < best) {
+            best = seconds;
+            best_cycles = cycles;
+        }
+    }
+    *cycles_per_op = (double)best_cycles / ops;
+    return best * 1e9 / ops;
+}
+
+/**
+ * @param run: run_emit or run_read
+ * @param length: code bits
+ * @param alignment: bit position of the first bit of each code in its byte
+ * @param runs
+ * @return ns per code of the fastest run
+ */
+double measure_sequence(uint64_t (*run)(int length, int alignment), int length, int alignment, int runs) {
+    double best = 0;
+    for (int i = 0; i < runs; ++i) {
+        double start = now_seconds();
+        sink += run(length, alignment);
+        double seconds = now_seconds() - start;
+        if (i == 0 || seconds < best)
+            best = seconds;
+    }
+    return best * 1e9 / SEQUENCE_SYMBOLS;
+}
+
+//
+// single kernels
+//
+
+uint64_t run_bit_check(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += bit_check(input_bytes[i & INPUT_MASK], input_positions[i & INPUT_MASK]) == BIT_1;
+    }
+    return sum;
+}
+
+uint64_t run_bit_set_one(int ops) {
+    byte_t buffer[INPUT_ENTRIES] = {0};
+    for (int i = 0; i < ops; ++i) {
+        bit_set_one(&buffer[(i * 7) & INPUT_MASK], input_positions[i & INPUT_MASK]);
+    }
+    return buffer[ops & INPUT_MASK];
+}
+
+uint64_t run_bit_set_zero(int ops) {
+    byte_t buffer[INPUT_ENTRIES];
+    memset(buffer, 0xFF, sizeof(buffer));
+    for (int i = 0; i < ops; ++i) {
+        bit_set_zero(&buffer[(i * 7) & INPUT_MASK], input_positions[i & INPUT_MASK]);
+    }
+    return buffer[ops & INPUT_MASK];
+}
+
+uint64_t run_bit_copy(int ops) {
+    byte_t buffer[INPUT_ENTRIES + 1] = {0};
+    for (int i = 0; i < ops; ++i) {
+        int size = input_sizes[i & INPUT_MASK];
+        int read_pos = SYMBOL_BITS - 1 - (input_positions[i & INPUT_MASK] % (SYMBOL_BITS - size + 1));
+        bit_copy(input_bytes[i & INPUT_MASK], &buffer[(i * 7) & INPUT_MASK], read_pos,
+                 input_positions[(i + 1) & INPUT_MASK], size);
+    }
+    return buffer[ops & INPUT_MASK];
+}
+
+uint64_t run_bit_idx_to_byte_idx(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += bit_idx_to_byte_idx(input_bit_indices[i & INPUT_MASK]);
+    }
+    return sum;
+}
+
+uint64_t run_bit_pos_in_current_byte(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += bit_pos_in_current_byte(input_bit_indices[i & INPUT_MASK]);
+    }
+    return sum;
+}
+
+uint64_t run_get_available_bits(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += get_available_bits(input_bit_indices[i & INPUT_MASK]);
+    }
+    return sum;
+}
+
+uint64_t run_symbol_to_bits(int ops) {
+    bit_array_t bit_array;
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        symbol_to_bits(input_bytes[i & INPUT_MASK], &bit_array);
+        sum += bit_array.buffer[i & (SYMBOL_BITS - 1)];
+    }
+    return sum;
+}
+
+uint64_t run_value_to_bits(int ops) {
+    bit_array_t bit_array;
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        value_to_bits(input_values[i & INPUT_MASK], input_lengths[i & INPUT_MASK], &bit_array);
+        sum += bit_array.buffer[0];
+    }
+    return sum;
+}
+
+uint64_t run_bitmap_rank(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += bitmap_rank(input_bitmap, input_bytes[i & INPUT_MASK]);
+    }
+    return sum;
+}
+
+uint64_t run_bitmap_select_zero(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += bitmap_select_zero(input_bitmap, BITMAP_WORDS, input_bytes[i & INPUT_MASK] & 63);
+    }
+    return sum;
+}
+
+uint64_t run_floor_log2(int ops) {
+    uint64_t sum = 0;
+    for (int i = 0; i < ops; ++i) {
+        sum += floor_log2(input_values[i & INPUT_MASK] | 1u);
+    }
+    return sum;
+}
+
+//
+// whole code sequences
+//
+
+/**
+ * write SEQUENCE_SYMBOLS codes bit by bit, as output_bit_array does, each one starting at the given alignment
+ * @param length
+ * @param alignment
+ * @return checksum
+ */
+uint64_t run_emit(int length, int alignment) {
+    // each code starts at a byte boundary + alignment
+    uint64_t stride = (uint64_t)(length + alignment + SYMBOL_BITS - 1) / SYMBOL_BITS * SYMBOL_BITS;
+    uint64_t buffer_bits = (uint64_t)SEQUENCE_BYTES * SYMBOL_BITS;
+    bit_array_t bit_array;
+    uint64_t code_start = 0;
+    for (int i = 0; i < SEQUENCE_SYMBOLS; ++i) {
+        value_to_bits(input_values[i & INPUT_MASK], length, &bit_array);
+
+        uint64_t out_bit_idx = code_start + alignment;
+        for (int b = bit_array.length - 1; b >= 0; b--) {
+            uint64_t byte_idx = bit_idx_to_byte_idx(out_bit_idx);
+            int bit_pos = bit_pos_in_current_byte(out_bit_idx);
+            if (bit_array.buffer[b] == BIT_1)
+                bit_set_one(&sequence_buffer[byte_idx], bit_pos);
+            else
+                bit_set_zero(&sequence_buffer[byte_idx], bit_pos);
+            out_bit_idx++;
+        }
+
+        code_start += stride;
+        if (code_start + stride > buffer_bits)
+            code_start = 0;
+    }
+    return sequence_buffer[0];
+}
+
+/**
+ * read SEQUENCE_SYMBOLS codes bit by bit, as read_value does, each one starting at the given alignment
+ * @param length
+ * @param alignment
+ * @return checksum
+ */
+uint64_t run_read(int length, int alignment) {
+    uint64_t stride = (uint64_t)(length + alignment + SYMBOL_BITS - 1) / SYMBOL_BITS * SYMBOL_BITS;
+    uint64_t buffer_bits = (uint64_t)SEQUENCE_BYTES * SYMBOL_BITS;
+    uint64_t sum = 0;
+    uint64_t code_start = 0;
+    for (int i = 0; i < SEQUENCE_SYMBOLS; ++i) {
+        uint64_t in_bit_idx = code_start + alignment;
+        uint32_t value = 0;
+        for (int b = 0; b < length; ++b) {
+            byte_t input_byte = sequence_buffer[bit_idx_to_byte_idx(in_bit_idx)];
+            byte_t bit = bit_check(input_byte, (unsigned int)bit_pos_in_current_byte(in_bit_idx));
+            value = (value << 1) | (bit == BIT_1 ? 1u : 0u);
+            in_bit_idx++;
+        }
+        sum += value;
+
+        code_start += stride;
+        if (code_start + stride > buffer_bits)
+            code_start = 0;
+    }
+    return sum;
+}
+
+/**
+ * @return monotonic time in seconds
+ */
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @return time stamp counter, 0 where not available
+ */
+uint64_t now_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../bin_io.h"
+#include "../log.h"
+
+/**
+ * constants
+ */
+enum {
+    CHUNK_SIZE          = 64 * 1024,    // bytes generated and written at a time
+    MAX_FIB_SYMBOLS     = 90,           // Fibonacci weights up to 2^62
+    TEXT_WORDS          = 512
+};
+
+/*
+ * generator state: each workload writes the next bytes of its stream
+ */
+typedef struct {
+    uint64_t            random;                         // LCG state
+    uint64_t            pos;                            // bytes generated so far
+    int                 num_weights;                    // Fibonacci: symbols and smooth weighted round robin
+    uint64_t            weights[MAX_FIB_SYMBOLS];
+    int64_t             credits[MAX_FIB_SYMBOLS];
+    uint64_t            total_weight;
+    char                words[TEXT_WORDS][12];          // text: vocabulary, Zipf distributed
+    double              word_cdf[TEXT_WORDS];           // text: probability of the words up to i
+    const char *        word;                           // text: rest of the word being written
+    byte_t              order[256];                     // new_symbols: order of the current block
+    byte_t              run_value;                      // runs: byte and length left of the current run
+    int                 run_length;
+} generator_t;
+
+typedef void (*generate_fn)(generator_t *gen, byte_t *buffer, size_t size);
+
+typedef struct {
+    const char *        name;
+    generate_fn         generate;
+    const char *        description;
+} workload_t;
+
+//
+// private methods
+//
+void        print_usage();
+int         parse_size(const char *str, uint64_t *size);
+int         write_workload(const workload_t *workload, uint64_t size, const char *file_name);
+void        init_generator(generator_t *gen, uint64_t size);
+uint32_t    next_random(generator_t *gen);
+void        gen_fibonacci(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_round_robin(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_new_symbols(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_random(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_skewed(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_text(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_records(generator_t *gen, byte_t *buffer, size_t size);
+void        gen_runs(generator_t *gen, byte_t *buffer, size_t size);
+
+static const workload_t WORKLOADS[] = {
+        // adversarial
+        { "fibonacci",   gen_fibonacci,   "symbol frequencies in Fibonacci ratio: the deepest tree the size allows, the longest walks" },
+        { "round_robin", gen_round_robin, "the 256 bytes in turn: every update swaps through a block of equal weights" },
+        { "new_symbols", gen_new_symbols, "each block of 256 bytes starts with a new order, escapes and order-1 trees churn" },
+        // realistic
+        { "random",      gen_random,      "uniform random bytes, incompressible" },
+        { "skewed",      gen_skewed,      "geometric byte distribution, about 2 bits per byte" },
+        { "text",        gen_text,        "words of a Zipf distributed vocabulary, separated by spaces and newlines" },
+        { "records",     gen_records,     "fixed size binary records: counters, small integers and padding" },
+        { "runs",        gen_runs,        "runs of repeated bytes, of random length and value" }
+};
+#define NUM_WORKLOADS   ((int)(sizeof(WORKLOADS) / sizeof(WORKLOADS[0])))
+
+/**
+ * write synthetic inputs for the benchmarks: adversarial for the FGK tree, and realistic ones
+ * usage: adhuff_gen <workload|all> <size> <output file|directory>
+ */
+int main(int argc, char* argv[]) {
+    set_log_level(LOG_ERROR);
+
+    uint64_t size = 0;
+    if (argc != 4 || parse_size(argv[2], &size) != RC_OK) {
+        print_usage();
+        return 2;
+    }
+
+    // all: one file per workload in the directory, named after the workload
+    if (strcmp(argv[1], "all") == 0) {
+        for (int i = 0; i < NUM_WORKLOADS; ++i) {
+            char file_name[1024];
+            snprintf(file_name, sizeof(file_name), "%s/%s", argv[3], WORKLOADS[i].name);
+            if (write_workload(&WORKLOADS[i], size, file_name) != RC_OK)
+                return 1;
+        }
+        return 0;
+    }
+
+    for (int i = 0; i < NUM_WORKLOADS; ++i) {
+        if (strcmp(argv[1], WORKLOADS[i].name) == 0)
+            return write_workload(&WORKLOADS[i], size, argv[3]) == RC_OK ? 0 : 1;
+    }
+
+    log_error("main", "unknown workload %s\n", argv[1]);
+    print_usage();
+    return 2;
+}
+
+/**
+ * Print usage
+ */
+void print_usage() {
+    puts("Usage:");
+    puts("\tadhuff_gen <workload|all> <size> <output file|directory>");
+    puts("\tsize in bytes, with an optional k, m or g suffix (powers of 1024). all writes every workload in the directory");
+    puts("Workloads:");
+    for (int i = 0; i < NUM_WORKLOADS; ++i) {
+        printf("\t%-12s :  %s\n", WORKLOADS[i].name, WORKLOADS[i].description);
+    }
+}
+
+/**
+ * parse a number of bytes, with an optional k, m or g suffix (powers of 1024)
+ * @param str
+ * @param size
+ * @return RC_OK / RC_FAIL
+ */
+int parse_size(const char *str, uint64_t *size) {
+    char *end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+        return RC_FAIL;
+
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != 0 || value > (UINT64_MAX >> shift))
+        return RC_FAIL;
+
+    *size = (uint64_t)value << shift;
+    return RC_OK;
+}
+
+/**
+ * generate the workload in chunks, any size fits in memory
+ * @param workload
+ * @param size
+ * @param file_name
+ * @return RC_OK / RC_FAIL
+ */
+int write_workload(const workload_t *workload, uint64_t size, const char *file_name) {
+    FILE * fp = bin_open_create(file_name);
+    if (fp == NULL)
+        return RC_FAIL;
+
+    static generator_t gen;
+    static byte_t buffer[CHUNK_SIZE];
+    init_generator(&gen, size);
+
+    int rc = RC_OK;
+    for (uint64_t written = 0; written < size && rc == RC_OK; ) {
+        size_t chunk = size - written < CHUNK_SIZE ? (size_t)(size - written) : CHUNK_SIZE;
+        workload->generate(&gen, buffer, chunk);
+        gen.pos += chunk;
+        if (fwrite(buffer, sizeof(byte_t), chunk, fp) != chunk) {
+            log_error("write_workload", "cannot write %s\n", file_name);
+            rc = RC_FAIL;
+        }
+        written += chunk;
+    }
+
+    if (fclose(fp) != 0)
+        rc = RC_FAIL;
+    if (rc == RC_OK)
+        printf("%-12s %12" PRIu64 " bytes  %s\n", workload->name, size, file_name);
+    return rc;
+}
+
+/**
+ * fixed seed, the same workload and size always give the same file
+ * @param gen
+ * @param size: the Fibonacci weights are chosen so that one period fits in it
+ */
+void init_generator(generator_t *gen, uint64_t size) {
+    memset(gen, 0, sizeof(generator_t));
+    gen->random = 0x2545F4914F6CDD1Dull;
+
+    // weights 1, 1, 2, 3, 5... while their sum fits in the size: a complete period is a Fibonacci tree
+    uint64_t a = 1, b = 1;
+    while (gen->num_weights < MAX_FIB_SYMBOLS && (gen->num_weights < 2 || gen->total_weight + a <= size)) {
+        gen->weights[gen->num_weights++] = a;
+        gen->total_weight += a;
+        uint64_t next = a + b;
+        a = b;
+        b = next;
+    }
+
+    // vocabulary: 2 to 11 letters, more frequent letters first
+    static const char LETTERS[] = "etaoinshrdlcumwfgypbvkjxqz";
+    for (int i = 0; i < TEXT_WORDS; ++i) {
+        int length = 2 + (int)(next_random(gen) % 10);
+        for (int c = 0; c < length; ++c) {
+            uint32_t r = next_random(gen) % 1000;
+            gen->words[i][c] = LETTERS[(r * r / 1000) * 26 / 1000];
+        }
+        gen->words[i][length] = 0;
+    }
+
+    // Zipf: word i with probability proportional to 1/(i+1)
+    double sum = 0;
+    for (int i = 0; i < TEXT_WORDS; ++i) {
+        sum += 1.0 / (i + 1);
+        gen->word_cdf[i] = sum;
+    }
+    for (int i = 0; i < TEXT_WORDS; ++i) {
+        gen->word_cdf[i] /= sum;
+    }
+}
+
+/**
+ * @param gen
+ * @return the next 32 pseudo random bits
+ */
+uint32_t next_random(generator_t *gen) {
+    gen->random = gen->random * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)(gen->random >> 32);
+}
+
+//
+// adversarial workloads
+//
+
+/**
+ * symbol i has weight Fib(i), spread by a smooth weighted round robin:
+ * every prefix keeps the Fibonacci proportions, so the tree stays as deep as the weights allow
+ */
+void gen_fibonacci(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        int best = 0;
+        for (int s = 0; s < gen->num_weights; ++s) {
+            gen->credits[s] += (int64_t)gen->weights[s];
+            if (gen->credits[s] > gen->credits[best])
+                best = s;
+        }
+        gen->credits[best] -= (int64_t)gen->total_weight;
+        buffer[i] = (byte_t)best;
+    }
+}
+
+void gen_round_robin(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = (byte_t)(gen->pos + i);
+    }
+}
+
+/**
+ * blocks of the 256 bytes, each block in a new pseudo random order
+ */
+void gen_new_symbols(generator_t *gen, byte_t *buffer, size_t size) {
+    byte_t * order = gen->order;
+    for (size_t i = 0; i < size; ++i) {
+        uint64_t pos = gen->pos + i;
+        if (pos % 256 == 0) {
+            for (int s = 0; s < 256; ++s) {
+                order[s] = (byte_t)s;
+            }
+            for (int s = 255; s > 0; --s) {
+                int j = (int)(next_random(gen) % (uint32_t)(s + 1));
+                byte_t tmp = order[s];
+                order[s] = order[j];
+                order[j] = tmp;
+            }
+        }
+        buffer[i] = order[pos % 256];
+    }
+}
+
+//
+// realistic workloads
+//
+
+void gen_random(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        buffer[i] = (byte_t)(next_random(gen) >> 24);
+    }
+}
+
+/**
+ * byte k with probability 2^-(k+1), most of the weight on a few symbols
+ */
+void gen_skewed(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        uint32_t r = next_random(gen);
+        buffer[i] = (byte_t)('a' + (r ? __builtin_ctz(r) : 31));
+    }
+}
+
+/**
+ * word i of the vocabulary with probability proportional to 1/(i+1), a newline every 12 words on average
+ */
+void gen_text(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (gen->word == NULL || *gen->word == 0) {
+            if (gen->word != NULL) {
+                buffer[i] = next_random(gen) % 12 == 0 ? '\n' : ' ';
+                gen->word = NULL;
+                continue;
+            }
+            // first word whose cumulative probability exceeds u
+            double u = next_random(gen) / 4294967296.0;
+            int low = 0, high = TEXT_WORDS - 1;
+            while (low < high) {
+                int mid = (low + high) / 2;
+                if (gen->word_cdf[mid] > u)
+                    high = mid;
+                else
+                    low = mid + 1;
+            }
+            gen->word = gen->words[low];
+        }
+        buffer[i] = (byte_t)*gen->word++;
+    }
+}
+
+/**
+ * 32 byte records: a little endian counter, a small random integer, a type byte and zero padding
+ */
+void gen_records(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        uint64_t pos = gen->pos + i;
+        uint64_t record = pos / 32;
+        int field = (int)(pos % 32);
+        byte_t value = 0;
+        if (field < 8)
+            value = (byte_t)(record >> (8 * field));
+        else if (field < 10)
+            value = (byte_t)(next_random(gen) % (field == 8 ? 200 : 2));
+        else if (field == 10)
+            value = (byte_t)(record % 7 == 0 ? 'E' : 'D');
+        buffer[i] = value;
+    }
+}
+
+/**
+ * runs of 1 to 64 bytes of the same value
+ */
+void gen_runs(generator_t *gen, byte_t *buffer, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (gen->run_length == 0) {
+            uint32_t r = next_random(gen);
+            gen->run_value = (byte_t)(r >> 24);
+            gen->run_length = 1 + (int)(r % 64);
+        }
+        buffer[i] = gen->run_value;
+        gen->run_length--;
+    }
+}
@@ -1,8 +1,13 @@
+#define _POSIX_C_SOURCE 200809L // fseeko, ftello
+#define _FILE_OFFSET_BITS 64
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
 
 #include "bin_io.h"
 #include "log.h"
@@ -35,6 +40,34 @@ FILE* bin_open_create(const char *filename) {
     return bin_open_file(filename, "wb");
 }
 
+/**
+ * ftell with 64 bit offsets, also where long is 32 bits
+ * @param fp
+ * @return the position in the file, -1 on error
+ */
+int64_t bin_tell(FILE *fp) {
+#ifdef WIN32
+    return _ftelli64(fp);
+#else
+    return (int64_t)ftello(fp);
+#endif
+}
+
+/**
+ * fseek with 64 bit offsets, also where long is 32 bits
+ * @param fp
+ * @param offset
+ * @param whence: SEEK_SET, SEEK_CUR, SEEK_END
+ * @return RC_OK / RC_FAIL
+ */
+int bin_seek(FILE *fp, int64_t offset, int whence) {
+#ifdef WIN32
+    return _fseeki64(fp, offset, whence) == 0 ? RC_OK : RC_FAIL;
+#else
+    return fseeko(fp, (off_t)offset, whence) == 0 ? RC_OK : RC_FAIL;
+#endif
+}
+
 /**
  * open a file in read and update mode.
  * @param filename
@@ -58,38 +91,55 @@ FILE* bin_open_file(const char *filename, const char *mode) {
     return file_ptr;
 }
 
-
-//
-// bit manipulation functions
-//
-
 /**
- * @param symbol
- * @param bit_pos
- * @return the char '1' if the bit at bit_pos is 1, otherwise '0'
+ * read length bytes from a socket or a pipe, less only at the end of the stream
+ * @param fd
+ * @param buffer
+ * @param length
+ * @param stop: a signal setting the flag interrupts the read, NULL to resume after any signal
+ * @return RC_OK if length bytes were read / RC_FAIL on error, a stop or the end of the stream
  */
-inline byte_t bit_check(byte_t symbol, unsigned int bit_pos) {
-    byte_t val = (symbol & (byte_t)(SINGLE_BIT_1 << bit_pos));
-    return val ? BIT_1 : BIT_0;
+int bin_read_all(int fd, void *buffer, size_t length, const volatile sig_atomic_t *stop) {
+    size_t done = 0;
+    while(done < length) {
+        ssize_t n = read(fd, (byte_t *)buffer + done, length - done);
+        if(n < 0 && errno == EINTR && (stop == NULL || !*stop))
+            continue;
+        if(n <= 0)
+            return RC_FAIL;
+        done += (size_t)n;
+    }
+    return RC_OK;
 }
 
 /**
- * set to 1 the bit at given position
- * @param symbol
- * @param bit_pos
+ * write length bytes to a socket or a pipe, without SIGPIPE on a socket whose other side is gone
+ * @param fd
+ * @param buffer
+ * @param length
+ * @param stop: a signal setting the flag interrupts the write, NULL to resume after any signal
+ * @return RC_OK / RC_FAIL
  */
-inline void bit_set_one(byte_t * symbol, unsigned int bit_pos) {
-    *symbol |= (byte_t) (SINGLE_BIT_1 << bit_pos);
+int bin_write_all(int fd, const void *buffer, size_t length, const volatile sig_atomic_t *stop) {
+    size_t done = 0;
+    while(done < length) {
+        const byte_t * data = (const byte_t *)buffer + done;
+        ssize_t n = send(fd, data, length - done, MSG_NOSIGNAL);
+        if(n < 0 && errno == ENOTSOCK)
+            n = write(fd, data, length - done);
+        if(n < 0 && errno == EINTR && (stop == NULL || !*stop))
+            continue;
+        if(n <= 0)
+            return RC_FAIL;
+        done += (size_t)n;
+    }
+    return RC_OK;
 }
 
-/**
- * set to 0 the bit at given position
- * @param symbol
- * @param bit_pos
- */
-inline void bit_set_zero(byte_t * symbol, unsigned int bit_pos) {
-    *symbol  &= ~((byte_t)(SINGLE_BIT_1 << bit_pos));
-}
+
+//
+// bit manipulation functions
+//
 
 /**
  * copy bits from most significant bit to least significant
@@ -123,40 +173,83 @@ void bit_copy(byte_t source, byte_t * destination, int read_pos, int write_pos,
 }
 
 /**
- * @param bit_idx
- * @return the byte index from the bit index
+ * fill the bit_array with the binary representation of the symbol
+ * @param symbol
+ * @param bit_array
  */
-inline long bit_idx_to_byte_idx(long bit_idx) {
-    return (bit_idx / SYMBOL_BITS);
+void symbol_to_bits(byte_t symbol, bit_array_t *bit_array) {
+    value_to_bits(symbol, SYMBOL_BITS, bit_array);
 }
 
 /**
- * @param buffer_idx
- * @return bit position in current byte
+ * fill the bit_array with the num_bits least significant bits of the value
+ * @param value
+ * @param num_bits: up to 32
+ * @param bit_array
  */
-inline int bit_pos_in_current_byte(long buffer_idx) {
-    return SYMBOL_BITS - (buffer_idx % SYMBOL_BITS) - 1;
+void value_to_bits(uint32_t value, int num_bits, bit_array_t *bit_array) {
+    bit_array->length = (uint16_t)num_bits;
+    for (int bit_pos = num_bits - 1; bit_pos >= 0; --bit_pos) {
+        bit_array->buffer[bit_pos] = ((value >> bit_pos) & 1u) ? BIT_1 : BIT_0;
+    }
 }
 
 /**
- * @param buffer_bit_idx
- * @return number of remaining bits for the current byte
+ * set to 1 the bit at the given index
+ * @param bitmap
+ * @param index
  */
-inline int get_available_bits(long buffer_bit_idx) {
-    return SYMBOL_BITS - (buffer_bit_idx % SYMBOL_BITS);
+void bitmap_set(uint64_t *bitmap, int index) {
+    bitmap[index / BITMAP_WORD_BITS] |= (uint64_t)1 << (index % BITMAP_WORD_BITS);
 }
 
 /**
- * fill the bit_array with the binary representation of the symbol
- * @param symbol
- * @param bit_array
+ * @param bitmap
+ * @param index
+ * @return number of bits set to 1 before the index
  */
-void symbol_to_bits(byte_t symbol, bit_array_t *bit_array) {
-    bit_array->length = SYMBOL_BITS;
-    for (int bit_pos = SYMBOL_BITS - 1; bit_pos >= 0; --bit_pos) {
-        byte_t val = bit_check(symbol, (unsigned int)bit_pos);
-        bit_array->buffer[bit_pos] = val;
+int bitmap_rank(const uint64_t *bitmap, int index) {
+    int word = index / BITMAP_WORD_BITS;
+    int rank = 0;
+    for (int i = 0; i < word; ++i) {
+        rank += __builtin_popcountll(bitmap[i]);
     }
+
+    // the word of the index is not read when the index is at a word boundary
+    uint64_t below = ((uint64_t)1 << (index % BITMAP_WORD_BITS)) - 1;
+    if(below != 0)
+        rank += __builtin_popcountll(bitmap[word] & below);
+    return rank;
+}
+
+/**
+ * @param bitmap
+ * @param num_words
+ * @param rank
+ * @return the index of the (rank+1)-th bit set to 0, -1 if not found
+ */
+int bitmap_select_zero(const uint64_t *bitmap, int num_words, int rank) {
+    for (int i = 0; i < num_words; ++i) {
+        uint64_t zeros = ~bitmap[i];
+        int count = __builtin_popcountll(zeros);
+        if(rank < count) {
+            // drop the lowest zeros, the next one is the result
+            for (int k = 0; k < rank; ++k) {
+                zeros &= zeros - 1;
+            }
+            return i * BITMAP_WORD_BITS + __builtin_ctzll(zeros);
+        }
+        rank -= count;
+    }
+    return -1;
+}
+
+/**
+ * @param value: > 0
+ * @return floor(log2(value))
+ */
+int floor_log2(uint32_t value) {
+    return 31 - __builtin_clz(value);
 }
 
 /**
@@ -165,8 +258,8 @@ void symbol_to_bits(byte_t symbol, bit_array_t *bit_array) {
  * @param output_file_ptr
  */
 void print_final_stats(FILE * input_file_ptr, FILE * output_file_ptr) {
-    long inSize = ftell(input_file_ptr);
-    long outSize = ftell(output_file_ptr);
+    int64_t inSize = bin_tell(input_file_ptr);
+    int64_t outSize = bin_tell(output_file_ptr);
     double ratio = 100.0 * (inSize - outSize) / inSize;
-    log_info(" print_final_stats", "rate= %.2f%% [%ld -> %ld] (bytes)\n", ratio, inSize, outSize);
+    log_info(" print_final_stats", "rate= %.2f%% [%" PRId64 " -> %" PRId64 "] (bytes)\n", ratio, inSize, outSize);
 }
@@ -7,6 +7,8 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <stdbool.h>
+#include <signal.h>
+#include <string.h>
 
 /**
  * uncomment line below to turn on LOGGING
@@ -21,7 +23,8 @@ enum {
     RC_FAIL             = 1,
     SYMBOL_BITS         = 8,
     MAX_SYMBOL_STR      = 100,
-    MAX_CODE_BITS       = 256
+    MAX_CODE_BITS       = 256,
+    BITMAP_WORD_BITS    = 64
 };
 
 static const char BIT_1 = '1';
@@ -43,21 +46,196 @@ typedef struct {
 FILE*       bin_open_read(const char *filename);
 FILE*       bin_open_create(const char *filename);
 FILE*       bin_open_update(const char *filename);
+int64_t     bin_tell(FILE *fp);
+int         bin_seek(FILE *fp, int64_t offset, int whence);
+int         bin_read_all(int fd, void *buffer, size_t length, const volatile sig_atomic_t *stop);
+int         bin_write_all(int fd, const void *buffer, size_t length, const volatile sig_atomic_t *stop);
 
 //
 // bit manipulation
 //
-byte_t      bit_check(byte_t symbol, unsigned int bit_pos);
-void        bit_set_one(byte_t * symbol, unsigned int bit_pos);
-void        bit_set_zero(byte_t * symbol, unsigned int bit_pos);
 void        bit_copy(byte_t source, byte_t *destination, int read_pos, int write_pos, int size);
-
-int         get_available_bits(long buffer_bit_idx);
-int         bit_pos_in_current_byte(long buffer_idx);
-long        bit_idx_to_byte_idx(long bit_idx);
 void        symbol_to_bits(byte_t symbol, bit_array_t *bit_array);
+void        value_to_bits(uint32_t value, int num_bits, bit_array_t *bit_array);
+
+//
+// bitmap with rank / select, BITMAP_WORD_BITS bits per word
+//
+void        bitmap_set(uint64_t *bitmap, int index);
+int         bitmap_rank(const uint64_t *bitmap, int index);
+int         bitmap_select_zero(const uint64_t *bitmap, int num_words, int rank);
+int         floor_log2(uint32_t value);
 
 void        print_final_stats(FILE *input_file_ptr, FILE *output_file_ptr);
 
+//
+// per bit kernels of the coders, inline so that each hot loop is compiled with them
+//
+
+/**
+ * @param symbol
+ * @param bit_pos
+ * @return the char '1' if the bit at bit_pos is 1, otherwise '0'
+ */
+static inline byte_t bit_check(byte_t symbol, unsigned int bit_pos) {
+    byte_t val = (symbol & (byte_t)(1u << bit_pos));
+    return val ? BIT_1 : BIT_0;
+}
+
+/**
+ * set to 1 the bit at given position
+ * @param symbol
+ * @param bit_pos
+ */
+static inline void bit_set_one(byte_t * symbol, unsigned int bit_pos) {
+    *symbol |= (byte_t) (1u << bit_pos);
+}
+
+/**
+ * set to 0 the bit at given position
+ * @param symbol
+ * @param bit_pos
+ */
+static inline void bit_set_zero(byte_t * symbol, unsigned int bit_pos) {
+    *symbol  &= ~((byte_t)(1u << bit_pos));
+}
+
+/**
+ * @param bit_idx
+ * @return the byte index from the bit index
+ */
+static inline uint64_t bit_idx_to_byte_idx(uint64_t bit_idx) {
+    return (bit_idx / SYMBOL_BITS);
+}
+
+/**
+ * @param buffer_idx
+ * @return bit position in current byte
+ */
+static inline int bit_pos_in_current_byte(uint64_t buffer_idx) {
+    return SYMBOL_BITS - (buffer_idx % SYMBOL_BITS) - 1;
+}
+
+/**
+ * @param buffer_bit_idx
+ * @return number of remaining bits for the current byte
+ */
+static inline int get_available_bits(uint64_t buffer_bit_idx) {
+    return SYMBOL_BITS - (buffer_bit_idx % SYMBOL_BITS);
+}
+
+/**
+ * read num_bits bits without moving, the first one most significant. Only the bytes holding them are read
+ * @param buffer
+ * @param bit_idx
+ * @param num_bits: [1..25]
+ * @return the bits
+ */
+static inline uint32_t bit_peek(const byte_t *buffer, uint64_t bit_idx, int num_bits) {
+    uint64_t first_byte = bit_idx_to_byte_idx(bit_idx);
+    uint64_t last_byte = bit_idx_to_byte_idx(bit_idx + num_bits - 1);
+    uint32_t window = 0;
+    for (uint64_t i = first_byte; i <= last_byte; ++i) {
+        window = (window << SYMBOL_BITS) | buffer[i];
+    }
+    unsigned int shift = (unsigned int)((last_byte + 1) * SYMBOL_BITS - bit_idx - num_bits);
+    return (window >> shift) & ((1u << num_bits) - 1);
+}
+
+/**
+ * the 64 bits from the byte of bit_idx, shifted so that the bit at bit_idx is the most significant:
+ * at least 57 valid bits. The buffer has 7 readable bytes after the last bit
+ * @param buffer
+ * @param bit_idx
+ * @return the window
+ */
+static inline uint64_t bit_window(const byte_t *buffer, uint64_t bit_idx) {
+    const byte_t *p = buffer + bit_idx_to_byte_idx(bit_idx);
+    uint64_t window = 0;
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(&window, p, sizeof(window));
+    window = __builtin_bswap64(window);
+#else
+    for (int i = 0; i < 8; ++i) {
+        window = (window << SYMBOL_BITS) | p[i];
+    }
+#endif
+    return window << (bit_idx % SYMBOL_BITS);
+}
+
+/**
+ * write a big endian value, the byte order of the file formats
+ * @param buffer
+ * @param value
+ * @param num_bytes: [1..8]
+ */
+static inline void bin_put_be(byte_t *buffer, uint64_t value, int num_bytes) {
+    for (int i = num_bytes - 1; i >= 0; --i) {
+        buffer[i] = (byte_t)value;
+        value >>= SYMBOL_BITS;
+    }
+}
+
+/**
+ * read a big endian value
+ * @param buffer
+ * @param num_bytes: [1..8]
+ * @return the value
+ */
+static inline uint64_t bin_get_be(const byte_t *buffer, int num_bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < num_bytes; ++i) {
+        value = (value << SYMBOL_BITS) | buffer[i];
+    }
+    return value;
+}
+
+/*
+ * sequential bit writer: the bits are gathered in a 64 bits window and stored 32 at a time, most significant first
+ */
+typedef struct {
+    byte_t *    next;       // next byte to store
+    uint64_t    window;     // bits not yet stored, in the low num_bits bits
+    int         num_bits;
+} bit_writer_t;
+
+/**
+ * @param writer
+ * @param buffer: large enough for all the bits put
+ */
+static inline void bit_writer_init(bit_writer_t *writer, byte_t *buffer) {
+    writer->next = buffer;
+    writer->window = 0;
+    writer->num_bits = 0;
+}
+
+/**
+ * @param writer
+ * @param value: < 2^num_bits
+ * @param num_bits: [1..32]
+ */
+static inline void bit_writer_put(bit_writer_t *writer, uint32_t value, int num_bits) {
+    writer->window = (writer->window << num_bits) | value;
+    writer->num_bits += num_bits;
+    if(writer->num_bits >= 32) {
+        writer->num_bits -= 32;
+        bin_put_be(writer->next, (uint32_t)(writer->window >> writer->num_bits), 4);
+        writer->next += 4;
+    }
+}
+
+/**
+ * store the bits left, the last byte padded with zeros
+ * @param writer
+ * @return the end of the bits
+ */
+static inline byte_t * bit_writer_flush(bit_writer_t *writer) {
+    for (; writer->num_bits > 0; writer->num_bits -= SYMBOL_BITS) {
+        int shift = writer->num_bits - SYMBOL_BITS;
+        *writer->next++ = (byte_t)(shift >= 0 ? writer->window >> shift : writer->window << -shift);
+    }
+    writer->num_bits = 0;
+    return writer->next;
+}
 
 #endif //ALGO_BIN_IO_H
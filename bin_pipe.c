@@ -0,0 +1,604 @@
+#define _GNU_SOURCE             // fopencookie
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "bin_pipe.h"
+#include "bin_uring.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+#if defined(__GLIBC__)
+
+enum {
+    PIPE_WAIT_US        = 1000          // a waiting thread checks the ring at least every millisecond
+};
+
+typedef struct {
+    byte_t *            data;
+    size_t              length;
+    // io_uring: request in flight on the buffer
+    int64_t             file_offset;
+    size_t              transferred;
+    bool                complete;
+} pipe_buffer_t;
+
+/*
+ * ring of buffers between the I/O thread and the coder, single producer single consumer:
+ * reading, the I/O thread produces and the coder consumes, writing the other way round.
+ * the indices are lock free, the mutex and the condition only put an idle thread to sleep
+ */
+typedef struct {
+    FILE *              file;           // the real file
+    bool                writing;
+    pipe_buffer_t       buffers[PIPE_BUFFERS];
+    uint64_t            head;           // next buffer to consume, written by the consumer
+    uint64_t            tail;           // next buffer to produce, written by the producer
+    size_t              offset;         // coder side: bytes consumed (reading) or produced (writing) of the current buffer
+    int64_t             position;       // coder side: position in the stream
+    int                 done;           // reading: the I/O thread reached the end of the file or an error
+    int                 error;          // set by the I/O thread
+    int                 stopping;       // set by the coder
+    bool                running;
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_cond_t      cond;
+    bin_uring_t *       uring;          // NULL: the I/O thread uses stdio
+    int64_t             file_offset;    // io_uring: next offset to read or write
+} bin_pipe_t;
+
+static bool use_uring = false;
+
+//
+// private methods
+//
+FILE*       pipe_open(FILE *file, bool writing);
+int         pipe_start(bin_pipe_t *pipe);
+void        pipe_stop(bin_pipe_t *pipe);
+void        pipe_release(bin_pipe_t *pipe);
+void        pipe_wait(bin_pipe_t *pipe);
+void        pipe_wake(bin_pipe_t *pipe);
+void *      pipe_reader_main(void *arg);
+void *      pipe_writer_main(void *arg);
+void *      pipe_uring_reader_main(void *arg);
+void *      pipe_uring_writer_main(void *arg);
+int         pipe_uring_complete(bin_pipe_t *pipe);
+ssize_t     pipe_read(void *cookie, char *buf, size_t size);
+ssize_t     pipe_write(void *cookie, const char *buf, size_t size);
+int         pipe_seek(void *cookie, off64_t *offset, int whence);
+int         pipe_close(void *cookie);
+
+/**
+ * read the file ahead of the coder, from its current position
+ * @param file: owned by the returned stream, still owned by the caller on failure
+ * @return the pipelined stream, NULL on error
+ */
+FILE* bin_pipe_read(FILE *file) {
+    return pipe_open(file, false);
+}
+
+/**
+ * write the file behind the coder, from its current position
+ * @param file: owned by the returned stream, still owned by the caller on failure
+ * @return the pipelined stream, NULL on error
+ */
+FILE* bin_pipe_write(FILE *file) {
+    return pipe_open(file, true);
+}
+
+/**
+ * move the data with io_uring instead of stdio, for the regular files opened from now on
+ * the streams fall back to stdio when io_uring is not available
+ * @param enabled
+ */
+void bin_pipe_use_uring(bool enabled) {
+    use_uring = enabled;
+}
+
+/**
+ * allocate the ring and start the I/O thread
+ * @param file
+ * @param writing
+ * @return the pipelined stream, NULL on error
+ */
+FILE* pipe_open(FILE *file, bool writing) {
+    bin_pipe_t * pipe = adh_calloc(1, sizeof(bin_pipe_t));
+    if(pipe == NULL)
+        return NULL;
+
+    pipe->file = file;
+    pipe->writing = writing;
+    pipe->position = bin_tell(file) > 0 ? bin_tell(file) : 0;     // a pipe or a terminal cannot tell
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->cond, NULL);
+
+    int rc = RC_OK;
+    for (int i = 0; i < PIPE_BUFFERS && rc == RC_OK; ++i) {
+        pipe->buffers[i].data = adh_malloc(PIPE_BUFFER_SIZE);
+        if(pipe->buffers[i].data == NULL)
+            rc = RC_FAIL;
+    }
+
+    // io_uring reads and writes at explicit offsets: regular files only
+    struct stat file_stat;
+    if(rc == RC_OK && use_uring && fstat(fileno(file), &file_stat) == 0 && S_ISREG(file_stat.st_mode)) {
+        byte_t * data[PIPE_BUFFERS];
+        for (int i = 0; i < PIPE_BUFFERS; ++i) {
+            data[i] = pipe->buffers[i].data;
+        }
+        pipe->uring = bin_uring_open(fileno(file), data, PIPE_BUFFERS, PIPE_BUFFER_SIZE);
+    }
+
+    cookie_io_functions_t functions = { pipe_read, pipe_write, pipe_seek, pipe_close };
+    FILE * stream = NULL;
+    if(rc == RC_OK)
+        rc = pipe_start(pipe);
+    if(rc == RC_OK) {
+        stream = fopencookie(pipe, writing ? "w" : "r", functions);
+        if(stream == NULL)
+            pipe_stop(pipe);
+    }
+
+    if(stream == NULL) {
+        log_error("pipe_open", "cannot start the %s thread\n", writing ? "writer" : "reader");
+        pipe_release(pipe);
+    }
+    return stream;
+}
+
+/**
+ * start the I/O thread
+ * @param pipe
+ * @return RC_OK / RC_FAIL
+ */
+int pipe_start(bin_pipe_t *pipe) {
+    pipe->stopping = 0;
+    pipe->done = 0;
+    pipe->file_offset = pipe->position;
+
+    void * (*thread_main)(void *);
+    if(pipe->uring)
+        thread_main = pipe->writing ? pipe_uring_writer_main : pipe_uring_reader_main;
+    else
+        thread_main = pipe->writing ? pipe_writer_main : pipe_reader_main;
+    if(pthread_create(&pipe->thread, NULL, thread_main, pipe) != 0)
+        return RC_FAIL;
+    pipe->running = true;
+    return RC_OK;
+}
+
+/**
+ * stop the I/O thread: writing, the buffers produced so far are written first.
+ * reading, the buffers read ahead are discarded
+ * @param pipe
+ */
+void pipe_stop(bin_pipe_t *pipe) {
+    if(!pipe->running)
+        return;
+
+    // the partial buffer of the coder
+    if(pipe->writing && pipe->offset > 0) {
+        pipe->buffers[pipe->tail % PIPE_BUFFERS].length = pipe->offset;
+        pipe->offset = 0;
+        __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    __atomic_store_n(&pipe->stopping, 1, __ATOMIC_RELEASE);
+    pipe_wake(pipe);
+    pthread_join(pipe->thread, NULL);
+    pipe->running = false;
+
+    if(!pipe->writing) {
+        pipe->head = pipe->tail;
+        pipe->offset = 0;
+    }
+}
+
+/**
+ * free the ring, the file is not closed
+ * @param pipe
+ */
+void pipe_release(bin_pipe_t *pipe) {
+    bin_uring_close(pipe->uring);
+    for (int i = 0; i < PIPE_BUFFERS; ++i) {
+        adh_free(pipe->buffers[i].data);
+    }
+    pthread_mutex_destroy(&pipe->lock);
+    pthread_cond_destroy(&pipe->cond);
+    adh_free(pipe);
+}
+
+/**
+ * sleep until woken or for PIPE_WAIT_US, the caller checks the ring again
+ * the timeout covers a wake up sent between the check of the ring and the wait
+ * @param pipe
+ */
+void pipe_wait(bin_pipe_t *pipe) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += PIPE_WAIT_US * 1000;
+    if(deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&pipe->lock);
+    pthread_cond_timedwait(&pipe->cond, &pipe->lock, &deadline);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/**
+ * wake the other thread, once per buffer
+ * @param pipe
+ */
+void pipe_wake(bin_pipe_t *pipe) {
+    pthread_mutex_lock(&pipe->lock);
+    pthread_cond_signal(&pipe->cond);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+/**
+ * reader thread: fill the free buffers until the end of the file, an error or a stop
+ * @param arg: bin_pipe_t
+ * @return NULL
+ */
+void * pipe_reader_main(void *arg) {
+    bin_pipe_t * pipe = arg;
+    while(!__atomic_load_n(&pipe->stopping, __ATOMIC_ACQUIRE)) {
+        if(pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == PIPE_BUFFERS) {
+            pipe_wait(pipe);
+            continue;
+        }
+
+        pipe_buffer_t * buffer = &pipe->buffers[pipe->tail % PIPE_BUFFERS];
+        buffer->length = fread(buffer->data, sizeof(byte_t), PIPE_BUFFER_SIZE, pipe->file);
+        if(buffer->length > 0)
+            __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+
+        if(buffer->length < PIPE_BUFFER_SIZE) {
+            if(ferror(pipe->file)) {
+                log_error("pipe_reader_main", "cannot read the input\n");
+                __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+            }
+            __atomic_store_n(&pipe->done, 1, __ATOMIC_RELEASE);
+            pipe_wake(pipe);
+            break;
+        }
+        pipe_wake(pipe);
+    }
+    return NULL;
+}
+
+/**
+ * writer thread: write the buffers produced by the coder, until a stop with all of them written
+ * after an error the buffers are dropped, the coder fails on its next write
+ * @param arg: bin_pipe_t
+ * @return NULL
+ */
+void * pipe_writer_main(void *arg) {
+    bin_pipe_t * pipe = arg;
+    for(;;) {
+        // stopping is read before tail: the buffers published before the stop are written
+        int stopping = __atomic_load_n(&pipe->stopping, __ATOMIC_ACQUIRE);
+        if(pipe->head == __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE)) {
+            if(stopping)
+                break;
+            pipe_wait(pipe);
+            continue;
+        }
+
+        pipe_buffer_t * buffer = &pipe->buffers[pipe->head % PIPE_BUFFERS];
+        if(!pipe->error && fwrite(buffer->data, sizeof(byte_t), buffer->length, pipe->file) != buffer->length) {
+            log_error("pipe_writer_main", "cannot write the output\n");
+            __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+        pipe_wake(pipe);
+    }
+    return NULL;
+}
+
+/**
+ * io_uring reader thread: keeps a read in flight on each free buffer and publishes them in order,
+ * until the end of the file, an error or a stop. The reads in flight are completed before leaving
+ * @param arg: bin_pipe_t
+ * @return NULL
+ */
+void * pipe_uring_reader_main(void *arg) {
+    bin_pipe_t * pipe = arg;
+    uint64_t issued = pipe->tail;       // buffers [tail, issued) are being read
+    int in_flight = 0;
+    bool end = false;                   // end of the file or error: no more reads
+    for(;;) {
+        bool stopping = __atomic_load_n(&pipe->stopping, __ATOMIC_ACQUIRE);
+        while(!stopping && !end && issued - __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) < PIPE_BUFFERS) {
+            int index = (int)(issued % PIPE_BUFFERS);
+            pipe_buffer_t * buffer = &pipe->buffers[index];
+            buffer->file_offset = pipe->file_offset;
+            buffer->transferred = 0;
+            buffer->complete = false;
+            if(bin_uring_submit(pipe->uring, false, index, 0, PIPE_BUFFER_SIZE, buffer->file_offset) != RC_OK) {
+                __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+                end = true;
+                break;
+            }
+            pipe->file_offset += PIPE_BUFFER_SIZE;
+            issued++;
+            in_flight++;
+        }
+
+        if(in_flight == 0) {
+            if(stopping || end)
+                break;
+            pipe_wait(pipe);
+            continue;
+        }
+
+        in_flight += pipe_uring_complete(pipe) - 1;
+        if(__atomic_load_n(&pipe->error, __ATOMIC_ACQUIRE))
+            end = true;
+
+        // the completions come in any order, the coder gets the buffers in order
+        while(!end && pipe->tail < issued && pipe->buffers[pipe->tail % PIPE_BUFFERS].complete) {
+            pipe_buffer_t * buffer = &pipe->buffers[pipe->tail % PIPE_BUFFERS];
+            buffer->length = buffer->transferred;
+            if(buffer->length < PIPE_BUFFER_SIZE)
+                end = true;
+            if(buffer->length > 0)
+                __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+            pipe_wake(pipe);
+        }
+    }
+
+    __atomic_store_n(&pipe->done, 1, __ATOMIC_RELEASE);
+    pipe_wake(pipe);
+    return NULL;
+}
+
+/**
+ * io_uring writer thread: writes each buffer produced by the coder as soon as it is published,
+ * several at the same time, and frees them in order. Leaves on a stop with all of them written
+ * after an error the buffers are dropped, the coder fails on its next write
+ * @param arg: bin_pipe_t
+ * @return NULL
+ */
+void * pipe_uring_writer_main(void *arg) {
+    bin_pipe_t * pipe = arg;
+    uint64_t issued = pipe->head;       // buffers [head, issued) are being written
+    int in_flight = 0;
+    for(;;) {
+        // stopping is read before tail: the buffers published before the stop are written
+        int stopping = __atomic_load_n(&pipe->stopping, __ATOMIC_ACQUIRE);
+        uint64_t tail = __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE);
+        for (; issued < tail; ++issued) {
+            int index = (int)(issued % PIPE_BUFFERS);
+            pipe_buffer_t * buffer = &pipe->buffers[index];
+            buffer->file_offset = pipe->file_offset;
+            buffer->transferred = 0;
+            buffer->complete = true;
+            pipe->file_offset += (int64_t)buffer->length;
+            if(__atomic_load_n(&pipe->error, __ATOMIC_ACQUIRE))
+                continue;
+
+            if(bin_uring_submit(pipe->uring, true, index, 0, buffer->length, buffer->file_offset) != RC_OK) {
+                __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+                continue;
+            }
+            buffer->complete = false;
+            in_flight++;
+        }
+
+        if(in_flight > 0)
+            in_flight += pipe_uring_complete(pipe) - 1;
+
+        while(pipe->head < issued && pipe->buffers[pipe->head % PIPE_BUFFERS].complete) {
+            __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+            pipe_wake(pipe);
+        }
+
+        if(in_flight == 0 && pipe->head == tail) {
+            if(stopping)
+                break;
+            pipe_wait(pipe);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * wait for a read or a write and account it, a partial transfer is submitted again for the rest
+ * a read returning 0 is the end of the file
+ * @param pipe
+ * @return 1 if the rest was submitted again, else 0
+ */
+int pipe_uring_complete(bin_pipe_t *pipe) {
+    int index;
+    int64_t result;
+    if(bin_uring_wait(pipe->uring, &index, &result) != RC_OK) {
+        // the ring is unusable: nothing else can be waited for
+        __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+        for (int i = 0; i < PIPE_BUFFERS; ++i) {
+            pipe->buffers[i].complete = true;
+        }
+        return 0;
+    }
+
+    pipe_buffer_t * buffer = &pipe->buffers[index];
+    size_t wanted = pipe->writing ? buffer->length : PIPE_BUFFER_SIZE;
+    if(result < 0 || (result == 0 && pipe->writing)) {
+        log_error("pipe_uring_complete", "cannot %s the %s: %s\n", pipe->writing ? "write" : "read",
+                  pipe->writing ? "output" : "input", strerror(result < 0 ? (int)-result : EIO));
+        __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+        buffer->complete = true;
+        return 0;
+    }
+
+    buffer->transferred += (size_t)result;
+    if(result > 0 && buffer->transferred < wanted) {
+        if(bin_uring_submit(pipe->uring, pipe->writing, index, buffer->transferred, wanted - buffer->transferred,
+                            buffer->file_offset + (int64_t)buffer->transferred) == RC_OK)
+            return 1;
+        __atomic_store_n(&pipe->error, 1, __ATOMIC_RELEASE);
+    }
+
+    buffer->complete = true;
+    return 0;
+}
+
+/**
+ * coder side of a reading stream: copy from the buffers read ahead
+ * @param cookie: bin_pipe_t
+ * @param buf
+ * @param size
+ * @return bytes read, 0 at the end of the file, -1 on error
+ */
+ssize_t pipe_read(void *cookie, char *buf, size_t size) {
+    bin_pipe_t * pipe = cookie;
+    size_t done = 0;
+    while(done < size) {
+        if(pipe->head == __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE)) {
+            // done is set after the last buffer is published: check the ring again
+            if(!pipe->running || (__atomic_load_n(&pipe->done, __ATOMIC_ACQUIRE)
+                                  && pipe->head == __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE)))
+                break;
+            pipe_wait(pipe);
+            continue;
+        }
+
+        pipe_buffer_t * buffer = &pipe->buffers[pipe->head % PIPE_BUFFERS];
+        size_t length = buffer->length - pipe->offset < size - done ? buffer->length - pipe->offset : size - done;
+        memcpy(buf + done, buffer->data + pipe->offset, length);
+        pipe->offset += length;
+        done += length;
+
+        if(pipe->offset == buffer->length) {
+            pipe->offset = 0;
+            __atomic_store_n(&pipe->head, pipe->head + 1, __ATOMIC_RELEASE);
+            pipe_wake(pipe);
+        }
+    }
+
+    pipe->position += (int64_t)done;
+    if(done == 0 && __atomic_load_n(&pipe->error, __ATOMIC_ACQUIRE))
+        return -1;
+    return (ssize_t)done;
+}
+
+/**
+ * coder side of a writing stream: copy to the free buffers, a full buffer goes to the writer thread
+ * @param cookie: bin_pipe_t
+ * @param buf
+ * @param size
+ * @return bytes written, -1 if the writer thread failed
+ */
+ssize_t pipe_write(void *cookie, const char *buf, size_t size) {
+    bin_pipe_t * pipe = cookie;
+    size_t done = 0;
+    while(done < size) {
+        if(__atomic_load_n(&pipe->error, __ATOMIC_ACQUIRE) || !pipe->running)
+            return -1;
+
+        if(pipe->tail - __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE) == PIPE_BUFFERS) {
+            pipe_wait(pipe);
+            continue;
+        }
+
+        pipe_buffer_t * buffer = &pipe->buffers[pipe->tail % PIPE_BUFFERS];
+        size_t length = PIPE_BUFFER_SIZE - pipe->offset < size - done ? PIPE_BUFFER_SIZE - pipe->offset : size - done;
+        memcpy(buffer->data + pipe->offset, buf + done, length);
+        pipe->offset += length;
+        done += length;
+
+        if(pipe->offset == PIPE_BUFFER_SIZE) {
+            buffer->length = PIPE_BUFFER_SIZE;
+            pipe->offset = 0;
+            __atomic_store_n(&pipe->tail, pipe->tail + 1, __ATOMIC_RELEASE);
+            pipe_wake(pipe);
+        }
+    }
+
+    pipe->position += (int64_t)done;
+    return (ssize_t)done;
+}
+
+/**
+ * the position is known without stopping the thread. A move stops it, seeks the file and starts it again
+ * @param cookie: bin_pipe_t
+ * @param offset: in, the offset. out, the new position
+ * @param whence
+ * @return 0, -1 on error
+ */
+int pipe_seek(void *cookie, off64_t *offset, int whence) {
+    bin_pipe_t * pipe = cookie;
+    if(whence == SEEK_CUR && *offset == 0) {
+        *offset = pipe->position;
+        return 0;
+    }
+
+    pipe_stop(pipe);
+
+    int64_t target = *offset;
+    if(whence == SEEK_CUR) {
+        target += pipe->position;
+    } else if(whence == SEEK_END) {
+        if(bin_seek(pipe->file, *offset, SEEK_END) != RC_OK)
+            target = -1;
+        else
+            target = bin_tell(pipe->file);
+    }
+
+    int rc = target >= 0 ? bin_seek(pipe->file, target, SEEK_SET) : RC_FAIL;
+    if(rc == RC_OK) {
+        pipe->position = target;
+        *offset = target;
+    }
+
+    // the stream stays usable after a failed seek, at its previous position if the file allows it
+    if(pipe_start(pipe) != RC_OK) {
+        log_error("pipe_seek", "cannot restart the I/O thread\n");
+        return -1;
+    }
+    return rc == RC_OK ? 0 : -1;
+}
+
+/**
+ * stop the thread, writing the last buffers, then close the file
+ * @param cookie: bin_pipe_t
+ * @return 0, -1 if a write or the close failed
+ */
+int pipe_close(void *cookie) {
+    bin_pipe_t * pipe = cookie;
+    pipe_stop(pipe);
+
+    int rc = pipe->writing && pipe->error ? -1 : 0;
+    if(fclose(pipe->file) != 0)
+        rc = -1;
+    pipe_release(pipe);
+    return rc;
+}
+
+#else
+
+void bin_pipe_use_uring(bool enabled) {
+    (void)enabled;
+}
+
+FILE* bin_pipe_read(FILE *file) {
+    (void)file;
+    log_info("bin_pipe_read", "pipelined streams are not available on this platform\n");
+    return NULL;
+}
+
+FILE* bin_pipe_write(FILE *file) {
+    (void)file;
+    log_info("bin_pipe_write", "pipelined streams are not available on this platform\n");
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ALGO_BIN_PIPE_H
+#define ALGO_BIN_PIPE_H
+
+#include "bin_io.h"
+
+/**
+ * constants
+ */
+enum {
+    PIPE_BUFFER_SIZE    = 256 * 1024,   // bytes moved at a time between the I/O thread and the coder
+    PIPE_BUFFERS        = 4             // ring of buffers between the two threads
+};
+
+/*
+ * pipelined streams: a thread reads the file ahead of the coder, or writes behind it,
+ * through a ring of large buffers. The coder sees a FILE, so the coders run unchanged.
+ * The returned FILE owns the file: fclose stops the thread, drains the buffers and closes the file.
+ * Seeks are supported, they drain (write) or discard (read) the buffers first.
+ * NULL when the platform has no custom FILE streams: the caller keeps the file and uses it directly.
+ */
+FILE*       bin_pipe_read(FILE *file);
+FILE*       bin_pipe_write(FILE *file);
+
+/*
+ * I/O threads backend: stdio (default) or io_uring, which keeps a request in flight on each buffer
+ * of a regular file. See bin_uring.h, stdio is kept when io_uring is not available
+ */
+void        bin_pipe_use_uring(bool enabled);
+
+#endif //ALGO_BIN_PIPE_H
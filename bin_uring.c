@@ -0,0 +1,287 @@
+#define _GNU_SOURCE             // syscall
+
+#include <string.h>
+#include <errno.h>
+
+#include "bin_uring.h"
+#include "adhuff_memory.h"
+#include "log.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BIN_HAVE_URING
+#endif
+#endif
+
+#if defined(BIN_HAVE_URING)
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+enum {
+    URING_MAX_BUFFERS   = 16
+};
+
+/*
+ * the submission and completion rings shared with the kernel.
+ * one thread uses the ring: only the indices written by the kernel need atomic loads
+ */
+struct bin_uring_s {
+    int                     ring_fd;
+    int                     fd;             // the file read or written
+    bool                    fixed;          // buffers registered, else plain reads and writes
+    byte_t *                buffers[URING_MAX_BUFFERS];
+    size_t                  size;
+
+    void *                  sq_ring;
+    size_t                  sq_ring_size;
+    void *                  cq_ring;        // same as sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t                  cq_ring_size;
+    struct io_uring_sqe *   sqes;
+    size_t                  sqes_size;
+
+    unsigned *              sq_head;
+    unsigned *              sq_tail;
+    unsigned *              sq_mask;
+    unsigned *              sq_array;
+    unsigned *              cq_head;
+    unsigned *              cq_tail;
+    unsigned *              cq_mask;
+    struct io_uring_cqe *   cqes;
+};
+
+//
+// private methods
+//
+int         uring_map(bin_uring_t *uring, const struct io_uring_params *params);
+int         uring_enter(bin_uring_t *uring, unsigned to_submit, unsigned min_complete);
+
+/**
+ * create a ring with one entry per buffer and register the buffers
+ * the registration can fail on a low RLIMIT_MEMLOCK: the ring works anyway, without fixed buffers
+ * @param fd: regular file, read or written at explicit offsets
+ * @param buffers
+ * @param count
+ * @param size: of each buffer
+ * @return the ring, NULL if io_uring is not available
+ */
+bin_uring_t* bin_uring_open(int fd, byte_t **buffers, int count, size_t size) {
+    if(count <= 0 || count > URING_MAX_BUFFERS)
+        return NULL;
+
+    bin_uring_t * uring = adh_calloc(1, sizeof(bin_uring_t));
+    if(uring == NULL)
+        return NULL;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->fd = fd;
+    uring->size = size;
+    uring->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)count, &params);
+    if(uring->ring_fd < 0) {
+        log_info("bin_uring_open", "io_uring not available: %s\n", strerror(errno));
+        adh_free(uring);
+        return NULL;
+    }
+
+    if(uring_map(uring, &params) != RC_OK) {
+        log_info("bin_uring_open", "cannot map the io_uring rings: %s\n", strerror(errno));
+        bin_uring_close(uring);
+        return NULL;
+    }
+
+    struct iovec iovecs[URING_MAX_BUFFERS];
+    for (int i = 0; i < count; ++i) {
+        uring->buffers[i] = buffers[i];
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = size;
+    }
+    uring->fixed = syscall(__NR_io_uring_register, uring->ring_fd, IORING_REGISTER_BUFFERS, iovecs, (unsigned)count) == 0;
+    if(!uring->fixed)
+        log_info("bin_uring_open", "buffers not registered: %s\n", strerror(errno));
+
+    return uring;
+}
+
+/**
+ * unmap and close the ring, the requests must be completed
+ * @param uring: may be NULL
+ */
+void bin_uring_close(bin_uring_t *uring) {
+    if(uring == NULL)
+        return;
+
+    if(uring->sqes)
+        munmap(uring->sqes, uring->sqes_size);
+    if(uring->cq_ring && uring->cq_ring != uring->sq_ring)
+        munmap(uring->cq_ring, uring->cq_ring_size);
+    if(uring->sq_ring)
+        munmap(uring->sq_ring, uring->sq_ring_size);
+    close(uring->ring_fd);      // unregisters the buffers
+    adh_free(uring);
+}
+
+/**
+ * submit a read or a write of part of a buffer
+ * @param uring
+ * @param writing
+ * @param buffer: index of the buffer, returned by bin_uring_wait with the result
+ * @param buffer_offset: first byte of the buffer to read or write
+ * @param length
+ * @param file_offset
+ * @return RC_OK / RC_FAIL
+ */
+int bin_uring_submit(bin_uring_t *uring, bool writing, int buffer, size_t buffer_offset,
+                     size_t length, int64_t file_offset) {
+    unsigned tail = *uring->sq_tail;
+    if(tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE) > *uring->sq_mask) {
+        log_error("bin_uring_submit", "submission ring full\n");
+        return RC_FAIL;
+    }
+
+    unsigned index = tail & *uring->sq_mask;
+    struct io_uring_sqe * sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if(uring->fixed) {
+        sqe->opcode = writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t)buffer;
+    } else {
+        sqe->opcode = writing ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = uring->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(uring->buffers[buffer] + buffer_offset);
+    sqe->len = (uint32_t)length;
+    sqe->off = (uint64_t)file_offset;
+    sqe->user_data = (uint64_t)buffer;
+    uring->sq_array[index] = index;
+    __atomic_store_n(uring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return uring_enter(uring, 1, 0);
+}
+
+/**
+ * wait for the completion of a request, in any order
+ * @param uring
+ * @param buffer: out, the index of the buffer
+ * @param result: out, the bytes read or written, -errno on error
+ * @return RC_OK / RC_FAIL
+ */
+int bin_uring_wait(bin_uring_t *uring, int *buffer, int64_t *result) {
+    for(;;) {
+        unsigned head = *uring->cq_head;
+        if(head != __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe * cqe = &uring->cqes[head & *uring->cq_mask];
+            *buffer = (int)cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(uring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return RC_OK;
+        }
+
+        if(uring_enter(uring, 0, 1) != RC_OK)
+            return RC_FAIL;
+    }
+}
+
+/**
+ * map the rings shared with the kernel
+ * @param uring
+ * @param params: returned by io_uring_setup
+ * @return RC_OK / RC_FAIL
+ */
+int uring_map(bin_uring_t *uring, const struct io_uring_params *params) {
+    uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+    uring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    if(params->features & IORING_FEAT_SINGLE_MMAP) {
+        if(uring->cq_ring_size > uring->sq_ring_size)
+            uring->sq_ring_size = uring->cq_ring_size;
+        uring->cq_ring_size = uring->sq_ring_size;
+    }
+
+    void * ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       uring->ring_fd, IORING_OFF_SQ_RING);
+    if(ring == MAP_FAILED)
+        return RC_FAIL;
+    uring->sq_ring = ring;
+
+    if(params->features & IORING_FEAT_SINGLE_MMAP) {
+        uring->cq_ring = ring;
+    } else {
+        ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    uring->ring_fd, IORING_OFF_CQ_RING);
+        if(ring == MAP_FAILED)
+            return RC_FAIL;
+        uring->cq_ring = ring;
+    }
+
+    uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+    ring = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                uring->ring_fd, IORING_OFF_SQES);
+    if(ring == MAP_FAILED)
+        return RC_FAIL;
+    uring->sqes = ring;
+
+    byte_t * sq = uring->sq_ring;
+    uring->sq_head = (unsigned *)(sq + params->sq_off.head);
+    uring->sq_tail = (unsigned *)(sq + params->sq_off.tail);
+    uring->sq_mask = (unsigned *)(sq + params->sq_off.ring_mask);
+    uring->sq_array = (unsigned *)(sq + params->sq_off.array);
+
+    byte_t * cq = uring->cq_ring;
+    uring->cq_head = (unsigned *)(cq + params->cq_off.head);
+    uring->cq_tail = (unsigned *)(cq + params->cq_off.tail);
+    uring->cq_mask = (unsigned *)(cq + params->cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(cq + params->cq_off.cqes);
+    return RC_OK;
+}
+
+/**
+ * submit the queued requests and / or wait for completions
+ * @param uring
+ * @param to_submit
+ * @param min_complete
+ * @return RC_OK / RC_FAIL
+ */
+int uring_enter(bin_uring_t *uring, unsigned to_submit, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    for(;;) {
+        long rc = syscall(__NR_io_uring_enter, uring->ring_fd, to_submit, min_complete, flags, NULL, 0);
+        if(rc >= 0)
+            return RC_OK;
+        if(errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            log_error("uring_enter", "io_uring_enter failed: %s\n", strerror(errno));
+            return RC_FAIL;
+        }
+    }
+}
+
+#else
+
+struct bin_uring_s {
+    int                     fd;
+};
+
+bin_uring_t* bin_uring_open(int fd, byte_t **buffers, int count, size_t size) {
+    (void)fd; (void)buffers; (void)count; (void)size;
+    log_info("bin_uring_open", "io_uring is not available on this platform\n");
+    return NULL;
+}
+
+void bin_uring_close(bin_uring_t *uring) {
+    (void)uring;
+}
+
+int bin_uring_submit(bin_uring_t *uring, bool writing, int buffer, size_t buffer_offset,
+                     size_t length, int64_t file_offset) {
+    (void)uring; (void)writing; (void)buffer; (void)buffer_offset; (void)length; (void)file_offset;
+    return RC_FAIL;
+}
+
+int bin_uring_wait(bin_uring_t *uring, int *buffer, int64_t *result) {
+    (void)uring; (void)buffer; (void)result;
+    return RC_FAIL;
+}
+
+#endif
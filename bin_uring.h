@@ -0,0 +1,20 @@
+#ifndef ALGO_BIN_URING_H
+#define ALGO_BIN_URING_H
+
+#include "bin_io.h"
+
+/*
+ * io_uring backend of the pipelined streams (see bin_pipe.h): reads and writes at explicit offsets,
+ * several in flight at the same time, on buffers registered once with the kernel.
+ * Linux only, through the raw system calls: bin_uring_open returns NULL when the kernel,
+ * a seccomp filter or the platform does not allow it, and the caller keeps using stdio.
+ */
+typedef struct bin_uring_s bin_uring_t;
+
+bin_uring_t*    bin_uring_open(int fd, byte_t **buffers, int count, size_t size);
+void            bin_uring_close(bin_uring_t *uring);
+int             bin_uring_submit(bin_uring_t *uring, bool writing, int buffer, size_t buffer_offset,
+                                 size_t length, int64_t file_offset);
+int             bin_uring_wait(bin_uring_t *uring, int *buffer, int64_t *result);
+
+#endif //ALGO_BIN_URING_H
@@ -1,4 +1,7 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, nanosleep
 #include <stdarg.h>
+#include <stdlib.h>
+#include <pthread.h>
 
 #ifdef WIN32
 #include <windows.h>
@@ -15,13 +18,46 @@
  * constants
  */
 enum {
-    MAX_BIT_STR         = MAX_CODE_BITS + 1 //257
+    LOG_RING_SIZE       = 4096,     // events per thread, power of 2
+    LOG_MAX_THREADS     = 64,
+    LOG_DRAIN_SLEEP_MS  = 1
 };
 
+/**
+ * binary trace event, formatted only by the drain thread
+ */
+typedef struct {
+    uint64_t        nanoseconds;
+    const char *    method;
+    const char *    format;
+    int             num_args;
+    long long       args[LOG_EVENT_ARGS];
+} log_record_t;
+
+/**
+ * single producer (the owning thread) / single consumer (the drain thread) ring
+ */
+typedef struct {
+    uint32_t        thread_id;
+    uint64_t        head;       // written by the producer
+    uint64_t        tail;       // written by the consumer
+    log_record_t    records[LOG_RING_SIZE];
+} log_ring_t;
+
 //
 // module variables
 //
 static log_level_t log_level = LOG_INFO;
+static int         log_error_delay_ms = LOG_ERROR_DELAY_MS;
+
+static log_ring_t * log_rings[LOG_MAX_THREADS];
+static uint32_t     log_num_rings = 0;
+static __thread log_ring_t * thread_ring = NULL;
+static uint64_t     log_dropped = 0;
+static FILE *       log_sink = NULL;
+static int          log_sink_running = 0;
+static int          log_sink_stopping = 0;
+static pthread_t    log_drain_thread;
 
 //
 // Diagnostic functions
@@ -30,6 +66,15 @@ void        print_time(FILE* fp);
 void        print_method(FILE* fp, const char *method);
 void        sleep_ms(int milliseconds);
 
+//
+// async sink
+//
+log_ring_t *get_thread_ring();
+uint64_t    log_clock_ns();
+int         drain_rings();
+void *      drain_thread_main(void *arg);
+void        print_record(FILE* fp, uint32_t thread_id, const log_record_t *record);
+
 /**
  * set the log level
  * @param level
@@ -38,6 +83,14 @@ void set_log_level(log_level_t level) {
     log_level = level;
 }
 
+/**
+ * set the delay before each error message
+ * @param milliseconds: 0 for none, e.g. in a server that must not hold a worker on a bad request
+ */
+void set_log_error_delay(int milliseconds) {
+    log_error_delay_ms = milliseconds;
+}
+
 /**
  * @return the log level
  */
@@ -50,12 +103,12 @@ log_level_t get_log_level() {
  * @param symbol
  */
 void log_trace_char_bin(byte_t symbol) {
-    if(get_log_level() < LOG_TRACE)
+    if(get_log_level() < LOG_TRACE || log_sink_running)
         return;
 
     bit_array_t bit_array = {0};
     symbol_to_bits(symbol, &bit_array);
-    fprintf(stdout, "%s\n", fmt_bit_array(&bit_array));
+    fprintf(stdout, "%s\n", fmt_bit_array(&bit_array, FMT_BUFFER));
 }
 
 /**
@@ -69,7 +122,8 @@ void log_error(const char *method, const char *format, ...) {
         return;
 
     // sleep some milliseconds to let info finish printing
-    sleep_ms(400);
+    if(log_error_delay_ms > 0)
+        sleep_ms(log_error_delay_ms);
 
     print_time(stderr);
     print_method(stderr, method);
@@ -138,6 +192,181 @@ void log_trace(const char *method, const char *format, ...) {
     va_end(args);
 }
 
+/**
+ * TRACE level event with integer arguments (use ADH_TRACE): copied to the ring buffer of the calling thread
+ * when the async sink is running, printed immediately otherwise
+ * @param method
+ * @param format printf format, the arguments are long long (%lld)
+ * @param num_args 0 to LOG_EVENT_ARGS
+ */
+void log_event(const char *method, const char *format, int num_args,
+               long long arg1, long long arg2, long long arg3, long long arg4) {
+    log_record_t record = { log_clock_ns(), method, format, num_args, { arg1, arg2, arg3, arg4 } };
+
+    if(!__atomic_load_n(&log_sink_running, __ATOMIC_ACQUIRE)) {
+        print_record(stdout, 0, &record);
+        return;
+    }
+
+    log_ring_t *ring = get_thread_ring();
+    if(!ring) {
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    uint64_t head = ring->head;
+    if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_RING_SIZE) {
+        // never block the coder: the event is lost
+        __atomic_fetch_add(&log_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    ring->records[head & (LOG_RING_SIZE - 1)] = record;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * start the background thread that writes the trace events to the sink
+ * @param sink
+ * @return RC_OK / RC_FAIL
+ */
+int log_sink_start(FILE *sink) {
+    if(!sink || log_sink_running)
+        return RC_FAIL;
+
+    log_sink = sink;
+    log_sink_stopping = 0;
+    if(pthread_create(&log_drain_thread, NULL, drain_thread_main, NULL) != 0) {
+        log_error("log_sink_start", "cannot start the drain thread\n");
+        return RC_FAIL;
+    }
+
+    __atomic_store_n(&log_sink_running, 1, __ATOMIC_RELEASE);
+    return RC_OK;
+}
+
+/**
+ * stop the background thread after it has written the pending events
+ * (the producers must not log concurrently with the stop)
+ * @return RC_OK / RC_FAIL
+ */
+int log_sink_stop() {
+    if(!log_sink_running)
+        return RC_FAIL;
+
+    __atomic_store_n(&log_sink_running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&log_sink_stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(log_drain_thread, NULL);
+
+    drain_rings();
+    fflush(log_sink);
+    log_sink = NULL;
+    return RC_OK;
+}
+
+/**
+ * @return the number of trace events lost because a ring buffer was full
+ */
+uint64_t log_sink_dropped() {
+    return __atomic_load_n(&log_dropped, __ATOMIC_RELAXED);
+}
+
+//
+// private methods
+//
+
+/**
+ * ring buffer of the calling thread, registered on first use
+ * @return the ring or NULL if there are too many threads
+ */
+log_ring_t *get_thread_ring() {
+    if(thread_ring)
+        return thread_ring;
+
+    log_ring_t *ring = calloc(1, sizeof(log_ring_t));
+    if(!ring)
+        return NULL;
+
+    uint32_t idx = __atomic_fetch_add(&log_num_rings, 1, __ATOMIC_ACQ_REL);
+    if(idx >= LOG_MAX_THREADS) {
+        free(ring);
+        return NULL;
+    }
+
+    // the rings live until the end of the process: the drain thread may read them after their thread exited
+    ring->thread_id = idx + 1;
+    __atomic_store_n(&log_rings[idx], ring, __ATOMIC_RELEASE);
+    thread_ring = ring;
+    return ring;
+}
+
+/**
+ * write the pending events of every ring to the sink
+ * @return number of events written
+ */
+int drain_rings() {
+    int written = 0;
+    uint32_t num_rings = __atomic_load_n(&log_num_rings, __ATOMIC_ACQUIRE);
+    if(num_rings > LOG_MAX_THREADS)
+        num_rings = LOG_MAX_THREADS;
+
+    for(uint32_t i = 0; i < num_rings; i++) {
+        log_ring_t *ring = __atomic_load_n(&log_rings[i], __ATOMIC_ACQUIRE);
+        if(!ring)
+            continue;
+
+        uint64_t tail = ring->tail;
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        for(; tail != head; tail++, written++)
+            print_record(log_sink, ring->thread_id, &ring->records[tail & (LOG_RING_SIZE - 1)]);
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return written;
+}
+
+/**
+ * drain thread: polls the rings until log_sink_stop
+ * @param arg unused
+ * @return NULL
+ */
+void * drain_thread_main(void *arg) {
+    (void) arg;
+    while(!__atomic_load_n(&log_sink_stopping, __ATOMIC_ACQUIRE)) {
+        if(drain_rings() == 0)
+            sleep_ms(LOG_DRAIN_SLEEP_MS);
+    }
+    return NULL;
+}
+
+/**
+ * print a trace event: time in ns, thread, method, formatted arguments
+ * @param fp
+ * @param thread_id 0 for synchronous events
+ * @param record
+ */
+void print_record(FILE* fp, uint32_t thread_id, const log_record_t *record) {
+    const long long *a = record->args;
+    fprintf(fp, "%" PRIu64 " %2u ", record->nanoseconds, thread_id);
+    print_method(fp, record->method);
+    switch(record->num_args) {
+        case 0:  fputs(record->format, fp); break;
+        case 1:  fprintf(fp, record->format, a[0]); break;
+        case 2:  fprintf(fp, record->format, a[0], a[1]); break;
+        case 3:  fprintf(fp, record->format, a[0], a[1], a[2]); break;
+        default: fprintf(fp, record->format, a[0], a[1], a[2], a[3]); break;
+    }
+}
+
+/**
+ * @return monotonic time in nanoseconds
+ */
+uint64_t log_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 /**
  * sleep utility to delay the print of error messages
  * @param milliseconds
@@ -155,52 +384,49 @@ void sleep_ms(int milliseconds) // cross-platform sleep function
 }
 
 /**
- * set an internal log buffer with the string representation of a symbol
- * (dirty trick to not reallocate the memory, a bit dangerous... it could be done better)
+ * write the string representation of a symbol
  * @param symbol
- * @return a pointer to the internal buffer
+ * @param str caller buffer of MAX_FMT_STR chars (FMT_BUFFER)
+ * @return str
  */
-char * fmt_symbol(adh_symbol_t symbol) {
-    static char str[MAX_SYMBOL_STR] = {0};
+char * fmt_symbol(adh_symbol_t symbol, char *str) {
     if(symbol == ADH_NYT_CODE)
-        snprintf(str, sizeof(str), "NYT");
+        snprintf(str, MAX_FMT_STR, "NYT");
     else if(symbol ==  ADH_OLD_NYT_CODE)
-        snprintf(str, sizeof(str), " ° ");
+        snprintf(str, MAX_FMT_STR, " ° ");
     else if(iscntrl(symbol))
-        snprintf(str, sizeof(str), "x%02X", symbol);
+        snprintf(str, MAX_FMT_STR, "x%02X", symbol);
     else
-        snprintf(str, sizeof(str), "'%c'", symbol);
+        snprintf(str, MAX_FMT_STR, "'%c'", symbol);
 
     return str;
 }
 
 /**
- * set an internal log buffer with the string representation of a node
- * (dirty trick to not reallocate the memory, a bit dangerous... it could be done better)
+ * write the string representation of a node
  * @param node
- * @return a pointer to the internal buffer
+ * @param str caller buffer of MAX_FMT_STR chars (FMT_BUFFER)
+ * @return str
  */
-char * fmt_node(const adh_node_t* node) {
-    static char str[MAX_SYMBOL_STR] = {0};
+char * fmt_node(const adh_node_t* node, char *str) {
+    char symbol_str[MAX_FMT_STR];
     if(node)
-        snprintf(str, sizeof(str), "%s (%3u,%6u)", fmt_symbol(node->symbol), node->order, node->weight);
+        snprintf(str, MAX_FMT_STR, "%.8s (%3u,%6" PRIu64 ")", fmt_symbol(node->symbol, symbol_str), node->order, (uint64_t)node->weight);
     else
-        snprintf(str, sizeof(str), " ");
+        snprintf(str, MAX_FMT_STR, " ");
 
     return str;
 }
 
 /**
- * set an internal log buffer with the string representation of a bit array
- * (dirty trick to not reallocate the memory, a bit dangerous... it could be done better)
+ * write the string representation of a bit array
  * @param bit_array
- * @return a pointer to the internal buffer
+ * @param str caller buffer of MAX_FMT_STR chars (FMT_BUFFER)
+ * @return str
  */
-char * fmt_bit_array(const bit_array_t *bit_array) {
-    static char str[MAX_BIT_STR] = {0};
-
+char * fmt_bit_array(const bit_array_t *bit_array, char *str) {
     int j = 0;
-    for(int i = bit_array->length-1; i>=0 && (j < sizeof(str)-2); i--) {
+    for(int i = bit_array->length-1; i>=0 && (j < MAX_FMT_STR-1); i--) {
         str[j] = bit_array->buffer[i];
         j++;
     }
@@ -211,12 +437,14 @@ char * fmt_bit_array(const bit_array_t *bit_array) {
 
 /**
  * TRACE level, print the tree
+ * @param tree
  */
-void log_tree() {
-    if(get_log_level() < LOG_TRACE)
+void log_tree(const adh_tree_t *tree) {
+    // the tree dumps are too slow for the async sink
+    if(get_log_level() < LOG_TRACE || log_sink_running)
         return;
 
-    print_tree();
+    print_tree(tree);
 }
 
 
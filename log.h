@@ -16,6 +16,50 @@ typedef enum {
     LOG_TRACE
 } log_level_t;
 
+/*
+ * build time log level: ADH_DEBUG / ADH_TRACE above it compile to nothing,
+ * below it they are filtered at runtime by set_log_level.
+ * 0 = error, 1 = info, 2 = debug, 3 = trace
+ */
+#ifndef ADH_LOG_LEVEL
+#ifdef _DEBUG
+#define ADH_LOG_LEVEL   3
+#else
+#define ADH_LOG_LEVEL   1
+#endif
+#endif
+
+enum {
+    MAX_FMT_STR         = MAX_CODE_BITS + 1, // room for the longest bit array
+    LOG_EVENT_ARGS      = 4,
+    LOG_ERROR_DELAY_MS  = 400                // default delay of the errors, for the info lines to be printed first
+};
+
+// scratch buffer for the fmt_* functions, one per call
+#define FMT_BUFFER      ((char[MAX_FMT_STR]){0})
+
+#define ADH_DEBUG(method, ...) do { \
+        if(ADH_LOG_LEVEL >= LOG_DEBUG && get_log_level() >= LOG_DEBUG) \
+            log_debug(method, __VA_ARGS__); \
+    } while(0)
+
+/*
+ * trace events take a format and up to 4 integer arguments (printed with %lld):
+ * when the async sink is running they are copied as binary records to a per thread ring buffer,
+ * otherwise they are printed like log_trace
+ */
+#define ADH_TRACE(method, ...) do { \
+        if(ADH_LOG_LEVEL >= LOG_TRACE && get_log_level() >= LOG_TRACE) \
+            LOG_EVENT_SELECT(__VA_ARGS__, LOG_EVENT_4, LOG_EVENT_3, LOG_EVENT_2, LOG_EVENT_1, LOG_EVENT_0, 0)(method, __VA_ARGS__); \
+    } while(0)
+
+#define LOG_EVENT_SELECT(format, a1, a2, a3, a4, name, ...) name
+#define LOG_EVENT_0(m, f)                   log_event(m, f, 0, 0, 0, 0, 0)
+#define LOG_EVENT_1(m, f, a)                log_event(m, f, 1, (long long)(a), 0, 0, 0)
+#define LOG_EVENT_2(m, f, a, b)             log_event(m, f, 2, (long long)(a), (long long)(b), 0, 0)
+#define LOG_EVENT_3(m, f, a, b, c)          log_event(m, f, 3, (long long)(a), (long long)(b), (long long)(c), 0)
+#define LOG_EVENT_4(m, f, a, b, c, d)       log_event(m, f, 4, (long long)(a), (long long)(b), (long long)(c), (long long)(d))
+
 //
 // logging
 //
@@ -24,13 +68,23 @@ void        log_info(const char *method, const char *format, ...);
 void        log_debug(const char *method, const char *format, ...);
 void        log_trace(const char *method, const char *format, ...);
 void        log_trace_char_bin(byte_t symbol);
-void        log_tree();
+void        log_tree(const adh_tree_t *tree);
+void        log_event(const char *method, const char *format, int num_args,
+                      long long arg1, long long arg2, long long arg3, long long arg4);
+
+//
+// async trace sink
+//
+int         log_sink_start(FILE *sink);
+int         log_sink_stop();
+uint64_t    log_sink_dropped();
 
 void        set_log_level(log_level_t level);
+void        set_log_error_delay(int milliseconds);
 log_level_t get_log_level();
 
-char *      fmt_node(const adh_node_t* node);
-char *      fmt_symbol(adh_symbol_t symbol);
-char *      fmt_bit_array(const bit_array_t *bit_array);
+char *      fmt_node(const adh_node_t* node, char *str);
+char *      fmt_symbol(adh_symbol_t symbol, char *str);
+char *      fmt_bit_array(const bit_array_t *bit_array, char *str);
 
 #endif //ADHUFF_EXE_LOG_H
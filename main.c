@@ -2,17 +2,49 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "adhuff_archive.h"
 #include "adhuff_compress.h"
 #include "adhuff_decompress.h"
+#include "adhuff_memory.h"
+#include "adhuff_serve.h"
 #include "log.h"
 
+enum {
+    PROGRESS_PERIOD_MS  = 500
+};
+
+int parse_size(const char *str, uint64_t *size);
+int print_progress(void *ctx, const adh_progress_t *progress);
+int load_priming(const char *file_name);
+
 /**
  * Print usage
  */
 void printUsage() {
     puts("Usage:");
-    puts("\tto compress a file   :  ./adaptive_huffman -c <input_file> <output_file>");
+    puts("\tto compress a file   :  ./adaptive_huffman [options] -c <input_file> <output_file>");
     puts("\tto decompress a file :  ./adaptive_huffman -d <input_file> <output_file>");
+    puts("\tto archive directory :  ./adaptive_huffman [options] [--workers=n] -a <archive> <directory>");
+    puts("\tto extract archive   :  ./adaptive_huffman -x <archive> <output_directory> [member]");
+    puts("\tto list an archive   :  ./adaptive_huffman -l <archive>");
+    puts("\tto serve requests    :  ./adaptive_huffman [--workers=n] [--prime=<file>] --serve <socket>");
+    puts("Compression options:");
+    puts("\t--order1             :  one adaptive tree per preceding byte");
+    puts("\t--bwt                :  BWT, move-to-front and zero-run filters before coding");
+    puts("\t--lz77[=level]       :  LZ77 matches, level 1 (fast) to 9 (best), default 6");
+    puts("\t--range              :  range coder with adaptive frequencies instead of the Huffman trees");
+    puts("\t--compact-escape     :  new symbols coded as their index among the symbols not yet seen");
+    puts("\t--interleave[=lanes] :  byte i coded by lane i mod lanes, each with its own tree (1 to 16, default 4)");
+    puts("\t--batched[=n]        :  trees rebuilt every n symbols instead of updated after each one (1 to 65536, default 1024)");
+    puts("\t--static             :  two passes over each 1 MB block: canonical codes built from the byte counts");
+    puts("Other options:");
+    puts("\t--stats              :  print the tree engine counters (swaps, hash chains, code lengths...) and phase timings");
+    puts("\t--pipeline           :  read and write the files from their own threads, while the coder runs");
+    puts("\t--io-uring           :  pipelined, with several large reads and writes in flight through io_uring (Linux)");
+    puts("\t--progress           :  print the bytes read and written and the throughput twice a second");
+    puts("\t--max-memory=<size>  :  fail instead of allocating more than size bytes (k, m, g suffixes)");
+    puts("\t--prime=<file>       :  start the byte tree from the symbols of file, decode with the same file");
+    puts("\t--trace=<file>       :  write the trace events to file from a background thread (build with ADH_LOG_LEVEL=3)");
 }
 
 /**
@@ -24,16 +56,88 @@ void printUsage() {
 int main(int argc, char* argv[])
 {
     int rc = 0;
-    if (argc < 4) {
+    adh_options_t options = {0};
+    bool print_stats = false;
+    const char *serve_path = NULL;
+    int workers = 0;
+    FILE *trace_file = NULL;
+
+    // options come before the command
+    int arg_idx = 1;
+    while (arg_idx < argc && strncmp(argv[arg_idx], "--", 2) == 0) {
+        if (strcmp(argv[arg_idx], "--stats") == 0) {
+            print_stats = true;
+            adh_stats_enable(ADH_STATS_ALL);
+        }
+        else if (strncmp(argv[arg_idx], "--trace=", 8) == 0 && !trace_file) {
+            trace_file = fopen(argv[arg_idx] + 8, "w");
+            if (!trace_file || log_sink_start(trace_file) != RC_OK) {
+                log_error("main", "cannot trace to %s\n", argv[arg_idx] + 8);
+                return 2;
+            }
+            set_log_level(LOG_TRACE);
+        }
+        else if (strcmp(argv[arg_idx], "--pipeline") == 0) {
+            adh_set_pipelined(true);
+        }
+        else if (strcmp(argv[arg_idx], "--io-uring") == 0) {
+            adh_set_io_uring(true);
+        }
+        else if (strcmp(argv[arg_idx], "--progress") == 0) {
+            adh_set_progress(print_progress, stderr, 0, PROGRESS_PERIOD_MS);
+        }
+        else if (strncmp(argv[arg_idx], "--max-memory=", 13) == 0) {
+            uint64_t limit = 0;
+            if (parse_size(argv[arg_idx] + 13, &limit) != RC_OK || limit == 0) {
+                log_error("main", "Invalid memory limit %s\n", argv[arg_idx] + 13);
+                return 2;
+            }
+            adh_set_memory_limit(limit);
+        }
+        else if (strcmp(argv[arg_idx], "--serve") == 0 && arg_idx + 1 < argc) {
+            serve_path = argv[++arg_idx];
+        }
+        else if (strncmp(argv[arg_idx], "--workers=", 10) == 0) {
+            workers = atoi(argv[arg_idx] + 10);
+            if (workers < 1 || workers > ADH_SERVE_MAX_WORKERS) {
+                log_error("main", "Invalid number of workers %s\n", argv[arg_idx] + 10);
+                return 2;
+            }
+        }
+        else if (strncmp(argv[arg_idx], "--prime=", 8) == 0) {
+            if (load_priming(argv[arg_idx] + 8) != RC_OK)
+                return 2;
+        }
+        else if (adh_parse_option(argv[arg_idx], &options) != RC_OK) {
+            log_error("main", "Unexpected option %s\n", argv[arg_idx]);
+            printUsage();
+            return 2;
+        }
+        arg_idx++;
+    }
+
+    if (serve_path) {
+        rc = adh_serve(serve_path, workers);
+    }
+    else if (argc - arg_idx == 2 && strcmp(argv[arg_idx], "-l") == 0) {
+        rc = adh_archive_list(argv[arg_idx+1], stdout);
+    }
+    else if (argc - arg_idx < 3) {
         log_error("main", "Not enough parameters.\n");
         printUsage();
         rc = 1;
     }
-    else if (strcmp(argv[1], "-c") == 0) {
-        rc = adh_compress_file(argv[2], argv[3]);
+    else if (strcmp(argv[arg_idx], "-c") == 0) {
+        rc = adh_compress_file(argv[arg_idx+1], argv[arg_idx+2], &options);
+    }
+    else if (strcmp(argv[arg_idx], "-d") == 0) {
+        rc = adh_decompress_file(argv[arg_idx+1], argv[arg_idx+2]);
     }
-    else if (strcmp(argv[1], "-d") == 0) {
-        rc = adh_decompress_file(argv[2], argv[3]);
+    else if (strcmp(argv[arg_idx], "-a") == 0) {
+        rc = adh_archive_create(argv[arg_idx+1], argv[arg_idx+2], &options, workers);
+    }
+    else if (strcmp(argv[arg_idx], "-x") == 0) {
+        rc = adh_archive_extract(argv[arg_idx+1], argv[arg_idx+2], argc - arg_idx > 3 ? argv[arg_idx+3] : NULL);
     }
     else {
         log_error("main", "Unexpected argument\n");
@@ -41,5 +145,82 @@ int main(int argc, char* argv[])
         rc = 2;
     }
 
+    if (print_stats && rc == RC_OK)
+        adh_stats_print(stdout);
+
+    if (trace_file) {
+        log_sink_stop();
+        if (log_sink_dropped() > 0)
+            log_info("main", "%" PRIu64 " trace events dropped\n", log_sink_dropped());
+        fclose(trace_file);
+    }
+
+    return rc;
+}
+
+/**
+ * parse a number of bytes, with an optional k, m or g suffix (powers of 1024)
+ * @param str
+ * @param size
+ * @return RC_OK / RC_FAIL
+ */
+int parse_size(const char *str, uint64_t *size) {
+    char *end = NULL;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str)
+        return RC_FAIL;
+
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: break;
+    }
+    if (*end != 0 || value > (UINT64_MAX >> shift))
+        return RC_FAIL;
+
+    *size = (uint64_t)value << shift;
+    return RC_OK;
+}
+
+/**
+ * prime the coders with the content of the file
+ * @param file_name
+ * @return RC_OK / RC_FAIL
+ */
+int load_priming(const char *file_name) {
+    FILE *fp = bin_open_read(file_name);
+    if (fp == NULL)
+        return RC_FAIL;
+
+    int64_t size = -1;
+    if (bin_seek(fp, 0, SEEK_END) == RC_OK)
+        size = bin_tell(fp);
+    byte_t *data = size > 0 && bin_seek(fp, 0, SEEK_SET) == RC_OK ? malloc((size_t)size) : NULL;
+    int rc = data != NULL && fread(data, 1, (size_t)size, fp) == (size_t)size ? RC_OK : RC_FAIL;
+    if (rc == RC_OK)
+        rc = adh_set_priming(data, (size_t)size);
+    if (rc != RC_OK)
+        log_error("load_priming", "cannot prime with %s\n", file_name);
+
+    free(data);
+    fclose(fp);
     return rc;
 }
+
+/**
+ * progress callback, print on a single line
+ * @param ctx: the output FILE
+ * @param progress
+ * @return ADH_PROGRESS_CONTINUE
+ */
+int print_progress(void *ctx, const adh_progress_t *progress) {
+    FILE *fp = ctx;
+    fprintf(fp, "\r%10.1f MB read %10.1f MB written %8.2f MB/s %8.1f s",
+            progress->bytes_in / 1e6, progress->bytes_out / 1e6, progress->mbps, progress->seconds);
+    if (progress->done)
+        fputc('\n', fp);
+    fflush(fp);
+    return ADH_PROGRESS_CONTINUE;
+}
@@ -1,18 +1,55 @@
+#define _GNU_SOURCE // fopencookie
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "../log.h"
 #include "../bin_io.h"
+#include "../adhuff_archive.h"
+#include "../adhuff_buffer.h"
+#include "../adhuff_client.h"
 #include "../adhuff_compress.h"
 #include "../adhuff_decompress.h"
+#include "../adhuff_lz77.h"
+#include "../adhuff_memory.h"
+#include "../adhuff_static.h"
 
-void    test_all_files();
+void    test_all_files(const adh_options_t *options);
 void    test_bit_helpers();
 void    test_bit_check(byte_t source, unsigned int bit_pos, byte_t expected);
 void    test_bit_set_zero(byte_t source, unsigned int bit_pos, byte_t expected);
 void    test_bit_set_one(byte_t source, unsigned int bit_pos, byte_t expected);
 void    test_bit_copy(byte_t source, byte_t destination, unsigned int read_pos, unsigned int write_pos, int size, byte_t expected);
+void    test_bitmap();
+void    test_lookup();
+void    test_batches();
+void    test_weights();
+int     check_sibling(const adh_tree_t *tree);
+void    test_static();
+int     check_lookup(adh_tree_t *tree);
+void    test_stats();
+void    test_memory();
+void    test_progress();
+int     progress_counter(void *ctx, const adh_progress_t *progress);
+void *  counting_alloc(void *ctx, size_t size);
+void    counting_release(void *ctx, void *ptr);
+void    test_trace_sink();
+void *  trace_producer(void *arg);
+void    test_buffers();
+void    test_range_damage();
+void    test_serve();
+void    test_archive();
+int     write_file(const char *file_name, const byte_t *data, size_t size);
+pid_t   start_server(const char *socket_path, const byte_t *priming, size_t priming_size);
+int     connect_server(const char *socket_path);
+void    stop_server(pid_t server);
+void    test_large_stream(uint64_t size);
 int     compare_files(const char *original, const char *generated);
 
 
@@ -41,11 +78,680 @@ static const char * TEST_FILES[] = {
 int main(int argc, char* argv[]) {
     set_log_level(LOG_INFO);
     test_bit_helpers();
-    test_all_files();
+    test_all_files(NULL);
+
+    adh_options_t order1 = { .flags = ADH_FLAG_ORDER1 };
+    test_all_files(&order1);
+
+    adh_options_t bwt = { .flags = ADH_FLAG_BWT };
+    test_all_files(&bwt);
+
+    adh_options_t lz77 = { .flags = ADH_FLAG_LZ77, .level = LZ77_DEFAULT_LEVEL };
+    test_all_files(&lz77);
+
+    adh_options_t compact = { .flags = ADH_FLAG_COMPACT_ESCAPE };
+    test_all_files(&compact);
+
+    adh_options_t compact_lz77 = { .flags = ADH_FLAG_COMPACT_ESCAPE | ADH_FLAG_LZ77, .level = LZ77_DEFAULT_LEVEL };
+    test_all_files(&compact_lz77);
+
+    adh_options_t range = { .flags = ADH_FLAG_RANGE };
+    test_all_files(&range);
+
+    adh_options_t range_order1 = { .flags = ADH_FLAG_RANGE | ADH_FLAG_ORDER1 };
+    test_all_files(&range_order1);
+
+    adh_options_t range_bwt = { .flags = ADH_FLAG_RANGE | ADH_FLAG_BWT };
+    test_all_files(&range_bwt);
+
+    adh_options_t range_lz77 = { .flags = ADH_FLAG_RANGE | ADH_FLAG_LZ77, .level = LZ77_DEFAULT_LEVEL };
+    test_all_files(&range_lz77);
+
+    adh_options_t range_compact = { .flags = ADH_FLAG_RANGE | ADH_FLAG_COMPACT_ESCAPE | ADH_FLAG_ORDER1 };
+    test_all_files(&range_compact);
+
+    adh_options_t interleaved = { .flags = ADH_FLAG_INTERLEAVED };
+    test_all_files(&interleaved);
+
+    adh_options_t interleaved_compact = { .flags = ADH_FLAG_INTERLEAVED | ADH_FLAG_COMPACT_ESCAPE, .lanes = 3 };
+    test_all_files(&interleaved_compact);
+
+    adh_options_t batched = { .flags = ADH_FLAG_BATCHED };
+    test_all_files(&batched);
+
+    adh_options_t batched_order1 = { .flags = ADH_FLAG_BATCHED | ADH_FLAG_ORDER1 | ADH_FLAG_COMPACT_ESCAPE, .batch = 7 };
+    test_all_files(&batched_order1);
+
+    adh_options_t batched_lz77 = { .flags = ADH_FLAG_BATCHED | ADH_FLAG_LZ77, .level = LZ77_DEFAULT_LEVEL, .batch = 64 };
+    test_all_files(&batched_lz77);
+    test_lookup();
+    test_batches();
+    test_weights();
+
+    adh_options_t static_codes = { .flags = ADH_FLAG_STATIC };
+    test_all_files(&static_codes);
+    test_static();
+
+    // reader and writer threads, the decoder seeks its input
+    adh_set_pipelined(true);
+    test_all_files(NULL);
+    test_all_files(&range_bwt);
+    // same threads moving the data with io_uring, stdio if not available
+    adh_set_io_uring(true);
+    test_all_files(&range_bwt);
+    adh_set_io_uring(false);
+    adh_set_pipelined(false);
+
+    test_stats();
+    test_memory();
+    test_progress();
+    test_trace_sink();
+    test_buffers();
+    test_range_damage();
+    test_serve();
+    test_archive();
+
+    // multi GB round trip, only on demand: ADH_TEST_LARGE_GB=5 ./adhuff_test
+    const char *large_gb = getenv("ADH_TEST_LARGE_GB");
+    if(large_gb)
+        test_large_stream((uint64_t)strtoull(large_gb, NULL, 10) << 30);
+}
+
+/*
+ * synthetic stream: skewed pseudo random bytes, generated on read and checked on write
+ */
+typedef struct {
+    uint64_t    size;
+    uint64_t    pos;
+    uint64_t    state;
+    uint64_t    mismatch;   // first position that differs, UINT64_MAX if none
+} synthetic_t;
+
+static inline byte_t synthetic_next(synthetic_t *stream) {
+    stream->state = stream->state * 6364136223846793005ull + 1442695040888963407ull;
+    byte_t x = (byte_t)(stream->state >> 56);
+    return x < 192 ? 'a' : (x < 240 ? 'b' : x);
+}
+
+static ssize_t synthetic_read(void *cookie, char *buf, size_t size) {
+    synthetic_t *stream = cookie;
+    size_t n = 0;
+    for(; n < size && stream->pos < stream->size; n++, stream->pos++)
+        buf[n] = (char)synthetic_next(stream);
+    return (ssize_t)n;
 }
 
-void test_all_files() {
-    log_trace("test_all_files", "\n");
+static ssize_t synthetic_write(void *cookie, const char *buf, size_t size) {
+    synthetic_t *stream = cookie;
+    for(size_t n = 0; n < size; n++, stream->pos++) {
+        if(synthetic_next(stream) != (byte_t)buf[n] && stream->mismatch == UINT64_MAX)
+            stream->mismatch = stream->pos;
+    }
+    return (ssize_t)size;
+}
+
+// only position queries, for ftell
+static int synthetic_seek(void *cookie, off64_t *offset, int whence) {
+    synthetic_t *stream = cookie;
+    if(whence != SEEK_CUR || *offset != 0)
+        return -1;
+    *offset = (off64_t)stream->pos;
+    return 0;
+}
+
+/*
+ * compress a synthetic stream of the given size (more than 4 G symbols for a 5 GB stream),
+ * then decompress and check it without storing the original
+ */
+void test_large_stream(uint64_t size) {
+    log_info("test_large_stream", "%" PRIu64 " bytes\n", size);
+    synthetic_t source = { size, 0, 1, UINT64_MAX };
+    synthetic_t check = { size, 0, 1, UINT64_MAX };
+
+    FILE *input = fopencookie(&source, "r", (cookie_io_functions_t){ synthetic_read, NULL, synthetic_seek, NULL });
+    FILE *compressed = fopen("large.compressed", "w+b");
+    int rc = input && compressed ? adh_compress_stream(input, compressed, NULL) : RC_FAIL;
+    if(input)
+        fclose(input);
+
+    FILE *output = fopencookie(&check, "w", (cookie_io_functions_t){ NULL, synthetic_write, synthetic_seek, NULL });
+    if(rc == RC_OK && output) {
+        rewind(compressed);
+        rc = adh_decompress_stream(compressed, output);
+    }
+    if(output)
+        fclose(output);
+    if(compressed)
+        fclose(compressed);
+    remove("large.compressed");
+
+    if(rc != RC_OK || check.pos != size || check.mismatch != UINT64_MAX)
+        log_error("test_large_stream", "rc=%d decompressed=%" PRIu64 " first difference=%" PRIu64 "\n",
+                  rc, check.pos, check.mismatch);
+}
+
+#define TRACE_EVENTS  1000
+
+/*
+ * test the async trace sink: events of two threads are all written once the sink is stopped
+ */
+void test_trace_sink() {
+    log_info("test_trace_sink", "\n");
+    FILE *sink = fopen("trace.log", "w+");
+    if(!sink || log_sink_start(sink) != RC_OK) {
+        log_error("test_trace_sink", "cannot start the sink\n");
+        return;
+    }
+
+    pthread_t thread;
+    pthread_create(&thread, NULL, trace_producer, NULL);
+    trace_producer(NULL);
+    pthread_join(thread, NULL);
+    log_sink_stop();
+
+    // every event is a line
+    long lines = 0;
+    rewind(sink);
+    for(int ch = fgetc(sink); ch != EOF; ch = fgetc(sink))
+        lines += ch == '\n';
+    fclose(sink);
+
+    if(lines + (long)log_sink_dropped() != 2 * TRACE_EVENTS)
+        log_error("test_trace_sink", "lines=%ld dropped=%" PRIu64 "\n", lines, log_sink_dropped());
+
+    // the fmt helpers write to the caller buffer
+    char str1[MAX_FMT_STR], str2[MAX_FMT_STR];
+    if(strcmp(fmt_symbol('A', str1), "'A'") != 0 || strcmp(fmt_symbol(0x0A, str2), "x0A") != 0 || strcmp(str1, "'A'") != 0)
+        log_error("test_trace_sink", "error in fmt_symbol\n");
+}
+
+void * trace_producer(void *arg) {
+    (void) arg;
+    for(int i = 0; i < TRACE_EVENTS; i++)
+        log_event("trace_producer", "i=%lld\n", 1, i, 0, 0, 0);
+    return NULL;
+}
+
+/*
+ * test the in-memory coding: caller buffers and allocated outputs give the same bytes,
+ * an empty input round trips and a short output buffer fails
+ */
+void test_buffers() {
+    log_info("test_buffers", "\n");
+    FILE *fp = bin_open_read("../../test/res/alice.txt");
+    byte_t *text = malloc(200000);
+    size_t text_size = fp ? fread(text, 1, 200000, fp) : 0;
+    if(fp)
+        fclose(fp);
+
+    const adh_options_t options[] = { { .flags = 0 }, { .flags = ADH_FLAG_LZ77 | ADH_FLAG_RANGE }, { .flags = ADH_FLAG_INTERLEAVED } };
+    byte_t *compressed = malloc(200000), *decompressed = malloc(200000), *allocated = NULL;
+    for(int i = 0; i < (int)(sizeof(options) / sizeof(options[0])); i++) {
+        size_t compressed_size = 0, decompressed_size = 0, allocated_size = 0;
+        int rc = adh_compress_buffer(text, text_size, compressed, 200000, &compressed_size, &options[i]);
+        if(rc == RC_OK)
+            rc = adh_decompress_buffer(compressed, compressed_size, decompressed, 200000, &decompressed_size);
+        if(rc == RC_OK)
+            rc = adh_compress_memory(text, text_size, &allocated, &allocated_size, &options[i]);
+        if(rc != RC_OK || text_size == 0 || decompressed_size != text_size || memcmp(decompressed, text, text_size) != 0
+           || allocated_size != compressed_size || memcmp(allocated, compressed, compressed_size) != 0)
+            log_error("test_buffers", "round trip %d failed: %zu -> %zu -> %zu bytes\n",
+                      i, text_size, compressed_size, decompressed_size);
+        free(allocated);
+        allocated = NULL;
+    }
+
+    size_t compressed_size = 0, decompressed_size = 1;
+    int rc = adh_compress_memory(text, 0, &allocated, &compressed_size, NULL);
+    if(rc == RC_OK)
+        rc = adh_decompress_buffer(allocated, compressed_size, decompressed, 0, &decompressed_size);
+    if(rc != RC_OK || compressed_size == 0 || decompressed_size != 0)
+        log_error("test_buffers", "empty round trip failed\n");
+    free(allocated);
+
+    // buffers kept by the caller: grown from nothing, then from a few bytes, then reused as they are
+    byte_t *kept = NULL, *reused = malloc(16);
+    size_t kept_capacity = 0, reused_capacity = 16;
+    for(int i = 0; i < 2; i++) {
+        size_t kept_size = 0, reused_size = 0;
+        rc = adh_compress_realloc(text, text_size, &kept, &kept_capacity, &kept_size, NULL);
+        if(rc == RC_OK)
+            rc = adh_decompress_realloc(kept, kept_size, &reused, &reused_capacity, &reused_size);
+        if(rc != RC_OK || kept_size == 0 || kept_size > kept_capacity || reused_size != text_size
+           || memcmp(reused, text, text_size) != 0)
+            log_error("test_buffers", "realloc round trip %d failed: %zu -> %zu -> %zu bytes\n",
+                      i, text_size, kept_size, reused_size);
+    }
+    free(kept);
+    free(reused);
+
+    log_info("test_buffers", "expected buffer error below\n");
+    if(adh_compress_buffer(text, text_size, compressed, 1000, &compressed_size, NULL) != RC_FAIL || compressed_size != 0)
+        log_error("test_buffers", "short output buffer accepted\n");
+
+    free(compressed);
+    free(decompressed);
+    free(text);
+}
+
+/*
+ * test the range decoder on truncated and corrupt streams: they fail instead of decoding zeros past the end
+ */
+void test_range_damage() {
+    log_info("test_range_damage", "\n");
+    FILE *fp = bin_open_read("../../test/res/alice_small.txt");
+    byte_t *text = malloc(20000);
+    size_t text_size = fp ? fread(text, 1, 20000, fp) : 0;
+    if(fp)
+        fclose(fp);
+
+    const adh_options_t options = { .flags = ADH_FLAG_RANGE };
+    byte_t *compressed = NULL, *decompressed = malloc(200000);
+    size_t compressed_size = 0, decompressed_size = 0;
+    if(adh_compress_memory(text, text_size, &compressed, &compressed_size, &options) != RC_OK || compressed_size < 100)
+        log_error("test_range_damage", "cannot compress: %zu bytes\n", compressed_size);
+
+    log_info("test_range_damage", "expected truncation errors below\n");
+    const size_t cuts[] = { 3, 10, 50 };
+    for(int i = 0; compressed_size >= 100 && i < (int)(sizeof(cuts) / sizeof(cuts[0])); i++) {
+        if(adh_decompress_buffer(compressed, compressed_size - cuts[i], decompressed, 200000, &decompressed_size) != RC_FAIL)
+            log_error("test_range_damage", "stream cut by %zu bytes accepted\n", cuts[i]);
+    }
+
+    // garbage decoded from there runs past the end of the stream
+    log_info("test_range_damage", "expected corruption error below\n");
+    for(size_t i = 3000; compressed_size >= 3004 && i < 3004; i++)
+        compressed[i] ^= 0x5A;
+    if(compressed_size >= 3004
+       && adh_decompress_buffer(compressed, compressed_size, decompressed, 200000, &decompressed_size) != RC_FAIL)
+        log_error("test_range_damage", "corrupt stream accepted\n");
+
+    free(compressed);
+    free(decompressed);
+    free(text);
+}
+
+#define SERVE_REQUESTS      4
+#define SERVE_SLICE         (16 * 1024)
+#define SERVE_SMALL         2048
+
+/*
+ * test the server in a child process: pipelined requests on a connection,
+ * then a primed server, whose output decodes with the same priming only
+ */
+void test_serve() {
+    log_info("test_serve", "\n");
+    FILE *fp = bin_open_read("../../test/res/alice.txt");
+    byte_t *text = malloc(163777);
+    size_t text_size = fp ? fread(text, 1, 163777, fp) : 0;
+    if(fp)
+        fclose(fp);
+    if(text_size < SERVE_REQUESTS * SERVE_SLICE) {
+        log_error("test_serve", "cannot read the test text\n");
+        free(text);
+        return;
+    }
+
+    // all the requests are sent before reading the answers
+    adh_options_t options[SERVE_REQUESTS] = {
+            { .flags = 0 }, { .flags = ADH_FLAG_ORDER1 }, { .flags = ADH_FLAG_RANGE | ADH_FLAG_BWT }, { .flags = ADH_FLAG_INTERLEAVED } };
+    size_t sizes[SERVE_REQUESTS] = { SERVE_SLICE, SERVE_SLICE, SERVE_SLICE, 0 };
+    byte_t *compressed[SERVE_REQUESTS] = {0};
+    size_t compressed_sizes[SERVE_REQUESTS] = {0};
+
+    pid_t server = start_server("serve.sock", NULL, 0);
+    int fd = connect_server("serve.sock");
+    for(int i = 0; i < SERVE_REQUESTS; i++)
+        adh_client_send(fd, ADH_SERVE_COMPRESS, &options[i], text + i * SERVE_SLICE, sizes[i]);
+    for(int i = 0; i < SERVE_REQUESTS; i++)
+        adh_client_receive(fd, &compressed[i], &compressed_sizes[i]);
+    for(int i = 0; i < SERVE_REQUESTS; i++)
+        adh_client_send(fd, ADH_SERVE_DECOMPRESS, NULL, compressed[i], compressed_sizes[i]);
+    for(int i = 0; i < SERVE_REQUESTS; i++) {
+        byte_t *decompressed = NULL;
+        size_t decompressed_size = 0;
+        if(adh_client_receive(fd, &decompressed, &decompressed_size) != RC_OK || decompressed_size != sizes[i]
+           || memcmp(decompressed, text + i * SERVE_SLICE, sizes[i]) != 0)
+            log_error("test_serve", "round trip %d failed: %zu bytes\n", i, decompressed_size);
+        free(decompressed);
+        free(compressed[i]);
+    }
+
+    // a few KB that expand past the payload limit: an error, the connection and the worker stay up
+    byte_t *zeros = calloc(ADH_SERVE_MAX_PAYLOAD + 1, 1);
+    byte_t *bomb = NULL, *expanded = NULL;
+    size_t bomb_size = 0, expanded_size = 0;
+    adh_options_t static_codes = { .flags = ADH_FLAG_STATIC };
+    adh_compress_memory(zeros, ADH_SERVE_MAX_PAYLOAD + 1, &bomb, &bomb_size, &static_codes);
+    log_info("test_serve", "expected output too large errors below\n");
+    if(adh_client_call(fd, ADH_SERVE_DECOMPRESS, NULL, bomb, bomb_size, &expanded, &expanded_size) != RC_FAIL)
+        log_error("test_serve", "%zu bytes expanded to %zu bytes\n", bomb_size, expanded_size);
+    free(expanded);
+    free(bomb);
+    free(zeros);
+
+    // a bad request does not hold the worker: its errors are logged without delay, here too for the timing
+    const byte_t garbage[10] = { 0x01, 0x7F, 0x33, 0xC4, 0x5A, 0x00, 0xFF, 0x12, 0x9E, 0x40 };
+    byte_t *rejected = NULL;
+    size_t rejected_size = 0;
+    struct timespec before, after;
+    log_info("test_serve", "expected decompression errors below\n");
+    set_log_error_delay(0);
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    int rejected_rc = adh_client_call(fd, ADH_SERVE_DECOMPRESS, NULL, garbage, sizeof(garbage), &rejected, &rejected_size);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    set_log_error_delay(LOG_ERROR_DELAY_MS);
+    double elapsed = (double)(after.tv_sec - before.tv_sec) + (double)(after.tv_nsec - before.tv_nsec) / 1e9;
+    if(rejected_rc != RC_FAIL || elapsed > 0.2)
+        log_error("test_serve", "bad request answered in %.3f s\n", elapsed);
+    free(rejected);
+
+    // a short text, coded without and with priming
+    const byte_t *small = text + 100000;
+    byte_t *plain = NULL, *primed = NULL, *decompressed = NULL;
+    size_t plain_size = 0, primed_size = 0, decompressed_size = 0;
+    adh_client_call(fd, ADH_SERVE_COMPRESS, NULL, small, SERVE_SMALL, &plain, &plain_size);
+    adh_client_close(fd);
+    stop_server(server);
+
+    server = start_server("serve.sock", text, 50000);
+    fd = connect_server("serve.sock");
+    adh_client_call(fd, ADH_SERVE_COMPRESS, NULL, small, SERVE_SMALL, &primed, &primed_size);
+    adh_client_call(fd, ADH_SERVE_DECOMPRESS, NULL, primed, primed_size, &decompressed, &decompressed_size);
+    if(primed_size == 0 || primed_size >= plain_size || decompressed_size != SERVE_SMALL
+       || memcmp(decompressed, small, SERVE_SMALL) != 0)
+        log_error("test_serve", "primed: %zu bytes, not primed: %zu bytes\n", primed_size, plain_size);
+    adh_client_close(fd);
+    stop_server(server);
+
+    FILE *primed_fp = fopen("serve_primed.compressed", "wb");
+    FILE *small_fp = fopen("serve_small.txt", "wb");
+    if(primed_fp && small_fp) {
+        fwrite(primed, 1, primed_size, primed_fp);
+        fwrite(small, 1, SERVE_SMALL, small_fp);
+    }
+    if(primed_fp)
+        fclose(primed_fp);
+    if(small_fp)
+        fclose(small_fp);
+    adh_set_priming(text, 50000);
+    if(adh_decompress_file("serve_primed.compressed", "serve_primed.uncompressed") != RC_OK)
+        log_error("test_serve", "cannot decode the primed output locally\n");
+    else
+        compare_files("serve_small.txt", "serve_primed.uncompressed");
+
+    // the stream records its priming: another sample or none is an error, not garbage
+    log_info("test_serve", "expected priming errors below\n");
+    adh_set_priming(text + 50000, 50000);
+    if(adh_decompress_file("serve_primed.compressed", "serve_primed.uncompressed") != RC_FAIL)
+        log_error("test_serve", "primed output decoded with another sample\n");
+    adh_set_priming(NULL, 0);
+    if(adh_decompress_file("serve_primed.compressed", "serve_primed.uncompressed") != RC_FAIL)
+        log_error("test_serve", "primed output decoded without priming\n");
+
+    free(plain);
+    free(primed);
+    free(decompressed);
+    free(text);
+}
+
+/**
+ * run adh_serve with 2 workers in a child process
+ * @param socket_path
+ * @param priming: NULL for no priming
+ * @param priming_size
+ * @return the server process
+ */
+pid_t start_server(const char *socket_path, const byte_t *priming, size_t priming_size) {
+    fflush(stdout);
+    fflush(stderr);
+    pid_t server = fork();
+    if(server == 0) {
+        if(priming)
+            adh_set_priming(priming, priming_size);
+        _exit(adh_serve(socket_path, 2) == RC_OK ? 0 : 1);
+    }
+    return server;
+}
+
+/**
+ * connect to the server, waiting for it to listen
+ * @param socket_path
+ * @return the connection, -1 after one second
+ */
+int connect_server(const char *socket_path) {
+    struct timespec delay = { 0, 10 * 1000000L };
+    for(int i = 0; i < 100; i++) {
+        int fd = adh_client_connect(socket_path);
+        if(fd >= 0)
+            return fd;
+        nanosleep(&delay, NULL);
+    }
+    log_error("connect_server", "cannot connect to %s\n", socket_path);
+    return -1;
+}
+
+/**
+ * stop the server, it must exit cleanly
+ * @param server
+ */
+void stop_server(pid_t server) {
+    int status = 0;
+    kill(server, SIGTERM);
+    waitpid(server, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        log_error("stop_server", "server status %d\n", status);
+}
+
+/*
+ * test the archives: a directory with a duplicated file archived by 2 workers,
+ * extracted whole then one member alone
+ */
+void test_archive() {
+    log_info("test_archive", "\n");
+    FILE *fp = bin_open_read("../../test/res/alice_small.txt");
+    byte_t *text = malloc(14082);
+    size_t text_size = fp ? fread(text, 1, 14082, fp) : 0;
+    if(fp)
+        fclose(fp);
+
+    static const char * const PATHS[] = { "alice_small.txt", "empty", "sub/copy.txt", "sub/deep/ABAB.txt" };
+    const size_t sizes[] = { text_size, 0, text_size, 4 };
+    mkdir("archive_in", 0777);
+    mkdir("archive_in/sub", 0777);
+    mkdir("archive_in/sub/deep", 0777);
+    char file_name[MAX_FILE_NAME], extracted[MAX_FILE_NAME];
+    for(int i = 0; i < 4; i++) {
+        snprintf(file_name, sizeof(file_name), "archive_in/%s", PATHS[i]);
+        write_file(file_name, i == 3 ? (const byte_t *)"ABAB" : text, sizes[i]);
+    }
+
+    // the copy shares the stream of the original
+    byte_t *compressed = NULL;
+    size_t compressed_size = 0;
+    adh_compress_memory(text, text_size, &compressed, &compressed_size, NULL);
+    fp = adh_archive_create("test.adha", "archive_in/", NULL, 2) == RC_OK ? bin_open_read("test.adha") : NULL;
+    long archive_size = fp && fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    if(fp)
+        fclose(fp);
+    if(archive_size <= (long)compressed_size || archive_size >= 2 * (long)compressed_size)
+        log_error("test_archive", "archive of %ld bytes, compressed text of %zu bytes\n", archive_size, compressed_size);
+    free(compressed);
+
+    if(adh_archive_extract("test.adha", "archive_out", NULL) != RC_OK)
+        log_error("test_archive", "cannot extract the archive\n");
+    for(int i = 0; i < 4; i++) {
+        snprintf(file_name, sizeof(file_name), "archive_in/%s", PATHS[i]);
+        snprintf(extracted, sizeof(extracted), "archive_out/%s", PATHS[i]);
+        compare_files(file_name, extracted);
+    }
+
+    remove("archive_member/alice_small.txt");
+    if(adh_archive_extract("test.adha", "archive_member", "sub/copy.txt") != RC_OK)
+        log_error("test_archive", "cannot extract a member\n");
+    compare_files("archive_in/sub/copy.txt", "archive_member/sub/copy.txt");
+    fp = fopen("archive_member/alice_small.txt", "rb");
+    if(fp) {
+        log_error("test_archive", "other member extracted\n");
+        fclose(fp);
+    }
+
+    // the workers read their files and the extracted files are written through io_uring
+    adh_set_io_uring(true);
+    if(adh_archive_create("uring.adha", "archive_in/", NULL, 2) != RC_OK
+       || adh_archive_extract("uring.adha", "archive_uring", NULL) != RC_OK)
+        log_error("test_archive", "cannot archive with io_uring\n");
+    adh_set_io_uring(false);
+    adh_set_pipelined(false);
+    for(int i = 0; i < 4; i++) {
+        snprintf(file_name, sizeof(file_name), "archive_in/%s", PATHS[i]);
+        snprintf(extracted, sizeof(extracted), "archive_uring/%s", PATHS[i]);
+        compare_files(file_name, extracted);
+    }
+    compare_files("test.adha", "uring.adha");
+
+    log_info("test_archive", "expected missing member error below\n");
+    if(adh_archive_extract("test.adha", "archive_member", "missing.txt") != RC_FAIL)
+        log_error("test_archive", "missing member extracted\n");
+    free(text);
+}
+
+/**
+ * @param file_name
+ * @param data
+ * @param size
+ * @return RC_OK / RC_FAIL
+ */
+int write_file(const char *file_name, const byte_t *data, size_t size) {
+    FILE *fp = bin_open_create(file_name);
+    int rc = fp && fwrite(data, 1, size, fp) == size ? RC_OK : RC_FAIL;
+    if(fp && fclose(fp) != 0)
+        rc = RC_FAIL;
+    return rc;
+}
+
+/*
+ * test the tree engine counters: ABAB.txt = 4 symbols, 2 of them new
+ */
+void test_stats() {
+    log_info("test_stats", "\n");
+    adh_stats_reset();
+    adh_stats_enable(ADH_STATS_ALL);
+    int rc = adh_compress_file("../../test/res/ABAB.txt", "stats.compressed", NULL);
+    adh_stats_enable(0);
+
+    const adh_stats_t * stats = adh_stats_get();
+    if(rc != RC_OK || stats->symbols != 4 || stats->escapes != 2 || stats->hash_lookups == 0
+       || stats->phase_ticks[ADH_PHASE_STREAM] == 0)
+        log_error("test_stats", "unexpected counters: symbols=%" PRIu64 " escapes=%" PRIu64 "\n",
+                  stats->symbols, stats->escapes);
+
+    // disabled counters don't change
+    adh_compress_file("../../test/res/ABAB.txt", "stats.compressed", NULL);
+    if(stats->symbols != 4)
+        log_error("test_stats", "counters updated while disabled\n");
+}
+
+/*
+ * allocator hook counting its calls, ctx = [allocations, releases]
+ */
+void * counting_alloc(void *ctx, size_t size) {
+    ((uint64_t *)ctx)[0]++;
+    return malloc(size);
+}
+
+void counting_release(void *ctx, void *ptr) {
+    ((uint64_t *)ctx)[1]++;
+    free(ptr);
+}
+
+/*
+ * test the memory accounting: every block goes through the hook and is released,
+ * a limit below the peak makes the coder fail without leaking
+ */
+void test_memory() {
+    log_info("test_memory", "\n");
+    uint64_t calls[2] = {0};
+    adh_allocator_t allocator = { counting_alloc, counting_release, calls };
+    adh_set_allocator(&allocator);
+
+    adh_options_t order1 = { .flags = ADH_FLAG_ORDER1 };
+    const adh_memory_t * memory = adh_memory_get();
+    int rc = adh_compress_file("../../test/res/alice.txt", "memory.compressed", &order1);
+    uint64_t compress_peak = memory->peak;
+    if(rc == RC_OK)
+        rc = adh_decompress_file("memory.compressed", "memory.uncompressed");
+    uint64_t decompress_peak = memory->peak;
+
+    if(rc != RC_OK || compress_peak == 0 || decompress_peak == 0 || memory->current != 0
+       || calls[0] == 0 || calls[0] != calls[1])
+        log_error("test_memory", "unexpected usage: peak=%" PRIu64 "/%" PRIu64 " current=%" PRIu64
+                  " allocations=%" PRIu64 " releases=%" PRIu64 "\n",
+                  compress_peak, decompress_peak, memory->current, calls[0], calls[1]);
+
+    // the coders fail cleanly over the limit
+    log_info("test_memory", "expected allocation errors below\n");
+    adh_set_memory_limit(compress_peak / 2);
+    int compress_rc = adh_compress_file("../../test/res/alice.txt", "memory_limit.compressed", &order1);
+    adh_set_memory_limit(decompress_peak / 2);
+    int decompress_rc = adh_decompress_file("memory.compressed", "memory.uncompressed");
+
+    if(compress_rc != RC_FAIL || decompress_rc != RC_FAIL || memory->current != 0 || memory->refused < 2
+       || calls[0] != calls[1])
+        log_error("test_memory", "limit not enforced: rc=%d/%d current=%" PRIu64 "\n",
+                  compress_rc, decompress_rc, memory->current);
+
+    adh_set_memory_limit(0);
+    adh_set_allocator(NULL);
+}
+
+/*
+ * progress callback recording its calls, cancels at the call number cancel_at (0 = never)
+ */
+typedef struct {
+    int             calls;
+    int             cancel_at;
+    adh_progress_t  last;
+} progress_counter_t;
+
+int progress_counter(void *ctx, const adh_progress_t *progress) {
+    progress_counter_t * counter = ctx;
+    counter->calls++;
+    counter->last = *progress;
+    return counter->calls == counter->cancel_at ? ADH_PROGRESS_CANCEL : ADH_PROGRESS_CONTINUE;
+}
+
+/*
+ * test the progress callback: called every 16 KB of input then at the end, cancels cleanly
+ */
+void test_progress() {
+    log_info("test_progress", "\n");
+    progress_counter_t counter = {0};
+    adh_set_progress(progress_counter, &counter, 16 * 1024, 0);
+    int rc = adh_compress_file("../../test/res/alice.txt", "progress.compressed", NULL);
+    if(rc != RC_OK || counter.calls < 163777 / (16 * 1024) || !counter.last.done
+       || counter.last.bytes_in != 163777 || counter.last.bytes_out == 0)
+        log_error("test_progress", "compress: calls=%d bytes_in=%" PRIu64 "\n", counter.calls, counter.last.bytes_in);
+
+    uint64_t compressed_size = counter.last.bytes_out;
+    memset(&counter, 0, sizeof(counter));
+    rc = adh_decompress_file("progress.compressed", "progress.uncompressed");
+    if(rc != RC_OK || !counter.last.done || counter.last.bytes_in != compressed_size
+       || counter.last.bytes_out != 163777)
+        log_error("test_progress", "decompress: calls=%d bytes_out=%" PRIu64 "\n", counter.calls, counter.last.bytes_out);
+
+    // cancelled at the second call
+    memset(&counter, 0, sizeof(counter));
+    counter.cancel_at = 2;
+    rc = adh_compress_file("../../test/res/alice.txt", "progress_cancelled.compressed", NULL);
+    if(rc != RC_FAIL || !adh_progress_cancelled() || counter.calls != 2 || adh_memory_get()->current != 0)
+        log_error("test_progress", "compress not cancelled: rc=%d calls=%d\n", rc, counter.calls);
+
+    adh_set_progress(NULL, NULL, 0, 0);
+}
+
+void test_all_files(const adh_options_t *options) {
+    log_info("test_all_files", "flags=%02X\n", options ? options->flags : 0);
     char compressed[MAX_FILE_NAME];
     char uncompressed[MAX_FILE_NAME];
 
@@ -59,7 +765,7 @@ void test_all_files() {
         strcpy(uncompressed, filename);
         strcat(uncompressed, ".uncompressed");
 
-        int rc = adh_compress_file(TEST_FILES[i], compressed);
+        int rc = adh_compress_file(TEST_FILES[i], compressed, options);
         if(rc == RC_FAIL)
             break;
 
@@ -152,6 +858,244 @@ void test_bit_helpers() {
     // res    9 = 0100 0001
     // copy 0100 from source to dest in pos 7
     test_bit_copy(0x08, 0x01, 4, 7, 4, 0x41);
+
+    test_bitmap();
+}
+
+/*
+ * test rank / select on a bitmap of 2 words
+ */
+void test_bitmap() {
+    uint64_t bitmap[2] = {0};
+    bitmap_set(bitmap, 0);
+    bitmap_set(bitmap, 2);
+    bitmap_set(bitmap, 64);
+
+    if(bitmap_rank(bitmap, 2) != 1 || bitmap_rank(bitmap, 65) != 3 || bitmap_rank(bitmap, 128) != 3)
+        log_error("test_bitmap", "error in rank\n");
+
+    // zeros: 1, 3, 4, ..., 63, 65, ...
+    if(bitmap_select_zero(bitmap, 2, 0) != 1 || bitmap_select_zero(bitmap, 2, 1) != 3
+       || bitmap_select_zero(bitmap, 2, 62) != 65 || bitmap_select_zero(bitmap, 2, 125) != -1)
+        log_error("test_bitmap", "error in select\n");
+
+    if(floor_log2(1) != 0 || floor_log2(2) != 1 || floor_log2(255) != 7 || floor_log2(256) != 8)
+        log_error("test_bitmap", "error in floor_log2\n");
+
+    // 1010 0101  0011 1100  1111 0000
+    const byte_t buffer[] = {0xA5, 0x3C, 0xF0};
+    if(bit_peek(buffer, 0, 8) != 0xA5 || bit_peek(buffer, 4, 8) != 0x53
+       || bit_peek(buffer, 3, 12) != 0x29E || bit_peek(buffer, 13, 10) != 0x278)
+        log_error("test_bitmap", "error in bit_peek\n");
+
+    // the same bits put back 3, 12 and 9 at a time
+    byte_t padded[11] = {0};
+    bit_writer_t writer;
+    bit_writer_init(&writer, padded);
+    bit_writer_put(&writer, 0x5, 3);
+    bit_writer_put(&writer, 0x29E, 12);
+    bit_writer_put(&writer, 0x0F0, 9);
+    if(bit_writer_flush(&writer) != padded + 3 || memcmp(padded, buffer, 3) != 0
+       || bit_window(padded, 4) >> 56 != 0x53 || bit_window(padded, 13) >> 54 != 0x278)
+        log_error("test_bitmap", "error in bit_writer / bit_window\n");
+}
+
+/*
+ * test the static codes on Fibonacci counts, whose Huffman codes exceed STATIC_MAX_CODE_BITS,
+ * over more than one block; then a format version the decoder does not know
+ */
+void test_static() {
+    log_info("test_static", "\n");
+    enum { FIB_SYMBOLS = 26, FIB_BYTES = 317810, COPIES = 4 };
+    byte_t *data = malloc(COPIES * FIB_BYTES);
+    size_t size = 0;
+    uint32_t fib[FIB_SYMBOLS] = {1, 1};
+    for (int s = 0; s < FIB_SYMBOLS; ++s) {
+        if(s > 1)
+            fib[s] = fib[s - 1] + fib[s - 2];
+        for (int c = 0; c < COPIES; ++c) {
+            memset(data + c * FIB_BYTES + size, 'a' + s, fib[s]);
+        }
+        size += fib[s];
+    }
+    if(size != FIB_BYTES)
+        log_error("test_static", "%zu bytes of Fibonacci counts\n", size);
+
+    adh_options_t options = { .flags = ADH_FLAG_STATIC };
+    write_file("fibonacci.txt", data, COPIES * FIB_BYTES);
+    if(adh_compress_file("fibonacci.txt", "fibonacci.compressed", &options) != RC_OK
+       || adh_decompress_file("fibonacci.compressed", "fibonacci.uncompressed") != RC_OK)
+        log_error("test_static", "round trip failed\n");
+    compare_files("fibonacci.txt", "fibonacci.uncompressed");
+    free(data);
+
+    const byte_t future[] = { ADH_FLAG_STATIC, STATIC_VERSION + 1 };
+    write_file("future.compressed", future, sizeof(future));
+    log_info("test_static", "expected version error below\n");
+    if(adh_decompress_file("future.compressed", "future.uncompressed") != RC_FAIL)
+        log_error("test_static", "unknown version decoded\n");
+}
+
+/*
+ * test the decoder lookup tables across the tree updates: after swaps, new symbols and rebuilds,
+ * every entry still filled is the walk of its bits in the current tree
+ */
+void test_lookup() {
+    log_info("test_lookup", "\n");
+    uint32_t batches[] = {0, 64};
+    for (int b = 0; b < 2; ++b) {
+        adh_model_t model;
+        if(adh_model_init(&model, 0) != RC_OK || adh_model_set_batch(&model, batches[b]) != RC_OK
+           || adh_lookup_enable(model.order0) != RC_OK) {
+            log_error("test_lookup", "cannot create the tree\n");
+            return;
+        }
+
+        // skewed symbols: the frequent ones get codes shorter than ADH_LOOKUP_BITS, the rare ones longer
+        adh_tree_t * tree = model.order0;
+        uint64_t state = 1;
+        int errors = 0;
+        for (int i = 0; i < 20000 && errors == 0; ++i) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            adh_symbol_t symbol = (adh_symbol_t)((state >> 56) % (1 + (state >> 40) % 256));
+            adh_node_t * node = adh_search_symbol_in_tree(tree, symbol);
+            if(node == NULL)
+                adh_update_tree(tree, adh_create_node_and_append(tree, symbol), true);
+            else
+                adh_update_tree(tree, node, false);
+
+            // filled as the decoder does, for the next bits
+            if(tree->root->left != NULL)
+                adh_lookup_fill(tree, (uint32_t)(state >> 20) % ADH_LOOKUP_SIZE);
+            if(i % 16 == 0)
+                errors = check_lookup(tree);
+        }
+        if(errors)
+            log_error("test_lookup", "%d stale entries, batch %u\n", errors, batches[b]);
+        adh_model_release(&model);
+    }
+}
+
+/*
+ * test the batched rebuilds: after each update, with new symbols between the rebuilds,
+ * the tree keeps the sibling property that the swaps of the next updates rely on
+ */
+void test_batches() {
+    log_info("test_batches", "\n");
+    uint32_t batches[] = {1, 7, 64};
+    for (int b = 0; b < 3; ++b) {
+        adh_model_t model;
+        if(adh_model_init(&model, 0) != RC_OK || adh_model_set_batch(&model, batches[b]) != RC_OK) {
+            log_error("test_batches", "cannot create the tree\n");
+            return;
+        }
+
+        adh_tree_t * tree = model.order0;
+        uint64_t state = 3;
+        int errors = 0;
+        for (int i = 0; i < 20000 && errors == 0; ++i) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            adh_symbol_t symbol = (adh_symbol_t)((state >> 56) % (1 + (state >> 40) % 256));
+            adh_node_t * node = adh_search_symbol_in_tree(tree, symbol);
+            if(node == NULL)
+                adh_update_tree(tree, adh_create_node_and_append(tree, symbol), true);
+            else
+                adh_update_tree(tree, node, false);
+            errors = check_sibling(tree);
+        }
+        if(errors)
+            log_error("test_batches", "%d nodes out of the sibling property, batch %u\n", errors, batches[b]);
+        adh_model_release(&model);
+    }
+}
+
+/*
+ * test the halving of the weights with a small limit: after each update the root stays below the limit,
+ * the tree keeps the sibling property and the lookup entries still filled are right.
+ * Then a stream recording weights wider than the format
+ */
+void test_weights() {
+    log_info("test_weights", "\n");
+    uint32_t batches[] = {0, 16};
+    for (int b = 0; b < 2; ++b) {
+        adh_model_t model;
+        if(adh_model_init(&model, 0) != RC_OK || adh_model_set_batch(&model, batches[b]) != RC_OK
+           || adh_lookup_enable(model.order0) != RC_OK) {
+            log_error("test_weights", "cannot create the tree\n");
+            return;
+        }
+
+        adh_tree_t * tree = model.order0;
+        tree->weight_limit = 256;
+        uint64_t state = 7;
+        int errors = 0;
+        for (int i = 0; i < 20000 && errors == 0; ++i) {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            adh_symbol_t symbol = (adh_symbol_t)((state >> 56) % (1 + (state >> 40) % 64));
+            adh_node_t * node = adh_search_symbol_in_tree(tree, symbol);
+            if(node == NULL)
+                adh_update_tree(tree, adh_create_node_and_append(tree, symbol), true);
+            else
+                adh_update_tree(tree, node, false);
+
+            if(tree->root->left != NULL)
+                adh_lookup_fill(tree, (uint32_t)(state >> 20) % ADH_LOOKUP_SIZE);
+            errors = (tree->root->weight >= tree->weight_limit) + check_sibling(tree) + check_lookup(tree);
+        }
+        if(errors)
+            log_error("test_weights", "%d errors, root weight %" PRIu64 ", batch %u\n",
+                      errors, (uint64_t)tree->root->weight, batches[b]);
+        adh_model_release(&model);
+    }
+
+    // interleaved stream of 4 lanes with weights of another width
+    const byte_t wider[] = { ADH_FLAG_INTERLEAVED, 4, 2 * ADH_FORMAT_WEIGHT_BITS };
+    write_file("wider.compressed", wider, sizeof(wider));
+    log_info("test_weights", "expected weight width error below\n");
+    if(adh_decompress_file("wider.compressed", "wider.uncompressed") != RC_FAIL)
+        log_error("test_weights", "weights of %d bits decoded\n", 2 * ADH_FORMAT_WEIGHT_BITS);
+}
+
+/*
+ * @param tree
+ * @return the number of nodes out of the sibling property: the weights do not decrease with the order,
+ *         a parent weighs its children and has a higher order. The sibling of the NYT, as heavy as its parent,
+ *         is just below it: its next update cannot swap with the parent and would pass the nodes in between
+ */
+int check_sibling(const adh_tree_t *tree) {
+    int errors = 0;
+    int num_nodes = tree->max_order - tree->next_order;
+    const adh_node_t ** by_order = calloc((size_t)num_nodes, sizeof(adh_node_t *));
+    for (int i = 0; i < num_nodes; ++i) {
+        const adh_node_t * node = &tree->nodes[i];
+        by_order[node->order - tree->next_order - 1] = node;
+        if(node->left != NULL && node->weight != node->left->weight + node->right->weight)
+            errors++;
+        if(node->parent != NULL && node->parent->order <= node->order)
+            errors++;
+        if(node->parent != NULL && node->parent->weight == node->weight && node->parent->order != node->order + 1)
+            errors++;
+    }
+    for (int i = 1; i < num_nodes; ++i) {
+        if(by_order[i - 1] == NULL || by_order[i - 1]->weight > by_order[i]->weight)
+            errors++;
+    }
+    free(by_order);
+    return errors;
+}
+
+/*
+ * @param tree
+ * @return the number of filled entries that differ from a new walk
+ */
+int check_lookup(adh_tree_t *tree) {
+    int errors = 0;
+    for (uint32_t index = 0; index < ADH_LOOKUP_SIZE; ++index) {
+        uint16_t entry = tree->lookup[index];
+        if(entry != 0 && adh_lookup_fill(tree, index) != entry)
+            errors++;
+    }
+    return errors;
 }
 
 void test_bit_set_one(byte_t source, unsigned int bit_pos, byte_t expected) {
@@ -0,0 +1,137 @@
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../adhuff.hpp"
+
+extern "C" {
+#include "../log.h"
+}
+
+void    test_contexts(const std::string &text);
+void    test_spans(const std::string &text);
+void    test_streams(const std::string &text);
+
+/*
+ * Main function: tests of the C++ layer (adhuff.hpp)
+ */
+int main() {
+    set_log_level(LOG_INFO);
+    std::ifstream file("../../test/res/alice.txt", std::ios::binary);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if(text.empty())
+        log_error("main", "cannot read the test text\n");
+
+    test_contexts(text);
+    test_spans(text);
+    test_streams(text);
+}
+
+/*
+ * test the contexts: round trips with several options, contexts moved into a pool and reused
+ */
+void test_contexts(const std::string &text) {
+    log_info("test_contexts", "\n");
+    std::vector<adh::Encoder> encoders;
+    encoders.emplace_back();
+    encoders.emplace_back(adh::Encoder{"--order1"});
+    encoders.emplace_back(adh::Encoder{"--range", "--bwt"});
+    encoders.emplace_back(adh::Encoder{"--interleave=3"});
+    encoders.emplace_back(adh::Encoder{"--static"});
+    adh::Decoder decoder;
+
+    // twice: the second round reuses the buffers of the contexts
+    for(int round = 0; round < 2; round++) {
+        for(adh::Encoder &encoder : encoders) {
+            adh::bytes compressed = encoder.compress(text);
+            adh::bytes decompressed = decoder.decompress(compressed);
+            if(compressed.size() >= text.size()
+               || std::string(decompressed.begin(), decompressed.end()) != text)
+                log_error("test_contexts", "round trip failed, flags %d: %zu bytes\n",
+                          encoder.options().flags, compressed.size());
+        }
+    }
+
+    adh::Encoder moved = std::move(encoders[1]);
+    if(moved.options().flags != ADH_FLAG_ORDER1)
+        log_error("test_contexts", "options not moved\n");
+
+    try {
+        adh::Encoder invalid{"--no-such-option"};
+        log_error("test_contexts", "invalid option accepted\n");
+    } catch(const adh::error &) {
+    }
+}
+
+/*
+ * test the zero copy calls: the coders write straight into the caller buffers
+ */
+void test_spans(const std::string &text) {
+    log_info("test_spans", "\n");
+    adh::Encoder encoder;
+    adh::Decoder decoder;
+    std::vector<byte_t> compressed(text.size());
+    std::string decompressed(text.size(), '\0');
+
+    size_t compressed_size = encoder.compress(text, compressed);
+    size_t decompressed_size = decoder.decompress(adh::bytes(compressed.data(), compressed_size), decompressed);
+    if(decompressed_size != text.size() || decompressed != text)
+        log_error("test_spans", "round trip failed: %zu -> %zu -> %zu bytes\n",
+                  text.size(), compressed_size, decompressed_size);
+
+    log_info("test_spans", "expected buffer error below\n");
+    try {
+        byte_t small[64];
+        encoder.compress(text, small);
+        log_error("test_spans", "short output buffer accepted\n");
+    } catch(const adh::error &) {
+    }
+}
+
+/*
+ * test the stream buffers: iostream code writes and reads the compressed format
+ */
+void test_streams(const std::string &text) {
+    log_info("test_streams", "\n");
+    std::ostringstream sink;
+    {
+        adh::ostreambuf buffer(sink, adh::Encoder{"--order1"});
+        std::ostream out(&buffer);
+        out << text.substr(0, 1000);
+        out.write(text.data() + 1000, static_cast<std::streamsize>(text.size() - 1000));
+    }
+
+    std::string compressed = sink.str();
+    std::istringstream source(compressed);
+    adh::istreambuf buffer(source);
+    std::istream in(&buffer);
+    std::string decompressed;
+    char chunk[4096];
+    while(in.read(chunk, sizeof(chunk)) || in.gcount() > 0)
+        decompressed.append(chunk, static_cast<size_t>(in.gcount()));
+    if(compressed.empty() || compressed.size() >= text.size() || decompressed != text)
+        log_error("test_streams", "round trip failed: %zu -> %zu -> %zu bytes\n",
+                  text.size(), compressed.size(), decompressed.size());
+
+    // the C decoder reads the output of the stream buffer
+    byte_t *output = nullptr;
+    size_t output_size = 0;
+    if(adh_decompress_memory(reinterpret_cast<const byte_t *>(compressed.data()), compressed.size(), &output, &output_size) != RC_OK
+       || std::string(reinterpret_cast<char *>(output), output_size) != text)
+        log_error("test_streams", "C decoder failed\n");
+    std::free(output);
+
+    // a sink that throws on write: the destructor swallows any exception and marks the sink bad
+    struct : std::streambuf {} full;              // overflow of the base class: every write fails
+    std::ostream failing(&full);
+    failing.exceptions(std::ios::badbit);
+    {
+        adh::ostreambuf buffer(failing);
+        std::ostream out(&buffer);
+        out << text.substr(0, 1000);
+    }
+    if(!failing.bad())
+        log_error("test_streams", "failed sink not marked bad\n");
+}